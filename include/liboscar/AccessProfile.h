@@ -0,0 +1,68 @@
+#ifndef LIBOSCAR_ACCESS_PROFILE_H
+#define LIBOSCAR_ACCESS_PROFILE_H
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace liboscar {
+
+/** Page access profile of the data files of an OsmCompleter.
+  * The profile is recorded by sampling which pages of the memory mapped files are resident (mincore)
+  * and by explicit hints. It is replayed after a restart by requesting the hot ranges from the os (madvise(MADV_WILLNEED))
+  * in order of decreasing weight, so the working set is in memory before the queries need it.
+  *
+  * Files are split into chunks of ChunkSize bytes, the weight of a chunk is the number of samples in which it was resident.
+  * Only files that are directly addressable (uncompressed and mmapped) are profiled.
+  *
+  * Pages requested by replay() are resident because of the replay and not because they were accessed,
+  * carryOver() excludes them from the samples and keeps their weights from the replayed profile instead.
+  *
+  * The profile is stored as a text file with one range per line: "<file config name> <offset> <size> <weight>"
+  */
+class AccessProfile final {
+public:
+	static constexpr uint64_t ChunkSize = 64*1024;
+	struct Range {
+		uint32_t fc;
+		uint64_t offset;
+		uint64_t size;
+		uint32_t weight;
+	};
+	typedef std::unordered_map<uint32_t, sserialize::UByteArrayAdapter> DataMap;
+public:
+	AccessProfile();
+	~AccessProfile();
+	///Add a sample of the resident chunks of data, thread-safe
+	void sample(const DataMap & data);
+	///Add the range [offset, offset+size) of the file fc with the given weight, thread-safe
+	void addHint(uint32_t fc, uint64_t offset, uint64_t size, uint32_t weight);
+	///Keep ranges with their weights and do not sample the chunks they touch, thread-safe
+	///Use it for the ranges passed to replay() so that the prefetched pages are not recorded as accessed.
+	void carryOver(const std::vector<Range> & ranges);
+	uint32_t sampleCount() const;
+	///@return ranges ordered by decreasing weight, adjacent chunks with the same weight are merged
+	std::vector<Range> ranges() const;
+	void clear();
+	///@return false if the file could not be read, the profile is not changed in this case
+	bool load(const std::string & fileName);
+	bool save(const std::string & fileName) const;
+public:
+	///Requests the pages of ranges in data from the os in the given order, returns early if stop is set
+	///@return number of bytes requested
+	static uint64_t replay(const std::vector<Range> & ranges, const DataMap & data, const std::atomic<bool> & stop);
+private:
+	mutable std::mutex m_lock;
+	uint32_t m_sampleCount{0};
+	///fc -> weight of each chunk
+	std::unordered_map<uint32_t, std::vector<uint32_t> > m_chunkWeights;
+	std::vector<Range> m_hints;
+	///fc -> true for chunks touched by carried over ranges, these are part of m_hints
+	std::unordered_map<uint32_t, std::vector<bool> > m_carriedChunks;
+};
+
+}//end namespace liboscar
+
+#endif
@@ -3,6 +3,7 @@
 #include <liboscar/AdvancedOpTree.h>
 #include <liboscar/CQRFromComplexSpatialQuery.h>
 #include <liboscar/CQRFromRouting.h>
+#include <liboscar/GeoHierarchyCellGraph.h>
 
 #include <sserialize/spatial/CellQueryResult.h>
 #include <sserialize/Static/CellTextCompleter.h>
@@ -18,18 +19,26 @@ namespace liboscar {
 */
 class AdvancedCellOpTree: public AdvancedOpTree {
 public:
+	///Buffers that are reused by consecutive calls of calc()
+	struct Scratch {
+		std::string str;
+	};
 	struct CalcBase {
 		CalcBase(sserialize::Static::CellTextCompleter & ctc,
 			const sserialize::Static::CQRDilator & cqrd,
 			const CQRFromComplexSpatialQuery & csq,
 			const sserialize::spatial::GeoHierarchySubGraph & ghsg,
 			const liboscar::interface::CQRFromRouting & cqrr,
+			const Static::GeoHierarchyCellGraph & cellGraph,
+			Scratch & scratch,
 			uint32_t threadCount) :
 		m_ctc(ctc),
 		m_cqrd(cqrd),
 		m_csq(csq),
 		m_ghsg(ghsg),
 		m_cqrr(cqrr),
+		m_cellGraph(cellGraph),
+		m_scratch(scratch),
 		m_threadCount(threadCount)
 		{}
 		sserialize::Static::CellTextCompleter & m_ctc;
@@ -37,6 +46,8 @@ public:
 		const CQRFromComplexSpatialQuery & m_csq;
 		const sserialize::spatial::GeoHierarchySubGraph & m_ghsg;
 		const liboscar::interface::CQRFromRouting & m_cqrr;
+		const Static::GeoHierarchyCellGraph & m_cellGraph;
+		Scratch & m_scratch;
 		uint32_t m_threadCount;
 		
 		const sserialize::Static::ItemIndexStore & idxStore() const;
@@ -45,6 +56,7 @@ public:
 		const liboscar::Static::OsmKeyValueObjectStore & store() const;
 		const sserialize::spatial::GeoHierarchySubGraph & ghsg() const;
 		const liboscar::interface::CQRFromRouting & cqrr() const;
+		const Static::GeoHierarchyCellGraph & cellGraph() const;
 		sserialize::Static::CellTextCompleter & ctc();
 
 		uint32_t threadCount() const;
@@ -71,8 +83,10 @@ public:
 			const CQRFromComplexSpatialQuery & csq,
 			const sserialize::spatial::GeoHierarchySubGraph & ghsg,
 			const liboscar::interface::CQRFromRouting & cqrr,
+			const Static::GeoHierarchyCellGraph & cellGraph,
+			Scratch & scratch,
 			uint32_t threadCount) :
-		CalcBase(ctc, cqrd, csq, ghsg, cqrr, threadCount)
+		CalcBase(ctc, cqrd, csq, ghsg, cqrr, cellGraph, scratch, threadCount)
 		{}
 		CQRType calc(Node * node);
 		CQRType calcItem(Node * node);
@@ -106,11 +120,13 @@ public:
 		const sserialize::Static::CQRDilator & cqrd,
 		const CQRFromComplexSpatialQuery & csq,
 		const sserialize::spatial::GeoHierarchySubGraph & ghsg,
-		std::shared_ptr<liboscar::interface::CQRFromRouting> cqrr = liboscar::interface::CQRFromRouting::make_shared<liboscar::impl::CQRFromRoutingNoOp>()
+		std::shared_ptr<liboscar::interface::CQRFromRouting> cqrr = liboscar::interface::CQRFromRouting::make_shared<liboscar::impl::CQRFromRoutingNoOp>(),
+		const Static::GeoHierarchyCellGraph & cellGraph = Static::GeoHierarchyCellGraph()
 	);
 	AdvancedCellOpTree(const AdvancedCellOpTree &) = delete;
 	virtual ~AdvancedCellOpTree();
 	AdvancedCellOpTree & operator=(const AdvancedCellOpTree&) = delete;
+	//parse() and calc() may be called repeatedly, the completers and the scratch buffers are reused
 	///remove potential harmless queries
 	void clean(double maxDilation);
 	template<typename T_CQR_TYPE>
@@ -123,12 +139,16 @@ public:
 	const CQRFromComplexSpatialQuery & csq() const { return m_csq; }
 	const sserialize::spatial::GeoHierarchySubGraph & ghsg() const { return m_ghsg; }
 	const liboscar::interface::CQRFromRouting & cqrr() const { return *m_cqrr; }
+	///used instead of ghsg() for per cell lookups if it is valid
+	const Static::GeoHierarchyCellGraph & cellGraph() const { return m_cellGraph; }
 private:
 	sserialize::Static::CellTextCompleter m_ctc;
 	sserialize::Static::CQRDilator m_cqrd;
 	CQRFromComplexSpatialQuery m_csq;
 	sserialize::spatial::GeoHierarchySubGraph m_ghsg;
 	std::shared_ptr<liboscar::interface::CQRFromRouting> m_cqrr;
+	Static::GeoHierarchyCellGraph m_cellGraph;
+	Scratch m_scratch;
 };
 
 template<typename T_CQR_TYPE>
@@ -136,7 +156,7 @@ T_CQR_TYPE
 AdvancedCellOpTree::calc(uint32_t threadCount) {
 	typedef T_CQR_TYPE CQRType;
 	if (root()) {
-		Calc<CQRType> calculator(ctc(), cqrd(), csq(), ghsg(), cqrr(), threadCount);
+		Calc<CQRType> calculator(ctc(), cqrd(), csq(), ghsg(), cqrr(), cellGraph(), m_scratch, threadCount);
 		return calculator.calc( root() );
 	}
 	else {
@@ -292,7 +312,8 @@ T_CQR_TYPE
 AdvancedCellOpTree::Calc<T_CQR_TYPE>::calcRegionExclusiveCells(AdvancedCellOpTree::Node * node) {
 	uint32_t storeId = atoi(node->value.c_str());
 	uint32_t ghId = m_ctc.geoHierarchy().storeIdToGhId(storeId);
-	return CQRType(ghsg().regionExclusiveCells(ghId), ci(), idxStore(), m_ctc.flags() & sserialize::CellQueryResult::FF_MASK_CELL_ITEM_IDS);
+	sserialize::ItemIndex cells(cellGraph().valid() ? cellGraph().regionExclusiveCells(ghId) : ghsg().regionExclusiveCells(ghId));
+	return CQRType(cells, ci(), idxStore(), m_ctc.flags() & sserialize::CellQueryResult::FF_MASK_CELL_ITEM_IDS);
 }
 
 template<typename T_CQR_TYPE>
@@ -364,8 +385,8 @@ AdvancedCellOpTree::Calc<T_CQR_TYPE>::calcString(AdvancedCellOpTree::Node* node)
 	if (!node->value.size()) {
 		return CQRType();
 	}
-	const std::string & str = node->value;
-	std::string qstr(str);
+	std::string & qstr = m_scratch.str;
+	qstr.assign(node->value);
 	sserialize::StringCompleter::QuerryType qt = sserialize::StringCompleter::QT_NONE;
 	qt = sserialize::StringCompleter::normalize(qstr);
 	if (node->subType == Node::STRING_ITEM) {
@@ -432,7 +453,7 @@ AdvancedCellOpTree::Calc<T_CQR_TYPE>::calcQueryExclusiveCells(AdvancedCellOpTree
 	std::vector<uint32_t> tmp;
 	for(uint32_t i(0), s(cqr.cellCount()); i < s; ++i) {
 		uint32_t cellId = cqr.cellId(i);
-		uint32_t dps = ghsg().directParentsSize(cellId);
+		uint32_t dps = (cellGraph().valid() ? cellGraph().directParentsSize(cellId) : ghsg().directParentsSize(cellId));
 		if (dps >= dpMin && dps <= dpMax) {
 			tmp.push_back(cellId);
 		}
@@ -2,6 +2,7 @@
 #define LIBOSCAR_CQR_FROM_COMPLEX_SPATIAL_QUERY_H
 #include <sserialize/spatial/CellQueryResult.h>
 #include <sserialize/Static/GeoHierarchySubGraph.h>
+#include <liboscar/GeoHierarchyCellGraph.h>
 #include "CQRFromPolygon.h"
 
 namespace liboscar {
@@ -17,7 +18,8 @@ public:
 	enum BinaryOp : uint32_t {BO_INVALID=0, BO_BETWEEN};
 public:
 	CQRFromComplexSpatialQuery(const CQRFromComplexSpatialQuery & other);
-	CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph & ssc, const CQRFromPolygon & cqrfp);
+	///@param cellGraph used instead of ssc for per cell lookups if it is valid
+	CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph & ssc, const CQRFromPolygon & cqrfp, const Static::GeoHierarchyCellGraph & cellGraph = Static::GeoHierarchyCellGraph());
 	~CQRFromComplexSpatialQuery();
 	sserialize::CellQueryResult compassOp(const sserialize::CellQueryResult & cqr, UnaryOp direction, uint32_t threadCount) const;
 	sserialize::CellQueryResult relevantElementOp(const sserialize::CellQueryResult & cqr) const;
@@ -36,7 +38,7 @@ public:
 private:
 	enum QueryItemType : uint32_t { QIT_INVALID=0, QIT_ITEM=1, QIT_REGION=2};
 public:
-	CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph& ssc, const liboscar::CQRFromPolygon& cqrfp);
+	CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph& ssc, const liboscar::CQRFromPolygon& cqrfp, const Static::GeoHierarchyCellGraph & cellGraph);
 	virtual ~CQRFromComplexSpatialQuery();
 	sserialize::CellQueryResult relevantElementOp(const sserialize::CellQueryResult& cqr) const;
 	sserialize::CellQueryResult compassOp(const sserialize::CellQueryResult& cqr, liboscar::CQRFromComplexSpatialQuery::UnaryOp direction, uint32_t threadCount) const;
@@ -77,6 +79,7 @@ private: //accessor function
 	const sserialize::Static::ItemIndexStore & idxStore() const;
 private:
 	sserialize::spatial::GeoHierarchySubGraph m_ssc;
+	Static::GeoHierarchyCellGraph m_cellGraph;
 	liboscar::CQRFromPolygon m_cqrfp;
 	uint32_t m_itemQueryItemCountTh;
 	uint32_t m_itemQueryCellCountTh;
@@ -0,0 +1,171 @@
+#ifndef LIBOSCAR_COMPRESSED_GEOMETRY_H
+#define LIBOSCAR_COMPRESSED_GEOMETRY_H
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <sserialize/spatial/GeoRect.h>
+#include <sserialize/spatial/GeoShape.h>
+#include <sserialize/Static/GeoShape.h>
+#include <liboscar/OsmKeyValueObjectStoreColumns.h>
+#include <liboscar/Sidecar.h>
+#include <cmath>
+#define LIBOSCAR_COMPRESSED_GEOMETRY_STORE_VERSION 1
+
+namespace liboscar {
+namespace Static {
+
+class OsmKeyValueObjectStore;
+
+/** View of the compressed geometry of a single item.
+  * Coordinates are quantized to 1e-7 degrees, points of a ring are delta encoded zigzag varints.
+  * Points are decoded on the fly without materializing GeoPoints.
+  *
+  * Encoding
+  *
+  * {
+  *   TYPE          u8, sserialize::spatial::GeoShapeType, nothing follows for GS_NONE
+  *   BBOX          4*int32 (minLat, maxLat, minLon, maxLon) little endian, quantized like OsmKeyValueObjectStoreColumns
+  *   OUTER_COUNT   vu32, number of outer rings (1 for points, ways and polygons)
+  *   INNER_COUNT   vu32, number of inner rings (only for multi polygons)
+  *   RINGS         Ring[OUTER_COUNT+INNER_COUNT], outer rings first
+  * }
+  *
+  * Ring
+  * {
+  *   SIZE          vu32
+  *   POINTS        (vs32 lat, vs32 lon)[SIZE], first point relative to (BBOX.minLat, BBOX.minLon), others to their predecessor, modulo 2^32
+  * }
+  */
+class CompressedGeometry final {
+public:
+	///Streams the points of a ring
+	class PointDecoder final {
+	public:
+		PointDecoder() {}
+		PointDecoder(const uint8_t * data, uint32_t size, int32_t baseLat, int32_t baseLon) :
+		m_data(data), m_remaining(size), m_lat(baseLat), m_lon(baseLon) {}
+		inline uint32_t remaining() const { return m_remaining; }
+		inline bool next(int32_t & lat, int32_t & lon) {
+			if (!m_remaining) {
+				return false;
+			}
+			--m_remaining;
+			m_lat = addDelta(m_lat, decodeVarUint(m_data));
+			m_lon = addDelta(m_lon, decodeVarUint(m_data));
+			lat = m_lat;
+			lon = m_lon;
+			return true;
+		}
+		///decode up to maxCount points into the given buffers
+		///@return number of decoded points
+		uint32_t decode(int32_t * lat, int32_t * lon, uint32_t maxCount);
+		///@return position after the last point of the ring
+		const uint8_t * skip();
+	private:
+		const uint8_t * m_data{nullptr};
+		uint32_t m_remaining{0};
+		int32_t m_lat{0};
+		int32_t m_lon{0};
+	};
+public:
+	CompressedGeometry() {}
+	CompressedGeometry(const uint8_t * data);
+	inline sserialize::spatial::GeoShapeType type() const { return m_type; }
+	inline bool valid() const { return m_type != sserialize::spatial::GS_NONE; }
+	inline uint32_t outerRingCount() const { return m_outerCount; }
+	inline uint32_t innerRingCount() const { return m_innerCount; }
+	inline uint32_t ringCount() const { return m_outerCount + m_innerCount; }
+	///quantized bounding box
+	sserialize::spatial::GeoRect boundary() const;
+	///Calls cb(ringId, PointDecoder & points) for every ring, rings with ringId >= outerRingCount() are inner rings
+	///cb does not need to consume all points
+	template<typename TCallback>
+	void visitRings(TCallback && cb) const;
+	///Same as the intersects test of the uncompressed shape, up to the quantization of the coordinates
+	bool intersects(const sserialize::spatial::GeoRect & rect) const;
+public:
+	///Append the compressed encoding of shape to dest
+	static void append(const sserialize::Static::spatial::GeoShape & shape, std::vector<uint8_t> & dest);
+	static inline int32_t quantize(double coord) { return int32_t(std::lround(coord*OsmKeyValueObjectStoreColumns::CoordinateScale)); }
+	static inline uint32_t zigzag(int32_t v) { return (uint32_t(v) << 1) ^ uint32_t(v >> 31); }
+	static inline int32_t unzigzag(uint32_t v) { return int32_t((v >> 1) ^ (~(v & 1) + 1)); }
+	///deltas are computed modulo 2^32 since longitude differences do not fit into an int32
+	static inline uint32_t delta(int32_t from, int32_t to) { return zigzag(int32_t(uint32_t(to) - uint32_t(from))); }
+	static inline int32_t addDelta(int32_t from, uint32_t encodedDelta) { return int32_t(uint32_t(from) + uint32_t(unzigzag(encodedDelta))); }
+	static inline uint32_t decodeVarUint(const uint8_t * & data) {
+		uint32_t v = *data & 0x7F;
+		if (!(*data++ & 0x80)) {
+			return v;
+		}
+		for(uint32_t shift(7); ; shift += 7) {
+			v |= uint32_t(*data & 0x7F) << shift;
+			if (!(*data++ & 0x80)) {
+				return v;
+			}
+		}
+	}
+	static inline void encodeVarUint(uint32_t v, std::vector<uint8_t> & dest) {
+		while (v >= 0x80) {
+			dest.push_back(uint8_t(v) | 0x80);
+			v >>= 7;
+		}
+		dest.push_back(uint8_t(v));
+	}
+private:
+	sserialize::spatial::GeoShapeType m_type{sserialize::spatial::GS_NONE};
+	int32_t m_minLat{1};
+	int32_t m_maxLat{0};
+	int32_t m_minLon{1};
+	int32_t m_maxLon{0};
+	uint32_t m_outerCount{0};
+	uint32_t m_innerCount{0};
+	const uint8_t * m_rings{nullptr};
+};
+
+template<typename TCallback>
+void CompressedGeometry::visitRings(TCallback && cb) const {
+	const uint8_t * data = m_rings;
+	for(uint32_t i(0), s(ringCount()); i < s; ++i) {
+		uint32_t size = decodeVarUint(data);
+		PointDecoder points(data, size, m_minLat, m_minLon);
+		cb(i, points);
+		data = points.skip();
+	}
+}
+
+/** Compressed geometries of all items of an OsmKeyValueObjectStore.
+  * This is a sidecar to the kvstore, items are ordered by their position in the store.
+  *
+  * Storage layout
+  *
+  * {
+  *   VERSION       u8
+  *   SIZE          u32
+  *   BYTE_ORDER    u32, see sidecar::ByteOrderMark
+  *   OFFSETS       u64[SIZE+1], native byte order and 64 byte aligned, geometry i is in DATA[OFFSETS[i], OFFSETS[i+1])
+  *   DATA          u8[OFFSETS[SIZE]], CompressedGeometry
+  * }
+  */
+class CompressedGeometryStore final {
+public:
+	CompressedGeometryStore();
+	///throws sserialize::CorruptDataException if data is invalid
+	CompressedGeometryStore(const sserialize::UByteArrayAdapter & data);
+	~CompressedGeometryStore();
+	inline bool valid() const { return m_offsets; }
+	inline uint32_t size() const { return m_size; }
+	sserialize::UByteArrayAdapter::OffsetType getSizeInBytes() const;
+	inline CompressedGeometry at(uint32_t itemPos) const { return CompressedGeometry(m_data + m_offsets[itemPos]); }
+	inline uint64_t dataSize(uint32_t itemPos) const { return m_offsets[itemPos+1] - m_offsets[itemPos]; }
+public:
+	///Serialize the compressed geometries of the items of store to dest
+	///@return offset of the geometries in dest
+	static sserialize::UByteArrayAdapter::OffsetType create(const OsmKeyValueObjectStore & store, sserialize::UByteArrayAdapter & dest, uint32_t threadCount);
+private:
+	uint32_t m_size{0};
+	sidecar::View m_view;
+	const uint64_t * m_offsets{nullptr};
+	const uint8_t * m_data{nullptr};
+};
+
+}}//end namespace liboscar::Static
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef LIBOSCAR_GEO_HIERARCHY_CELL_GRAPH_H
+#define LIBOSCAR_GEO_HIERARCHY_CELL_GRAPH_H
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <sserialize/containers/ItemIndex.h>
+#include <sserialize/Static/GeoHierarchy.h>
+#include <sserialize/Static/ItemIndexStore.h>
+#include <sserialize/spatial/CellQueryResult.h>
+#include <liboscar/Sidecar.h>
+#define LIBOSCAR_GEO_HIERARCHY_CELL_GRAPH_VERSION 1
+
+namespace liboscar {
+namespace Static {
+
+/** Precomputed cell/region relations of a GeoHierarchy as used by the queries of the GeoHierarchySubGraph.
+  * This is a sidecar to the kvstore. It replaces the in-memory GeoHierarchySubGraph
+  * (the parents of a cell, the number of direct parents, the exclusive cells, the cell count of a region and subSet())
+  * by arrays that are used directly from the memory mapped file and can be shared between processes.
+  *
+  * Storage layout
+  *
+  * {
+  *   VERSION              u8
+  *   REGION_SIZE          u32
+  *   CELL_SIZE            u32
+  *   PARENT_COUNT         u64, total number of cell parents
+  *   EXCLUSIVE_COUNT      u64, total number of exclusive cells
+  *   BYTE_ORDER           u32, see sidecar::ByteOrderMark
+  *   REGION_CELL_COUNTS   u32[REGION_SIZE]
+  *   PARENT_OFFSETS       u64[CELL_SIZE+1], the parents of cell c are PARENTS[PARENT_OFFSETS[c], PARENT_OFFSETS[c+1])
+  *   DIRECT_PARENT_COUNTS u32[CELL_SIZE]
+  *   PARENTS              u32[PARENT_COUNT], direct parents first, both parts sorted
+  *   EXCLUSIVE_OFFSETS    u64[REGION_SIZE+1], the exclusive cells of region r are EXCLUSIVE_CELLS[EXCLUSIVE_OFFSETS[r], EXCLUSIVE_OFFSETS[r+1])
+  *   EXCLUSIVE_CELLS      u32[EXCLUSIVE_COUNT], sorted per region
+  * }
+  *
+  * Arrays start at offsets that are a multiple of 64 and are stored in native byte order.
+  * A region is a direct parent of a cell if none of its children contains the cell, the exclusive cells of a region are the cells it is a direct parent of.
+  */
+class GeoHierarchyCellGraph final {
+public:
+	GeoHierarchyCellGraph();
+	///throws sserialize::CorruptDataException if data is invalid
+	GeoHierarchyCellGraph(const sserialize::UByteArrayAdapter & data);
+	~GeoHierarchyCellGraph();
+	inline bool valid() const { return m_regionCellCounts; }
+	inline uint32_t regionSize() const { return m_regionSize; }
+	inline uint32_t cellSize() const { return m_cellSize; }
+	sserialize::UByteArrayAdapter::OffsetType getSizeInBytes() const;
+public:
+	///number of cells of region regionId including the cells of its children
+	inline uint32_t regionCellCount(uint32_t regionId) const { return m_regionCellCounts[regionId]; }
+	inline const uint32_t * cellParentsBegin(uint32_t cellId) const { return m_parents + m_parentOffsets[cellId]; }
+	inline const uint32_t * cellParentsEnd(uint32_t cellId) const { return m_parents + m_parentOffsets[cellId+1]; }
+	inline uint32_t directParentsSize(uint32_t cellId) const { return m_directParentCounts[cellId]; }
+	inline const uint32_t * regionExclusiveCellsBegin(uint32_t regionId) const { return m_exclusiveCells + m_exclusiveOffsets[regionId]; }
+	inline const uint32_t * regionExclusiveCellsEnd(uint32_t regionId) const { return m_exclusiveCells + m_exclusiveOffsets[regionId+1]; }
+	sserialize::ItemIndex regionExclusiveCells(uint32_t regionId) const;
+	///Same as GeoHierarchySubGraph::subSet() but computed from the parents of the cells of cqr
+	///Every node gets the items of all cells in its subtree, its cell positions are those of all these cells
+	///or only those of the cells it is a direct parent of if sparse is true.
+	///@param gh the GeoHierarchy this cell graph was created from
+	sserialize::Static::spatial::GeoHierarchy::SubSet subSet(const sserialize::Static::spatial::GeoHierarchy & gh, const sserialize::CellQueryResult & cqr, bool sparse) const;
+public:
+	///Serialize the cell graph of gh to dest using threadCount threads
+	///@return offset of the data in dest
+	static sserialize::UByteArrayAdapter::OffsetType create(
+		const sserialize::Static::spatial::GeoHierarchy & gh,
+		const sserialize::Static::ItemIndexStore & idxStore,
+		sserialize::UByteArrayAdapter & dest,
+		uint32_t threadCount);
+private:
+	uint32_t m_regionSize{0};
+	uint32_t m_cellSize{0};
+	sidecar::View m_view;
+	const uint32_t * m_regionCellCounts{nullptr};
+	const uint64_t * m_parentOffsets{nullptr};
+	const uint32_t * m_directParentCounts{nullptr};
+	const uint32_t * m_parents{nullptr};
+	const uint64_t * m_exclusiveOffsets{nullptr};
+	const uint32_t * m_exclusiveCells{nullptr};
+};
+
+}}//end namespace liboscar::Static
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef LIBOSCAR_HILBERT_CURVE_H
+#define LIBOSCAR_HILBERT_CURVE_H
+#include <liboscar/OsmKeyValueObjectStoreColumns.h>
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+namespace liboscar {
+namespace detail {
+namespace HilbertCurve {
+
+///position of (x, y) on the hilbert curve filling a 2^16 x 2^16 grid
+inline uint64_t index(uint32_t x, uint32_t y) {
+	constexpr uint32_t n = uint32_t(1) << 16;
+	uint64_t d = 0;
+	for(uint32_t s(n/2); s > 0; s /= 2) {
+		uint32_t rx = (x & s) > 0;
+		uint32_t ry = (y & s) > 0;
+		d += uint64_t(s) * uint64_t(s) * ((3 * rx) ^ ry);
+		if (ry == 0) {
+			if (rx == 1) {
+				x = n-1-x;
+				y = n-1-y;
+			}
+			std::swap(x, y);
+		}
+	}
+	return d;
+}
+
+///grid coordinate of the center of [minQ, maxQ] where the coordinates are quantized like in OsmKeyValueObjectStoreColumns
+///and the grid spans [-range, range]
+inline uint32_t gridCoord(int64_t minQ, int64_t maxQ, double range) {
+	double center = (double(minQ) + double(maxQ)) / 2.0 / Static::OsmKeyValueObjectStoreColumns::CoordinateScale;
+	double v = (center + range) / (2*range) * 65535.0;
+	return uint32_t(std::max(0.0, std::min(65535.0, v)));
+}
+
+///position of the center of the quantized bounding box on the hilbert curve
+inline uint64_t index(int32_t minLat, int32_t maxLat, int32_t minLon, int32_t maxLon) {
+	return index(gridCoord(minLon, maxLon, 180.0), gridCoord(minLat, maxLat, 90.0));
+}
+
+}}}//end namespace liboscar::detail::HilbertCurve
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef LIBOSCAR_ITEM_RTREE_H
+#define LIBOSCAR_ITEM_RTREE_H
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <liboscar/OsmKeyValueObjectStoreColumns.h>
+#include <algorithm>
+#include <array>
+#include <liboscar/Sidecar.h>
+#define LIBOSCAR_ITEM_RTREE_VERSION 1
+
+namespace liboscar {
+namespace Static {
+
+class OsmKeyValueObjectStore;
+
+/** Packed R-tree over the bounding boxes of the items of an OsmKeyValueObjectStore.
+  * This is a sidecar to the kvstore. Items are ordered along a hilbert curve of their bounding box centers
+  * and grouped bottom-up into nodes of NodeSize entries. Items without a shape are not part of the tree.
+  *
+  * Storage layout
+  *
+  * {
+  *   VERSION       u8
+  *   SIZE          u32, number of items in the tree
+  *   ENTRY_COUNT   u32, number of entries in all levels
+  *   LEVEL_COUNT   u32
+  *   BYTE_ORDER    u32, see sidecar::ByteOrderMark
+  *   LEVEL_ENDS    u32[LEVEL_COUNT], entries of level i are in [LEVEL_ENDS[i-1], LEVEL_ENDS[i]), level 0 are the items
+  *   MIN_LAT       int32[ENTRY_COUNT]
+  *   MAX_LAT       int32[ENTRY_COUNT]
+  *   MIN_LON       int32[ENTRY_COUNT]
+  *   MAX_LON       int32[ENTRY_COUNT]
+  *   INDEX         u32[ENTRY_COUNT], item id for level 0, position of the first child entry otherwise
+  * }
+  *
+  * Arrays start at offsets that are a multiple of 64 and are stored in native byte order.
+  * Bounding boxes are quantized like in OsmKeyValueObjectStoreColumns.
+  */
+class ItemRTree final {
+public:
+	static constexpr uint32_t NodeSize = 16;
+	///16 levels of 16 entries suffice for 2^64 items
+	static constexpr uint32_t MaxLevelCount = 16;
+	using QuantizedRect = OsmKeyValueObjectStoreColumns::QuantizedRect;
+public:
+	ItemRTree();
+	///throws sserialize::CorruptDataException if data is invalid
+	ItemRTree(const sserialize::UByteArrayAdapter & data);
+	~ItemRTree();
+	inline bool valid() const { return m_levelEnds; }
+	inline uint32_t size() const { return m_size; }
+	inline uint32_t levelCount() const { return m_levelCount; }
+	///bounding box of all items in the tree, O(1)
+	sserialize::spatial::GeoRect boundary() const;
+	sserialize::UByteArrayAdapter::OffsetType getSizeInBytes() const;
+public:
+	///Calls cb(itemId, contained) for every item whose bounding box intersects rect.
+	///contained is true if the bounding box of the item is within rect.
+	///Does not allocate memory.
+	template<typename TCallback>
+	void visit(const QuantizedRect & rect, TCallback && cb) const;
+	///@return the items whose bounding box intersects rect
+	std::vector<uint32_t> candidates(const sserialize::spatial::GeoRect & rect) const;
+public:
+	///Serialize the tree of the items of store to dest, uses the columns of store if available
+	///@return offset of the tree in dest
+	static sserialize::UByteArrayAdapter::OffsetType create(const OsmKeyValueObjectStore & store, sserialize::UByteArrayAdapter & dest, uint32_t threadCount);
+private:
+	uint32_t m_size{0};
+	uint32_t m_entryCount{0};
+	uint32_t m_levelCount{0};
+	sidecar::View m_view;
+	const uint32_t * m_levelEnds{nullptr};
+	const int32_t * m_minLat{nullptr};
+	const int32_t * m_maxLat{nullptr};
+	const int32_t * m_minLon{nullptr};
+	const int32_t * m_maxLon{nullptr};
+	const uint32_t * m_index{nullptr};
+};
+
+template<typename TCallback>
+void ItemRTree::visit(const QuantizedRect & rect, TCallback && cb) const {
+	if (!m_entryCount) {
+		return;
+	}
+	struct Task {
+		uint32_t begin;
+		uint32_t level;
+		bool contained;
+	};
+	//every node pushes at most NodeSize children and is removed before that
+	std::array<Task, MaxLevelCount*NodeSize> stack;
+	uint32_t stackSize = 0;
+	stack[stackSize++] = Task{m_entryCount-1, m_levelCount-1, false};
+	while (stackSize) {
+		Task t = stack[--stackSize];
+		uint32_t end = std::min(t.begin + NodeSize, m_levelEnds[t.level]);
+		for(uint32_t pos(t.begin); pos < end; ++pos) {
+			bool contained = t.contained;
+			if (!contained) {
+				if (m_maxLat[pos] < rect.minLat || m_minLat[pos] > rect.maxLat || m_maxLon[pos] < rect.minLon || m_minLon[pos] > rect.maxLon) {
+					continue;
+				}
+				contained = rect.minLat <= m_minLat[pos] && m_maxLat[pos] <= rect.maxLat && rect.minLon <= m_minLon[pos] && m_maxLon[pos] <= rect.maxLon;
+			}
+			if (t.level == 0) {
+				cb(m_index[pos], contained);
+			}
+			else {
+				stack[stackSize++] = Task{m_index[pos], t.level-1, contained};
+			}
+		}
+	}
+}
+
+}}//end namespace liboscar::Static
+
+#endif
@@ -1,6 +1,7 @@
 #pragma once
 #ifndef LIBOSCAR_KVCLUSTERING_H
 #define LIBOSCAR_KVCLUSTERING_H
+#include <algorithm>
 #include <memory>
 #include <type_traits>
 #include <unordered_set>
@@ -30,10 +31,22 @@ public:
 	KeyExclusions operator+(const KeyExclusions & other) const;
 public:
 	///create search data structures
+	///The key ranges are compiled into a bitmap with one bit per key.
+	///Copies share the compiled bitmap, so preprocess a static set of exclusions once and copy it per request.
 	void preprocess();
 public:
 	bool hasExceptions() const;
-	bool contains(uint32_t keyId) const;
+	///@complexity O(1)
+	inline bool contains(uint32_t keyId) const {
+		if (!m_valid) {
+			throwNotPreprocessed();
+		}
+		const std::vector<uint64_t> & bitmap = *m_bitmap;
+		std::size_t word = keyId/64;
+		return word < bitmap.size() && ((bitmap[word] >> (keyId%64)) & 0x1);
+	}
+private:
+	[[noreturn]] static void throwNotPreprocessed();
 private:
 	struct KeyRange {
 		uint32_t begin;
@@ -48,6 +61,8 @@ private:
 	KeyStringTable m_kst;
 	bool m_valid{true};
 	std::vector<KeyRange> m_keyRange;
+	//one bit per key id, set iff the key is excluded
+	std::shared_ptr<const std::vector<uint64_t>> m_bitmap;
 };
 
 class KeyValueExclusions final {
@@ -64,15 +79,73 @@ public:
 	void add(const KeyValueExclusions & other);
 public:
 	KeyValueExclusions operator+(const KeyValueExclusions & other) const;
+public:
+	///create search data structures
+	///The pairs are compiled into a bitmap of keys having excluded values and one bitmap of values per such key
+	///spanning the range of its excluded values. Keys whose values are spread too far for a bitmap use a sorted array.
+	///Copies share the compiled form, so preprocess a static set of exclusions once and copy it per request.
+	///Adding pairs afterwards falls back to hashing until preprocess() is called again.
+	void preprocess();
 public:
 	bool hasExceptions() const;
-	bool contains(uint32_t keyId, uint32_t valueId) const;
+	///@complexity O(1)
+	inline bool contains(uint32_t keyId, uint32_t valueId) const {
+		if (m_compiled) {
+			return m_compiled->contains(keyId, valueId);
+		}
+		return m_keyValues.count(std::make_pair(keyId, valueId));
+	}
 private:
 	using KeyValue = std::pair<uint32_t, uint32_t>;
+	struct Compiled {
+		struct ValueRange {
+			uint32_t begin;
+			uint32_t last; //inclusive, an exclusive end would overflow for the value id 0xFFFFFFFF
+			uint64_t offset; //bit offset into values, or offset into sparseValues if sparse
+			uint32_t size; //number of excluded values
+			bool sparse;
+		};
+		///a key uses a bitmap if it needs at most this many words per excluded value, otherwise a sorted array
+		static constexpr uint64_t MaxBitmapWordsPerValue = 1;
+		//one bit per key id, set iff the key has excluded values
+		std::vector<uint64_t> keys;
+		//number of set bits in keys before each word
+		std::vector<uint32_t> keyRank;
+		//value ranges of the keys with excluded values ordered by key id
+		std::vector<ValueRange> valueRanges;
+		//one bit per value id in the range of a key
+		std::vector<uint64_t> values;
+		//sorted value ids of the sparse keys
+		std::vector<uint32_t> sparseValues;
+		inline bool contains(uint32_t keyId, uint32_t valueId) const {
+			std::size_t word = keyId/64;
+			if (word >= keys.size()) {
+				return false;
+			}
+			uint64_t mask = uint64_t(1) << (keyId%64);
+			if (!(keys[word] & mask)) {
+				return false;
+			}
+			const ValueRange & vr = valueRanges[keyRank[word] + __builtin_popcountll(keys[word] & (mask-1))];
+			//unsigned wrap-around maps values before begin beyond the range
+			uint64_t pos = uint64_t(valueId) - vr.begin;
+			if (pos > uint64_t(vr.last - vr.begin)) {
+				return false;
+			}
+			if (vr.sparse) {
+				const uint32_t * begin = sparseValues.data() + vr.offset;
+				return std::binary_search(begin, begin + vr.size, valueId);
+			}
+			pos += vr.offset;
+			return (values[pos/64] >> (pos%64)) & 0x1;
+		}
+	};
 private:
 	KeyStringTable m_kst;
 	ValueStringTable m_vst;
 	std::unordered_set<KeyValue> m_keyValues;
+	//valid iff it contains exactly the pairs in m_keyValues
+	std::shared_ptr<const Compiled> m_compiled;
 };
 
 class KeyInfo {
@@ -5,18 +5,31 @@
 #include <sserialize/containers/CFLArray.h>
 #include <sserialize/iterator/RangeGenerator.h>
 #include <sserialize/containers/OADHashTable.h>
+#include <sserialize/spatial/CellQueryResult.h>
+#include <sserialize/mt/ThreadPool.h>
 
 #include <liboscar/OsmKeyValueObjectStore.h>
 #include <liboscar/KVClustering.h>
 
 #include <unordered_map>
 #include <queue>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
 
 namespace liboscar {
 namespace detail {
 namespace KVStats {
 	
 struct Data;
+struct PackedData;
+class Stats;
+
+///Pack a key-value pair into a single integer.
+///Packed pairs compare in the same order as the pairs themselves
+inline uint64_t packKeyValue(uint32_t keyId, uint32_t valueId) { return (uint64_t(keyId) << 32) | uint64_t(valueId); }
+inline uint32_t unpackKeyId(uint64_t kv) { return uint32_t(kv >> 32); }
+inline uint32_t unpackValueId(uint64_t kv) { return uint32_t(kv); }
 
 struct SortedData {
 	using KeyValue = std::pair<uint32_t, uint32_t>;
@@ -26,9 +39,19 @@ struct SortedData {
 	SortedData();
 	SortedData(const SortedData & other) = default;
 	SortedData(Data && other);
+	///run-length reduces other, other.keyValues has to be sorted
+	SortedData(PackedData && other);
+	///all key-value pairs of stats with their counts
+	explicit SortedData(const Stats & stats);
 	SortedData(SortedData && other);
 	SortedData & operator=(SortedData && other);
 	static SortedData merge(SortedData && first, SortedData && second);
+	///k-way merge of all runs using up to threadCount threads
+	///The key-value space is split by splitters sampled from the runs such that every thread merges a disjoint range
+	static SortedData merge(std::vector<SortedData> && runs, uint32_t threadCount);
+	///subtract the counts of second from first, pairs whose count drops to 0 are removed
+	///second has to be the data of a subset of the items of first
+	static SortedData difference(SortedData && first, const SortedData & second);
 };
 
 struct Data {
@@ -42,9 +65,26 @@ struct Data {
 	Data(Data && other);
 	Data & operator=(Data && other);
 	void update(const Static::OsmKeyValueObjectStore::KVItemBase & item);
+	inline std::size_t size() const { return keyValueCount.size(); }
 	static Data merge(Data && first, Data && second);
 };
 
+///Unreduced key-value pairs packed by packKeyValue()
+///This is cheaper to fill than Data if most key-value pairs are distinct
+struct PackedData {
+	using KeyValueContainer = std::vector<uint64_t>;
+	KeyValueContainer keyValues;
+	PackedData();
+	PackedData(PackedData && other);
+	PackedData & operator=(PackedData && other);
+	void update(const Static::OsmKeyValueObjectStore::KVItemBase & item);
+	///sort keyValues using a lsd radix sort with 8 Bit digits
+	///Digits that are the same for all entries are skipped
+	///@param tmp buffer used during sorting, reuse it to avoid reallocations
+	void sort(KeyValueContainer & tmp);
+	inline std::size_t size() const { return keyValues.size(); }
+};
+
 
 struct ValueInfo {
 	uint32_t valueId{ std::numeric_limits<uint32_t>::max() };
@@ -79,13 +119,14 @@ struct KeyInfoPtr {
 	inline bool valid() const { return offset != std::numeric_limits<uint32_t>::max(); }
 };
 
+///Workers publish their sorted runs to d, these are merged once all workers are done
 struct State {
 	using DataType = SortedData;
 	const Static::OsmKeyValueObjectStore & store;
 	const sserialize::ItemIndex & items;
 	std::atomic<std::size_t> pos{0};
 	
-	std::mutex lock;
+	std::mutex lock; //only guards publishing to d
 	std::vector<DataType> d;
 	
 	State(const Static::OsmKeyValueObjectStore & store, const sserialize::ItemIndex & items);
@@ -104,6 +145,108 @@ struct Worker {
 	void flush();
 };
 
+///Counts key-value pairs by appending them to a buffer, radix sorting and run-length reducing them.
+///The sorted runs are published to state->d and merged by SortedData::merge(std::vector<SortedData>&&, uint32_t)
+struct SortWorker {
+	//number of items to fetch at once
+	static constexpr std::size_t BlockSize = Worker::BlockSize;
+	//number of queued key-value pairs before flushing
+	static constexpr std::size_t FlushSize = Worker::FlushSize;
+	PackedData d;
+	PackedData::KeyValueContainer tmp;
+	State * state;
+	SortWorker(State * state);
+	SortWorker(const SortWorker & other);
+	void operator()();
+	void flush();
+};
+
+///State of KVStats::stats(const sserialize::CellQueryResult&)
+struct CellState {
+	sserialize::ItemIndex noItems;
+	State state; //state.items is empty, the items are taken from cqr
+	const sserialize::CellQueryResult & cqr;
+	std::atomic<uint32_t> cellPos{0};
+	///one bit per item of the store, set once the item was counted
+	std::vector< std::atomic<uint64_t> > visited;
+	CellState(const Static::OsmKeyValueObjectStore & store, const sserialize::CellQueryResult & cqr);
+	///thread-safe
+	///@return true iff itemId was not visited before
+	inline bool visit(uint32_t itemId) {
+		uint64_t mask = uint64_t(1) << (itemId % 64);
+		return !(visited[itemId/64].fetch_or(mask, std::memory_order_relaxed) & mask);
+	}
+};
+
+///Processes whole cells of a CellQueryResult instead of blocks of an ItemIndex
+///Items that are part of multiple cells are only counted by the first worker visiting them
+///@param TWorker either Worker or SortWorker
+template<typename TWorker>
+struct CellWorker: public TWorker {
+	CellState * cellState;
+	CellWorker(CellState * cellState) : TWorker(&cellState->state), cellState(cellState) {}
+	CellWorker(const CellWorker & other) : TWorker(other), cellState(other.cellState) {}
+	void operator()() {
+		const sserialize::CellQueryResult & cqr = cellState->cqr;
+		while (true) {
+			uint32_t cellPos = cellState->cellPos.fetch_add(1, std::memory_order_relaxed);
+			if (cellPos >= cqr.cellCount()) {
+				break;
+			}
+			sserialize::ItemIndex idx(cqr.idx(cellPos));
+			for(uint32_t itemId : idx) {
+				if (cellState->visit(itemId)) {
+					TWorker::d.update( cellState->state.store.kvBaseItem(itemId) );
+				}
+			}
+			if (TWorker::d.size() > TWorker::FlushSize) {
+				TWorker::flush();
+			}
+		}
+		TWorker::flush();
+	}
+};
+
+///Parameters to compute approximate statistics on a sample of the items
+///Samples of a CellQueryResult are stratified by cell: every non-empty cell contributes at least one item,
+///the remaining samples are distributed in proportion to the cell sizes.
+///Each drawn item is weighted by the size of its cell divided by the number of items drawn from that cell.
+///Samples of an ItemIndex have no cells, the strata are sampleSize consecutive ranges of item positions.
+struct Sampling {
+	///a drawn item and the number of items of its stratum it stands for
+	struct WeightedItem {
+		uint32_t itemId;
+		double weight;
+	};
+	Sampling() = default;
+	Sampling(const Sampling &) = default;
+	Sampling(double rate, uint32_t maxItems) : rate(rate), maxItems(maxItems) {}
+	///fraction of items to look at, in (0, 1]
+	double rate{1.0};
+	///upper bound on the number of items to look at, this bounds the work per request
+	///A sample of a CellQueryResult additionally has up to one item per non-empty cell, see sample()
+	uint32_t maxItems{std::numeric_limits<uint32_t>::max()};
+	///seed of the random number generator, a fixed seed gives the same counts for the same items
+	uint32_t seed{0};
+	///@return the number of items to sample from itemCount items, at least 1 if itemCount > 0
+	uint32_t sampleSize(uint32_t itemCount) const;
+	///draw the sample, items needs to support random access
+	sserialize::ItemIndex sample(const sserialize::ItemIndex & items) const;
+	///draw a sample stratified by the cells of cqr
+	///The sample has at most sampleSize(itemCount) items plus one per non-empty cell
+	///Items that are part of multiple cells may be drawn once per cell
+	///@param itemCount set to the sum of the cell sizes
+	std::vector<WeightedItem> sample(const sserialize::CellQueryResult & cqr, uint64_t & itemCount) const;
+};
+
+///Estimate the number of distinct key-value pairs of itemCount items from a uniform sample of them
+std::size_t estimateDistinctKeyValues(const Static::OsmKeyValueObjectStore & store, const std::vector<uint32_t> & sample, std::size_t itemCount);
+///Estimate the number of distinct key-value pairs of items by looking at a sample of items
+std::size_t estimateDistinctKeyValues(const Static::OsmKeyValueObjectStore & store, const sserialize::ItemIndex & items);
+///Estimate the number of distinct key-value pairs of the items of cqr by looking at a sample of items
+///Items that are part of multiple cells are counted multiple times
+std::size_t estimateDistinctKeyValues(const Static::OsmKeyValueObjectStore & store, const sserialize::CellQueryResult & cqr);
+
 class KeyValueInfo {
 public:
 	KeyValueInfo() = default;
@@ -136,6 +279,64 @@ struct NoKeyValueExclusions {
 	inline bool operator()(const KeyInfo&, const ValueInfo&) const {return false; }
 };
 
+///Strict weak order derived from the comparators of Stats::topk and Stats::topkv: the topk are the k smallest entries
+template<typename TCompare>
+struct RankOrder {
+	TCompare compare;
+	RankOrder(const TCompare & compare) : compare(compare) {}
+	template<typename T>
+	inline bool operator()(const T & a, const T & b) const { return !compare(a, b); }
+};
+
+///Orders offsets into a container by comparing the referenced entries
+template<typename TContainer, typename TCompare>
+struct IndirectRankOrder {
+	const TContainer * container;
+	TCompare compare;
+	IndirectRankOrder(const TContainer * container, const TCompare & compare) : container(container), compare(compare) {}
+	inline bool operator()(uint32_t a, uint32_t b) const { return !compare((*container)[a], (*container)[b]); }
+};
+
+///Keeps the k smallest entries with respect to TOrder.
+///Entries are appended to a flat buffer which is cut down to k entries by nth_element once it is full.
+template<typename T, typename TOrder>
+class TopKBuffer {
+public:
+	TopKBuffer(uint32_t k, const TOrder & order) : m_k(k), m_order(order) {}
+	inline void push(const T & v) {
+		m_d.push_back(v);
+		if (m_d.size() >= capacity()) {
+			shrink();
+		}
+	}
+	void merge(TopKBuffer && other) {
+		m_d.insert(m_d.end(), other.m_d.begin(), other.m_d.end());
+		other.m_d.clear();
+		if (m_d.size() >= capacity()) {
+			shrink();
+		}
+	}
+	///@return the k smallest entries in ascending order
+	std::vector<T> result() {
+		shrink();
+		std::sort(m_d.begin(), m_d.end(), m_order);
+		return std::move(m_d);
+	}
+private:
+	//amortizes nth_element to O(1) per entry
+	inline std::size_t capacity() const { return 2*std::size_t(m_k) + 1024; }
+	void shrink() {
+		if (m_d.size() > m_k) {
+			std::nth_element(m_d.begin(), m_d.begin()+m_k, m_d.end(), m_order);
+			m_d.resize(m_k);
+		}
+	}
+private:
+	uint32_t m_k;
+	TOrder m_order;
+	std::vector<T> m_d;
+};
+
 class Stats {
 public:
 	using ValueInfo = liboscar::detail::KVStats::ValueInfo;
@@ -145,6 +346,8 @@ public:
 	using KeyInfoConstIterator = std::vector<KeyInfo>::const_iterator;
 public:
 	Stats(std::unique_ptr<std::vector<ValueInfo>> && valueInfoStore, std::vector<KeyInfo> && keyInfoStore, std::unordered_map<uint32_t, KeyInfoPtr> && keyInfo);
+	///deep copy
+	Stats(const Stats & other);
 	Stats(Stats && other);
 	Stats & operator=(Stats && other);
 public:
@@ -157,23 +360,46 @@ public:
 	KeyInfoConstIterator keysBegin() const;
 	KeyInfoIterator keysEnd();
 	KeyInfoConstIterator keysEnd() const;
+	///approximate memory usage in bytes
+	std::size_t memoryUsage() const;
+public:
+	///true iff the counts are estimates computed from a sample
+	bool approximate() const;
+	uint32_t sampleSize() const;
+	uint32_t populationSize() const;
+	///confidence interval [first, second] of an estimated count of key or key:value occurences
+	///Uses the normal approximation of the sampled proportion with finite population correction
+	///@param z quantile of the standard normal distribution, 1.96 for a confidence of 95%
+	std::pair<uint32_t, uint32_t> countInterval(uint32_t count, double z = 1.96) const;
+	///scale all counts computed on a sample of sampleSize items to populationSize items
+	void extrapolate(uint32_t sampleSize, uint32_t populationSize);
+	///mark the counts as estimates from a sample of sampleSize items of populationSize items without scaling them
+	void setSample(uint32_t sampleSize, uint32_t populationSize);
 public:
 	///return topk keyIds sorted according to compare
 	///@param compare(KeyInfo)
 	template<typename TCompare, typename TKeyExclusions = NoKeyExclusions>
 	std::vector<uint32_t> topk(uint32_t k, TCompare compare, TKeyExclusions keyExclusions = TKeyExclusions()) const;
 	///return topk key:value pairs, sorted according to compare
+	///Keys are split into blocks that are scanned by up to threadCount threads,
+	///each thread keeps its candidates in a flat buffer which are merged at the end.
 	///@param compare(KeyValueInfo, KeyValueInfo)
 	///@param keyExclusions(KeyInfo) -> bool; true iff we should NOT analze key-value pairs with the given key
 	///@param keyValueExclusions(KeyInfo,ValueInfo) -> bool; true iff we should NOT analze key-value pairs with the given key:value
+	///compare and the exclusions are called concurrently if threadCount > 1
 	template<typename TCompare, typename TKeyExclusions = NoKeyExclusions, typename TKeyValueExclusions = NoKeyValueExclusions>
-	std::vector<KeyValueInfo> topkv(uint32_t k, TCompare compare, TKeyExclusions keyExclusions = TKeyExclusions(), TKeyValueExclusions keyValueExclusions = TKeyValueExclusions()) const;
+	std::vector<KeyValueInfo> topkv(uint32_t k, TCompare compare, TKeyExclusions keyExclusions = TKeyExclusions(), TKeyValueExclusions keyValueExclusions = TKeyValueExclusions(), uint32_t threadCount = 1) const;
 private:
 	std::unique_ptr<std::vector<ValueInfo>> m_valueInfoStore;
 	std::vector<KeyInfo> m_keyInfoStore;
 	std::unordered_map<uint32_t, KeyInfoPtr> m_keyInfo; //keyId -> keyInfoStore
+	uint32_t m_sampleSize{0};
+	uint32_t m_populationSize{0};
 };
 
+///Works on exact and approximate Stats alike.
+///With approximate Stats (see KVStats::Sampling) the reported counts are the extrapolated ones
+///and the work per request is bounded by the sample size
 template<typename TKeyCompare, typename TKeyValueCompare>
 class KVClusteringBase: public liboscar::kvclustering::Interface {
 public:
@@ -189,17 +415,17 @@ public:
 	virtual std::vector<liboscar::kvclustering::KeyInfo> topKeys(uint32_t k) override {
 		std::vector<uint32_t> tmp;
 		if (m_ke && m_ke->hasExceptions()) {
-			tmp = m_stats.topk(k, m_kc, [this](const KeyInfo & ki) {
+			tmp = m_stats->topk(k, m_kc, [this](const KeyInfo & ki) {
 				return this->m_ke->contains(ki.keyId);
 			});
 		}
 		else {
-			tmp = m_stats.topk(k, m_kc);
+			tmp = m_stats->topk(k, m_kc);
 		}
 		std::vector<liboscar::kvclustering::KeyInfo> result;
 		result.reserve(tmp.size());
 		for(uint32_t keyId : tmp) {
-			result.emplace_back(keyId, m_stats.key(keyId).count);
+			result.emplace_back(keyId, m_stats->key(keyId).count);
 		}
 		return result;
 	}
@@ -213,20 +439,20 @@ public:
 				auto mkve = [this](const KeyInfo & ki, const ValueInfo & vi) {
 					return this->m_kve->contains(ki.keyId, vi.valueId);
 				};
-				tmp = m_stats.topkv(k, m_kvc, mke, mkve);
+				tmp = m_stats->topkv(k, m_kvc, mke, mkve, m_threadCount);
 			}
 			else {
-				tmp = m_stats.topkv(k, m_kvc, mke);
+				tmp = m_stats->topkv(k, m_kvc, mke, NoKeyValueExclusions(), m_threadCount);
 			}
 		}
 		else if (m_kve && m_kve->hasExceptions()) {
 			auto mkve = [this](const KeyInfo & ki, const ValueInfo & vi) {
 				return this->m_kve->contains(ki.keyId, vi.valueId);
 			};
-			tmp = m_stats.topkv(k, m_kvc, NoKeyExclusions(), mkve);
+			tmp = m_stats->topkv(k, m_kvc, NoKeyExclusions(), mkve, m_threadCount);
 		}
 		else {
-			tmp = m_stats.topkv(k, m_kvc);
+			tmp = m_stats->topkv(k, m_kvc, NoKeyExclusions(), NoKeyValueExclusions(), m_threadCount);
 		}
 		std::vector<liboscar::kvclustering::KeyValueInfo> result;
 		result.reserve(tmp.size());
@@ -255,22 +481,33 @@ public:
 		else {
 			m_kve = std::make_unique<KeyValueExclusions>(e);
 		}
+		m_kve->preprocess();
 	}
 	virtual void preprocess() override {}
 protected:
-	KVClusteringBase(Stats && stats, KeyCompare kc = KeyCompare(), KeyValueCompare kvc = KeyValueCompare()) :
-	m_stats(std::move(stats)),
+	///@param threadCount number of threads used by topKeyValues()
+	KVClusteringBase(Stats && stats, KeyCompare kc = KeyCompare(), KeyValueCompare kvc = KeyValueCompare(), uint32_t threadCount = 1) :
+	m_stats(std::make_shared<const Stats>(std::move(stats))),
+	m_kc(kc),
+	m_kvc(kvc),
+	m_threadCount(std::max<uint32_t>(1, threadCount))
+	{}
+	///shares stats, e.g. with a KVStatsCache
+	KVClusteringBase(const std::shared_ptr<const Stats> & stats, KeyCompare kc = KeyCompare(), KeyValueCompare kvc = KeyValueCompare(), uint32_t threadCount = 1) :
+	m_stats(stats),
 	m_kc(kc),
-	m_kvc(kvc)
+	m_kvc(kvc),
+	m_threadCount(std::max<uint32_t>(1, threadCount))
 	{}
 	KVClusteringBase() = delete;
 	KVClusteringBase(const KVClusteringBase &) = delete;
 private:
-	Stats m_stats;
+	std::shared_ptr<const Stats> m_stats;
 	KeyCompare m_kc;
 	KeyValueCompare m_kvc;
 	std::unique_ptr<KeyExclusions> m_ke;
 	std::unique_ptr<KeyValueExclusions> m_kve;
+	uint32_t m_threadCount;
 };
 
 }} //end namespace detail::KVStats
@@ -350,8 +587,12 @@ public:
 	using MyBase::preprocess;
 protected:
 public: //actually protected, but make_shared/make_unique need this to be public
-	explicit ShannonClustering(Stats && stats, uint32_t keySplitThreshold, uint32_t keyValueSplitThreshold) :
-	MyBase(std::move(stats), KeyCompare(keySplitThreshold), KeyValueCompare(keyValueSplitThreshold))
+	///@param threadCount number of threads used by topKeyValues()
+	explicit ShannonClustering(Stats && stats, uint32_t keySplitThreshold, uint32_t keyValueSplitThreshold, uint32_t threadCount = 1) :
+	MyBase(std::move(stats), KeyCompare(keySplitThreshold), KeyValueCompare(keyValueSplitThreshold), threadCount)
+	{}
+	explicit ShannonClustering(const std::shared_ptr<const Stats> & stats, uint32_t keySplitThreshold, uint32_t keyValueSplitThreshold, uint32_t threadCount = 1) :
+	MyBase(stats, KeyCompare(keySplitThreshold), KeyValueCompare(keyValueSplitThreshold), threadCount)
 	{}
 	ShannonClustering() = delete;
 	ShannonClustering(const ShannonClustering&) = delete;
@@ -366,10 +607,33 @@ public:
 	using KeyInfo = detail::KVStats::KeyInfo;
 	using KeyValueInfo = detail::KVStats::KeyValueInfo;
 	using Stats = detail::KVStats::Stats;
+	using Sampling = detail::KVStats::Sampling;
+	///E_HASH counts pairs in hash tables, E_SORT sorts packed pairs
+	///E_AUTO selects E_SORT if the estimated number of distinct pairs is at least SortEngineMinDistinctKeyValues
+	enum Engine { E_AUTO, E_HASH, E_SORT };
+	///Hash tables of this size no longer fit into the cpu caches
+	static constexpr std::size_t SortEngineMinDistinctKeyValues = std::size_t(1) << 17;
 public:
 	KVStats(const Static::OsmKeyValueObjectStore & other);
 public:
-	Stats stats(const sserialize::ItemIndex & items, uint32_t threadCount = 1);
+	Stats stats(const sserialize::ItemIndex & items, uint32_t threadCount = 1, Engine engine = E_AUTO);
+	///Approximate statistics computed on a sample of items
+	///Counts are scaled to items.size(), use Stats::countInterval() to get their error bounds
+	///The work done is bounded by sampling.maxItems
+	Stats stats(const sserialize::ItemIndex & items, uint32_t threadCount, const Sampling & sampling, Engine engine = E_AUTO);
+	///Statistics of the items of cqr without flattening it
+	///Cells are processed in parallel, items that are part of multiple cells are counted once
+	Stats stats(const sserialize::CellQueryResult & cqr, uint32_t threadCount = 1, Engine engine = E_AUTO);
+	///Approximate statistics computed on a sample of the items of cqr that is stratified by cell
+	///Counts are the sums of the weights of the drawn items (see Sampling), scaled by the share of distinct drawn items
+	///The work done is bounded by sampling.maxItems plus the number of non-empty cells,
+	///the weighted counts are always computed by sorting, engine is not used
+	Stats stats(const sserialize::CellQueryResult & cqr, uint32_t threadCount, const Sampling & sampling, Engine engine = E_AUTO);
+	Engine engine(const sserialize::ItemIndex & items) const;
+	Engine engine(const sserialize::CellQueryResult & cqr) const;
+	///Statistics of the items of a that are not items of b
+	///The items of b have to be a subset of the items of a, both have to be exact
+	Stats difference(const Stats & a, const Stats & b);
 private:
 	Stats stats(detail::KVStats::Data && data);
 	Stats stats(detail::KVStats::SortedData && data);
@@ -386,125 +650,84 @@ namespace liboscar {
 template<typename TCompare, typename TValueExclusions>
 std::vector<uint32_t>
 detail::KVStats::KeyInfo::topk(uint32_t k, TCompare compare, TValueExclusions valueExclusions) const {
-	auto mycompare = [this, &compare](uint32_t a, uint32_t b) {
-		return ! compare(this->values.at(a), this->values.at(b));
-	};
-	std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(mycompare)> pq(mycompare);
-	//add k items to pq
-	uint32_t i(0);
-	for(uint32_t s(values.size()); i < s && pq.size() < k; ++i) {
-		if (valueExclusions(this->values[i])) {
+	using Order = IndirectRankOrder<ValuesContainer, TCompare>;
+	TopKBuffer<uint32_t, Order> buffer(k, Order(&values, compare));
+	for(uint32_t i(0), s(values.size()); i < s; ++i) {
+		if (valueExclusions(values[i])) {
 			continue;
 		}
-		pq.emplace(i);
-	}
-	//now add one and remove one
-	for(uint32_t s(values.size()); i < s; ++i) {
-		if (valueExclusions(this->values[i])) {
-			continue;
-		}
-		pq.emplace(i);
-		pq.pop();
-	}
-	//and retrieve them all, they are sorted from small to large, so inverse the mapping
-	std::vector<uint32_t> result(pq.size());
-	for(auto rit(result.rbegin()), rend(result.rend()); rit != rend; ++rit) {
-		*rit = pq.top();
-		pq.pop();
+		buffer.push(i);
 	}
-	SSERIALIZE_CHEAP_ASSERT_EQUAL(std::size_t(0), pq.size());
-	return result;
+	return buffer.result();
 }
 
 template<typename TCompare, typename TKeyExclusions>
 std::vector<uint32_t>
 detail::KVStats::Stats::topk(uint32_t k, TCompare compare, TKeyExclusions keyExclusions) const {
-	auto mycompare = [this, &compare](uint32_t a, uint32_t b) -> bool {
-		return ! compare(this->keys().at(a), this->keys().at(b));
-	};
-	std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(mycompare)> pq(mycompare);
-	//add k items to pq
-	uint32_t i(0);
-	for(uint32_t s(keys().size()); i < s && pq.size() < k; ++i) {
-		if (keyExclusions(this->keys()[i])) {
+	using Order = IndirectRankOrder<std::vector<KeyInfo>, TCompare>;
+	TopKBuffer<uint32_t, Order> buffer(k, Order(&m_keyInfoStore, compare));
+	for(uint32_t i(0), s(m_keyInfoStore.size()); i < s; ++i) {
+		if (keyExclusions(m_keyInfoStore[i])) {
 			continue;
 		}
-		pq.emplace(i);
+		buffer.push(i);
 	}
-	//now add one and remove one
-	for(uint32_t s(keys().size()); i < s; ++i) {
-		if (keyExclusions(this->keys()[i])) {
-			continue;
-		}
-		pq.emplace(i);
-		pq.pop();
+	std::vector<uint32_t> result = buffer.result();
+	for(uint32_t & x : result) {
+		x = m_keyInfoStore[x].keyId;
 	}
-	//and retrieve them all, they are sorted from small to large, so inverse the mapping
-	std::vector<uint32_t> result(pq.size());
-	for(auto rit(result.rbegin()), rend(result.rend()); rit != rend; ++rit) {
-		*rit = m_keyInfoStore.at(pq.top()).keyId;
-		pq.pop();
-	}
-	SSERIALIZE_CHEAP_ASSERT_EQUAL(std::size_t(0), pq.size());
 	return result;
 }
 
 
 template<typename TCompare, typename TKeyExclusions, typename TKeyValueExclusions>
 std::vector<detail::KVStats::Stats::KeyValueInfo>
-detail::KVStats::Stats::topkv(uint32_t k, TCompare compare, TKeyExclusions keyExclusions, TKeyValueExclusions keyValueExclusions) const {
-	auto mycompare = [&compare](const KeyValueInfo & a, const KeyValueInfo & b) -> bool {
-		return ! compare(a, b);
-	};
-	std::priority_queue<KeyValueInfo, std::vector<KeyValueInfo>, decltype(mycompare)> pq(mycompare);
-	//add k items to pq
-	uint32_t i(0);
-	uint32_t j(0);
-	for(uint32_t s(keys().size()); i < s && pq.size() < k; ++i) {
-		const KeyInfo & ki = m_keyInfoStore[i];
-		if (keyExclusions(ki)) {
-			continue;
-		}
-		
-		uint32_t sj(ki.values.size());
-		for(; j < sj && pq.size() < k; ++j) {
-			if (keyValueExclusions(ki, ki.values[j])) {
+detail::KVStats::Stats::topkv(uint32_t k, TCompare compare, TKeyExclusions keyExclusions, TKeyValueExclusions keyValueExclusions, uint32_t threadCount) const {
+	using Order = RankOrder<TCompare>;
+	using Buffer = TopKBuffer<KeyValueInfo, Order>;
+	//number of keys fetched by a thread at once
+	constexpr uint32_t BlockSize = 256;
+	//starting a thread is only worth it if it has enough values to look at
+	constexpr std::size_t MinValuesPerThread = std::size_t(1) << 16;
+	
+	auto scan = [this, &keyExclusions, &keyValueExclusions](uint32_t keyBegin, uint32_t keyEnd, Buffer & buffer) {
+		for(uint32_t i(keyBegin); i < keyEnd; ++i) {
+			const KeyInfo & ki = m_keyInfoStore[i];
+			if (keyExclusions(ki)) {
 				continue;
 			}
-			pq.emplace(ki, ki.values[j]);
-		}
-		if (j < ki.values.size()) { //more to come below
-			break;
-		}
-		else {
-			j = 0;
-		}
-	}
-	//now add one and remove one
-	for(uint32_t s(keys().size()); i < s; ++i) {
-		const KeyInfo & ki = m_keyInfoStore[i];
-		if (keyExclusions(ki)) {
-			continue;
-		}
-		
-		for(uint32_t sj(ki.values.size()); j < sj; ++j) {
-			if (keyValueExclusions(ki, ki.values[j])) {
-				continue;
+			for(const ValueInfo & vi : ki.values) {
+				if (keyValueExclusions(ki, vi)) {
+					continue;
+				}
+				buffer.push(KeyValueInfo(ki, vi));
 			}
-			pq.emplace(ki, ki.values[j]);
-			pq.pop();
 		}
-		j = 0;
+	};
+	
+	uint32_t keyCount = m_keyInfoStore.size();
+	threadCount = uint32_t( std::min<std::size_t>(threadCount, m_valueInfoStore->size()/MinValuesPerThread) );
+	Buffer result(k, Order(compare));
+	if (threadCount <= 1) {
+		scan(0, keyCount, result);
 	}
-	//and retrieve them all, they are sorted from small to large, so inverse the mapping
-	std::vector<KeyValueInfo> result(pq.size());
-	for(auto rit(result.rbegin()), rend(result.rend()); rit != rend; ++rit) {
-		*rit = pq.top();
-		pq.pop();
+	else {
+		std::atomic<uint32_t> pos{0};
+		std::mutex lock;
+		sserialize::ThreadPool::execute([&]() {
+			Buffer buffer(k, Order(compare));
+			while (true) {
+				uint32_t p = pos.fetch_add(BlockSize, std::memory_order_relaxed);
+				if (p >= keyCount) {
+					break;
+				}
+				scan(p, std::min(p+BlockSize, keyCount), buffer);
+			}
+			std::lock_guard<std::mutex> lck(lock);
+			result.merge(std::move(buffer));
+		}, threadCount, sserialize::ThreadPool::CopyTaskTag());
 	}
-	SSERIALIZE_CHEAP_ASSERT_EQUAL(std::size_t(0), pq.size());
-	SSERIALIZE_NORMAL_ASSERT( std::is_sorted(result.begin(), result.end(), mycompare) );
-	return result;
+	return result.result();
 }
 
 }//end namespace liboscar
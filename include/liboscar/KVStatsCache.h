@@ -0,0 +1,106 @@
+#ifndef LIBOSCAR_KV_STATS_CACHE_H
+#define LIBOSCAR_KV_STATS_CACHE_H
+#include <liboscar/KVStats.h>
+#include <sserialize/spatial/CellQueryResult.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace liboscar {
+
+///Caches the KVStats of CellQueryResults across requests.
+///Entries are identified by a compact key of the cqr and evicted in lru order once the byte budget is exceeded.
+///The budget is charged for the stats and the key of every entry, the cqrs themselves are not kept.
+///All functions are thread-safe. Stats are computed outside of the lock,
+///concurrent misses on the same cqr may compute it more than once.
+class KVStatsCache final {
+public:
+	using Stats = KVStats::Stats;
+	using StatsPtr = std::shared_ptr<const Stats>;
+	///Identity of a CellQueryResult: its cells and a hash of its partial-match indexes.
+	///Partial-match indexes from the index store are hashed by their store id and size without decoding them,
+	///those computed by set operations are already in memory and are hashed by their items.
+	///dataset identifies the data the cqr was computed on, see OsmCompleter::datasetFingerprint().
+	struct Key {
+		uint64_t dataset{0};
+		uint64_t itemCount{0};
+		std::vector<uint32_t> cellIds;
+		std::vector<bool> fullMatch;
+		uint64_t partialMatches{0};
+		//hash of all of the above
+		uint64_t hash{0};
+		inline bool operator==(const Key & other) const {
+			return hash == other.hash && dataset == other.dataset && itemCount == other.itemCount &&
+				partialMatches == other.partialMatches && cellIds == other.cellIds && fullMatch == other.fullMatch;
+		}
+		inline bool operator!=(const Key & other) const { return !(*this == other); }
+		///memory used by the key in bytes
+		std::size_t byteSize() const;
+	};
+	///the default byte budget of 256 MiB holds the stats of a few hundred large result sets
+	static constexpr std::size_t DefaultByteBudget = std::size_t(1) << 28;
+public:
+	///@param dataset identity of the data of store, part of the keys of the cached entries
+	KVStatsCache(const Static::OsmKeyValueObjectStore & store, std::size_t byteBudget = DefaultByteBudget, uint64_t dataset = 0);
+	~KVStatsCache();
+public:
+	///@return stats of cqr, computed with threadCount threads on a cache miss
+	StatsPtr stats(const sserialize::CellQueryResult & cqr, uint32_t threadCount = 1);
+	///@return stats of the items of a that are not items of b
+	///If b is a subset of a (see subset()) this is stats(a) - stats(b) using the cached stats of a and b.
+	///Otherwise the stats of (a - b) are computed.
+	StatsPtr difference(const sserialize::CellQueryResult & a, const sserialize::CellQueryResult & b, uint32_t threadCount = 1);
+public:
+	static Key key(const sserialize::CellQueryResult & cqr, uint64_t dataset = 0);
+	///true iff every item of b is an item of a
+	///Decided cell by cell: cells of b have to be full-match cells of a or partial-match cells whose items are contained in a.
+	static bool subset(const sserialize::CellQueryResult & a, const sserialize::CellQueryResult & b);
+public:
+	void setByteBudget(std::size_t byteBudget);
+	std::size_t byteBudget() const;
+	inline uint64_t dataset() const { return m_dataset; }
+	///size of all cached entries in bytes
+	std::size_t byteSize() const;
+	std::size_t size() const;
+	std::size_t hits() const;
+	std::size_t misses() const;
+	void clear();
+private:
+	struct KeyPtrHash {
+		inline std::size_t operator()(const Key * key) const { return key->hash; }
+	};
+	struct KeyPtrEqual {
+		inline bool operator()(const Key * a, const Key * b) const { return *a == *b; }
+	};
+	struct Entry {
+		Key key;
+		StatsPtr stats;
+		std::size_t byteSize;
+	};
+	//most recently used entry first
+	using EntryList = std::list<Entry>;
+	//the key is stored in the entry, the map points to it
+	using EntryMap = std::unordered_map<const Key*, EntryList::iterator, KeyPtrHash, KeyPtrEqual>;
+private:
+	StatsPtr find(const Key & key);
+	StatsPtr insert(Key && key, Stats && stats);
+	///call with m_lock held
+	void evict();
+private:
+	KVStats m_kvstats;
+	uint64_t m_dataset;
+	mutable std::mutex m_lock;
+	std::size_t m_byteBudget;
+	std::size_t m_byteSize{0};
+	std::size_t m_hits{0};
+	std::size_t m_misses{0};
+	EntryList m_entries;
+	EntryMap m_entryMap;
+};
+
+}//end namespace liboscar
+
+#endif
@@ -4,53 +4,92 @@
 
 #include <unordered_map>
 #include <vector>
+#include <limits>
+#include <cmath>
+#include <atomic>
 #include "OsmKeyValueObjectStore.h"
 #include "KVClustering.h"
-#include <sserialize/containers/OADHashTable.h>
 
 namespace liboscar {
 namespace detail {
 namespace KoMaClustering {
-struct Data {
-	using KeyValue = std::pair<uint32_t, uint32_t>;
-	using KeyValueItemMap = sserialize::OADHashTable<KeyValue, std::vector<uint32_t>>;
-	KeyValueItemMap keyValueItemMap;
-	//const kvclustering::KeyExclusions &keyExclusions;
-	//const kvclustering::KeyValueExclusions &keyValueExclusions;
-	Data();
-	void update(const KeyValue &key, const uint32_t& itemId);
-};
+using KeyValue = std::pair<uint32_t, uint32_t>;
 
+///State of the second pass of KoMaClustering::preprocess()
+///Collects the item positions of a batch of key-value pairs into a single array (CSR layout)
 struct State {
 	const Static::OsmKeyValueObjectStore &store;
 	const sserialize::ItemIndex &items;
-	const kvclustering::KeyExclusions &keyExclusions;
-	const kvclustering::KeyValueExclusions &keyValueExclusions;
-	Data::KeyValueItemMap &keyValueItemMap;
-	std::vector<Data> d;
-	size_t numberOfThreads;
-	std::mutex m;
+	//sorted key-value pairs of this batch, packed by detail::KVStats::packKeyValue
+	const uint64_t * keyValuesBegin;
+	const uint64_t * keyValuesEnd;
+	//item positions of keyValuesBegin[i] are stored in itemPositions[offsets[i], offsets[i+1])
+	std::vector<uint64_t> offsets;
+	std::vector<uint32_t> itemPositions;
+	//number of item positions already stored per key-value pair
+	std::vector< std::atomic<uint32_t> > fill;
 	std::atomic<std::size_t> pos{0};
-	void merge();
+	///@param counts number of items of each key-value pair in [keyValuesBegin, keyValuesEnd)
 	State(const Static::OsmKeyValueObjectStore &store,
 		const sserialize::ItemIndex &items,
-		const kvclustering::KeyExclusions &keyExclusions,
-		const kvclustering::KeyValueExclusions &keyValueExclusions,
-		Data::KeyValueItemMap &keyValueItemMap,
-		size_t numberOfThreads);
+		const uint64_t * keyValuesBegin,
+		const uint64_t * keyValuesEnd,
+		const uint32_t * counts);
 };
 
 struct Worker {
 	//number of items to fetch at once
 	static constexpr std::size_t BlockSize = 1000;
-	//number of queued key-value pairs before flushing
-	static constexpr std::size_t FlushSize = BlockSize * 1000;
 	State * state;
-	Data d;
 	void operator()();
-	void flush();
 	Worker(State * state);
+	Worker(const Worker & other);
 };
+
+///Compressed set of item positions in the style of roaring bitmaps.
+///Positions are split into chunks by their upper 16 bits,
+///each chunk is stored either as a sorted array of the lower 16 bits or as a bitmap if it is dense.
+///Additionally keeps a bottom-k MinHash sketch to cheaply estimate the overlap of two sets.
+class ItemSet {
+public:
+	//chunks with more entries are stored as bitmap
+	static constexpr uint32_t MaxArraySize = 4096;
+	static constexpr uint32_t BitmapWords = (1 << 16)/64;
+	//number of hashes in the MinHash sketch
+	static constexpr uint32_t SketchSize = 64;
+public:
+	ItemSet() {}
+	///@param items sorted and unique
+	explicit ItemSet(const std::vector<uint32_t> & items);
+	///@param [begin, end) sorted and unique
+	ItemSet(const uint32_t * begin, const uint32_t * end);
+	inline uint32_t size() const { return m_size; }
+	///@return true iff the intersection of this and other has more than minNumber entries
+	///Uses the sketches to decide pairs that clearly do or do not intersect enough
+	bool hasIntersection(const ItemSet & other, const std::float_t & minNumber) const;
+	///@return size of the intersection of this and other, stops counting once it exceeds limit
+	uint32_t intersectionSize(const ItemSet & other, uint32_t limit = std::numeric_limits<uint32_t>::max()) const;
+	///Estimate of the jaccard index based on the sketches
+	double jaccard(const ItemSet & other) const;
+private:
+	struct Chunk {
+		uint32_t key; //upper 16 bits
+		uint32_t size;
+		uint32_t offset; //into m_values or m_words
+		inline bool bitmap() const { return size > MaxArraySize; }
+	};
+private:
+	uint32_t intersectionSize(const Chunk & a, const ItemSet & other, const Chunk & b, uint32_t limit) const;
+	static uint64_t hash(uint32_t item);
+private:
+	uint32_t m_size{0};
+	std::vector<Chunk> m_chunks;
+	std::vector<uint16_t> m_values;
+	std::vector<uint64_t> m_words;
+	//SketchSize smallest hash values of the items, sorted ascending
+	std::vector<uint64_t> m_sketch;
+};
+
 } // end namespace KoMaClustering
 } // end namespace detail
 
@@ -62,6 +101,8 @@ public:
 	using ValueInfo = kvclustering::ValueInfo;
 	using KeyValuePair = std::pair<uint32_t, uint32_t>;
 	using ValueCountPair = std::pair<uint32_t, uint32_t>;
+	//default batch size in bytes of the item position array of preprocess(), see setMemoryLimit()
+	static constexpr std::size_t DefaultMemoryLimit = std::size_t(1) << 30;
 public:
 	KoMaClustering(const Static::OsmKeyValueObjectStore &store,
 			sserialize::ItemIndex &items,
@@ -76,15 +117,26 @@ private:
 	const sserialize::ItemIndex &items;
 	kvclustering::KeyExclusions &keyExclusions;
 	kvclustering::KeyValueExclusions &keyValueExclusions;
-	using KeyValueCountVec = std::vector<std::pair<detail::KoMaClustering::Data::KeyValue, uint32_t>>;
-	detail::KoMaClustering::Data::KeyValueItemMap keyValueItemMap;
+	using KeyValueCountVec = std::vector<std::pair<detail::KoMaClustering::KeyValue, uint32_t>>;
 	KeyValueCountVec keyValueCountVec;
 	KeyValueCountVec keyValueCountVecSortedByIds;
+	//item sets of the entries of keyValueCountVec
+	std::vector<detail::KoMaClustering::ItemSet> itemSets;
 	uint32_t threadCount;
+	std::size_t memoryLimit{DefaultMemoryLimit};
 
 	void sort();
 public:
+	///Computes the item sets of all key-value pairs in two passes over the items:
+	///The first pass counts the key-value pairs, the second one collects their item positions.
+	///If the item positions need more than memoryLimit bytes, the second pass is repeated for batches of key-value pairs
 	void preprocess() override;
+	///Batch size in bytes of the uncompressed item position array (CSR) of the second pass of preprocess()
+	///This is not a bound on the total memory used by preprocess(), it does not cover
+	///the key-value counts of the first pass (about 12 bytes per distinct key-value pair),
+	///the compressed item sets that are the result of preprocess(),
+	///and a single key-value pair with more items than fit into a batch, which is processed as a batch of its own.
+	inline void setMemoryLimit(std::size_t bytes) { memoryLimit = bytes; }
 
 	std::vector<std::pair<uint32_t, std::list<std::pair<uint32_t, uint32_t>>>> facets(uint32_t k, std::map<std::uint32_t, std::uint32_t> dynFacetSize, std::uint32_t defaultFacetSize);
 
@@ -0,0 +1,106 @@
+#ifndef LIBOSCAR_MEMORY_POLICY_H
+#define LIBOSCAR_MEMORY_POLICY_H
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <liboscar/AccessProfile.h>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace liboscar {
+
+/** Decides how the data files of an OsmCompleter are held in memory.
+  * A policy decides for each file whether it is memory mapped, memory mapped in chunks on demand or copied to program memory.
+  * In addition sections of a file may be locked into memory (mlock) or backed by huge pages (MADV_HUGEPAGE).
+  * Sections only apply to files that are directly addressable, i.e. uncompressed and not chunked.
+  */
+class MemoryPolicy {
+public:
+	enum Placement : uint32_t {
+		///memory map the whole file and leave it to the page cache
+		MP_MMAP=0,
+		///memory map the file in chunks on demand, uses little address space
+		MP_CHUNKED=1,
+		///copy the file to program memory
+		MP_IN_MEMORY=2
+	};
+	///range of a file whose pages are locked into memory and/or backed by huge pages
+	struct Section {
+		uint64_t offset;
+		uint64_t size;
+		bool lock;
+		bool hugePages;
+	};
+	struct FileInfo {
+		uint32_t fc;
+		uint64_t size;
+		bool compressed;
+	};
+	struct Decision {
+		Placement placement{MP_MMAP};
+		std::vector<Section> sections;
+	};
+	///outcome of applying a Decision to a file
+	struct Report {
+		uint32_t fc{0};
+		uint64_t size{0};
+		Placement placement{MP_MMAP};
+		uint64_t lockedBytes{0};
+		uint64_t hugePageBytes{0};
+		///bytes of sections that could not be locked or advised, see RLIMIT_MEMLOCK
+		uint64_t failedBytes{0};
+	};
+public:
+	MemoryPolicy() {}
+	virtual ~MemoryPolicy() {}
+	///@param files the files in the order of their importance
+	///@return one decision per file
+	virtual std::vector<Decision> decide(const std::vector<FileInfo> & files) const = 0;
+public:
+	///physical memory of the machine, 0 if unknown
+	static uint64_t physicalMemory();
+	///memory limit of the cgroup (v2 or v1) of this process, 0 if there is none
+	static uint64_t cgroupMemoryLimit();
+	///the smaller one of physicalMemory() and cgroupMemoryLimit(), 0 if both are unknown
+	static uint64_t availableMemory();
+	///address space usable for full memory maps
+	static uint64_t addressSpace();
+	static std::string toString(Placement p);
+	///@return copy of data in program memory, backed by huge pages if hugePages is set and they are available
+	static sserialize::UByteArrayAdapter copyToMemory(const sserialize::UByteArrayAdapter & data, bool hugePages);
+	///Lock and advise the sections of decision, data has to be the data of file fc opened according to decision
+	static Report apply(uint32_t fc, const sserialize::UByteArrayAdapter & data, const Decision & decision);
+	static std::ostream & printStats(std::ostream & out, const std::vector<Report> & reports);
+};
+
+/** Budget based memory policy.
+  * Files are handled in order of their importance:
+  * Uncompressed files are copied to program memory while they fit into the in-memory budget.
+  * The remaining files are fully memory mapped while they fit into addressSpace(), the others are memory mapped in chunks.
+  * The hottest ranges of an AccessProfile are locked into memory up to the lock budget.
+  * Without any budgets set this is the behaviour of OsmCompleter before memory policies existed.
+  */
+class DefaultMemoryPolicy: public MemoryPolicy {
+public:
+	DefaultMemoryPolicy();
+	virtual ~DefaultMemoryPolicy();
+	///Force the placement of file fc, files copied to memory in this way do not count against the in-memory budget
+	void setPlacement(uint32_t fc, Placement p);
+	///budget for files copied to memory, capped at half of availableMemory(), 0 disables copying
+	void setInMemoryBudget(uint64_t budget);
+	///Lock the ranges in hotRanges in the given order up to budget bytes, budget is capped at half of availableMemory()
+	void setLockBudget(uint64_t budget, const std::vector<AccessProfile::Range> & hotRanges);
+	///Back files copied to memory by huge pages
+	void setHugePages(bool enable);
+	virtual std::vector<Decision> decide(const std::vector<FileInfo> & files) const override;
+private:
+	std::unordered_map<uint32_t, Placement> m_placements;
+	uint64_t m_inMemoryBudget{0};
+	uint64_t m_lockBudget{0};
+	std::vector<AccessProfile::Range> m_hotRanges;
+	bool m_hugePages{false};
+};
+
+}//end namespace liboscar
+
+#endif
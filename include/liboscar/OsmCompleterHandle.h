@@ -0,0 +1,75 @@
+#ifndef LIBOSCAR_OSM_COMPLETER_HANDLE_H
+#define LIBOSCAR_OSM_COMPLETER_HANDLE_H
+#include <liboscar/StaticOsmCompleter.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace liboscar {
+namespace Static {
+
+/** Read-copy-update handle of an OsmCompleter that allows to replace the data set without downtime.
+  * Queries take a snapshot with get() and use it from start to end.
+  * A new completer is energized while the current one serves queries and is then published atomically.
+  * The old completer and its data files are released once the last snapshot of it is released.
+  *
+  * Everything derived from a snapshot (item sets, stores, cqrs) has to be released before the snapshot,
+  * this is required if LIBOSCAR_NO_DATA_REFCOUNTING is set since the data of the completer is then not reference counted.
+  * Caches that outlive a snapshot have to include OsmCompleter::datasetFingerprint() in their keys.
+  *
+  * All functions are thread-safe.
+  */
+class OsmCompleterHandle final {
+public:
+	using CompleterPtr = std::shared_ptr<OsmCompleter>;
+	using Configurator = std::function<void(OsmCompleter &)>;
+public:
+	OsmCompleterHandle();
+	OsmCompleterHandle(const CompleterPtr & completer);
+	~OsmCompleterHandle();
+	OsmCompleterHandle(const OsmCompleterHandle & other) = delete;
+	OsmCompleterHandle & operator=(const OsmCompleterHandle & other) = delete;
+	///@return the current completer, may be empty if nothing was published
+	CompleterPtr get() const;
+	///number of published completers
+	inline uint64_t version() const { return m_version.load(std::memory_order_acquire); }
+	///Replace the current completer by completer
+	void publish(const CompleterPtr & completer);
+	///Create a completer for the files in filesDir, energize and publish it.
+	///Loads are serialized, the current completer serves queries in the meantime.
+	///@param prepare called before energize(), e.g. to set a memory policy
+	///@param finish called after energize() and before the completer is published, e.g. to set up caches
+	///@return false if the completer could not be energized, the current completer is kept in this case
+	bool load(
+		const std::string & filesDir,
+		sserialize::spatial::GeoHierarchySubGraph::Type ghsgType,
+		uint32_t threadCount,
+		const Configurator & prepare = Configurator(),
+		const Configurator & finish = Configurator()
+	);
+	///load() in a new detached thread
+	///The future may be dropped without blocking, the destructor waits for loads that are still running.
+	std::future<bool> loadAsync(
+		const std::string & filesDir,
+		sserialize::spatial::GeoHierarchySubGraph::Type ghsgType,
+		uint32_t threadCount,
+		const Configurator & prepare = Configurator(),
+		const Configurator & finish = Configurator()
+	);
+private:
+	CompleterPtr m_completer;
+	std::atomic<uint64_t> m_version{0};
+	std::mutex m_loadLock;
+	//loads started by loadAsync() that did not finish yet
+	std::mutex m_asyncLock;
+	std::condition_variable m_asyncDone;
+	uint32_t m_asyncLoads{0};
+};
+
+}}//end namespace liboscar::Static
+
+#endif
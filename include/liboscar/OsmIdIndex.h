@@ -0,0 +1,75 @@
+#ifndef LIBOSCAR_OSM_ID_INDEX_H
+#define LIBOSCAR_OSM_ID_INDEX_H
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <liboscar/OsmIdType.h>
+#include <liboscar/Sidecar.h>
+#define LIBOSCAR_OSM_ID_INDEX_VERSION 2
+
+namespace liboscar {
+namespace Static {
+
+class OsmKeyValueObjectStore;
+
+/** Maps OsmIdType to the item id of an OsmKeyValueObjectStore.
+  * This is a sidecar to the kvstore, lookups take O(log n) using an Eytzinger layout (BFS order of the implicit search tree).
+  *
+  * Storage layout
+  *
+  * {
+  *   VERSION       u8
+  *   SIZE          u32
+  *   BYTE_ORDER    u32, see sidecar::ByteOrderMark
+  *   KEYS          int64[SIZE+1], OsmIdType::raw() in Eytzinger order, KEYS[k] is node k of the 1-based tree, KEYS[0] is unused
+  *   ITEM_IDS      u32[SIZE], ITEM_IDS[k-1] is the item id of KEYS[k]
+  * }
+  *
+  * KEYS and ITEM_IDS start at offsets that are a multiple of 64 and are stored in native byte order.
+  * With the unused KEYS[0] the 8 descendants 3 levels below node k, KEYS[8k..8k+7], are a single cache line.
+  * If multiple items share an osm id then the smallest item id is stored.
+  */
+class OsmIdIndex final {
+public:
+	static constexpr uint32_t npos = 0xFFFFFFFF;
+public:
+	OsmIdIndex();
+	///throws sserialize::CorruptDataException if data is invalid
+	OsmIdIndex(const sserialize::UByteArrayAdapter & data);
+	~OsmIdIndex();
+	inline bool valid() const { return m_keys; }
+	inline uint32_t size() const { return m_size; }
+	sserialize::UByteArrayAdapter::OffsetType getSizeInBytes() const;
+public:
+	///@return item id of osmIdType or npos if there is none
+	inline uint32_t find(const OsmIdType & osmIdType) const {
+		//1-based index into the implicit tree
+		uint64_t k = 1;
+		int64_t key = osmIdType.raw();
+		while (k <= m_size) {
+			//descendants 3 levels below share a cache line
+			__builtin_prefetch(m_keys + k*8);
+			k = 2*k + (m_keys[k] < key);
+		}
+		//undo the right turns after the last left turn, k is then the lower bound
+		k >>= __builtin_ffsll(~k);
+		if (k && m_keys[k] == key) {
+			return m_itemIds[k-1];
+		}
+		return npos;
+	}
+	///result[i] = find(osmIdTypes[i])
+	///The searches of blocks of ids are interleaved to hide memory latency.
+	void find(const OsmIdType * osmIdTypes, uint32_t count, uint32_t * result) const;
+public:
+	///Serialize the index of the items of store to dest
+	///@return offset of the index in dest
+	static sserialize::UByteArrayAdapter::OffsetType create(const OsmKeyValueObjectStore & store, sserialize::UByteArrayAdapter & dest, uint32_t threadCount);
+private:
+	uint32_t m_size{0};
+	sidecar::View m_view;
+	const int64_t * m_keys{nullptr};
+	const uint32_t * m_itemIds{nullptr};
+};
+
+}}//end namespace liboscar::Static
+
+#endif
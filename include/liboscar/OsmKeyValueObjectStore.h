@@ -11,6 +11,16 @@
 #include <sserialize/iterator/TransformIterator.h>
 #include <liboscar/constants.h>
 #include <liboscar/OsmIdType.h>
+#include <liboscar/OsmKeyValueObjectStoreColumns.h>
+#include <liboscar/OsmIdIndex.h>
+#include <liboscar/ItemRTree.h>
+#include <liboscar/CompressedGeometry.h>
+#include <liboscar/SimplifiedGeometryStore.h>
+#include <liboscar/SpatialPayloadStore.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #define LIBOSCAR_OSM_KEY_VALUE_OBJECT_STORE_VERSION 7
 
 namespace liboscar {
@@ -77,6 +87,96 @@ public:
 	inline uint32_t score() const { return m_score; }
 	inline sserialize::BoundedCompactUintArray cells() const { return m_cells; }
 };
+
+///Flat result buffer of OsmKeyValueObjectStore::items()
+///Entry i belongs to the i-th item of the requested index, only the requested fields are filled.
+///Key-value pairs and cells are stored as compressed rows: the data of entry i is in [offsets[i], offsets[i+1])
+class OsmKeyValueObjectStoreItemBatch {
+public:
+	enum Fields : uint32_t {
+		F_NONE=0x0,
+		F_OSM_ID=0x1,
+		F_SCORE=0x2,
+		F_SHAPE_TYPE=0x4,
+		F_BOUNDARY=0x8,
+		F_KEY_VALUES=0x10,
+		F_CELLS=0x20,
+		F_ALL=0x3F
+	};
+	struct KeyValue {
+		uint32_t keyId;
+		uint32_t valueId;
+	};
+public:
+	OsmKeyValueObjectStoreItemBatch() {}
+	~OsmKeyValueObjectStoreItemBatch() {}
+	inline uint32_t size() const { return (uint32_t) itemIds.size(); }
+	inline bool has(Fields f) const { return fields & f; }
+	void clear();
+public:
+	uint32_t fields{F_NONE};
+	std::vector<uint32_t> itemIds;
+	std::vector<OsmIdType> osmIdTypes;
+	std::vector<uint32_t> scores;
+	std::vector<sserialize::spatial::GeoShapeType> shapeTypes;
+	std::vector<sserialize::spatial::GeoRect> boundaries;
+	std::vector<uint32_t> keyValueOffsets;
+	std::vector<KeyValue> keyValues;
+	std::vector<uint32_t> cellOffsets;
+	std::vector<uint32_t> cells;
+};
+
+///Sharded LRU cache of decoded payloads (and thereby of the shape views) of an OsmKeyValueObjectStore
+///Every shard has its own lock and an equal share of the byte budget.
+///The cost of an entry is its bookkeeping (entry, list node and hash node). The payload data are views
+///into the memory of the store and are not charged, hence the budget effectively limits the number of entries.
+///Hits only mark an entry as referenced, referenced entries get a second chance on eviction (CLOCK) instead of
+///being moved to the front of the list on every hit.
+class OsmKeyValueObjectStorePayloadCache final {
+public:
+	struct ShardStats {
+		uint64_t hits{0};
+		uint64_t misses{0};
+		uint64_t evictions{0};
+		uint64_t entries{0};
+		uint64_t bytes{0};
+	};
+public:
+	///@param shardCount is rounded up to a power of 2
+	OsmKeyValueObjectStorePayloadCache(uint64_t byteBudget, uint32_t shardCount);
+	~OsmKeyValueObjectStorePayloadCache();
+	inline uint64_t byteBudget() const { return m_byteBudget; }
+	inline uint32_t shardCount() const { return m_shardMask+1; }
+	///@return true and sets payload if itemPos is cached
+	bool get(uint32_t itemPos, OsmKeyValueObjectStorePayload & payload);
+	void put(uint32_t itemPos, const OsmKeyValueObjectStorePayload & payload);
+	void clear();
+	std::vector<ShardStats> stats() const;
+private:
+	struct Entry {
+		uint32_t itemPos;
+		bool referenced;
+		OsmKeyValueObjectStorePayload payload;
+	};
+	typedef std::list<Entry> EntryList;
+	//aligned to keep the locks of neighboring shards on separate cache lines
+	struct alignas(64) Shard {
+		std::mutex lock;
+		//most recently inserted or given a second chance first
+		EntryList lru;
+		std::unordered_map<uint32_t, EntryList::iterator> entries;
+		ShardStats stats;
+	};
+private:
+	inline Shard & shard(uint32_t itemPos) { return m_shards[(itemPos * 0x9E3779B1u) >> 16 & m_shardMask]; }
+	//entry, list node, hash node and bucket
+	static constexpr uint64_t EntryBytes = sizeof(Entry) + 4*sizeof(void*);
+private:
+	uint64_t m_byteBudget;
+	uint64_t m_shardBudget;
+	uint32_t m_shardMask;
+	std::unique_ptr<Shard[]> m_shards;
+};
   
 class OsmKeyValueObjectStore {
 public:
@@ -136,10 +236,12 @@ public:
 
 	sserialize::ItemIndex complete(const sserialize::spatial::GeoRect & rect, bool approximate) const;
 	sserialize::ItemIndex filter(const sserialize::spatial::GeoRect & rect, bool approximate, const sserialize::ItemIndex & partner) const;
+	///@return the first maxResultSize items of partner that match rect
+	sserialize::ItemIndex filter(const sserialize::spatial::GeoRect & rect, bool approximate, const sserialize::ItemIndex & partner, uint32_t maxResultSize) const;
 	sserialize::ItemIndexIterator filter(const sserialize::spatial::GeoRect & rect, bool approximate, const sserialize::ItemIndexIterator & partner) const;
 	
-	///expensive operation
-	sserialize::spatial::GeoRect boundary() const;
+	///O(1) if the store has an rtree, otherwise the items are scanned once with threadCount threads and the result is cached
+	sserialize::spatial::GeoRect boundary(uint32_t threadCount = 1) const;
 	
 	/** checks if any point of the item lies within boundary */
 	bool match(uint32_t itemPos, const sserialize::spatial::GeoRect & boundary) const;
@@ -147,16 +249,70 @@ public:
 	uint32_t geoPointCount(uint32_t itemPos) const;
 	sserialize::Static::spatial::GeoPoint geoPointAt(uint32_t itemPos, uint32_t pos) const;
 	sserialize::Static::spatial::GeoShape geoShape(uint32_t itemPos) const;
+	///@return the coarsest simplification of the shape whose points are at most tolerance degrees off
+	///returns geoShape(itemPos) if there is no such simplification, see SimplifiedGeometryStore
+	sserialize::Static::spatial::GeoShape geoShape(uint32_t itemPos, double tolerance) const;
 	
 	int64_t osmId(uint32_t itemPos) const;
 	uint32_t score(uint32_t itemPos) const;
 	bool isRegion(uint32_t itemPos) const;
 	sserialize::BoundedCompactUintArray cells(uint32_t itemPos) const;
 	OsmKeyValueObjectStorePayload payload(uint32_t itemPos) const;
+	///@return the serialized payload of the item
+	sserialize::UByteArrayAdapter payloadData(uint32_t itemPos) const;
+	///Decode the given fields (OsmKeyValueObjectStoreItemBatch::Fields) of all items of idx into out
+	///Items are decoded in storage order with prefetching, which is much faster than calling at() for each item
+	void items(const sserialize::ItemIndex & idx, uint32_t fields, OsmKeyValueObjectStoreItemBatch & out) const;
+	
+	///Attach the columnar sidecar of this store, see OsmKeyValueObjectStoreColumns
+	///osmId(), score(), geoShapeType() and match(itemPos, rect) use it if it is valid
+	///throws sserialize::CorruptDataException if the size of columns does not match
+	void setColumns(const OsmKeyValueObjectStoreColumns & columns);
+	const OsmKeyValueObjectStoreColumns & columns() const;
+	
+	///Attach the osm id index of this store, see OsmIdIndex
+	///throws sserialize::CorruptDataException if the index has more entries than the store
+	void setOsmIdIndex(const OsmIdIndex & index);
+	const OsmIdIndex & osmIdIndex() const;
+	///@return the item id of the item with the given osm id and type or npos if there is none
+	///O(log n) with an osm id index, otherwise all items are scanned
+	uint32_t findByOsmId(const OsmIdType & osmIdType) const;
+	uint32_t findByOsmId(liboscar::OsmItemTypes type, int64_t osmId) const;
+	///result[i] = findByOsmId(osmIdTypes[i]), scans the store at most once if there is no osm id index
+	std::vector<uint32_t> findByOsmId(const std::vector<OsmIdType> & osmIdTypes) const;
+	
+	///Attach the spatial index of this store, see ItemRTree
+	///complete(rect) and filter(rect, ...) use it if it is valid
+	void setRTree(const ItemRTree & rtree);
+	const ItemRTree & rtree() const;
+	
+	///Attach the compressed geometries of this store, see CompressedGeometryStore
+	///spatial queries test shapes on the compressed geometries if they are valid
+	///throws sserialize::CorruptDataException if the size of geometries does not match
+	void setCompressedGeometry(const CompressedGeometryStore & geometries);
+	const CompressedGeometryStore & compressedGeometry() const;
+	
+	///Attach the simplified shapes of this store used by geoShape(itemPos, tolerance)
+	///throws sserialize::CorruptDataException if the size of geometries does not match
+	void setSimplifiedGeometry(const SimplifiedGeometryStore & geometries);
+	const SimplifiedGeometryStore & simplifiedGeometry() const;
 	
-	std::ostream & printStats(std::ostream & out) const;
+	///Attach a copy of the payloads in spatial order, payloads are read from it if it is valid
+	///throws sserialize::CorruptDataException if the size of payloads does not match
+	void setSpatialPayloads(const SpatialPayloadStore & payloads);
+	const SpatialPayloadStore & spatialPayloads() const;
 	
-	bool sanityCheck() const;
+	///Cache decoded payloads with up to byteBudget bytes of bookkeeping, a budget of 0 disables the cache
+	///The cache is replaced atomically, queries that are running keep using the old cache until they finish
+	void setPayloadCache(uint64_t byteBudget, uint32_t shardCount = 16);
+	///@return per shard statistics of the payload cache, empty if it is disabled
+	std::vector<OsmKeyValueObjectStorePayloadCache::ShardStats> payloadCacheStats() const;
+	///Load the payloads of itemIds into the cache, invalid ids are skipped
+	void warmPayloadCache(const std::vector<uint32_t> & itemIds) const;
+	
+	std::ostream & printStats(std::ostream & out, uint32_t threadCount = 1) const;
+	
+	bool sanityCheck(uint32_t threadCount = 1) const;
 	
 public: //dummy functions
 	sserialize::ItemIndex complete(const std::string & str, sserialize::StringCompleter::QuerryType qtype) const;
@@ -221,6 +377,7 @@ public:
 	inline bool match(const sserialize::spatial::GeoRect & boundary) const { return m_db.match(m_id,boundary); }
 	inline sserialize::spatial::GeoShapeType geoShapeType() const { return db().geoShapeType(id()); }
 	inline sserialize::Static::spatial::GeoShape geoShape() const { return db().geoShape(id()); }
+	inline sserialize::Static::spatial::GeoShape geoShape(double tolerance) const { return db().geoShape(id(), tolerance); }
 	inline uint32_t geoPointCount() const { return db().geoPointCount(id()); }
 	inline sserialize::Static::spatial::GeoPoint geoPointAt(uint32_t pos) const { return db().geoPointAt(id(), pos); }
 	inline OsmKeyValueObjectStorePayload payload() const { return m_db.payload(id()); }
@@ -248,7 +405,20 @@ private:
 	sserialize::Static::spatial::TriangulationGeoHierarchyArrangement m_ra;
 	sserialize::Static::spatial::TracGraph m_cg;
 	sserialize::Static::Array<sserialize::Static::spatial::GeoPoint> m_ccm;
+	OsmKeyValueObjectStoreColumns m_columns;
+	OsmIdIndex m_osmIdIndex;
+	ItemRTree m_rtree;
+	CompressedGeometryStore m_geometry;
+	SimplifiedGeometryStore m_simplifiedGeometry;
+	SpatialPayloadStore m_spatialPayloads;
+	//only accessed with std::atomic_load/std::atomic_store, see payloadCache()
+	std::shared_ptr<OsmKeyValueObjectStorePayloadCache> m_payloadCache;
+	mutable std::once_flag m_boundaryFlag;
+	mutable sserialize::spatial::GeoRect m_boundary;
 	uint32_t m_size;
+private:
+	///exact intersection test of the shape of the item, uses the compressed geometries if available
+	bool shapeIntersects(uint32_t itemPos, const sserialize::spatial::GeoRect & rect) const;
 public:
 	OsmKeyValueObjectStorePrivate(const sserialize::UByteArrayAdapter & data);
 	OsmKeyValueObjectStorePrivate();
@@ -268,7 +438,9 @@ public:
 	sserialize::Static::KeyValueObjectStoreItem kvItem(uint32_t pos) const;
 	
 	sserialize::ItemIndex complete(const sserialize::spatial::GeoRect & rect) const;
-	sserialize::ItemIndex filter(const sserialize::spatial::GeoRect & rect, bool approximate, const sserialize::ItemIndex & partner) const;
+	///Tests the bounding boxes of blocks of items using the columns if available,
+	///only items whose bounding box intersects but is not contained in rect are tested with their shape
+	sserialize::ItemIndex filter(const sserialize::spatial::GeoRect & rect, bool approximate, const sserialize::ItemIndex & partner, uint32_t maxResultSize) const;
 	
 	bool match(uint32_t pos, const std::pair< std::string, sserialize::StringCompleter::QuerryType > & querry) const;
 	sserialize::StringCompleter::SupportedQuerries getSupportedQuerries() const;
@@ -281,14 +453,38 @@ public:
 	sserialize::Static::spatial::GeoPoint geoPointAt(uint32_t itemPos, uint32_t pos) const;
 	
 	sserialize::Static::spatial::GeoShape geoShapeAt(uint32_t itemPos) const;
+	sserialize::Static::spatial::GeoShape geoShapeAt(uint32_t itemPos, double tolerance) const;
 	
 	int64_t osmId(uint32_t itemPos) const;
 	uint32_t score(uint32_t itemPos) const;
 	bool isRegion(uint32_t itemPos) const;
 	sserialize::BoundedCompactUintArray cells(uint32_t itemPos) const;
 	OsmKeyValueObjectStorePayload payload(uint32_t itemPos) const;
-
-	std::ostream & printStats(std::ostream & out) const;
+	///from the spatial payloads if available
+	sserialize::UByteArrayAdapter payloadData(uint32_t itemPos) const;
+	void items(const sserialize::ItemIndex & idx, uint32_t fields, OsmKeyValueObjectStoreItemBatch & out) const;
+	
+	void setColumns(const OsmKeyValueObjectStoreColumns & columns);
+	inline const OsmKeyValueObjectStoreColumns & columns() const { return m_columns; }
+	void setOsmIdIndex(const OsmIdIndex & index);
+	inline const OsmIdIndex & osmIdIndex() const { return m_osmIdIndex; }
+	uint32_t findByOsmId(const OsmIdType & osmIdType) const;
+	std::vector<uint32_t> findByOsmId(const std::vector<OsmIdType> & osmIdTypes) const;
+	void setRTree(const ItemRTree & rtree);
+	inline const ItemRTree & rtree() const { return m_rtree; }
+	void setCompressedGeometry(const CompressedGeometryStore & geometries);
+	inline const CompressedGeometryStore & compressedGeometry() const { return m_geometry; }
+	void setSimplifiedGeometry(const SimplifiedGeometryStore & geometries);
+	inline const SimplifiedGeometryStore & simplifiedGeometry() const { return m_simplifiedGeometry; }
+	void setSpatialPayloads(const SpatialPayloadStore & payloads);
+	inline const SpatialPayloadStore & spatialPayloads() const { return m_spatialPayloads; }
+	void setPayloadCache(uint64_t byteBudget, uint32_t shardCount);
+	///payload() may run concurrently with setPayloadCache(), use a snapshot of the cache
+	inline std::shared_ptr<OsmKeyValueObjectStorePayloadCache> payloadCache() const { return std::atomic_load_explicit(&m_payloadCache, std::memory_order_acquire); }
+	
+	sserialize::spatial::GeoRect boundary(uint32_t threadCount) const;
+	bool sanityCheck(uint32_t threadCount) const;
+	std::ostream & printStats(std::ostream & out, uint32_t threadCount) const;
 };
 
 namespace detail {
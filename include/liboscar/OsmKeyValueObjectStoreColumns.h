@@ -0,0 +1,117 @@
+#ifndef LIBOSCAR_OSM_KEY_VALUE_OBJECT_STORE_COLUMNS_H
+#define LIBOSCAR_OSM_KEY_VALUE_OBJECT_STORE_COLUMNS_H
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <sserialize/spatial/GeoRect.h>
+#include <sserialize/spatial/GeoShape.h>
+#include <liboscar/OsmIdType.h>
+#include <liboscar/Sidecar.h>
+#include <cmath>
+#define LIBOSCAR_OSM_KEY_VALUE_OBJECT_STORE_COLUMNS_VERSION 1
+
+namespace liboscar {
+namespace Static {
+
+class OsmKeyValueObjectStore;
+
+/** Fixed-width columns of frequently accessed payload fields of an OsmKeyValueObjectStore.
+  * This is a sidecar to the kvstore, items are ordered by their position in the store (not their internalId).
+  * Reading a field is O(1) without decoding the variable length payload.
+  *
+  * Storage layout
+  *
+  * {
+  *   VERSION       u8
+  *   SIZE          u32
+  *   BYTE_ORDER    u32, see sidecar::ByteOrderMark
+  *   OSM_ID_TYPE   int64[SIZE], OsmIdType::raw()
+  *   SCORE         u32[SIZE]
+  *   SHAPE_TYPE    u8[SIZE], sserialize::spatial::GeoShapeType
+  *   MIN_LAT       int32[SIZE]
+  *   MAX_LAT       int32[SIZE]
+  *   MIN_LON       int32[SIZE]
+  *   MAX_LON       int32[SIZE]
+  * }
+  *
+  * Columns are stored in native byte order and start at offsets that are a multiple of sidecar::Alignment.
+  * Bounding boxes are quantized to 1e-7 degrees and rounded outwards, hence they contain the exact bounding box.
+  * Items without a shape have an empty bounding box (min > max).
+  */
+class OsmKeyValueObjectStoreColumns final {
+public:
+	static constexpr double CoordinateScale = 1e7;
+	///Bounding boxes as structure of arrays
+	struct BBoxColumns {
+		const int32_t * minLat{nullptr};
+		const int32_t * maxLat{nullptr};
+		const int32_t * minLon{nullptr};
+		const int32_t * maxLon{nullptr};
+	};
+	///Result of testing an item against a rectangle using its bounding box only
+	enum MatchResult { MR_DISJOINT=0, MR_UNDECIDED=1, MR_CONTAINED=2 };
+	///Rectangle quantized inwards, hence tests of quantized bounding boxes against it are conservative
+	struct QuantizedRect {
+		int32_t minLat;
+		int32_t maxLat;
+		int32_t minLon;
+		int32_t maxLon;
+		QuantizedRect(const sserialize::spatial::GeoRect & rect);
+	};
+public:
+	OsmKeyValueObjectStoreColumns();
+	///throws sserialize::CorruptDataException if data is invalid
+	OsmKeyValueObjectStoreColumns(const sserialize::UByteArrayAdapter & data);
+	~OsmKeyValueObjectStoreColumns();
+	inline bool valid() const { return m_osmIdTypes; }
+	inline uint32_t size() const { return m_size; }
+	sserialize::UByteArrayAdapter::OffsetType getSizeInBytes() const;
+public:
+	inline OsmIdType osmIdType(uint32_t itemPos) const { return OsmIdType(m_osmIdTypes[itemPos]); }
+	inline int64_t osmId(uint32_t itemPos) const { return osmIdType(itemPos).id(); }
+	inline uint32_t score(uint32_t itemPos) const { return m_scores[itemPos]; }
+	inline sserialize::spatial::GeoShapeType geoShapeType(uint32_t itemPos) const {
+		return sserialize::spatial::GeoShapeType(m_shapeTypes[itemPos]);
+	}
+	inline const BBoxColumns & bboxes() const { return m_bboxes; }
+	///@return the quantized bounding box of the item, which is invalid if the item has no shape
+	sserialize::spatial::GeoRect boundary(uint32_t itemPos) const;
+	///Decides rect tests that do not need the shape of the item
+	///MR_DISJOINT if the bounding box of the item does not intersect rect, MR_CONTAINED if it is within rect
+	inline MatchResult match(uint32_t itemPos, const QuantizedRect & rect) const {
+		int32_t minLat = m_bboxes.minLat[itemPos];
+		int32_t maxLat = m_bboxes.maxLat[itemPos];
+		int32_t minLon = m_bboxes.minLon[itemPos];
+		int32_t maxLon = m_bboxes.maxLon[itemPos];
+		if (minLat > maxLat || maxLat < rect.minLat || minLat > rect.maxLat || maxLon < rect.minLon || minLon > rect.maxLon) {
+			return MR_DISJOINT;
+		}
+		if (rect.minLat <= minLat && maxLat <= rect.maxLat && rect.minLon <= minLon && maxLon <= rect.maxLon) {
+			return MR_CONTAINED;
+		}
+		return MR_UNDECIDED;
+	}
+	inline MatchResult match(uint32_t itemPos, const sserialize::spatial::GeoRect & rect) const {
+		return match(itemPos, QuantizedRect(rect));
+	}
+	///Batch version of match(), result[i] = match(itemPos[i], rect)
+	///Uses AVX-512 or AVX2 if supported by the cpu
+	void match(const uint32_t * itemPos, uint32_t count, const QuantizedRect & rect, uint8_t * result) const;
+	///like the batch version of match() but always uses the portable implementation
+	void matchScalar(const uint32_t * itemPos, uint32_t count, const QuantizedRect & rect, uint8_t * result) const;
+public:
+	static inline int32_t quantizeLower(double coord) { return int32_t(std::floor(coord*CoordinateScale)); }
+	static inline int32_t quantizeUpper(double coord) { return int32_t(std::ceil(coord*CoordinateScale)); }
+	///Serialize the columns of store to dest
+	///@return offset of the columns in dest
+	static sserialize::UByteArrayAdapter::OffsetType create(const OsmKeyValueObjectStore & store, sserialize::UByteArrayAdapter & dest, uint32_t threadCount);
+private:
+	uint32_t m_size{0};
+	sidecar::View m_view;
+	const int64_t * m_osmIdTypes{nullptr};
+	const uint32_t * m_scores{nullptr};
+	const uint8_t * m_shapeTypes{nullptr};
+	BBoxColumns m_bboxes;
+};
+
+}}//end namespace liboscar::Static
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef LIBOSCAR_OSM_QUERY_CONTEXT_H
+#define LIBOSCAR_OSM_QUERY_CONTEXT_H
+#include <liboscar/StaticOsmCompleter.h>
+#include <liboscar/AdvancedCellOpTree.h>
+#include <liboscar/CQRFromComplexSpatialQuery.h>
+#include <liboscar/CQRFromPolygon.h>
+#include <memory>
+#include <string>
+
+namespace liboscar {
+namespace Static {
+
+/** Per thread state for queries on a shared OsmCompleter.
+  * The items completer, the op trees and their scratch buffers are set up once and reused by all queries of the context.
+  * The items completer and the tag filters are registered once in the set op trees of complete() and simpleComplete(),
+  * the item sets of these queries share the set op tree of the context and only take a reference to it and the store.
+  * Hence an item set is only valid for update() until the next query of the same kind on the context.
+  * The rect queries need a set op tree per rect and register the completer and the filters per query.
+  *
+  * Use one context per thread: a context must not be used by multiple threads concurrently,
+  * but any number of contexts may query the same const OsmCompleter concurrently.
+  * The completer has to outlive the context and everything returned by it.
+  * With OsmCompleterHandle take a snapshot, create the context from it and drop both together.
+  */
+class OsmQueryContext final {
+public:
+	///Call after energize() returned, the item set queries use the geo search and the tags of a background energize() once these are ready
+	explicit OsmQueryContext(const OsmCompleter & completer);
+	~OsmQueryContext();
+	OsmQueryContext(const OsmQueryContext & other) = delete;
+	OsmQueryContext & operator=(const OsmQueryContext & other) = delete;
+	inline const OsmCompleter & completer() const { return m_completer; }
+public:
+	OsmItemSet complete(const std::string & query);
+	OsmItemSet simpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen);
+	OsmItemSet simpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen, const sserialize::spatial::GeoRect & rect);
+	OsmItemSetIterator partialComplete(const std::string & query, const sserialize::spatial::GeoRect & rect = sserialize::spatial::GeoRect());
+	///@param threadCount: the number of threads used to flatten a TreedCQR
+	sserialize::CellQueryResult cqrComplete(const std::string & query, bool treedCQR = false, uint32_t threadCount = 1);
+	sserialize::Static::spatial::GeoHierarchy::SubSet clusteredComplete(const std::string & query, uint32_t minCq4SparseSubSet, bool treedCQR = false, uint32_t threadCount = 1);
+	sserialize::CellQueryResult cqr(const sserialize::ItemIndex & fullMatchCells) const;
+private:
+	///sets up the items completer and the set op trees on first use and again once the background tasks of energize() added capabilities
+	const sserialize::StringCompleter & itemsCompleter();
+private:
+	const OsmCompleter & m_completer;
+	sserialize::CellQueryResult::CellInfo m_ci;
+	//created on first use, depends on the capabilities
+	sserialize::StringCompleter m_itemsCompleter;
+	bool m_hasItemsCompleter{false};
+	//OsmCompleter::itemsCapabilities() at the time m_itemsCompleter was created
+	uint32_t m_itemsCapabilities{0};
+	//with the items completer and the tag filters registered
+	sserialize::SetOpTree m_complexSetOpTree{sserialize::SetOpTree::SOT_COMPLEX};
+	sserialize::SetOpTree m_simpleSetOpTree{sserialize::SetOpTree::SOT_SIMPLE};
+	//empty if the data has no CellTextCompleter
+	std::unique_ptr<AdvancedCellOpTree> m_opTree;
+};
+
+}}//end namespace liboscar::Static
+
+#endif
@@ -8,14 +8,27 @@
 namespace liboscar {
 namespace Static {
 
+///ItemFilter that is able to filter whole indexes at once
+class BatchItemFilter: public sserialize::ItemIndex::ItemFilter {
+public:
+	virtual ~BatchItemFilter() {}
+	///@return the first maxResultSize items of idx that pass the filter
+	virtual sserialize::ItemIndex operator()(const sserialize::ItemIndex & idx, uint32_t maxResultSize) const = 0;
+	using sserialize::ItemIndex::ItemFilter::operator();
+};
+
+///T_DB_TYPE needs to provide match(id, rect) and filter(rect, approximate, idx, maxResultSize)
 template<typename T_DB_TYPE>
-class GeoConstraintFilter: public sserialize::ItemIndex::ItemFilter {
+class GeoConstraintFilter: public BatchItemFilter {
 	T_DB_TYPE m_db;
 	sserialize::spatial::GeoRect m_rect;
 public:
 	GeoConstraintFilter(const T_DB_TYPE & db, const sserialize::spatial::GeoRect & rect) : m_db(db), m_rect(rect) {}
 	virtual ~GeoConstraintFilter() {}
 	virtual bool operator()(uint32_t id) const { return m_db.match(id, m_rect); }
+	virtual sserialize::ItemIndex operator()(const sserialize::ItemIndex & idx, uint32_t maxResultSize) const override {
+		return m_db.filter(m_rect, false, idx, maxResultSize);
+	}
 };
 
 class SetOpTreePrivateGeo: public sserialize::SetOpTreePrivateSimple {
@@ -0,0 +1,78 @@
+#ifndef LIBOSCAR_SIDECAR_H
+#define LIBOSCAR_SIDECAR_H
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <memory>
+#include <vector>
+
+namespace liboscar {
+namespace Static {
+namespace sidecar {
+
+/** Common parts of the kvstore sidecars (columns, osm id index, rtree, geometry, payloads, cell graph)
+  *
+  * Storage layout
+  *
+  * {
+  *   VERSION       u8
+  *   ...           sidecar specific header fields
+  *   BYTE_ORDER    u32, ByteOrderMark in the native byte order of the machine that created the data
+  *   ARRAYS        arrays in native byte order, each starts at an offset that is a multiple of Alignment
+  * }
+  *
+  * The byte order mark is always the last field of the header.
+  */
+
+using OffsetType = sserialize::UByteArrayAdapter::OffsetType;
+
+constexpr uint32_t ByteOrderMark = 0x01020304;
+constexpr OffsetType Alignment = 64;
+
+inline constexpr OffsetType alignOffset(OffsetType v) {
+	return (v + Alignment - 1)/Alignment*Alignment;
+}
+
+///Zero-copy view of the first size bytes of a sidecar
+///The data is copied if it is not directly addressable with an alignment suitable for the arrays
+class View final {
+public:
+	View();
+	///@param headerSize size of the header including the byte order mark
+	///@param name used in error messages
+	///throws sserialize::CorruptDataException if data is smaller than size or was created with a different byte order
+	View(const sserialize::UByteArrayAdapter & data, OffsetType headerSize, OffsetType size, const char * name);
+	~View();
+	inline bool valid() const { return m_base; }
+	inline OffsetType size() const { return m_size; }
+	inline const uint8_t * data() const { return m_base; }
+	template<typename T>
+	inline const T * array(OffsetType offset) const { return reinterpret_cast<const T*>(m_base + offset); }
+private:
+	//keeps the memory alive
+	sserialize::UByteArrayAdapter::MemoryView m_mem;
+	//used if the data in m_mem is not aligned
+	std::shared_ptr< std::vector<uint64_t> > m_alignedCopy;
+	const uint8_t * m_base{nullptr};
+	OffsetType m_size{0};
+};
+
+///Write the byte order mark, call after the sidecar specific header fields
+void putByteOrderMark(sserialize::UByteArrayAdapter & dest);
+
+///Pad dest with zeros up to begin+offset
+void putPadding(sserialize::UByteArrayAdapter & dest, OffsetType begin, OffsetType offset);
+
+///Write size entries of data at begin+offset
+template<typename T>
+void putArray(sserialize::UByteArrayAdapter & dest, OffsetType begin, OffsetType offset, const T * data, std::size_t size) {
+	putPadding(dest, begin, offset);
+	dest.putData(reinterpret_cast<const uint8_t*>(data), OffsetType(size)*sizeof(T));
+}
+
+template<typename T>
+void putArray(sserialize::UByteArrayAdapter & dest, OffsetType begin, OffsetType offset, const std::vector<T> & data) {
+	putArray(dest, begin, offset, data.data(), data.size());
+}
+
+}}}//end namespace liboscar::Static::sidecar
+
+#endif
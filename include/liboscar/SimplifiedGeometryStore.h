@@ -0,0 +1,76 @@
+#ifndef LIBOSCAR_SIMPLIFIED_GEOMETRY_STORE_H
+#define LIBOSCAR_SIMPLIFIED_GEOMETRY_STORE_H
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <sserialize/Static/GeoShape.h>
+#include <liboscar/Sidecar.h>
+#define LIBOSCAR_SIMPLIFIED_GEOMETRY_STORE_VERSION 1
+
+namespace liboscar {
+namespace Static {
+
+class OsmKeyValueObjectStore;
+
+/** Precomputed simplifications of the shapes of the items of an OsmKeyValueObjectStore.
+  * This is a sidecar to the kvstore. Ways and rings of large shapes are simplified with the Douglas-Peucker algorithm
+  * for each of LEVEL_COUNT tolerances, every point of the original shape is within the tolerance of its simplification.
+  * Only items with at least MinPointCount points have entries and a level is only stored if it
+  * removes enough points compared to the next finer level.
+  *
+  * Storage layout
+  *
+  * {
+  *   VERSION       u8
+  *   SIZE          u32, number of items of the store
+  *   LEVEL_COUNT   u32
+  *   ENTRY_COUNT   u32, number of items with simplified shapes
+  *   BYTE_ORDER    u32, see sidecar::ByteOrderMark
+  *   TOLERANCES    double[LEVEL_COUNT], in degrees and strictly increasing
+  *   ITEM_IDS      u32[ENTRY_COUNT], sorted
+  *   OFFSETS       u64[ENTRY_COUNT*LEVEL_COUNT+1], level l of entry e is in DATA[OFFSETS[e*LEVEL_COUNT+l], OFFSETS[e*LEVEL_COUNT+l+1])
+  *   DATA          sserialize::Static::spatial::GeoShape[], empty if the level is not stored
+  * }
+  *
+  * Arrays start at offsets that are a multiple of 64 and are stored in native byte order.
+  */
+class SimplifiedGeometryStore final {
+public:
+	///items with fewer points are not simplified
+	static constexpr uint32_t MinPointCount = 64;
+public:
+	SimplifiedGeometryStore();
+	///throws sserialize::CorruptDataException if data is invalid
+	SimplifiedGeometryStore(const sserialize::UByteArrayAdapter & data);
+	~SimplifiedGeometryStore();
+	inline bool valid() const { return m_tolerances; }
+	inline uint32_t size() const { return m_size; }
+	inline uint32_t levelCount() const { return m_levelCount; }
+	inline uint32_t entryCount() const { return m_entryCount; }
+	inline double tolerance(uint32_t level) const { return m_tolerances[level]; }
+	sserialize::UByteArrayAdapter::OffsetType getSizeInBytes() const;
+public:
+	///Sets shape to the coarsest stored simplification of item itemPos whose tolerance is at most tolerance
+	///@return false if there is none, shape is not changed in this case
+	bool at(uint32_t itemPos, double tolerance, sserialize::Static::spatial::GeoShape & shape) const;
+public:
+	///Tolerances in degrees used by default, from about 1m to about 10km at the equator
+	static std::vector<double> defaultTolerances();
+	///Serialize the simplified shapes of the items of store to dest
+	///@param tolerances strictly increasing tolerances in degrees
+	///@return offset of the data in dest
+	static sserialize::UByteArrayAdapter::OffsetType create(const OsmKeyValueObjectStore & store, const std::vector<double> & tolerances, sserialize::UByteArrayAdapter & dest, uint32_t threadCount);
+private:
+	uint32_t m_size{0};
+	uint32_t m_levelCount{0};
+	uint32_t m_entryCount{0};
+	sserialize::UByteArrayAdapter::OffsetType m_sizeInBytes{0};
+	//header and arrays, DATA is accessed through m_shapes
+	sidecar::View m_view;
+	const double * m_tolerances{nullptr};
+	const uint32_t * m_itemIds{nullptr};
+	const uint64_t * m_offsets{nullptr};
+	sserialize::UByteArrayAdapter m_shapes;
+};
+
+}}//end namespace liboscar::Static
+
+#endif
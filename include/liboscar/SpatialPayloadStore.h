@@ -0,0 +1,71 @@
+#ifndef LIBOSCAR_SPATIAL_PAYLOAD_STORE_H
+#define LIBOSCAR_SPATIAL_PAYLOAD_STORE_H
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <liboscar/Sidecar.h>
+#define LIBOSCAR_SPATIAL_PAYLOAD_STORE_VERSION 1
+
+namespace liboscar {
+namespace Static {
+
+class OsmKeyValueObjectStore;
+
+/** Copy of the payloads of an OsmKeyValueObjectStore ordered along a hilbert curve of the item bounding box centers.
+  * This is a sidecar to the kvstore. Item ids are not changed, items that are close to each other
+  * have their payloads (shapes and cells) close to each other in the file, which reduces the number of pages
+  * touched by spatial queries. Items without a shape are at the end.
+  *
+  * Storage layout
+  *
+  * {
+  *   VERSION       u8
+  *   SIZE          u32
+  *   BYTE_ORDER    u32, see sidecar::ByteOrderMark
+  *   POSITIONS     u32[SIZE], POSITIONS[itemId] is the position of the payload of item itemId
+  *   OFFSETS       u64[SIZE+1], the payload at position p is in DATA[OFFSETS[p], OFFSETS[p+1])
+  *   DATA          u8[OFFSETS[SIZE]], serialized OsmKeyValueObjectStorePayload
+  * }
+  *
+  * POSITIONS and OFFSETS start at offsets that are a multiple of 64 and are stored in native byte order.
+  *
+  * Disk size: the payloads are duplicated, the kvstore keeps its own copy in item order since the key-value
+  * pairs and the payloads of other users of the kvstore are read from it. The sidecar needs the size of all payloads
+  * plus 12 bytes per item and at most 128 bytes of padding. Only the pages of the copy that is read are loaded,
+  * so the memory needed at runtime does not grow. tools/SpatialPayloadPageFaults.cpp measures the major page faults
+  * of a rect query workload with and without the sidecar, tools/CreateSidecars.cpp writes it.
+  */
+class SpatialPayloadStore final {
+public:
+	SpatialPayloadStore();
+	///throws sserialize::CorruptDataException if data is invalid
+	SpatialPayloadStore(const sserialize::UByteArrayAdapter & data);
+	~SpatialPayloadStore();
+	inline bool valid() const { return m_positions; }
+	inline uint32_t size() const { return m_size; }
+	sserialize::UByteArrayAdapter::OffsetType getSizeInBytes() const;
+	inline uint32_t position(uint32_t itemId) const { return m_positions[itemId]; }
+	///serialized payload at position
+	sserialize::UByteArrayAdapter dataAt(uint32_t position) const;
+	///the payload at position p is in data()[offsets()[p], offsets()[p+1])
+	inline const uint64_t * offsets() const { return m_offsets; }
+	inline const sserialize::UByteArrayAdapter & data() const { return m_data; }
+	///DATA if it is contiguous in memory, nullptr otherwise
+	inline const uint8_t * rawData() const { return m_rawData; }
+public:
+	///Serialize the payloads of the items of store to dest, uses the columns of store if available
+	///@return offset of the data in dest
+	static sserialize::UByteArrayAdapter::OffsetType create(const OsmKeyValueObjectStore & store, sserialize::UByteArrayAdapter & dest, uint32_t threadCount);
+private:
+	uint32_t m_size{0};
+	sserialize::UByteArrayAdapter::OffsetType m_sizeInBytes{0};
+	//header and arrays, DATA is accessed through m_data
+	sidecar::View m_view;
+	const uint32_t * m_positions{nullptr};
+	const uint64_t * m_offsets{nullptr};
+	sserialize::UByteArrayAdapter m_data;
+	sserialize::UByteArrayAdapter::MemoryView m_rawDataMem;
+	const uint8_t * m_rawData{nullptr};
+};
+
+}}//end namespace liboscar::Static
+
+#endif
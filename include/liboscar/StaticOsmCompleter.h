@@ -3,7 +3,16 @@
 #include <string>
 #include <ostream>
 #include <unordered_map>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <liboscar/constants.h>
+#include <liboscar/AccessProfile.h>
+#include <liboscar/MemoryPolicy.h>
+#include <liboscar/GeoHierarchyCellGraph.h>
+#include <liboscar/KVStatsCache.h>
 #include <liboscar/StaticOsmItemSet.h>
 #include <liboscar/tagcompleters.h>
 #include <liboscar/TextSearch.h>
@@ -19,7 +28,10 @@
 namespace liboscar {
 namespace Static {
 
+class OsmQueryContext;
+
 class OsmCompleter {
+	friend class OsmQueryContext;
 protected:
 	template<typename TCompleter>
 	class GeoCompleterOp: public sserialize::spatial::GeoConstraintSetOpTreeSF<TCompleter> {
@@ -30,6 +42,42 @@ protected:
 		virtual ~GeoCompleterOp() {}
 		virtual std::string describe() const { return MyBaseClass::completer().getName(); }
 	};
+public:
+	///Parts of the completer that are initialized by energize()
+	enum Capability : uint32_t {
+		CAP_NONE=0x0,
+		///kvstore including its sidecars
+		CAP_STORE=0x1,
+		CAP_INDEX=0x2,
+		CAP_TEXT_SEARCH=0x4,
+		///geo search and the geo completers
+		CAP_GEO_SEARCH=0x8,
+		///tag store and the tag completers
+		CAP_TAGS=0x10,
+		CAP_GHSG=0x20,
+		///cell distance, CQRDilator and CQRFromRouting
+		CAP_CELL_DISTANCE=0x40,
+		CAP_ALL=0x7F
+	};
+private:
+	struct Readiness {
+		std::atomic<uint32_t> capabilities{CAP_NONE};
+		bool finished{true};
+		std::mutex lock;
+		std::condition_variable cv;
+		std::thread background;
+	};
+	struct Profiling {
+		AccessProfile profile;
+		std::atomic<bool> stopRecorder{false};
+		std::atomic<bool> stopPrefetcher{false};
+		std::mutex lock;
+		std::condition_variable cv;
+		std::thread recorder;
+		std::thread prefetcher;
+		//ranges of the access profile requested by the last prefetch(), carried over into the next recorded profile
+		std::vector<AccessProfile::Range> prefetched;
+	};
 private:
 	std::string m_filesDir;
 	std::unordered_map<uint32_t, sserialize::UByteArrayAdapter> m_data;
@@ -38,9 +86,12 @@ private:
 	TextSearch m_textSearch;
 	GeoSearch m_geoSearch;
 	std::vector<sserialize::RCPtrWrapper<sserialize::SetOpTree::SelectableOpFilter> > m_geoCompleters;
+	//the first entry of m_geoCompleters, used by queries during a background energize()
+	sserialize::RCPtrWrapper<sserialize::SetOpTree::SelectableOpFilter> m_storeGeoCompleter;
 	///maps from TextSearch::Type->(Position, StringCompleter)
 	uint8_t m_selectedGeoCompleter;
 	sserialize::spatial::GeoHierarchySubGraph m_ghsg;
+	liboscar::Static::GeoHierarchyCellGraph m_cellGraph;
 	std::shared_ptr<sserialize::spatial::interface::CellDistance> m_cellDistance;
 	sserialize::Static::CQRDilator m_cqrd;
 	std::shared_ptr<liboscar::interface::CQRFromRouting> m_cqrr;
@@ -49,33 +100,86 @@ private:
 	sserialize::RCPtrWrapper<TagCompleter> m_tagCompleter;
 	sserialize::RCPtrWrapper<TagNameCompleter> m_tagNameCompleter;
 	sserialize::RCPtrWrapper<TagPhraseCompleter> m_tagPhraseCompleter;
+	std::shared_ptr<Readiness> m_readiness;
+	std::shared_ptr<Profiling> m_profiling;
+	std::shared_ptr<MemoryPolicy> m_memoryPolicy;
+	std::vector<MemoryPolicy::Report> m_memoryReports;
+	uint64_t m_datasetFingerprint{0};
+	std::shared_ptr<KVStatsCache> m_kvStatsCache;
 	
 private:
+	///Registers the filters of the parts that are ready, see itemsCapabilities()
+	///Before CAP_GEO_SEARCH only the geo completer of the store is available, m_geoCompleters is still being extended then
 	template<typename T_ITEM_SET_TYPE>
-	void registerFilters(T_ITEM_SET_TYPE & itemSet) {
-		itemSet.registerSelectableOpFilter(geoCompleter().priv());
-		itemSet.registerSelectableOpFilter(m_tagCompleter.priv());
-		itemSet.registerSelectableOpFilter( m_tagNameCompleter.priv() );
-		itemSet.registerSelectableOpFilter( m_tagPhraseCompleter.priv() );
+	void registerFilters(T_ITEM_SET_TYPE & itemSet, uint32_t caps) const {
+		itemSet.registerSelectableOpFilter((caps & CAP_GEO_SEARCH ? geoCompleter() : m_storeGeoCompleter).priv());
+		if (caps & CAP_TAGS) {
+			itemSet.registerSelectableOpFilter(m_tagCompleter.priv());
+			itemSet.registerSelectableOpFilter( m_tagNameCompleter.priv() );
+			itemSet.registerSelectableOpFilter( m_tagPhraseCompleter.priv() );
+		}
 	}
-	sserialize::StringCompleter getItemsCompleter() const;
+	///The subset of CAP_GEO_SEARCH and CAP_TAGS that is ready, waits for the text search
+	uint32_t itemsCapabilities() const;
+	///@param caps see itemsCapabilities(), the tag phrases are only part of it with CAP_TAGS
+	sserialize::StringCompleter getItemsCompleter(uint32_t caps) const;
+	//the queries with a given items completer, see OsmQueryContext
+	///@param caps the capabilities strCmp was created with
+	Static::OsmItemSet doComplete(const std::string & query, const sserialize::StringCompleter & strCmp, uint32_t caps) const;
+	Static::OsmItemSet doSimpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen, const sserialize::StringCompleter & strCmp, uint32_t caps) const;
+	Static::OsmItemSet doSimpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen, const sserialize::spatial::GeoRect & rect, const sserialize::StringCompleter & strCmp, uint32_t caps) const;
+	Static::OsmItemSetIterator doPartialComplete(const std::string & query, const sserialize::spatial::GeoRect & rect, const sserialize::StringCompleter & strCmp, uint32_t caps) const;
+	void setCapability(Capability c);
+	void setFinished();
+	void joinBackground();
+	void openFiles(uint32_t threadCount);
+	void initStore();
+	bool initIndex();
+	void initTextSearch();
+	void initGeoSearch();
+	void initTags();
+	void initGhsg(sserialize::spatial::GeoHierarchySubGraph::Type ghsgType, uint32_t threadCount);
+	///uses the cell graph if ghsg is ghsg() and there is one
+	sserialize::Static::spatial::GeoHierarchy::SubSet subSet(const sserialize::CellQueryResult & cqr, const sserialize::spatial::GeoHierarchySubGraph & ghsg, bool sparse, uint32_t threadCount) const;
+	void initCellDistance();
+	void stopPrefetch();
+	///@return false if the recorder was not running
+	bool stopRecorder();
 public:
 	typedef enum {CDT_CENTER_OF_MASS, CDT_ANULUS, CDT_MIN_SPHERE, CDT_SPHERE} CellDistanceType;
 public:
 	OsmCompleter();
 	virtual ~OsmCompleter();
-#ifdef LIBOSCAR_NO_DATA_REFCOUNTING
+	///the background initialization of energize() refers to this, share completers with OsmCompleterHandle instead
 	OsmCompleter(const OsmCompleter & other) = delete;
 	OsmCompleter & operator=(const OsmCompleter & other) = delete;
-#endif
 	sserialize::UByteArrayAdapter data(liboscar::FileConfig fc) const;
 	bool setAllFilesFromPrefix(const std::string & fileName);
 	///throws an exception if something goes wrong
-	void energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsgType = sserialize::spatial::GeoHierarchySubGraph::T_PASS_THROUGH);
+	///Independent parts are initialized concurrently if threadCount > 1.
+	///@param background return as soon as everything but the geo search and the tags is ready,
+	///these are then initialized by a background thread, see capabilities() and waitFor()
+	///@param ghsgType T_INVALID selects the sub graph by the size of the hierarchy, large ones use the cell graph
+	///which is loaded from the cellgraph file or created with threadCount threads
+	void energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsgType = sserialize::spatial::GeoHierarchySubGraph::T_PASS_THROUGH, uint32_t threadCount = 1, bool background = false);
+	///@return the Capability flags of the parts that are ready to use
+	inline uint32_t capabilities() const { return m_readiness->capabilities.load(std::memory_order_acquire); }
+	inline bool hasCapabilities(uint32_t caps) const { return (capabilities() & caps) == caps; }
+	///Identity of the data files, changes if the files change. Use it in keys of caches that outlive this completer.
+	inline uint64_t datasetFingerprint() const { return m_datasetFingerprint; }
+	///Cache of kvStats(), keyed with datasetFingerprint(), created by energize()
+	inline KVStatsCache & kvStatsCache() const { return *m_kvStatsCache; }
+	///Blocks until all of caps are ready or energize() finished
+	///@return hasCapabilities(caps)
+	bool waitFor(uint32_t caps) const;
 
+	///The following accessors do not wait, use waitFor(CAP_GEO_SEARCH) before geoSearch(), geoCompleters() and geoCompleter()
+	///if energize() was called with background = true
 	inline const TextSearch & textSearch() const { return m_textSearch; }
 	inline const GeoSearch & geoSearch() const { return m_geoSearch; }
 	inline const sserialize::spatial::GeoHierarchySubGraph & ghsg() const { return m_ghsg; }
+	///invalid if there is no cellgraph file and energize() did not create one, see energize()
+	inline const liboscar::Static::GeoHierarchyCellGraph & cellGraph() const { return m_cellGraph; }
 	inline const std::vector<sserialize::RCPtrWrapper<sserialize::SetOpTree::SelectableOpFilter> > & geoCompleters() const { return m_geoCompleters; }
 	inline const liboscar::Static::OsmKeyValueObjectStore & store() const { return m_store; }
 	inline const sserialize::Static::ItemIndexStore & indexStore() const { return m_indexStore; }
@@ -89,29 +193,52 @@ public:
 	void setCellDistance(CellDistanceType cdt, uint32_t threadCount);
 	///@param threshold in meter
 	void setCQRDilatorCache(uint32_t threshold, uint32_t threadCount);
+	///Cache decoded kvstore payloads with up to byteBudget bytes of bookkeeping, 0 disables the cache
+	///The cache is filled with the items listed in the kvstore.warmup file (one item id per line) if it exists
+	///Unlike the other setters this may be called while queries are running
+	void setPayloadCache(uint64_t byteBudget);
+	///Policy used by energize() to decide how the data files are held in memory, DefaultMemoryPolicy if not set
+	void setMemoryPolicy(std::shared_ptr<MemoryPolicy> policy);
+	///Record which pages of the data files are in memory every sampleInterval seconds, see AccessProfile
+	///The ranges requested by prefetch() are not sampled, they keep their weights from the replayed profile
+	void startAccessProfile(uint32_t sampleInterval);
+	///Stop recording and write the profile to the access.profile file
+	///@return false if the profile could not be written
+	bool stopAccessProfile();
+	///Request the pages listed in the access.profile file and the pages of the kvstore sidecars from the os
+	///in a background thread, call after energize()
+	void prefetch();
 
 	void setCQRFromRouting(std::shared_ptr<liboscar::interface::CQRFromRouting> v);
 	void setCQRFromRouting(liboscar::adaptors::CQRFromRoutingFromCellList::Operator v);
 	
-	inline uint8_t selectedGeoCompleter() { return m_selectedGeoCompleter; }
-	inline uint8_t selectedTextSearcher(TextSearch::Type t) { return m_textSearch.selectedTextSearcher(t); }
+	inline uint8_t selectedGeoCompleter() const { return m_selectedGeoCompleter; }
+	inline uint8_t selectedTextSearcher(TextSearch::Type t) const { return m_textSearch.selectedTextSearcher(t); }
 	
 public: //Stats
 	std::ostream & printStats(std::ostream& out) const;
 	
 public:
-	Static::OsmItemSet complete(const std::string& query);
+	/** Queries
+	  * The query functions are const and may be called by any number of threads concurrently once energize() returned
+	  * (the item set queries only wait for CAP_TEXT_SEARCH, they use the geo search and the tags of a background energize() once these are ready).
+	  * The setters above must not be called concurrently with queries.
+	  * Each call sets up the items completer anew, use an OsmQueryContext per thread to reuse it across queries.
+	  */
+	Static::OsmItemSet complete(const std::string& query) const;
 	//Do a simple result set size limited search (this currently only supports string queries)
-	Static::OsmItemSet simpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen);
-	Static::OsmItemSet simpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen, const sserialize::spatial::GeoRect & rect);
-	Static::OsmItemSetIterator partialComplete(const std::string& query, const sserialize::spatial::GeoRect & rect = sserialize::spatial::GeoRect());
-	sserialize::CellQueryResult cqrComplete(const std::string & query, const sserialize::spatial::GeoHierarchySubGraph & ghsg, bool treedCQR = false, uint32_t threadCount = 1);
+	Static::OsmItemSet simpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen) const;
+	Static::OsmItemSet simpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen, const sserialize::spatial::GeoRect & rect) const;
+	Static::OsmItemSetIterator partialComplete(const std::string& query, const sserialize::spatial::GeoRect & rect = sserialize::spatial::GeoRect()) const;
+	sserialize::CellQueryResult cqrComplete(const std::string & query, const sserialize::spatial::GeoHierarchySubGraph & ghsg, bool treedCQR = false, uint32_t threadCount = 1) const;
 	///@param threadCount: the number of threads used to flatten a TreedCQR
-	sserialize::CellQueryResult cqrComplete(const std::string & query, bool treedCQR = false, uint32_t threadCount = 1);
+	sserialize::CellQueryResult cqrComplete(const std::string & query, bool treedCQR = false, uint32_t threadCount = 1) const;
 	sserialize::CellQueryResult cqr(sserialize::ItemIndex const & fullMatchCells) const;
-	sserialize::Static::spatial::GeoHierarchy::SubSet clusteredComplete(const std::string& query, const sserialize::spatial::GeoHierarchySubGraph & ghs, uint32_t minCq4SparseSubSet, bool treedCQR = false, uint32_t threadCount = 1);
-	sserialize::Static::spatial::GeoHierarchy::SubSet clusteredComplete(const std::string& query, uint32_t minCq4SparseSubSet, bool treedCQR = false, uint32_t threadCount = 1);
-	sserialize::Static::spatial::GeoHierarchy::SubSet clusteredComplete(const std::string & query);
+	///Key-value statistics of the items of cqr, cached across requests in kvStatsCache()
+	KVStatsCache::StatsPtr kvStats(const sserialize::CellQueryResult & cqr, uint32_t threadCount = 1) const;
+	sserialize::Static::spatial::GeoHierarchy::SubSet clusteredComplete(const std::string& query, const sserialize::spatial::GeoHierarchySubGraph & ghs, uint32_t minCq4SparseSubSet, bool treedCQR = false, uint32_t threadCount = 1) const;
+	sserialize::Static::spatial::GeoHierarchy::SubSet clusteredComplete(const std::string& query, uint32_t minCq4SparseSubSet, bool treedCQR = false, uint32_t threadCount = 1) const;
+	sserialize::Static::spatial::GeoHierarchy::SubSet clusteredComplete(const std::string & query) const;
 	Static::TagStore tagStore() const;
 };
 
@@ -28,7 +28,16 @@ enum FileConfig {
 	FC_TAGSTORE=4,
 	FC_GEO_SEARCH=5,
 	FC_END=6,
-	FC_TAGSTORE_PHRASES=7
+	FC_TAGSTORE_PHRASES=7,
+	FC_KV_STORE_COLUMNS=8,
+	FC_KV_STORE_OSM_ID_INDEX=9,
+	FC_KV_STORE_RTREE=10,
+	FC_KV_STORE_GEOMETRY=11,
+	FC_KV_STORE_SIMPLIFIED_GEOMETRY=12,
+	FC_KV_STORE_WARMUP=13,
+	FC_KV_STORE_SPATIAL_PAYLOADS=14,
+	FC_ACCESS_PROFILE=15,
+	FC_CELL_GRAPH=16
 };
 
 FileConfig fileConfigFromString(const std::string & str);
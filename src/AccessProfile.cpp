@@ -0,0 +1,232 @@
+#include <liboscar/AccessProfile.h>
+#include <liboscar/constants.h>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#if defined(__unix__) || defined(__APPLE__)
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+namespace liboscar {
+namespace {
+
+//mincore is called on at most this many bytes at once to bound the size of its result vector
+constexpr uint64_t SamplePieceSize = uint64_t(1024)*1024*1024;
+//replay() requests at most this many bytes at once so that stop is checked regularly
+constexpr uint64_t ReplayPieceSize = 16*1024*1024;
+
+//@return pointer to the data if it is directly addressable
+inline const uint8_t * dataPtr(const sserialize::UByteArrayAdapter & d) {
+	if (!d.size() || !d.isContiguous()) {
+		return nullptr;
+	}
+	return d.getMemView(0, 1).data();
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+inline uintptr_t pageSize() {
+	static const uintptr_t ps = uintptr_t(::sysconf(_SC_PAGESIZE));
+	return ps;
+}
+#endif
+
+}//end namespace
+
+constexpr uint64_t AccessProfile::ChunkSize;
+
+AccessProfile::AccessProfile() {}
+
+AccessProfile::~AccessProfile() {}
+
+void AccessProfile::sample(const DataMap & data) {
+#if defined(__unix__) || defined(__APPLE__)
+	#ifdef __APPLE__
+	typedef char MincoreType;
+	#else
+	typedef unsigned char MincoreType;
+	#endif
+	std::unordered_map<uint32_t, std::vector<uint32_t> > resident;
+	std::vector<MincoreType> vec;
+	for(const auto & x : data) {
+		const uint8_t * base = dataPtr(x.second);
+		if (!base) {
+			continue;
+		}
+		uint64_t size = x.second.size();
+		std::vector<uint32_t> & chunks = resident[x.first];
+		uintptr_t begin = uintptr_t(base) & ~(pageSize()-1);
+		uintptr_t end = uintptr_t(base) + size;
+		uint64_t lastChunk = std::numeric_limits<uint64_t>::max();
+		for(uintptr_t p(begin); p < end; p += SamplePieceSize) {
+			uintptr_t pieceEnd = std::min<uintptr_t>(p + SamplePieceSize, end);
+			vec.resize((pieceEnd - p + pageSize() - 1) / pageSize());
+			if (::mincore(reinterpret_cast<void*>(p), pieceEnd - p, vec.data()) != 0) {
+				break;
+			}
+			for(std::size_t i(0), s(vec.size()); i < s; ++i) {
+				if (!(vec[i] & 0x1)) {
+					continue;
+				}
+				uintptr_t page = p + i*pageSize();
+				uint64_t chunk = (page < uintptr_t(base) ? 0 : page - uintptr_t(base)) / ChunkSize;
+				if (chunk != lastChunk) {
+					chunks.push_back(chunk);
+					lastChunk = chunk;
+				}
+			}
+		}
+	}
+	std::lock_guard<std::mutex> lck(m_lock);
+	for(const auto & x : resident) {
+		std::vector<uint32_t> & weights = m_chunkWeights[x.first];
+		uint64_t chunkCount = (data.at(x.first).size() + ChunkSize - 1) / ChunkSize;
+		if (weights.size() < chunkCount) {
+			weights.resize(chunkCount, 0);
+		}
+		auto carried = m_carriedChunks.find(x.first);
+		for(uint32_t chunk : x.second) {
+			if (carried != m_carriedChunks.end() && chunk < carried->second.size() && carried->second[chunk]) {
+				continue;
+			}
+			weights[chunk] += 1;
+		}
+	}
+	m_sampleCount += 1;
+#else
+	(void) data;
+#endif
+}
+
+void AccessProfile::addHint(uint32_t fc, uint64_t offset, uint64_t size, uint32_t weight) {
+	std::lock_guard<std::mutex> lck(m_lock);
+	m_hints.push_back(Range{fc, offset, size, weight});
+}
+
+void AccessProfile::carryOver(const std::vector<Range> & ranges) {
+	std::lock_guard<std::mutex> lck(m_lock);
+	for(const Range & r : ranges) {
+		if (!r.size) {
+			continue;
+		}
+		m_hints.push_back(r);
+		std::vector<bool> & chunks = m_carriedChunks[r.fc];
+		uint64_t first = r.offset / ChunkSize;
+		uint64_t last = (r.offset + r.size - 1) / ChunkSize;
+		if (chunks.size() <= last) {
+			chunks.resize(last+1, false);
+		}
+		std::fill(chunks.begin()+first, chunks.begin()+(last+1), true);
+	}
+}
+
+uint32_t AccessProfile::sampleCount() const {
+	std::lock_guard<std::mutex> lck(m_lock);
+	return m_sampleCount;
+}
+
+std::vector<AccessProfile::Range> AccessProfile::ranges() const {
+	std::lock_guard<std::mutex> lck(m_lock);
+	std::vector<Range> result(m_hints);
+	for(const auto & x : m_chunkWeights) {
+		const std::vector<uint32_t> & weights = x.second;
+		for(std::size_t i(0), s(weights.size()); i < s;) {
+			if (!weights[i]) {
+				++i;
+				continue;
+			}
+			std::size_t j(i+1);
+			for(; j < s && weights[j] == weights[i]; ++j) {}
+			result.push_back(Range{x.first, i*ChunkSize, (j-i)*ChunkSize, weights[i]});
+			i = j;
+		}
+	}
+	//ranges of the same weight are requested in file order
+	std::sort(result.begin(), result.end(), [](const Range & a, const Range & b) {
+		if (a.weight != b.weight) {
+			return a.weight > b.weight;
+		}
+		if (a.fc != b.fc) {
+			return a.fc < b.fc;
+		}
+		return a.offset < b.offset;
+	});
+	return result;
+}
+
+void AccessProfile::clear() {
+	std::lock_guard<std::mutex> lck(m_lock);
+	m_sampleCount = 0;
+	m_chunkWeights.clear();
+	m_hints.clear();
+	m_carriedChunks.clear();
+}
+
+bool AccessProfile::load(const std::string & fileName) {
+	std::ifstream file(fileName);
+	if (!file.is_open()) {
+		return false;
+	}
+	std::vector<Range> loaded;
+	std::string fcName;
+	Range r;
+	while (file >> fcName >> r.offset >> r.size >> r.weight) {
+		r.fc = fileConfigFromString(fcName);
+		if (r.fc != FC_INVALID) {
+			loaded.push_back(r);
+		}
+	}
+	std::lock_guard<std::mutex> lck(m_lock);
+	m_sampleCount = 0;
+	m_chunkWeights.clear();
+	m_hints = std::move(loaded);
+	m_carriedChunks.clear();
+	return true;
+}
+
+bool AccessProfile::save(const std::string & fileName) const {
+	std::vector<Range> rs(ranges());
+	std::ofstream file(fileName);
+	if (!file.is_open()) {
+		return false;
+	}
+	for(const Range & r : rs) {
+		file << toString(FileConfig(r.fc)) << ' ' << r.offset << ' ' << r.size << ' ' << r.weight << '\n';
+	}
+	file.close();
+	return !file.fail();
+}
+
+uint64_t AccessProfile::replay(const std::vector<Range> & ranges, const DataMap & data, const std::atomic<bool> & stop) {
+	uint64_t requested = 0;
+#if defined(__unix__) || defined(__APPLE__)
+	for(const Range & r : ranges) {
+		auto it = data.find(r.fc);
+		if (it == data.end()) {
+			continue;
+		}
+		const uint8_t * base = dataPtr(it->second);
+		uint64_t size = it->second.size();
+		if (!base || r.offset >= size) {
+			continue;
+		}
+		uint64_t end = std::min(r.offset + r.size, size);
+		for(uint64_t p(r.offset); p < end; p += ReplayPieceSize) {
+			if (stop.load(std::memory_order_relaxed)) {
+				return requested;
+			}
+			uintptr_t b = (uintptr_t(base) + p) & ~(pageSize()-1);
+			uintptr_t e = uintptr_t(base) + std::min(p + ReplayPieceSize, end);
+			::madvise(reinterpret_cast<void*>(b), e-b, MADV_WILLNEED);
+			requested += e-b;
+		}
+	}
+#else
+	(void) ranges;
+	(void) data;
+	(void) stop;
+#endif
+	return requested;
+}
+
+}//end namespace liboscar
@@ -8,13 +8,15 @@ AdvancedCellOpTree(
 	const sserialize::Static::CQRDilator & cqrd,
 	const CQRFromComplexSpatialQuery & csq,
 	const sserialize::spatial::GeoHierarchySubGraph & ghsg,
-	std::shared_ptr<liboscar::interface::CQRFromRouting> cqrr) :
+	std::shared_ptr<liboscar::interface::CQRFromRouting> cqrr,
+	const Static::GeoHierarchyCellGraph & cellGraph) :
 AdvancedOpTree(),
 m_ctc(ctc),
 m_cqrd(cqrd),
 m_csq(csq),
 m_ghsg(ghsg),
-m_cqrr(cqrr)
+m_cqrr(cqrr),
+m_cellGraph(cellGraph)
 {}
 
 AdvancedCellOpTree::~AdvancedCellOpTree() {}
@@ -210,6 +212,10 @@ const liboscar::interface::CQRFromRouting & AdvancedCellOpTree::CalcBase::cqrr()
 	return m_cqrr;
 }
 
+const Static::GeoHierarchyCellGraph & AdvancedCellOpTree::CalcBase::cellGraph() const {
+	return m_cellGraph;
+}
+
 sserialize::Static::CellTextCompleter & AdvancedCellOpTree::CalcBase::ctc() {
 		return m_ctc;
 }
@@ -8,8 +8,8 @@
 
 namespace liboscar {
 
-CQRFromComplexSpatialQuery::CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph & ssc, const CQRFromPolygon & cqrfp) :
-m_priv(new detail::CQRFromComplexSpatialQuery(ssc, cqrfp))
+CQRFromComplexSpatialQuery::CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph & ssc, const CQRFromPolygon & cqrfp, const Static::GeoHierarchyCellGraph & cellGraph) :
+m_priv(new detail::CQRFromComplexSpatialQuery(ssc, cqrfp, cellGraph))
 {}
 
 CQRFromComplexSpatialQuery::CQRFromComplexSpatialQuery(const CQRFromComplexSpatialQuery& other) :
@@ -36,8 +36,9 @@ sserialize::CellQueryResult CQRFromComplexSpatialQuery::betweenOp(const sseriali
 
 namespace detail {
 
-CQRFromComplexSpatialQuery::CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph & ssc, const liboscar::CQRFromPolygon & cqrfp) :
+CQRFromComplexSpatialQuery::CQRFromComplexSpatialQuery(const sserialize::spatial::GeoHierarchySubGraph & ssc, const liboscar::CQRFromPolygon & cqrfp, const Static::GeoHierarchyCellGraph & cellGraph) :
 m_ssc(ssc),
+m_cellGraph(cellGraph),
 m_cqrfp(cqrfp),
 m_itemQueryItemCountTh(20),
 m_itemQueryCellCountTh(10)
@@ -807,21 +808,31 @@ CQRFromComplexSpatialQuery::determineQueryItemType(const sserialize::CellQueryRe
 
 	Stat best = Stat::min();
 	std::unordered_map<uint32_t, Stat> r2s;
+	auto update = [&r2s, &best](uint32_t rid, bool fm, auto regionCellCount) {
+		Stat & s = r2s[rid];
+		if (!s.rcc) {
+			s.rid = rid;
+			s.rcc = regionCellCount(rid);
+		}
+		//https://stackoverflow.com/questions/2725044/can-i-assume-booltrue-int1-for-any-c-compiler
+		s.fmc += (int)fm;
+		s.pmc += (int)!fm;
+		if (best < s) {
+			best = s;
+		}
+	};
 	for(sserialize::CellQueryResult::const_iterator it(cqr.begin()), end(cqr.end()); it != end; ++it) {
-		auto cellParents = m_ssc.cellParents(it.cellId());
 		bool fm = it.fullMatch();
-		bool pm = !fm;
-		for(uint32_t rid : cellParents) {
-			Stat & s = r2s[rid];
-			if (!s.rcc) {
-				s.rid = rid;
-				s.rcc = m_ssc.regionCellCount(rid);
+		if (m_cellGraph.valid()) {
+			auto regionCellCount = [this](uint32_t rid) { return m_cellGraph.regionCellCount(rid); };
+			for(const uint32_t * pIt(m_cellGraph.cellParentsBegin(it.cellId())), * pEnd(m_cellGraph.cellParentsEnd(it.cellId())); pIt != pEnd; ++pIt) {
+				update(*pIt, fm, regionCellCount);
 			}
-			//https://stackoverflow.com/questions/2725044/can-i-assume-booltrue-int1-for-any-c-compiler
-			s.fmc += (int)fm;
-			s.pmc += (int)pm;
-			if (best < s) {
-				best = s;
+		}
+		else {
+			auto regionCellCount = [this](uint32_t rid) { return m_ssc.regionCellCount(rid); };
+			for(uint32_t rid : m_ssc.cellParents(it.cellId())) {
+				update(rid, fm, regionCellCount);
 			}
 		}
 	}
@@ -844,6 +855,9 @@ CQRFromComplexSpatialQuery::determineQueryItemType(const sserialize::CellQueryRe
 
 detail::CQRFromComplexSpatialQuery::SubSet
 CQRFromComplexSpatialQuery::createSubSet(const sserialize::CellQueryResult cqr) const {
+	if (m_cellGraph.valid()) {
+		return m_cellGraph.subSet(geoHierarchy(), cqr, false);
+	}
 	return m_ssc.subSet(cqr, false, 1);
 }
 
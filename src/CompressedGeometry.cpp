@@ -0,0 +1,360 @@
+#include <liboscar/CompressedGeometry.h>
+#include <liboscar/OsmKeyValueObjectStore.h>
+#include <sserialize/Static/GeoWay.h>
+#include <sserialize/Static/GeoPolygon.h>
+#include <sserialize/Static/GeoMultiPolygon.h>
+#include <sserialize/utility/exceptions.h>
+#include <sserialize/utility/VersionChecker.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <atomic>
+#include <cstring>
+
+namespace liboscar {
+namespace Static {
+namespace {
+
+using sidecar::OffsetType;
+
+constexpr OffsetType HeaderSize = 1+4+4;
+
+inline OffsetType offsetsOffset() {
+	return sidecar::alignOffset(HeaderSize);
+}
+
+inline OffsetType dataOffset(uint32_t size) {
+	return offsetsOffset() + (OffsetType(size)+1)*sizeof(uint64_t);
+}
+
+inline int32_t getInt32LE(const uint8_t * data) {
+	return int32_t(uint32_t(data[0]) | (uint32_t(data[1]) << 8) | (uint32_t(data[2]) << 16) | (uint32_t(data[3]) << 24));
+}
+
+inline void putInt32LE(int32_t v, std::vector<uint8_t> & dest) {
+	for(uint32_t i(0); i < 4; ++i) {
+		dest.push_back(uint8_t(uint32_t(v) >> (8*i)));
+	}
+}
+
+//exact geometric predicates on quantized coordinates
+struct Point {
+	int64_t lat;
+	int64_t lon;
+};
+
+//>0 if c is left of a->b, <0 if right, 0 if collinear
+inline int orientation(const Point & a, const Point & b, const Point & c) {
+	__int128 v = __int128(b.lon - a.lon) * (c.lat - a.lat) - __int128(b.lat - a.lat) * (c.lon - a.lon);
+	return (v > 0) - (v < 0);
+}
+
+struct QRect {
+	int64_t minLat;
+	int64_t maxLat;
+	int64_t minLon;
+	int64_t maxLon;
+	inline bool contains(const Point & p) const {
+		return minLat <= p.lat && p.lat <= maxLat && minLon <= p.lon && p.lon <= maxLon;
+	}
+	//segment a->b intersects the closed rectangle
+	inline bool intersects(const Point & a, const Point & b) const {
+		if (std::max(a.lat, b.lat) < minLat || std::min(a.lat, b.lat) > maxLat || std::max(a.lon, b.lon) < minLon || std::min(a.lon, b.lon) > maxLon) {
+			return false;
+		}
+		if (contains(a) || contains(b)) {
+			return true;
+		}
+		//the segment intersects the rectangle iff the corners are not strictly on one side of it
+		int o1 = orientation(a, b, Point{minLat, minLon});
+		int o2 = orientation(a, b, Point{minLat, maxLon});
+		int o3 = orientation(a, b, Point{maxLat, minLon});
+		int o4 = orientation(a, b, Point{maxLat, maxLon});
+		return !((o1 > 0 && o2 > 0 && o3 > 0 && o4 > 0) || (o1 < 0 && o2 < 0 && o3 < 0 && o4 < 0));
+	}
+};
+
+//even-odd crossing test of a ray from p towards increasing lon with the edge a->b
+inline bool crosses(const Point & p, const Point & a, const Point & b) {
+	if ((a.lat > p.lat) == (b.lat > p.lat)) {
+		return false;
+	}
+	__int128 v = __int128(a.lon - p.lon) * (b.lat - a.lat) + __int128(p.lat - a.lat) * (b.lon - a.lon);
+	return (v > 0) == (b.lat > a.lat);
+}
+
+template<typename TPoint>
+inline void appendPoint(const TPoint & gp, int32_t & prevLat, int32_t & prevLon, std::vector<uint8_t> & dest) {
+	int32_t lat = CompressedGeometry::quantize(gp.lat());
+	int32_t lon = CompressedGeometry::quantize(gp.lon());
+	CompressedGeometry::encodeVarUint(CompressedGeometry::delta(prevLat, lat), dest);
+	CompressedGeometry::encodeVarUint(CompressedGeometry::delta(prevLon, lon), dest);
+	prevLat = lat;
+	prevLon = lon;
+}
+
+template<typename TWay>
+inline void appendRing(const TWay & way, int32_t baseLat, int32_t baseLon, std::vector<uint8_t> & dest) {
+	uint32_t size = (uint32_t) way.size();
+	CompressedGeometry::encodeVarUint(size, dest);
+	for(uint32_t i(0); i < size; ++i) {
+		appendPoint(way.at(i), baseLat, baseLon, dest);
+	}
+}
+
+} //end namespace
+
+uint32_t CompressedGeometry::PointDecoder::decode(int32_t * lat, int32_t * lon, uint32_t maxCount) {
+	uint32_t count = std::min(maxCount, m_remaining);
+	const uint8_t * data = m_data;
+	int32_t curLat = m_lat;
+	int32_t curLon = m_lon;
+	for(uint32_t i(0); i < count; ++i) {
+		curLat = addDelta(curLat, decodeVarUint(data));
+		curLon = addDelta(curLon, decodeVarUint(data));
+		lat[i] = curLat;
+		lon[i] = curLon;
+	}
+	m_data = data;
+	m_lat = curLat;
+	m_lon = curLon;
+	m_remaining -= count;
+	return count;
+}
+
+const uint8_t * CompressedGeometry::PointDecoder::skip() {
+	//every coordinate ends with the first byte without continuation bit
+	for(uint32_t i(0), s(2*m_remaining); i < s; ++m_data) {
+		i += !(*m_data & 0x80);
+	}
+	m_remaining = 0;
+	return m_data;
+}
+
+CompressedGeometry::CompressedGeometry(const uint8_t * data) :
+m_type(sserialize::spatial::GeoShapeType(*data))
+{
+	++data;
+	if (m_type == sserialize::spatial::GS_NONE) {
+		return;
+	}
+	m_minLat = getInt32LE(data);
+	m_maxLat = getInt32LE(data+4);
+	m_minLon = getInt32LE(data+8);
+	m_maxLon = getInt32LE(data+12);
+	data += 16;
+	m_outerCount = decodeVarUint(data);
+	if (m_type == sserialize::spatial::GS_MULTI_POLYGON) {
+		m_innerCount = decodeVarUint(data);
+	}
+	m_rings = data;
+}
+
+sserialize::spatial::GeoRect CompressedGeometry::boundary() const {
+	if (!valid()) {
+		return sserialize::spatial::GeoRect();
+	}
+	double s = OsmKeyValueObjectStoreColumns::CoordinateScale;
+	return sserialize::spatial::GeoRect(m_minLat/s, m_maxLat/s, m_minLon/s, m_maxLon/s);
+}
+
+bool CompressedGeometry::intersects(const sserialize::spatial::GeoRect & rect) const {
+	if (!valid()) {
+		return false;
+	}
+	OsmKeyValueObjectStoreColumns::QuantizedRect qr(rect);
+	QRect r{qr.minLat, qr.maxLat, qr.minLon, qr.maxLon};
+	if (m_maxLat < r.minLat || m_minLat > r.maxLat || m_maxLon < r.minLon || m_minLon > r.maxLon || r.minLat > r.maxLat || r.minLon > r.maxLon) {
+		return false;
+	}
+	if (r.minLat <= m_minLat && m_maxLat <= r.maxLat && r.minLon <= m_minLon && m_maxLon <= r.maxLon) {
+		return true;
+	}
+	bool isArea = (m_type == sserialize::spatial::GS_POLYGON || m_type == sserialize::spatial::GS_MULTI_POLYGON);
+	bool closeRings = isArea;
+	//a corner of rect, if no edge intersects rect then rect is either completely inside the area or outside of it
+	Point corner{r.minLat, r.minLon};
+	bool cornerInside = false;
+	bool result = false;
+	constexpr uint32_t BlockSize = 256;
+	int32_t lat[BlockSize];
+	int32_t lon[BlockSize];
+	visitRings([&](uint32_t /*ringId*/, PointDecoder & points) {
+		if (result || !points.remaining()) {
+			return;
+		}
+		Point first{0, 0};
+		Point prev{0, 0};
+		bool havePrev = false;
+		while (points.remaining()) {
+			uint32_t count = points.decode(lat, lon, BlockSize);
+			for(uint32_t i(0); i < count; ++i) {
+				Point cur{lat[i], lon[i]};
+				if (!havePrev) {
+					first = cur;
+					if (r.contains(cur)) {
+						result = true;
+						return;
+					}
+				}
+				else {
+					if (r.intersects(prev, cur)) {
+						result = true;
+						return;
+					}
+					cornerInside ^= crosses(corner, prev, cur);
+				}
+				prev = cur;
+				havePrev = true;
+			}
+		}
+		if (closeRings) {
+			if (r.intersects(prev, first)) {
+				result = true;
+				return;
+			}
+			cornerInside ^= crosses(corner, prev, first);
+		}
+	});
+	return result || (isArea && cornerInside);
+}
+
+void CompressedGeometry::append(const sserialize::Static::spatial::GeoShape & shape, std::vector<uint8_t> & dest) {
+	sserialize::spatial::GeoShapeType type = shape.type();
+	dest.push_back(uint8_t(type));
+	if (type == sserialize::spatial::GS_NONE) {
+		return;
+	}
+	sserialize::spatial::GeoRect bbox(shape.boundary());
+	int32_t minLat = OsmKeyValueObjectStoreColumns::quantizeLower(bbox.minLat());
+	int32_t minLon = OsmKeyValueObjectStoreColumns::quantizeLower(bbox.minLon());
+	putInt32LE(minLat, dest);
+	putInt32LE(OsmKeyValueObjectStoreColumns::quantizeUpper(bbox.maxLat()), dest);
+	putInt32LE(minLon, dest);
+	putInt32LE(OsmKeyValueObjectStoreColumns::quantizeUpper(bbox.maxLon()), dest);
+	switch (type) {
+	case sserialize::spatial::GS_POINT:
+	{
+		encodeVarUint(1, dest);
+		encodeVarUint(1, dest);
+		int32_t prevLat = minLat;
+		int32_t prevLon = minLon;
+		appendPoint(*shape.get<sserialize::spatial::GS_POINT>(), prevLat, prevLon, dest);
+		break;
+	}
+	case sserialize::spatial::GS_WAY:
+		encodeVarUint(1, dest);
+		appendRing(*shape.get<sserialize::spatial::GS_WAY>(), minLat, minLon, dest);
+		break;
+	case sserialize::spatial::GS_POLYGON:
+		encodeVarUint(1, dest);
+		appendRing(*shape.get<sserialize::spatial::GS_POLYGON>(), minLat, minLon, dest);
+		break;
+	case sserialize::spatial::GS_MULTI_POLYGON:
+	{
+		auto gmp = shape.get<sserialize::spatial::GS_MULTI_POLYGON>();
+		uint32_t outerCount = (uint32_t) gmp->outerPolygons().size();
+		uint32_t innerCount = (uint32_t) gmp->innerPolygons().size();
+		encodeVarUint(outerCount, dest);
+		encodeVarUint(innerCount, dest);
+		for(uint32_t i(0); i < outerCount; ++i) {
+			appendRing(gmp->outerPolygons().at(i), minLat, minLon, dest);
+		}
+		for(uint32_t i(0); i < innerCount; ++i) {
+			appendRing(gmp->innerPolygons().at(i), minLat, minLon, dest);
+		}
+		break;
+	}
+	default:
+		throw sserialize::CorruptDataException("CompressedGeometry: unknown shape type");
+	}
+}
+
+CompressedGeometryStore::CompressedGeometryStore() {}
+
+CompressedGeometryStore::CompressedGeometryStore(const sserialize::UByteArrayAdapter & data) {
+	sserialize::VersionChecker::check(data, LIBOSCAR_COMPRESSED_GEOMETRY_STORE_VERSION, data.at(0), "CompressedGeometryStore");
+	uint32_t size = data.getUint32(1);
+	if (data.size() < dataOffset(size)) {
+		throw sserialize::CorruptDataException("CompressedGeometryStore: data is too small");
+	}
+	uint64_t dataSize;
+	{
+		sserialize::UByteArrayAdapter::MemoryView mv(data.getMemView(offsetsOffset() + OffsetType(size)*sizeof(uint64_t), sizeof(uint64_t)));
+		std::memcpy(&dataSize, mv.data(), sizeof(dataSize));
+	}
+	m_view = sidecar::View(data, HeaderSize, dataOffset(size) + dataSize, "CompressedGeometryStore");
+	m_size = size;
+	m_offsets = m_view.array<uint64_t>(offsetsOffset());
+	m_data = m_view.array<uint8_t>(dataOffset(size));
+}
+
+CompressedGeometryStore::~CompressedGeometryStore() {}
+
+sserialize::UByteArrayAdapter::OffsetType CompressedGeometryStore::getSizeInBytes() const {
+	return m_view.size();
+}
+
+sserialize::UByteArrayAdapter::OffsetType
+CompressedGeometryStore::create(const OsmKeyValueObjectStore & store, sserialize::UByteArrayAdapter & dest, uint32_t threadCount) {
+	//items are encoded in blocks which are concatenated in order
+	struct State {
+		static constexpr uint32_t BlockSize = 1024;
+		const OsmKeyValueObjectStore & store;
+		std::atomic<uint32_t> block{0};
+		std::vector< std::vector<uint8_t> > blockData;
+		std::vector< std::vector<uint32_t> > blockOffsets;
+		State(const OsmKeyValueObjectStore & store) :
+		store(store),
+		blockData(store.size()/BlockSize+1),
+		blockOffsets(store.size()/BlockSize+1)
+		{}
+	};
+	struct Worker {
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			uint32_t size = state->store.size();
+			while (true) {
+				uint32_t b = state->block.fetch_add(1, std::memory_order_relaxed);
+				uint32_t p = b*State::BlockSize;
+				if (p >= size) {
+					break;
+				}
+				std::vector<uint8_t> & data = state->blockData[b];
+				std::vector<uint32_t> & offsets = state->blockOffsets[b];
+				for(uint32_t end(std::min(p+State::BlockSize, size)); p < end; ++p) {
+					offsets.push_back((uint32_t) data.size());
+					CompressedGeometry::append(state->store.geoShape(p), data);
+				}
+			}
+		}
+	};
+	State state(store);
+	sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+
+	uint32_t size = store.size();
+	std::vector<uint64_t> offsets;
+	offsets.reserve(size+1);
+	uint64_t blockBegin = 0;
+	for(uint32_t b(0), s((uint32_t) state.blockData.size()); b < s; ++b) {
+		for(uint32_t o : state.blockOffsets[b]) {
+			offsets.push_back(blockBegin + o);
+		}
+		blockBegin += state.blockData[b].size();
+	}
+	offsets.push_back(blockBegin);
+	SSERIALIZE_CHEAP_ASSERT_EQUAL(offsets.size(), std::size_t(size)+1);
+
+	OffsetType begin = dest.tellPutPtr();
+	dest.putUint8(LIBOSCAR_COMPRESSED_GEOMETRY_STORE_VERSION);
+	dest.putUint32(size);
+	sidecar::putByteOrderMark(dest);
+	sidecar::putArray(dest, begin, offsetsOffset(), offsets);
+	for(const std::vector<uint8_t> & data : state.blockData) {
+		dest.putData(data.data(), data.size());
+	}
+	SSERIALIZE_CHEAP_ASSERT_EQUAL(dest.tellPutPtr() - begin, dataOffset(size) + blockBegin);
+	return begin;
+}
+
+}}//end namespace liboscar::Static
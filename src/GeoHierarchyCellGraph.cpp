@@ -0,0 +1,273 @@
+#include <liboscar/GeoHierarchyCellGraph.h>
+#include <sserialize/utility/exceptions.h>
+#include <sserialize/utility/VersionChecker.h>
+#include <sserialize/utility/assert.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace liboscar {
+namespace Static {
+namespace {
+
+using sidecar::OffsetType;
+using sidecar::alignOffset;
+
+constexpr OffsetType HeaderSize = 1+4+4+8+8+4;
+
+//offsets of the arrays relative to the beginning of the data
+struct ArrayOffsets {
+	OffsetType regionCellCounts;
+	OffsetType parentOffsets;
+	OffsetType directParentCounts;
+	OffsetType parents;
+	OffsetType exclusiveOffsets;
+	OffsetType exclusiveCells;
+	OffsetType end;
+	ArrayOffsets(uint32_t regionSize, uint32_t cellSize, uint64_t parentCount, uint64_t exclusiveCount) {
+		regionCellCounts = alignOffset(HeaderSize);
+		parentOffsets = alignOffset(regionCellCounts + OffsetType(regionSize)*sizeof(uint32_t));
+		directParentCounts = alignOffset(parentOffsets + (OffsetType(cellSize)+1)*sizeof(uint64_t));
+		parents = alignOffset(directParentCounts + OffsetType(cellSize)*sizeof(uint32_t));
+		exclusiveOffsets = alignOffset(parents + OffsetType(parentCount)*sizeof(uint32_t));
+		exclusiveCells = alignOffset(exclusiveOffsets + (OffsetType(regionSize)+1)*sizeof(uint64_t));
+		end = exclusiveCells + OffsetType(exclusiveCount)*sizeof(uint32_t);
+	}
+};
+
+} //end namespace
+
+GeoHierarchyCellGraph::GeoHierarchyCellGraph() {}
+
+GeoHierarchyCellGraph::GeoHierarchyCellGraph(const sserialize::UByteArrayAdapter & data) {
+	sserialize::VersionChecker::check(data, LIBOSCAR_GEO_HIERARCHY_CELL_GRAPH_VERSION, data.at(0), "GeoHierarchyCellGraph");
+	uint32_t regionSize = data.getUint32(1);
+	uint32_t cellSize = data.getUint32(5);
+	uint64_t parentCount = data.getUint64(9);
+	uint64_t exclusiveCount = data.getUint64(17);
+	ArrayOffsets offsets(regionSize, cellSize, parentCount, exclusiveCount);
+	sidecar::View view(data, HeaderSize, offsets.end, "GeoHierarchyCellGraph");
+	const uint64_t * parentOffsets = view.array<uint64_t>(offsets.parentOffsets);
+	const uint64_t * exclusiveOffsets = view.array<uint64_t>(offsets.exclusiveOffsets);
+	if (parentOffsets[cellSize] != parentCount || exclusiveOffsets[regionSize] != exclusiveCount) {
+		throw sserialize::CorruptDataException("GeoHierarchyCellGraph: invalid offsets");
+	}
+	m_regionSize = regionSize;
+	m_cellSize = cellSize;
+	m_view = view;
+	m_regionCellCounts = view.array<uint32_t>(offsets.regionCellCounts);
+	m_parentOffsets = parentOffsets;
+	m_directParentCounts = view.array<uint32_t>(offsets.directParentCounts);
+	m_parents = view.array<uint32_t>(offsets.parents);
+	m_exclusiveOffsets = exclusiveOffsets;
+	m_exclusiveCells = view.array<uint32_t>(offsets.exclusiveCells);
+}
+
+GeoHierarchyCellGraph::~GeoHierarchyCellGraph() {}
+
+sserialize::UByteArrayAdapter::OffsetType GeoHierarchyCellGraph::getSizeInBytes() const {
+	return m_view.size();
+}
+
+sserialize::ItemIndex GeoHierarchyCellGraph::regionExclusiveCells(uint32_t regionId) const {
+	return sserialize::ItemIndex(std::vector<uint32_t>(regionExclusiveCellsBegin(regionId), regionExclusiveCellsEnd(regionId)));
+}
+
+sserialize::Static::spatial::GeoHierarchy::SubSet
+GeoHierarchyCellGraph::subSet(const sserialize::Static::spatial::GeoHierarchy & gh, const sserialize::CellQueryResult & cqr, bool sparse) const {
+	using SubSet = sserialize::Static::spatial::GeoHierarchy::SubSet;
+	//the root region of the GeoHierarchy has the id regionSize
+	SubSet::Node * root = new SubSet::Node(m_regionSize, 0);
+	std::unordered_map<uint32_t, SubSet::Node*> nodes;
+	for(uint32_t i(0), s(cqr.cellCount()); i < s; ++i) {
+		uint32_t cellId = cqr.cellId(i);
+		uint32_t itemCount = cqr.idxSize(i);
+		const uint32_t * pIt = cellParentsBegin(cellId);
+		const uint32_t * pEnd = cellParentsEnd(cellId);
+		const uint32_t * directEnd = pIt + directParentsSize(cellId);
+		root->maxItemsSize() += itemCount;
+		if (!sparse || pIt == pEnd) {
+			root->cellPositions().push_back(i);
+		}
+		for(; pIt != pEnd; ++pIt) {
+			SubSet::Node* & node = nodes[*pIt];
+			if (!node) {
+				node = new SubSet::Node(*pIt, 0);
+			}
+			node->maxItemsSize() += itemCount;
+			if (!sparse || pIt < directEnd) {
+				node->cellPositions().push_back(i);
+			}
+		}
+	}
+	//All ancestors of a cell are parents of it, hence the parents of a region of the sub set are part of the sub set as well.
+	//Regions that are not the child of any other region are children of the root.
+	std::vector<uint32_t> regions;
+	regions.reserve(nodes.size());
+	for(const auto & x : nodes) {
+		regions.push_back(x.first);
+	}
+	std::sort(regions.begin(), regions.end());
+	std::unordered_set<uint32_t> children;
+	for(uint32_t rId : regions) {
+		SubSet::Node * node = nodes[rId];
+		sserialize::Static::spatial::GeoHierarchy::Region r(gh.region(rId));
+		for(uint32_t i(0), s(r.childrenSize()); i < s; ++i) {
+			auto it = nodes.find(r.child(i));
+			if (it != nodes.end()) {
+				node->push_back(SubSet::NodePtr(it->second));
+				children.insert(it->first);
+			}
+		}
+	}
+	for(uint32_t rId : regions) {
+		if (!children.count(rId)) {
+			root->push_back(SubSet::NodePtr(nodes[rId]));
+		}
+	}
+	return SubSet(root, gh, cqr, sparse);
+}
+
+sserialize::UByteArrayAdapter::OffsetType
+GeoHierarchyCellGraph::create(
+	const sserialize::Static::spatial::GeoHierarchy & gh,
+	const sserialize::Static::ItemIndexStore & idxStore,
+	sserialize::UByteArrayAdapter & dest,
+	uint32_t threadCount)
+{
+	struct State {
+		static constexpr uint32_t BlockSize = 1024;
+		const sserialize::Static::spatial::GeoHierarchy & gh;
+		const sserialize::Static::ItemIndexStore & idxStore;
+		uint32_t regionSize;
+		uint32_t cellSize;
+		std::atomic<uint32_t> cellPos{0};
+		std::atomic<uint32_t> regionPos{0};
+		//direct parents first
+		std::vector< std::vector<uint32_t> > parents;
+		std::vector<uint32_t> directParentCounts;
+		std::vector<uint32_t> regionCellCounts;
+		State(const sserialize::Static::spatial::GeoHierarchy & gh, const sserialize::Static::ItemIndexStore & idxStore) :
+		gh(gh),
+		idxStore(idxStore),
+		regionSize(gh.regionSize()),
+		cellSize(gh.cellSize()),
+		parents(cellSize),
+		directParentCounts(cellSize, 0),
+		regionCellCounts(regionSize, 0)
+		{}
+	};
+	struct Worker {
+		State * state;
+		std::vector<uint32_t> direct;
+		std::vector<uint32_t> indirect;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			processCells();
+			processRegions();
+		}
+		void processCells() {
+			while (true) {
+				uint32_t p = state->cellPos.fetch_add(State::BlockSize, std::memory_order_relaxed);
+				if (p >= state->cellSize) {
+					break;
+				}
+				for(uint32_t end(std::min(p+State::BlockSize, state->cellSize)); p < end; ++p) {
+					processCell(p);
+				}
+			}
+		}
+		void processCell(uint32_t cellId) {
+			const sserialize::Static::spatial::GeoHierarchy & gh = state->gh;
+			std::vector<uint32_t> & parents = state->parents[cellId];
+			for(uint32_t cP(gh.cellParentsBegin(cellId)), cE(gh.cellParentsEnd(cellId)); cP != cE; ++cP) {
+				uint32_t rId = gh.cellPtr(cP);
+				if (rId < state->regionSize) {
+					parents.push_back(rId);
+				}
+			}
+			std::sort(parents.begin(), parents.end());
+			parents.erase(std::unique(parents.begin(), parents.end()), parents.end());
+			//a parent is a direct parent if none of its children contains the cell
+			direct.clear();
+			indirect.clear();
+			for(uint32_t rId : parents) {
+				sserialize::Static::spatial::GeoHierarchy::Region r(gh.region(rId));
+				bool isDirect = true;
+				for(uint32_t i(0), s(r.childrenSize()); i < s && isDirect; ++i) {
+					isDirect = !std::binary_search(parents.begin(), parents.end(), r.child(i));
+				}
+				(isDirect ? direct : indirect).push_back(rId);
+			}
+			state->directParentCounts[cellId] = direct.size();
+			parents.assign(direct.begin(), direct.end());
+			parents.insert(parents.end(), indirect.begin(), indirect.end());
+		}
+		void processRegions() {
+			while (true) {
+				uint32_t p = state->regionPos.fetch_add(State::BlockSize, std::memory_order_relaxed);
+				if (p >= state->regionSize) {
+					break;
+				}
+				for(uint32_t end(std::min(p+State::BlockSize, state->regionSize)); p < end; ++p) {
+					state->regionCellCounts[p] = state->idxStore.idxSize(state->gh.regionCellIdxPtr(p));
+				}
+			}
+		}
+	};
+	State state(gh, idxStore);
+	sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+
+	uint32_t regionSize = state.regionSize;
+	uint32_t cellSize = state.cellSize;
+	std::vector<uint64_t> parentOffsets;
+	parentOffsets.reserve(OffsetType(cellSize)+1);
+	parentOffsets.push_back(0);
+	std::vector<uint64_t> exclusiveOffsets(OffsetType(regionSize)+1, 0);
+	for(uint32_t cellId(0); cellId < cellSize; ++cellId) {
+		const std::vector<uint32_t> & parents = state.parents[cellId];
+		parentOffsets.push_back(parentOffsets.back() + parents.size());
+		for(uint32_t i(0); i < state.directParentCounts[cellId]; ++i) {
+			exclusiveOffsets[parents[i]+1] += 1;
+		}
+	}
+	for(uint32_t i(0); i < regionSize; ++i) {
+		exclusiveOffsets[i+1] += exclusiveOffsets[i];
+	}
+	//cells are visited in ascending order, hence the exclusive cells of each region are sorted
+	std::vector<uint32_t> exclusiveCells(exclusiveOffsets.back());
+	{
+		std::vector<uint64_t> pos(exclusiveOffsets.begin(), exclusiveOffsets.end()-1);
+		for(uint32_t cellId(0); cellId < cellSize; ++cellId) {
+			const std::vector<uint32_t> & parents = state.parents[cellId];
+			for(uint32_t i(0); i < state.directParentCounts[cellId]; ++i) {
+				exclusiveCells[pos[parents[i]]++] = cellId;
+			}
+		}
+	}
+
+	ArrayOffsets offsets(regionSize, cellSize, parentOffsets.back(), exclusiveCells.size());
+	OffsetType begin = dest.tellPutPtr();
+	dest.putUint8(LIBOSCAR_GEO_HIERARCHY_CELL_GRAPH_VERSION);
+	dest.putUint32(regionSize);
+	dest.putUint32(cellSize);
+	dest.putUint64(parentOffsets.back());
+	dest.putUint64(exclusiveCells.size());
+	sidecar::putByteOrderMark(dest);
+	sidecar::putArray(dest, begin, offsets.regionCellCounts, state.regionCellCounts);
+	sidecar::putArray(dest, begin, offsets.parentOffsets, parentOffsets);
+	sidecar::putArray(dest, begin, offsets.directParentCounts, state.directParentCounts);
+	sidecar::putPadding(dest, begin, offsets.parents);
+	for(const std::vector<uint32_t> & parents : state.parents) {
+		dest.putData(reinterpret_cast<const uint8_t*>(parents.data()), OffsetType(parents.size())*sizeof(uint32_t));
+	}
+	sidecar::putArray(dest, begin, offsets.exclusiveOffsets, exclusiveOffsets);
+	sidecar::putArray(dest, begin, offsets.exclusiveCells, exclusiveCells);
+	SSERIALIZE_CHEAP_ASSERT_EQUAL(dest.tellPutPtr() - begin, offsets.end);
+	return begin;
+}
+
+}}//end namespace liboscar::Static
@@ -0,0 +1,213 @@
+#include <liboscar/ItemRTree.h>
+#include <liboscar/OsmKeyValueObjectStore.h>
+#include <liboscar/HilbertCurve.h>
+#include <sserialize/utility/exceptions.h>
+#include <sserialize/utility/VersionChecker.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <atomic>
+
+namespace liboscar {
+namespace Static {
+namespace {
+
+using sidecar::OffsetType;
+using sidecar::alignOffset;
+
+constexpr OffsetType HeaderSize = 1+4+4+4+4;
+
+//offsets of the arrays relative to the beginning of the data
+struct ArrayOffsets {
+	OffsetType levelEnds;
+	OffsetType minLat;
+	OffsetType maxLat;
+	OffsetType minLon;
+	OffsetType maxLon;
+	OffsetType index;
+	OffsetType end;
+	ArrayOffsets(uint32_t entryCount, uint32_t levelCount) {
+		levelEnds = alignOffset(HeaderSize);
+		minLat = alignOffset(levelEnds + OffsetType(levelCount)*sizeof(uint32_t));
+		maxLat = alignOffset(minLat + OffsetType(entryCount)*sizeof(int32_t));
+		minLon = alignOffset(maxLat + OffsetType(entryCount)*sizeof(int32_t));
+		maxLon = alignOffset(minLon + OffsetType(entryCount)*sizeof(int32_t));
+		index = alignOffset(maxLon + OffsetType(entryCount)*sizeof(int32_t));
+		end = index + OffsetType(entryCount)*sizeof(uint32_t);
+	}
+};
+
+struct Entry {
+	uint64_t hilbert;
+	int32_t minLat;
+	int32_t maxLat;
+	int32_t minLon;
+	int32_t maxLon;
+	uint32_t itemId;
+	inline bool valid() const { return minLat <= maxLat; }
+};
+
+} //end namespace
+
+constexpr uint32_t ItemRTree::NodeSize;
+constexpr uint32_t ItemRTree::MaxLevelCount;
+
+ItemRTree::ItemRTree() {}
+
+ItemRTree::ItemRTree(const sserialize::UByteArrayAdapter & data) {
+	sserialize::VersionChecker::check(data, LIBOSCAR_ITEM_RTREE_VERSION, data.at(0), "ItemRTree");
+	uint32_t size = data.getUint32(1);
+	uint32_t entryCount = data.getUint32(5);
+	uint32_t levelCount = data.getUint32(9);
+	if (levelCount > MaxLevelCount || (entryCount && !levelCount) || (!entryCount && levelCount)) {
+		throw sserialize::CorruptDataException("ItemRTree: invalid level count");
+	}
+	ArrayOffsets offsets(entryCount, levelCount);
+	m_view = sidecar::View(data, HeaderSize, offsets.end, "ItemRTree");
+	m_size = size;
+	m_entryCount = entryCount;
+	m_levelCount = levelCount;
+	m_levelEnds = m_view.array<uint32_t>(offsets.levelEnds);
+	m_minLat = m_view.array<int32_t>(offsets.minLat);
+	m_maxLat = m_view.array<int32_t>(offsets.maxLat);
+	m_minLon = m_view.array<int32_t>(offsets.minLon);
+	m_maxLon = m_view.array<int32_t>(offsets.maxLon);
+	m_index = m_view.array<uint32_t>(offsets.index);
+	if (m_levelCount) {
+		uint32_t rootLevelBegin = (m_levelCount > 1 ? m_levelEnds[m_levelCount-2] : 0);
+		if (m_levelEnds[0] != m_size || m_levelEnds[m_levelCount-1] != m_entryCount || m_entryCount - rootLevelBegin != 1) {
+			throw sserialize::CorruptDataException("ItemRTree: invalid level ends");
+		}
+	}
+}
+
+ItemRTree::~ItemRTree() {}
+
+sserialize::UByteArrayAdapter::OffsetType ItemRTree::getSizeInBytes() const {
+	return m_view.size();
+}
+
+sserialize::spatial::GeoRect ItemRTree::boundary() const {
+	if (!m_entryCount) {
+		return sserialize::spatial::GeoRect();
+	}
+	uint32_t root = m_entryCount-1;
+	double s = OsmKeyValueObjectStoreColumns::CoordinateScale;
+	return sserialize::spatial::GeoRect(m_minLat[root]/s, m_maxLat[root]/s, m_minLon[root]/s, m_maxLon[root]/s);
+}
+
+std::vector<uint32_t> ItemRTree::candidates(const sserialize::spatial::GeoRect & rect) const {
+	std::vector<uint32_t> result;
+	visit(QuantizedRect(rect), [&result](uint32_t itemId, bool) {
+		result.push_back(itemId);
+	});
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+sserialize::UByteArrayAdapter::OffsetType
+ItemRTree::create(const OsmKeyValueObjectStore & store, sserialize::UByteArrayAdapter & dest, uint32_t threadCount) {
+	struct State {
+		const OsmKeyValueObjectStore & store;
+		std::atomic<uint32_t> pos{0};
+		std::vector<Entry> entries;
+		State(const OsmKeyValueObjectStore & store) : store(store), entries(store.size()) {}
+	};
+	struct Worker {
+		static constexpr uint32_t BlockSize = 1000;
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			const OsmKeyValueObjectStoreColumns & columns = state->store.columns();
+			uint32_t size = state->store.size();
+			while (true) {
+				uint32_t p = state->pos.fetch_add(BlockSize, std::memory_order_relaxed);
+				if (p >= size) {
+					break;
+				}
+				for(uint32_t end(std::min(p+BlockSize, size)); p < end; ++p) {
+					Entry & e = state->entries[p];
+					e.itemId = p;
+					if (columns.valid()) {
+						const OsmKeyValueObjectStoreColumns::BBoxColumns & bboxes = columns.bboxes();
+						e.minLat = bboxes.minLat[p];
+						e.maxLat = bboxes.maxLat[p];
+						e.minLon = bboxes.minLon[p];
+						e.maxLon = bboxes.maxLon[p];
+					}
+					else {
+						sserialize::Static::spatial::GeoShape shape(state->store.geoShape(p));
+						if (shape.type() != sserialize::spatial::GS_NONE) {
+							sserialize::spatial::GeoRect rect(shape.boundary());
+							e.minLat = OsmKeyValueObjectStoreColumns::quantizeLower(rect.minLat());
+							e.maxLat = OsmKeyValueObjectStoreColumns::quantizeUpper(rect.maxLat());
+							e.minLon = OsmKeyValueObjectStoreColumns::quantizeLower(rect.minLon());
+							e.maxLon = OsmKeyValueObjectStoreColumns::quantizeUpper(rect.maxLon());
+						}
+						else {
+							e.minLat = e.minLon = 1;
+							e.maxLat = e.maxLon = 0;
+						}
+					}
+					if (e.valid()) {
+						e.hilbert = detail::HilbertCurve::index(e.minLat, e.maxLat, e.minLon, e.maxLon);
+					}
+				}
+			}
+		}
+	};
+	State state(store);
+	sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+
+	std::vector<Entry> & entries = state.entries;
+	entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entry & e) { return !e.valid(); }), entries.end());
+	std::sort(entries.begin(), entries.end(), [](const Entry & a, const Entry & b) {
+		return a.hilbert < b.hilbert || (a.hilbert == b.hilbert && a.itemId < b.itemId);
+	});
+
+	uint32_t size = (uint32_t) entries.size();
+	std::vector<int32_t> minLat, maxLat, minLon, maxLon;
+	std::vector<uint32_t> index, levelEnds;
+	for(const Entry & e : entries) {
+		minLat.push_back(e.minLat);
+		maxLat.push_back(e.maxLat);
+		minLon.push_back(e.minLon);
+		maxLon.push_back(e.maxLon);
+		index.push_back(e.itemId);
+	}
+	entries = std::vector<Entry>();
+	if (size) {
+		levelEnds.push_back(size);
+	}
+	//build the next level until it only consists of the root
+	for(uint32_t begin(0), end(size); end - begin > 1; begin = end, end = (uint32_t) index.size(), levelEnds.push_back(end)) {
+		for(uint32_t i(begin); i < end; i += NodeSize) {
+			uint32_t nodeEnd = std::min(i + NodeSize, end);
+			minLat.push_back(*std::min_element(minLat.begin()+i, minLat.begin()+nodeEnd));
+			maxLat.push_back(*std::max_element(maxLat.begin()+i, maxLat.begin()+nodeEnd));
+			minLon.push_back(*std::min_element(minLon.begin()+i, minLon.begin()+nodeEnd));
+			maxLon.push_back(*std::max_element(maxLon.begin()+i, maxLon.begin()+nodeEnd));
+			index.push_back(i);
+		}
+	}
+	uint32_t entryCount = (uint32_t) index.size();
+	uint32_t levelCount = (uint32_t) levelEnds.size();
+	SSERIALIZE_CHEAP_ASSERT_SMALLER_OR_EQUAL(levelCount, MaxLevelCount);
+
+	ArrayOffsets offsets(entryCount, levelCount);
+	OffsetType begin = dest.tellPutPtr();
+	dest.putUint8(LIBOSCAR_ITEM_RTREE_VERSION);
+	dest.putUint32(size);
+	dest.putUint32(entryCount);
+	dest.putUint32(levelCount);
+	sidecar::putByteOrderMark(dest);
+	sidecar::putArray(dest, begin, offsets.levelEnds, levelEnds);
+	sidecar::putArray(dest, begin, offsets.minLat, minLat);
+	sidecar::putArray(dest, begin, offsets.maxLat, maxLat);
+	sidecar::putArray(dest, begin, offsets.minLon, minLon);
+	sidecar::putArray(dest, begin, offsets.maxLon, maxLon);
+	sidecar::putArray(dest, begin, offsets.index, index);
+	SSERIALIZE_CHEAP_ASSERT_EQUAL(dest.tellPutPtr() - begin, offsets.end);
+	return begin;
+}
+
+}}//end namespace liboscar::Static
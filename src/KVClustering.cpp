@@ -28,7 +28,8 @@ KeyExclusions::KeyRange::merge(const KeyRange & other) const {
 }
 
 KeyExclusions::KeyExclusions(const KeyStringTable & kst) :
-m_kst(kst)
+m_kst(kst),
+m_bitmap(std::make_shared<std::vector<uint64_t>>())
 {}
 KeyExclusions::~KeyExclusions()
 {}
@@ -77,6 +78,7 @@ KeyExclusions KeyExclusions::operator+(const KeyExclusions & other) const {
 	KeyExclusions result(m_kst);
 	result.m_keyRange.insert(result.m_keyRange.end(), m_keyRange.begin(), m_keyRange.end());
 	result.m_keyRange.insert(result.m_keyRange.end(), other.m_keyRange.begin(), other.m_keyRange.end());
+	result.m_valid = !result.m_keyRange.size();
 	if (m_valid || other.m_valid) {
 		result.preprocess();
 	}
@@ -85,7 +87,11 @@ KeyExclusions KeyExclusions::operator+(const KeyExclusions & other) const {
 
 void
 KeyExclusions::preprocess() {
+	if (m_valid) {
+		return;
+	}
 	if (!m_keyRange.size()) {
+		m_bitmap = std::make_shared<std::vector<uint64_t>>();
 		m_valid = true;
 		return;
 	}
@@ -114,6 +120,14 @@ KeyExclusions::preprocess() {
 		}
 	}
 	m_keyRange = std::move(tmp);
+	
+	auto bitmap = std::make_shared<std::vector<uint64_t>>((m_keyRange.back().end+63)/64, 0);
+	for(const KeyRange & kr : m_keyRange) {
+		for(uint32_t keyId(kr.begin); keyId < kr.end; ++keyId) {
+			(*bitmap)[keyId/64] |= uint64_t(1) << (keyId%64);
+		}
+	}
+	m_bitmap = std::move(bitmap);
 	m_valid = true;
 }
 
@@ -122,16 +136,9 @@ KeyExclusions::hasExceptions() const {
 	return m_keyRange.size();
 }
 
-bool
-KeyExclusions::contains(uint32_t keyId) const {
-	if (!m_valid) {
-		throw sserialize::InvalidAlgorithmStateException("ExceptionList: needs preprocessing");
-	}
-	auto cmp = [](const KeyRange & kr, uint32_t keyId) {
-		return kr.end < keyId;
-	};
-	auto lb = std::lower_bound(m_keyRange.begin(), m_keyRange.end(), keyId, cmp);
-	return lb != m_keyRange.end() && lb->contains(keyId);
+void
+KeyExclusions::throwNotPreprocessed() {
+	throw sserialize::InvalidAlgorithmStateException("ExceptionList: needs preprocessing");
 }
 
 KeyValueExclusions::KeyValueExclusions(const KeyStringTable & kst, const ValueStringTable & vst) :
@@ -157,13 +164,19 @@ KeyValueExclusions::add(const std::string & key, const std::string & value) {
 
 void
 KeyValueExclusions::add(uint32_t keyId, uint32_t valueId) {
-	m_keyValues.emplace(keyId, valueId);
+	if (m_keyValues.emplace(keyId, valueId).second) {
+		m_compiled.reset();
+	}
 }
 
 
 void
 KeyValueExclusions::add(const KeyValueExclusions & other) {
+	std::size_t size = m_keyValues.size();
 	m_keyValues.insert(other.m_keyValues.begin(), other.m_keyValues.end());
+	if (size != m_keyValues.size()) {
+		m_compiled.reset();
+	}
 }
 
 KeyValueExclusions KeyValueExclusions::operator+(const KeyValueExclusions & other) const {
@@ -175,17 +188,64 @@ KeyValueExclusions KeyValueExclusions::operator+(const KeyValueExclusions & othe
 	KeyValueExclusions result(m_kst, m_vst);
 	result.m_keyValues = m_keyValues;
 	result.m_keyValues.insert(other.m_keyValues.begin(), other.m_keyValues.end());
+	if (m_compiled || other.m_compiled) {
+		result.preprocess();
+	}
 	return result;
 }
 
+void
+KeyValueExclusions::preprocess() {
+	if (m_compiled) {
+		return;
+	}
+	std::vector<KeyValue> kvs(m_keyValues.begin(), m_keyValues.end());
+	std::sort(kvs.begin(), kvs.end());
+	
+	auto compiled = std::make_shared<Compiled>();
+	if (kvs.size()) {
+		compiled->keys.resize(kvs.back().first/64+1, 0);
+	}
+	for(auto it(kvs.begin()), end(kvs.end()); it != end;) {
+		uint32_t keyId = it->first;
+		auto keyEnd = std::find_if(it, end, [keyId](const KeyValue & kv) { return kv.first != keyId; });
+		//values of a key are sorted
+		Compiled::ValueRange vr;
+		vr.begin = it->second;
+		vr.last = (keyEnd-1)->second;
+		vr.size = uint32_t(keyEnd - it);
+		uint64_t words = (uint64_t(vr.last-vr.begin)+64)/64;
+		//few values spread over a large range would need a huge bitmap
+		vr.sparse = words > Compiled::MaxBitmapWordsPerValue*vr.size;
+		if (vr.sparse) {
+			vr.offset = compiled->sparseValues.size();
+			for(; it != keyEnd; ++it) {
+				compiled->sparseValues.push_back(it->second);
+			}
+		}
+		else {
+			vr.offset = compiled->values.size()*64;
+			compiled->values.resize(compiled->values.size() + words, 0);
+			for(; it != keyEnd; ++it) {
+				uint64_t pos = vr.offset + (it->second - vr.begin);
+				compiled->values[pos/64] |= uint64_t(1) << (pos%64);
+			}
+		}
+		compiled->keys[keyId/64] |= uint64_t(1) << (keyId%64);
+		compiled->valueRanges.push_back(vr);
+	}
+	compiled->keyRank.resize(compiled->keys.size());
+	uint32_t rank = 0;
+	for(std::size_t i(0), s(compiled->keys.size()); i < s; ++i) {
+		compiled->keyRank[i] = rank;
+		rank += __builtin_popcountll(compiled->keys[i]);
+	}
+	m_compiled = std::move(compiled);
+}
+
 bool
 KeyValueExclusions::hasExceptions() const {
 	return m_keyValues.size();
 }
 
-bool
-KeyValueExclusions::contains(uint32_t keyId, uint32_t valueId) const {
-	return m_keyValues.count(std::make_pair(keyId, valueId));
-}
-	
 }} //end namespace liboscar::kvclustering
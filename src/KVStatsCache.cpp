@@ -0,0 +1,192 @@
+#include <liboscar/KVStatsCache.h>
+#include <algorithm>
+#include <limits>
+
+namespace liboscar {
+namespace {
+
+//splitmix64 finalizer
+inline uint64_t mix(uint64_t x) {
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+inline uint64_t hashCombine(uint64_t seed, uint64_t v) {
+	return mix(seed ^ (v + 0x9E3779B97F4A7C15ULL + (seed << 6) + (seed >> 2)));
+}
+
+//memory of a list node and a map node with the pointers to their neighbours
+constexpr std::size_t EntryOverhead = 4*sizeof(void*);
+
+} //end namespace
+
+KVStatsCache::KVStatsCache(const Static::OsmKeyValueObjectStore & store, std::size_t byteBudget, uint64_t dataset) :
+m_kvstats(store),
+m_dataset(dataset),
+m_byteBudget(byteBudget)
+{}
+
+KVStatsCache::~KVStatsCache() {}
+
+KVStatsCache::StatsPtr
+KVStatsCache::stats(const sserialize::CellQueryResult & cqr, uint32_t threadCount) {
+	Key k = key(cqr, m_dataset);
+	StatsPtr result = find(k);
+	if (result) {
+		return result;
+	}
+	return insert(std::move(k), m_kvstats.stats(cqr, threadCount));
+}
+
+KVStatsCache::StatsPtr
+KVStatsCache::difference(const sserialize::CellQueryResult & a, const sserialize::CellQueryResult & b, uint32_t threadCount) {
+	if (!subset(a, b)) {
+		return stats(a - b, threadCount);
+	}
+	StatsPtr sa = stats(a, threadCount);
+	StatsPtr sb = stats(b, threadCount);
+	return std::make_shared<Stats>(m_kvstats.difference(*sa, *sb));
+}
+
+std::size_t KVStatsCache::Key::byteSize() const {
+	return sizeof(Key) + cellIds.capacity()*sizeof(uint32_t) + fullMatch.capacity()/8;
+}
+
+KVStatsCache::Key
+KVStatsCache::key(const sserialize::CellQueryResult & cqr, uint64_t dataset) {
+	Key k;
+	k.dataset = dataset;
+	k.cellIds.reserve(cqr.cellCount());
+	k.fullMatch.reserve(cqr.cellCount());
+	uint64_t cells = 0;
+	for(uint32_t i(0), s(cqr.cellCount()); i < s; ++i) {
+		bool fullMatch = cqr.fullMatch(i);
+		uint32_t idxSize = cqr.idxSize(i);
+		k.cellIds.push_back(cqr.cellId(i));
+		k.fullMatch.push_back(fullMatch);
+		cells = hashCombine(cells, (uint64_t(cqr.cellId(i)) << 1) | uint64_t(fullMatch));
+		k.itemCount += idxSize;
+		if (fullMatch) {
+			continue;
+		}
+		uint64_t h = hashCombine(i, idxSize);
+		if (cqr.fetched(i)) {
+			for(uint32_t itemId : cqr.idx(i)) {
+				h = hashCombine(h, itemId);
+			}
+		}
+		else {
+			h = hashCombine(h, cqr.idxId(i));
+		}
+		k.partialMatches = hashCombine(k.partialMatches, h);
+	}
+	k.hash = hashCombine(hashCombine(hashCombine(cells, k.partialMatches), k.itemCount), dataset);
+	return k;
+}
+
+bool
+KVStatsCache::subset(const sserialize::CellQueryResult & a, const sserialize::CellQueryResult & b) {
+	//cells are sorted by their id
+	uint32_t ai = 0;
+	uint32_t as = a.cellCount();
+	for(uint32_t bi(0), bs(b.cellCount()); bi < bs; ++bi) {
+		uint32_t cellId = b.cellId(bi);
+		for(; ai < as && a.cellId(ai) < cellId; ++ai) {}
+		if (ai >= as || a.cellId(ai) != cellId) {
+			return false;
+		}
+		if (a.fullMatch(ai)) {
+			continue;
+		}
+		if (b.fullMatch(bi)) {
+			return false;
+		}
+		sserialize::ItemIndex aIdx(a.idx(ai));
+		sserialize::ItemIndex bIdx(b.idx(bi));
+		if (!std::includes(aIdx.begin(), aIdx.end(), bIdx.begin(), bIdx.end())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void KVStatsCache::setByteBudget(std::size_t byteBudget) {
+	std::lock_guard<std::mutex> lck(m_lock);
+	m_byteBudget = byteBudget;
+	evict();
+}
+
+std::size_t KVStatsCache::byteBudget() const {
+	std::lock_guard<std::mutex> lck(m_lock);
+	return m_byteBudget;
+}
+
+std::size_t KVStatsCache::byteSize() const {
+	std::lock_guard<std::mutex> lck(m_lock);
+	return m_byteSize;
+}
+
+std::size_t KVStatsCache::size() const {
+	std::lock_guard<std::mutex> lck(m_lock);
+	return m_entries.size();
+}
+
+std::size_t KVStatsCache::hits() const {
+	std::lock_guard<std::mutex> lck(m_lock);
+	return m_hits;
+}
+
+std::size_t KVStatsCache::misses() const {
+	std::lock_guard<std::mutex> lck(m_lock);
+	return m_misses;
+}
+
+void KVStatsCache::clear() {
+	std::lock_guard<std::mutex> lck(m_lock);
+	m_entries.clear();
+	m_entryMap.clear();
+	m_byteSize = 0;
+}
+
+KVStatsCache::StatsPtr
+KVStatsCache::find(const Key & key) {
+	std::lock_guard<std::mutex> lck(m_lock);
+	auto it = m_entryMap.find(&key);
+	if (it == m_entryMap.end()) {
+		++m_misses;
+		return StatsPtr();
+	}
+	++m_hits;
+	m_entries.splice(m_entries.begin(), m_entries, it->second);
+	return it->second->stats;
+}
+
+KVStatsCache::StatsPtr
+KVStatsCache::insert(Key && key, Stats && stats) {
+	StatsPtr result = std::make_shared<Stats>(std::move(stats));
+	std::size_t byteSize = sizeof(Entry) + EntryOverhead + key.byteSize() + result->memoryUsage();
+	std::lock_guard<std::mutex> lck(m_lock);
+	if (m_entryMap.count(&key)) { //computed concurrently by another thread
+		return result;
+	}
+	if (byteSize > m_byteBudget) {
+		return result;
+	}
+	m_entries.push_front(Entry{std::move(key), result, byteSize});
+	m_entryMap[&m_entries.front().key] = m_entries.begin();
+	m_byteSize += byteSize;
+	evict();
+	return result;
+}
+
+void KVStatsCache::evict() {
+	while (m_byteSize > m_byteBudget && m_entries.size()) {
+		const Entry & e = m_entries.back();
+		m_byteSize -= e.byteSize;
+		m_entryMap.erase(&e.key);
+		m_entries.pop_back();
+	}
+}
+
+}//end namespace liboscar
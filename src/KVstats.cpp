@@ -1,6 +1,10 @@
 #include <liboscar/KVStats.h>
 #include <sserialize/mt/ThreadPool.h>
 
+#include <array>
+#include <cmath>
+#include <random>
+
 
 namespace liboscar {
 namespace detail {
@@ -19,6 +23,29 @@ keyValueCount(other.keyValueCount.begin(), other.keyValueCount.end())
 	other.keyValueCount.clear();
 }
 
+SortedData::SortedData(const Stats & stats) {
+	for(auto it(stats.keysBegin()), end(stats.keysEnd()); it != end; ++it) {
+		for(const ValueInfo & vi : it->values) {
+			keyValueCount.emplace_back(KeyValue(it->keyId, vi.valueId), vi.count);
+		}
+	}
+	std::sort(keyValueCount.begin(), keyValueCount.end(), [](const KeyValueCount & a, const KeyValueCount & b) {
+		return a.first < b.first;
+	});
+}
+
+SortedData::SortedData(PackedData && other) {
+	auto & kvs = other.keyValues;
+	SSERIALIZE_NORMAL_ASSERT(std::is_sorted(kvs.begin(), kvs.end()));
+	for(auto it(kvs.begin()), end(kvs.end()); it != end;) {
+		uint64_t kv = *it;
+		auto runEnd = std::find_if(it, end, [kv](uint64_t x) { return x != kv; });
+		keyValueCount.emplace_back(KeyValue(unpackKeyId(kv), unpackValueId(kv)), uint32_t(runEnd - it));
+		it = runEnd;
+	}
+	kvs.clear();
+}
+
 SortedData::SortedData(SortedData && other) :
 keyValueCount(std::move(other.keyValueCount))
 {}
@@ -55,6 +82,223 @@ SortedData SortedData::merge(SortedData && first, SortedData && second) {
 	return result;
 }
 
+SortedData SortedData::merge(std::vector<SortedData> && runs, uint32_t threadCount) {
+	using Iterator = KeyValueCountContainer::const_iterator;
+	using Range = std::pair<Iterator, Iterator>;
+	//number of samples per partition taken to compute the splitters
+	constexpr std::size_t Oversampling = 32;
+	//partitions smaller than this are not worth a thread
+	constexpr std::size_t MinPartitionSize = 1024*64;
+	//marks exhausted ranges in the tournament tree
+	static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+	
+	runs.erase(std::remove_if(runs.begin(), runs.end(), [](const SortedData & x) {
+		return x.keyValueCount.empty();
+	}), runs.end());
+	
+	if (!runs.size()) {
+		return SortedData();
+	}
+	if (runs.size() == 1) {
+		return std::move(runs.front());
+	}
+	
+	std::size_t totalSize = 0;
+	for(const SortedData & run : runs) {
+		totalSize += run.keyValueCount.size();
+	}
+	threadCount = std::max<uint32_t>(1, std::min<std::size_t>(threadCount, totalSize/MinPartitionSize));
+	
+	//sample splitters, every run contributes samples according to its size
+	std::vector<KeyValue> splitters;
+	if (threadCount > 1) {
+		std::size_t sampleCount = threadCount*Oversampling;
+		for(const SortedData & run : runs) {
+			const KeyValueCountContainer & kvc = run.keyValueCount;
+			std::size_t runSamples = 1 + (sampleCount*kvc.size())/totalSize;
+			for(std::size_t i(1); i <= runSamples; ++i) {
+				splitters.emplace_back(kvc[(i*kvc.size())/(runSamples+1)].first);
+			}
+		}
+		std::sort(splitters.begin(), splitters.end());
+		std::vector<KeyValue> tmp;
+		for(uint32_t i(1); i < threadCount; ++i) {
+			tmp.emplace_back(splitters[(i*splitters.size())/threadCount]);
+		}
+		tmp.resize(std::unique(tmp.begin(), tmp.end()) - tmp.begin());
+		splitters = std::move(tmp);
+	}
+	
+	//partition i contains the key-value pairs in [splitters[i-1], splitters[i])
+	std::vector< std::vector<Range> > partitions(splitters.size()+1);
+	for(const SortedData & run : runs) {
+		const KeyValueCountContainer & kvc = run.keyValueCount;
+		Iterator begin = kvc.cbegin();
+		for(std::size_t i(0), s(splitters.size()); i < s; ++i) {
+			Iterator end = std::lower_bound(begin, kvc.cend(), splitters[i], [](const KeyValueCount & a, const KeyValue & b) {
+				return a.first < b;
+			});
+			partitions[i].emplace_back(begin, end);
+			begin = end;
+		}
+		partitions.back().emplace_back(begin, kvc.cend());
+	}
+	
+	///Tournament tree over the heads of the ranges of a partition
+	///Advancing the winner only replays the matches on the path from its leaf to the root
+	class Tournament {
+	public:
+		Tournament(std::vector<Range> & ranges) :
+		m_ranges(ranges),
+		m_leafCount(1)
+		{
+			while (m_leafCount < m_ranges.size()) {
+				m_leafCount *= 2;
+			}
+			m_tree.resize(2*m_leafCount, npos);
+			for(uint32_t i(0), s(m_ranges.size()); i < s; ++i) {
+				if (m_ranges[i].first != m_ranges[i].second) {
+					m_tree[m_leafCount+i] = i;
+				}
+			}
+			for(uint32_t i(m_leafCount-1); i > 0; --i) {
+				m_tree[i] = match(m_tree[2*i], m_tree[2*i+1]);
+			}
+		}
+		inline bool empty() const { return m_tree[1] == npos; }
+		inline Range & winner() { return m_ranges[m_tree[1]]; }
+		void next() {
+			uint32_t w = m_tree[1];
+			Range & r = m_ranges[w];
+			++r.first;
+			uint32_t i = m_leafCount+w;
+			if (r.first == r.second) {
+				m_tree[i] = npos;
+			}
+			for(i /= 2; i > 0; i /= 2) {
+				m_tree[i] = match(m_tree[2*i], m_tree[2*i+1]);
+			}
+		}
+	private:
+		///exhausted ranges always lose
+		inline uint32_t match(uint32_t a, uint32_t b) const {
+			if (a == npos) {
+				return b;
+			}
+			if (b == npos) {
+				return a;
+			}
+			return (m_ranges[b].first->first < m_ranges[a].first->first ? b : a);
+		}
+	private:
+		std::vector<Range> & m_ranges;
+		uint32_t m_leafCount;
+		std::vector<uint32_t> m_tree;
+	};
+	
+	struct State {
+		std::vector< std::vector<Range> > & partitions;
+		std::vector<KeyValueCountContainer> results;
+		std::vector<std::size_t> resultOffsets;
+		KeyValueCountContainer * dest{nullptr};
+		std::atomic<std::size_t> partition{0};
+		State(std::vector< std::vector<Range> > & partitions) : partitions(partitions), results(partitions.size()) {}
+	};
+	
+	struct Worker {
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			while(true) {
+				std::size_t p = state->partition.fetch_add(1, std::memory_order_relaxed);
+				if (p >= state->partitions.size()) {
+					break;
+				}
+				process(state->partitions[p], state->results[p]);
+			}
+		}
+		void process(std::vector<Range> & ranges, KeyValueCountContainer & dest) {
+			std::size_t size = 0;
+			for(const Range & r : ranges) {
+				size = std::max<std::size_t>(size, r.second - r.first);
+			}
+			dest.reserve(size);
+			for(Tournament t(ranges); !t.empty(); t.next()) {
+				const KeyValueCount & x = *t.winner().first;
+				if (dest.size() && dest.back().first == x.first) {
+					dest.back().second += x.second;
+				}
+				else {
+					dest.emplace_back(x);
+				}
+			}
+		}
+	};
+	
+	///copy the merged partitions to their final position
+	struct CopyWorker {
+		State * state;
+		CopyWorker(State * state) : state(state) {}
+		CopyWorker(const CopyWorker & other) : state(other.state) {}
+		void operator()() {
+			while(true) {
+				std::size_t p = state->partition.fetch_add(1, std::memory_order_relaxed);
+				if (p >= state->results.size()) {
+					break;
+				}
+				KeyValueCountContainer & src = state->results[p];
+				std::copy(src.begin(), src.end(), state->dest->begin()+state->resultOffsets[p]);
+				src = KeyValueCountContainer();
+			}
+		}
+	};
+	
+	State state(partitions);
+	sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	runs.clear();
+	
+	//partitions are disjoint and ordered, hence concatenation yields the result
+	SortedData result;
+	if (state.results.size() == 1) {
+		result.keyValueCount = std::move(state.results.front());
+		return result;
+	}
+	std::size_t resultSize = 0;
+	for(const KeyValueCountContainer & x : state.results) {
+		state.resultOffsets.push_back(resultSize);
+		resultSize += x.size();
+	}
+	result.keyValueCount.resize(resultSize);
+	state.dest = &result.keyValueCount;
+	state.partition = 0;
+	sserialize::ThreadPool::execute(CopyWorker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	return result;
+}
+
+SortedData SortedData::difference(SortedData && first, const SortedData & second) {
+	SortedData result(std::move(first));
+	auto & kvc = result.keyValueCount;
+	auto out = kvc.begin();
+	auto sit = second.keyValueCount.begin();
+	auto send = second.keyValueCount.end();
+	for(auto it(kvc.begin()), end(kvc.end()); it != end; ++it) {
+		//pairs missing in first violate the precondition, skip them
+		for(; sit != send && sit->first < it->first; ++sit) {}
+		if (sit != send && sit->first == it->first) {
+			SSERIALIZE_CHEAP_ASSERT_SMALLER_OR_EQUAL(sit->second, it->second);
+			it->second -= std::min(sit->second, it->second);
+			++sit;
+		}
+		if (it->second) {
+			*out = *it;
+			++out;
+		}
+	}
+	kvc.erase(out, kvc.end());
+	return result;
+}
+
 Data::Data() {}
 
 Data::Data(Data && other) : keyValueCount(std::move(other.keyValueCount)) {}
@@ -87,6 +331,65 @@ Data Data::merge(Data && first, Data && second) {
 	return std::move(first);
 }
 
+PackedData::PackedData() {}
+
+PackedData::PackedData(PackedData && other) : keyValues(std::move(other.keyValues)) {}
+
+PackedData & PackedData::operator=(PackedData && other) {
+	keyValues = std::move(other.keyValues);
+	return *this;
+}
+
+void PackedData::update(const Static::OsmKeyValueObjectStore::KVItemBase & item) {
+	for (uint32_t i(0), s(item.size()); i < s; ++i) {
+		keyValues.emplace_back(packKeyValue(item.keyId(i), item.valueId(i)));
+	}
+}
+
+void PackedData::sort(KeyValueContainer & tmp) {
+	constexpr uint32_t DigitCount = sizeof(uint64_t);
+	constexpr uint32_t BucketCount = 256;
+	//radix sort does not pay off for small inputs
+	constexpr std::size_t MinRadixSortSize = 1024;
+	
+	if (keyValues.size() < MinRadixSortSize) {
+		std::sort(keyValues.begin(), keyValues.end());
+		return;
+	}
+	
+	//compute the histograms of all digits in a single pass
+	std::array<std::array<std::size_t, BucketCount>, DigitCount> histograms;
+	for(auto & h : histograms) {
+		h.fill(0);
+	}
+	for(uint64_t kv : keyValues) {
+		for(uint32_t d(0); d < DigitCount; ++d) {
+			++histograms[d][(kv >> (8*d)) & 0xFF];
+		}
+	}
+	
+	tmp.resize(keyValues.size());
+	for(uint32_t d(0); d < DigitCount; ++d) {
+		auto & h = histograms[d];
+		//all entries have the same digit, nothing to do
+		//this is the case for the high bytes of key and value ids
+		if (h[(keyValues.front() >> (8*d)) & 0xFF] == keyValues.size()) {
+			continue;
+		}
+		std::size_t offset = 0;
+		for(std::size_t & x : h) {
+			std::size_t count = x;
+			x = offset;
+			offset += count;
+		}
+		for(uint64_t kv : keyValues) {
+			tmp[ h[(kv >> (8*d)) & 0xFF]++ ] = kv;
+		}
+		keyValues.swap(tmp);
+	}
+	SSERIALIZE_NORMAL_ASSERT(std::is_sorted(keyValues.begin(), keyValues.end()));
+}
+
 KeyInfo::KeyInfo() : values(sserialize::CFLArray<std::vector<ValueInfo>>::DeferContainerAssignment{}) {}
 
 KeyInfo::KeyInfo(uint32_t keyId, std::vector<ValueInfo> * valuesContainer, uint64_t offset, uint32_t size) :
@@ -123,23 +426,171 @@ void Worker::operator()() {
 }
 
 void Worker::flush() {
+	if (!d.keyValueCount.size()) {
+		return;
+	}
 	State::DataType sd(std::move(d));
-	std::unique_lock<std::mutex> lck(state->lock, std::defer_lock);
-	while(true) {
-		lck.lock();
-		state->d.emplace_back(std::move(sd));
-		if (state->d.size() < 2) {
+	std::lock_guard<std::mutex> lck(state->lock);
+	state->d.emplace_back(std::move(sd));
+}
+
+SortWorker::SortWorker(State * state) : state(state) {}
+
+SortWorker::SortWorker(const SortWorker & other) : state(other.state) {}
+
+void SortWorker::operator()() {
+	std::size_t size = state->items.size();
+	d.keyValues.reserve(FlushSize);
+	while (true) {
+		std::size_t p = state->pos.fetch_add(BlockSize, std::memory_order_relaxed);
+		if (p >= size) {
 			break;
 		}
-		auto first = std::move(state->d.back());
-		state->d.pop_back();
-		auto second = std::move(state->d.back());
-		state->d.pop_back();
-		lck.unlock();
-		sd = State::DataType::merge(std::move(first), std::move(second));
+		for(std::size_t i(0); i < BlockSize && p < size; ++i, ++p) {
+			uint32_t itemId = state->items.at(p);
+			d.update( state->store.kvBaseItem(itemId) );
+		}
+		if (d.size() > FlushSize) {
+			flush();
+		}
 	}
+	flush();
 }
 
+void SortWorker::flush() {
+	if (!d.size()) {
+		return;
+	}
+	d.sort(tmp);
+	State::DataType sd(std::move(d));
+	std::lock_guard<std::mutex> lck(state->lock);
+	state->d.emplace_back(std::move(sd));
+}
+
+uint32_t Sampling::sampleSize(uint32_t itemCount) const {
+	double rateSize = std::ceil(std::max(0.0, std::min(rate, 1.0))*itemCount);
+	uint32_t size = std::min<uint32_t>(maxItems, uint32_t(rateSize));
+	//an empty sample has no information, counts and intervals would all be 0
+	return std::min<uint32_t>(itemCount, std::max<uint32_t>(size, 1));
+}
+
+sserialize::ItemIndex Sampling::sample(const sserialize::ItemIndex & items) const {
+	uint32_t itemCount = items.size();
+	uint32_t size = sampleSize(itemCount);
+	if (size >= itemCount) {
+		return items;
+	}
+	std::minstd_rand rng(seed);
+	std::vector<uint32_t> result;
+	result.reserve(size);
+	for(uint64_t i(0); i < size; ++i) {
+		uint32_t begin = uint32_t((i*itemCount)/size);
+		uint32_t end = uint32_t(((i+1)*itemCount)/size);
+		result.push_back( items.at(begin + rng() % (end-begin)) );
+	}
+	return sserialize::ItemIndex(std::move(result));
+}
+
+std::vector<Sampling::WeightedItem> Sampling::sample(const sserialize::CellQueryResult & cqr, uint64_t & itemCount) const {
+	itemCount = 0;
+	for(uint32_t i(0), s(cqr.cellCount()); i < s; ++i) {
+		itemCount += cqr.idxSize(i);
+	}
+	std::vector<WeightedItem> result;
+	if (!itemCount) {
+		return result;
+	}
+	uint64_t size = sampleSize(uint32_t(std::min<uint64_t>(itemCount, std::numeric_limits<uint32_t>::max())));
+	std::minstd_rand rng(seed);
+	for(uint32_t i(0), s(cqr.cellCount()); i < s; ++i) {
+		uint32_t cellSize = cqr.idxSize(i);
+		if (!cellSize) {
+			continue;
+		}
+		uint32_t cellSamples = uint32_t(std::min<uint64_t>(cellSize, std::max<uint64_t>(1, (size*cellSize)/itemCount)));
+		double weight = double(cellSize)/cellSamples;
+		sserialize::ItemIndex idx(cqr.idx(i));
+		if (cellSamples >= cellSize) {
+			for(uint32_t itemId : idx) {
+				result.push_back(WeightedItem{itemId, 1.0});
+			}
+			continue;
+		}
+		if (idx.type() & int(sserialize::ItemIndex::RANDOM_ACCESS_NO)) {
+			idx = sserialize::ItemIndex(idx.toVector());
+		}
+		for(uint64_t j(0); j < cellSamples; ++j) {
+			uint32_t begin = uint32_t((j*cellSize)/cellSamples);
+			uint32_t end = uint32_t(((j+1)*cellSize)/cellSamples);
+			result.push_back(WeightedItem{idx.at(begin + rng() % (end-begin)), weight});
+		}
+	}
+	return result;
+}
+
+namespace {
+	//number of items looked at to estimate the number of distinct key-value pairs
+	constexpr std::size_t EstimationSampleSize = 1000;
+}
+
+std::size_t estimateDistinctKeyValues(const Static::OsmKeyValueObjectStore & store, const std::vector<uint32_t> & sample, std::size_t itemCount) {
+	if (!sample.size()) {
+		return 0;
+	}
+	std::unordered_map<uint64_t, uint32_t> kvc;
+	for(uint32_t itemId : sample) {
+		auto item = store.kvBaseItem(itemId);
+		for(uint32_t i(0), s(item.size()); i < s; ++i) {
+			kvc[packKeyValue(item.keyId(i), item.valueId(i))] += 1;
+		}
+	}
+	//key-value pairs seen only once are most likely rare in the full set as well.
+	//Each of them represents about itemCount/sample.size() distinct pairs
+	std::size_t singletons = 0;
+	for(const auto & x : kvc) {
+		singletons += std::size_t(x.second == 1);
+	}
+	return kvc.size() + singletons*(std::max<std::size_t>(1, itemCount/sample.size()) - 1);
+}
+
+std::size_t estimateDistinctKeyValues(const Static::OsmKeyValueObjectStore & store, const sserialize::ItemIndex & items) {
+	std::size_t size = items.size();
+	std::size_t stride = std::max<std::size_t>(1, size/EstimationSampleSize);
+	std::vector<uint32_t> sample;
+	for(std::size_t p(0); p < size; p += stride) {
+		sample.push_back(items.at(p));
+	}
+	return estimateDistinctKeyValues(store, sample, size);
+}
+
+std::size_t estimateDistinctKeyValues(const Static::OsmKeyValueObjectStore & store, const sserialize::CellQueryResult & cqr) {
+	std::size_t size = 0;
+	for(uint32_t i(0), s(cqr.cellCount()); i < s; ++i) {
+		size += cqr.idxSize(i);
+	}
+	//take every stride-th item of the concatenation of all cells
+	std::size_t stride = std::max<std::size_t>(1, size/EstimationSampleSize);
+	std::size_t next = 0;
+	std::size_t cellBegin = 0;
+	std::vector<uint32_t> sample;
+	for(uint32_t i(0), s(cqr.cellCount()); i < s; ++i) {
+		std::size_t cellEnd = cellBegin + cqr.idxSize(i);
+		if (next < cellEnd) {
+			sserialize::ItemIndex idx(cqr.idx(i));
+			for(; next < cellEnd; next += stride) {
+				sample.push_back(idx.at(next-cellBegin));
+			}
+		}
+		cellBegin = cellEnd;
+	}
+	return estimateDistinctKeyValues(store, sample, size);
+}
+
+CellState::CellState(const Static::OsmKeyValueObjectStore & store, const sserialize::CellQueryResult & cqr) :
+state(store, noItems),
+cqr(cqr),
+visited((store.size()+63)/64)
+{}
 
 Stats::Stats(std::unique_ptr<std::vector<ValueInfo>> && valueInfoStore, std::vector<KeyInfo> && keyInfoStore, std::unordered_map<uint32_t, KeyInfoPtr> && keyInfo) :
 m_valueInfoStore(std::move(valueInfoStore)),
@@ -147,19 +598,83 @@ m_keyInfoStore(std::move(keyInfoStore)),
 m_keyInfo(std::move(keyInfo))
 {}
 
+Stats::Stats(const Stats & other) :
+m_valueInfoStore(std::make_unique<std::vector<ValueInfo>>(*other.m_valueInfoStore)),
+m_keyInfoStore(other.m_keyInfoStore),
+m_keyInfo(other.m_keyInfo),
+m_sampleSize(other.m_sampleSize),
+m_populationSize(other.m_populationSize)
+{
+	for(KeyInfo & ki : m_keyInfoStore) {
+		ki.values.rebind(m_valueInfoStore.get());
+	}
+}
+
 Stats::Stats(Stats && other) :
 m_valueInfoStore(std::move(other.m_valueInfoStore)),
 m_keyInfoStore(std::move(other.m_keyInfoStore)),
-m_keyInfo(std::move(other.m_keyInfo))
+m_keyInfo(std::move(other.m_keyInfo)),
+m_sampleSize(other.m_sampleSize),
+m_populationSize(other.m_populationSize)
 {}
 
 Stats & Stats::operator=(Stats && other) {
 	m_valueInfoStore = std::move(other.m_valueInfoStore);
 	m_keyInfoStore = std::move(other.m_keyInfoStore);
 	m_keyInfo = std::move(other.m_keyInfo);
+	m_sampleSize = other.m_sampleSize;
+	m_populationSize = other.m_populationSize;
 	return *this;
 }
 
+bool Stats::approximate() const {
+	return m_sampleSize < m_populationSize;
+}
+
+uint32_t Stats::sampleSize() const {
+	return m_sampleSize;
+}
+
+uint32_t Stats::populationSize() const {
+	return m_populationSize;
+}
+
+std::pair<uint32_t, uint32_t> Stats::countInterval(uint32_t count, double z) const {
+	if (!approximate() || !m_sampleSize) {
+		return std::pair<uint32_t, uint32_t>(count, count);
+	}
+	double N = m_populationSize;
+	double n = m_sampleSize;
+	double p = std::min(1.0, double(count)/N);
+	double fpc = (N - n)/std::max(1.0, N - 1.0);
+	double error = z * N * std::sqrt(p*(1.0-p)/n * fpc);
+	double low = std::max(0.0, double(count) - error);
+	double high = std::min(N, double(count) + error);
+	return std::pair<uint32_t, uint32_t>(uint32_t(std::floor(low)), uint32_t(std::ceil(high)));
+}
+
+void Stats::setSample(uint32_t sampleSize, uint32_t populationSize) {
+	m_sampleSize = sampleSize;
+	m_populationSize = populationSize;
+}
+
+void Stats::extrapolate(uint32_t sampleSize, uint32_t populationSize) {
+	setSample(sampleSize, populationSize);
+	if (!approximate() || !sampleSize) {
+		return;
+	}
+	double scale = double(populationSize)/double(sampleSize);
+	auto scaled = [scale](uint32_t count) {
+		return uint32_t(std::llround(count*scale));
+	};
+	for(ValueInfo & vi : *m_valueInfoStore) {
+		vi.count = scaled(vi.count);
+	}
+	for(KeyInfo & ki : m_keyInfoStore) {
+		ki.count = scaled(ki.count);
+	}
+}
+
 
 Stats::KeyInfo & Stats::key(uint32_t keyId) {
 	return m_keyInfoStore.at( m_keyInfo.at(keyId).offset );
@@ -193,6 +708,14 @@ Stats::KeyInfoConstIterator Stats::keysEnd() const {
 	return m_keyInfoStore.cend();
 }
 
+std::size_t Stats::memoryUsage() const {
+	//the hash map needs about one node with two pointers per key
+	return sizeof(Stats) +
+		m_valueInfoStore->size()*sizeof(ValueInfo) +
+		m_keyInfoStore.size()*sizeof(KeyInfo) +
+		m_keyInfo.size()*(sizeof(std::pair<uint32_t, KeyInfoPtr>) + 2*sizeof(void*));
+}
+
 }} //end namespace detail::KVStats
 
 
@@ -200,19 +723,139 @@ KVStats::KVStats(const Static::OsmKeyValueObjectStore & store) :
 m_store(store)
 {}
 
-KVStats::Stats KVStats::stats(const sserialize::ItemIndex & items, uint32_t threadCount) {
+KVStats::Stats KVStats::stats(const sserialize::ItemIndex & items, uint32_t threadCount, Engine engine) {
 	if (items.type() & int(sserialize::ItemIndex::RANDOM_ACCESS_NO)) {
-		return stats( sserialize::ItemIndex( items.toVector() ), threadCount);
+		return stats( sserialize::ItemIndex( items.toVector() ), threadCount, engine);
 	}
 	
+	if (engine == E_AUTO) {
+		engine = this->engine(items);
+	}
+	
+	uint32_t requestedThreadCount = threadCount;
 	///we can process about 1k items per ms per thread, starting a thread costs less than 1 ms
 	threadCount = std::min<uint32_t>(threadCount, std::max<uint32_t>(1, items.size()/1000));
 	
 	detail::KVStats::State state(m_store, items);
 	
-	sserialize::ThreadPool::execute(detail::KVStats::Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	if (engine == E_SORT) {
+		sserialize::ThreadPool::execute(detail::KVStats::SortWorker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	}
+	else {
+		sserialize::ThreadPool::execute(detail::KVStats::Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	}
+	
+	//the merge may use more threads than counting since it does not depend on the number of items
+	return stats(detail::KVStats::SortedData::merge(std::move(state.d), requestedThreadCount));
+}
+
+KVStats::Stats KVStats::stats(const sserialize::ItemIndex & items, uint32_t threadCount, const Sampling & sampling, Engine engine) {
+	if (items.type() & int(sserialize::ItemIndex::RANDOM_ACCESS_NO)) {
+		return stats( sserialize::ItemIndex( items.toVector() ), threadCount, sampling, engine);
+	}
+	sserialize::ItemIndex sample = sampling.sample(items);
+	Stats result = stats(sample, threadCount, engine);
+	result.extrapolate(sample.size(), items.size());
+	return result;
+}
+
+KVStats::Stats KVStats::stats(const sserialize::CellQueryResult & cqr, uint32_t /*threadCount*/, const Sampling & sampling, Engine /*engine*/) {
+	uint64_t itemCount = 0;
+	std::vector<Sampling::WeightedItem> sample = sampling.sample(cqr, itemCount);
+	if (sample.empty()) {
+		return stats(detail::KVStats::SortedData());
+	}
+	//The weights sum up to itemCount which counts items of multiple cells multiple times.
+	//The share of distinct items among the drawn ones estimates the share of distinct items among all of them.
+	std::vector<uint32_t> distinct;
+	distinct.reserve(sample.size());
+	for(const Sampling::WeightedItem & x : sample) {
+		distinct.push_back(x.itemId);
+	}
+	std::sort(distinct.begin(), distinct.end());
+	distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+	double distinctShare = double(distinct.size())/sample.size();
+	
+	//the sample is small, hence the weighted pairs are simply sorted and reduced
+	std::vector< std::pair<uint64_t, double> > kvWeights;
+	for(const Sampling::WeightedItem & x : sample) {
+		auto item = m_store.kvBaseItem(x.itemId);
+		for(uint32_t i(0), s(item.size()); i < s; ++i) {
+			kvWeights.emplace_back(detail::KVStats::packKeyValue(item.keyId(i), item.valueId(i)), x.weight*distinctShare);
+		}
+	}
+	std::sort(kvWeights.begin(), kvWeights.end(), [](const std::pair<uint64_t, double> & a, const std::pair<uint64_t, double> & b) {
+		return a.first < b.first;
+	});
+	detail::KVStats::SortedData data;
+	for(auto it(kvWeights.begin()), end(kvWeights.end()); it != end;) {
+		uint64_t kv = it->first;
+		double weight = 0;
+		for(; it != end && it->first == kv; ++it) {
+			weight += it->second;
+		}
+		//every drawn pair occurs at least once
+		uint32_t count = uint32_t(std::max<long long>(1, std::min<long long>(std::llround(weight), std::numeric_limits<uint32_t>::max())));
+		data.keyValueCount.emplace_back(
+			detail::KVStats::SortedData::KeyValue(detail::KVStats::unpackKeyId(kv), detail::KVStats::unpackValueId(kv)),
+			count
+		);
+	}
+	Stats result = stats(std::move(data));
+	uint64_t populationSize = uint64_t(std::llround(itemCount*distinctShare));
+	result.setSample(uint32_t(distinct.size()), uint32_t(std::min<uint64_t>(populationSize, std::numeric_limits<uint32_t>::max())));
+	return result;
+}
+
+KVStats::Stats KVStats::stats(const sserialize::CellQueryResult & cqr, uint32_t threadCount, Engine engine) {
+	std::size_t itemCount = 0;
+	for(uint32_t i(0), s(cqr.cellCount()); i < s; ++i) {
+		itemCount += cqr.idxSize(i);
+	}
+	//the bitset needs one bit per item in the store, for small results flattening is cheaper
+	if (itemCount < m_store.size()/64) {
+		return stats(cqr.flaten(), threadCount, engine);
+	}
+	
+	if (engine == E_AUTO) {
+		engine = this->engine(cqr);
+	}
+	
+	uint32_t requestedThreadCount = threadCount;
+	threadCount = std::min<uint32_t>(threadCount, std::max<uint32_t>(1, cqr.cellCount()));
 	
-	return stats(std::move(state.d.front()));
+	detail::KVStats::CellState state(m_store, cqr);
+	
+	if (engine == E_SORT) {
+		sserialize::ThreadPool::execute(detail::KVStats::CellWorker<detail::KVStats::SortWorker>(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	}
+	else {
+		sserialize::ThreadPool::execute(detail::KVStats::CellWorker<detail::KVStats::Worker>(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	}
+	return stats(detail::KVStats::SortedData::merge(std::move(state.state.d), requestedThreadCount));
+}
+
+KVStats::Engine KVStats::engine(const sserialize::ItemIndex & items) const {
+	//items have about 10 key-value pairs, small sets will not have enough distinct pairs
+	if (items.size() < SortEngineMinDistinctKeyValues/16) {
+		return E_HASH;
+	}
+	if (detail::KVStats::estimateDistinctKeyValues(m_store, items) < SortEngineMinDistinctKeyValues) {
+		return E_HASH;
+	}
+	return E_SORT;
+}
+
+KVStats::Engine KVStats::engine(const sserialize::CellQueryResult & cqr) const {
+	if (detail::KVStats::estimateDistinctKeyValues(m_store, cqr) < SortEngineMinDistinctKeyValues) {
+		return E_HASH;
+	}
+	return E_SORT;
+}
+
+KVStats::Stats KVStats::difference(const Stats & a, const Stats & b) {
+	SSERIALIZE_CHEAP_ASSERT(!a.approximate() && !b.approximate());
+	return stats(detail::KVStats::SortedData::difference(detail::KVStats::SortedData(a), detail::KVStats::SortedData(b)));
 }
 
 KVStats::Stats KVStats::stats(detail::KVStats::Data && data) {
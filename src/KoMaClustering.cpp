@@ -1,71 +1,254 @@
 #include <liboscar/KoMaClustering.h>
+#include <liboscar/KVStats.h>
 #include <sserialize/mt/ThreadPool.h>
+#include <queue>
 
 namespace liboscar{
 namespace detail {
 namespace KoMaClustering {
-void
-Data::update(const KeyValue &key, const uint32_t& itemId) {
-	keyValueItemMap[key].emplace_back(itemId);
-}
-Data::Data() {}
-
 State::State(const Static::OsmKeyValueObjectStore &store, const sserialize::ItemIndex &items,
-			 const kvclustering::KeyExclusions &keyExclusions,
-			 const kvclustering::KeyValueExclusions &keyValueExclusions,
-			 Data::KeyValueItemMap &keyValueItemMap,
-			 size_t numberOfThreads) :
+			 const uint64_t * keyValuesBegin,
+			 const uint64_t * keyValuesEnd,
+			 const uint32_t * counts) :
 		store(store),
 		items(items),
-		keyExclusions(keyExclusions),
-		keyValueExclusions(keyValueExclusions),
-		keyValueItemMap(keyValueItemMap),
-		numberOfThreads(numberOfThreads)
-{}
-
-void State::merge() {
-	for(auto & data : d) {
-		for(auto & keyValueItem : data.keyValueItemMap) {
-			auto & destination = keyValueItemMap[keyValueItem.first];
-			auto & itemVec = keyValueItem.second;
-			std::move(itemVec.begin(), itemVec.end(), std::back_inserter(destination));
-		}
+		keyValuesBegin(keyValuesBegin),
+		keyValuesEnd(keyValuesEnd),
+		offsets(keyValuesEnd-keyValuesBegin+1, 0),
+		fill(keyValuesEnd-keyValuesBegin)
+{
+	for(std::size_t i(0), s(keyValuesEnd-keyValuesBegin); i < s; ++i) {
+		offsets[i+1] = offsets[i] + counts[i];
 	}
+	itemPositions.resize(offsets.back());
 }
 
 Worker::Worker(State * state):
 		state(state)
 {}
-void Worker::operator()() {
 
+Worker::Worker(const Worker & other) :
+		state(other.state)
+{}
+
+void Worker::operator()() {
+	const uint64_t * kvBegin = state->keyValuesBegin;
+	const uint64_t * kvEnd = state->keyValuesEnd;
 	size_t size = state->items.size();
 	while(true) {
 		std::size_t p = state->pos.fetch_add(BlockSize, std::memory_order_relaxed);
-		if (p>= state->items.size())
+		if (p>= size)
 			break;
 		for(std::size_t i(0); i < BlockSize && p < size; ++i, ++p) {
-			 uint32_t itemId = state->items.at(p);
-			 const auto &item = state->store.kvBaseItem(itemId);
+			uint32_t itemId = state->items.at(p);
+			const auto &item = state->store.kvBaseItem(itemId);
 			//iterate over all key-value pairs
-			 for (uint32_t i = 0; i < item.size(); ++i) {
-				 d.update(std::make_pair(item.keyId(i), item.valueId(i)), p);
-			 }
-			 if(d.keyValueItemMap.size() > FlushSize)
-			 	flush();
-		 }
+			for (uint32_t j = 0; j < item.size(); ++j) {
+				uint64_t kv = detail::KVStats::packKeyValue(item.keyId(j), item.valueId(j));
+				if (kv < *kvBegin || kv > *(kvEnd-1)) {
+					//not part of this batch
+					continue;
+				}
+				const uint64_t * kvIt = std::lower_bound(kvBegin, kvEnd, kv);
+				if (kvIt == kvEnd || *kvIt != kv) {
+					continue;
+				}
+				std::size_t kvPos = kvIt - kvBegin;
+				uint32_t offset = state->fill[kvPos].fetch_add(1, std::memory_order_relaxed);
+				state->itemPositions[state->offsets[kvPos] + offset] = p;
+			}
+		}
+	}
+}
+
+ItemSet::ItemSet(const std::vector<uint32_t> & items) :
+ItemSet(items.data(), items.data()+items.size())
+{}
+
+ItemSet::ItemSet(const uint32_t * begin, const uint32_t * end) :
+m_size(end-begin)
+{
+	for(const uint32_t * it(begin); it != end;) {
+		Chunk chunk;
+		chunk.key = *it >> 16;
+		auto chunkEnd = std::upper_bound(it, end, (chunk.key << 16) | 0xFFFF);
+		chunk.size = chunkEnd - it;
+		if (chunk.bitmap()) {
+			chunk.offset = m_words.size();
+			m_words.resize(m_words.size() + BitmapWords, 0);
+			uint64_t * words = m_words.data() + chunk.offset;
+			for(; it != chunkEnd; ++it) {
+				uint32_t low = *it & 0xFFFF;
+				words[low/64] |= uint64_t(1) << (low%64);
+			}
+		}
+		else {
+			chunk.offset = m_values.size();
+			for(; it != chunkEnd; ++it) {
+				m_values.push_back(*it & 0xFFFF);
+			}
+		}
+		m_chunks.push_back(chunk);
+	}
+	//bottom-k sketch: keep the SketchSize smallest hash values in a max-heap
+	std::priority_queue<uint64_t> heap;
+	for(const uint32_t * it(begin); it != end; ++it) {
+		uint64_t h = hash(*it);
+		if (heap.size() < SketchSize) {
+			heap.push(h);
+		}
+		else if (h < heap.top()) {
+			heap.pop();
+			heap.push(h);
+		}
+	}
+	m_sketch.resize(heap.size());
+	for(auto it(m_sketch.rbegin()); !heap.empty(); ++it) {
+		*it = heap.top();
+		heap.pop();
+	}
+}
+
+bool ItemSet::hasIntersection(const ItemSet & other, const std::float_t & minNumber) const {
+	//number of standard deviations of the jaccard estimate until a pair is considered clearly decided
+	constexpr double SketchDeviations = 5.0;
+	if (std::min(m_size, other.m_size) <= minNumber) {
+		return false;
+	}
+	//for small sets the exact test is as cheap as the estimate
+	if (m_size > SketchSize && other.m_size > SketchSize) {
+		//wilson score interval of the jaccard estimate, it stays reliable for estimates close to 0
+		double j = jaccard(other);
+		double z2n = SketchDeviations*SketchDeviations/SketchSize;
+		double center = (j + z2n/2.0)/(1.0 + z2n);
+		double halfWidth = SketchDeviations/(1.0 + z2n)*std::sqrt(j*(1.0-j)/SketchSize + z2n/(4.0*SketchSize));
+		double lower = std::max(0.0, center - halfWidth);
+		//|A ∩ B| = J/(1+J) * (|A| + |B|)
+		double total = double(m_size) + double(other.m_size);
+		if (lower/(1.0+lower)*total > minNumber) {
+			return true;
+		}
+		//There is no early out for clearly disjoint sets: even for J = 0 the upper bound is
+		//z²/(SketchSize+z²) ≈ 0.28, which only decides thresholds above 22% of |A| + |B|,
+		//but the callers test for overlaps of 0.5%.
+	}
+	uint32_t limit = minNumber < 0 ? 0 : uint32_t(minNumber);
+	return intersectionSize(other, limit) > limit;
+}
+
+uint32_t ItemSet::intersectionSize(const ItemSet & other, uint32_t limit) const {
+	uint32_t result = 0;
+	auto i(m_chunks.begin()), iend(m_chunks.end());
+	auto j(other.m_chunks.begin()), jend(other.m_chunks.end());
+	while (i != iend && j != jend) {
+		if (i->key < j->key) {
+			++i;
+		}
+		else if (j->key < i->key) {
+			++j;
+		}
+		else {
+			result += intersectionSize(*i, other, *j, limit - result);
+			if (result > limit) {
+				break;
+			}
+			++i;
+			++j;
+		}
 	}
-	flush();
+	return result;
 }
 
-void Worker::flush() {
-	std::unique_lock<std::mutex> lck{state->m, std::defer_lock};
-	lck.lock();
-	auto & destination = state->d;
-	destination.emplace_back(std::move(d));
-	lck.unlock();
-	d.keyValueItemMap.clear();
+uint32_t ItemSet::intersectionSize(const Chunk & a, const ItemSet & other, const Chunk & b, uint32_t limit) const {
+	uint32_t result = 0;
+	if (a.bitmap() && b.bitmap()) {
+		const uint64_t * wa = m_words.data() + a.offset;
+		const uint64_t * wb = other.m_words.data() + b.offset;
+		//check the limit every 64 words, the inner loop is vectorized by the compiler
+		for(uint32_t block(0); block < BitmapWords && result <= limit; block += 64) {
+			for(uint32_t w(block); w < block+64; ++w) {
+				result += __builtin_popcountll(wa[w] & wb[w]);
+			}
+		}
+		return result;
+	}
+	if (a.bitmap() || b.bitmap()) {
+		const ItemSet & arraySet = a.bitmap() ? other : *this;
+		const Chunk & arrayChunk = a.bitmap() ? b : a;
+		const uint64_t * words = a.bitmap() ? m_words.data() + a.offset : other.m_words.data() + b.offset;
+		const uint16_t * values = arraySet.m_values.data() + arrayChunk.offset;
+		for(uint32_t i(0); i < arrayChunk.size && result <= limit; ++i) {
+			result += (words[values[i]/64] >> (values[i]%64)) & 0x1;
+		}
+		return result;
+	}
+	const uint16_t * va = m_values.data() + a.offset;
+	const uint16_t * vaEnd = va + a.size;
+	const uint16_t * vb = other.m_values.data() + b.offset;
+	const uint16_t * vbEnd = vb + b.size;
+	if (a.size > b.size) {
+		std::swap(va, vb);
+		std::swap(vaEnd, vbEnd);
+	}
+	//very different sizes: search the entries of the smaller array in the larger one
+	if (uint32_t(vbEnd - vb) / 32 > uint32_t(vaEnd - va)) {
+		for(; va != vaEnd && vb != vbEnd && result <= limit; ++va) {
+			vb = std::lower_bound(vb, vbEnd, *va);
+			if (vb != vbEnd && *vb == *va) {
+				++result;
+				++vb;
+			}
+		}
+		return result;
+	}
+	while (va != vaEnd && vb != vbEnd) {
+		if (*va < *vb) {
+			++va;
+		}
+		else if (*vb < *va) {
+			++vb;
+		}
+		else {
+			++va;
+			++vb;
+			if (++result > limit) {
+				break;
+			}
+		}
+	}
+	return result;
 }
 
+double ItemSet::jaccard(const ItemSet & other) const {
+	//the SketchSize smallest hashes of the union are a uniform sample of it,
+	//the fraction of them present in both sketches estimates the jaccard index
+	uint32_t taken = 0;
+	uint32_t common = 0;
+	auto i(m_sketch.begin()), iend(m_sketch.end());
+	auto j(other.m_sketch.begin()), jend(other.m_sketch.end());
+	for(; taken < SketchSize && (i != iend || j != jend); ++taken) {
+		if (j == jend || (i != iend && *i < *j)) {
+			++i;
+		}
+		else if (i == iend || *j < *i) {
+			++j;
+		}
+		else {
+			++common;
+			++i;
+			++j;
+		}
+	}
+	return taken ? double(common)/taken : 0.0;
+}
+
+uint64_t ItemSet::hash(uint32_t item) {
+	//splitmix64 finalizer
+	uint64_t x = uint64_t(item) + 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
 
 } //end namespace KoMaClustering
 } //end namespace detail
@@ -83,13 +266,87 @@ KoMaClustering::KoMaClustering(const Static::OsmKeyValueObjectStore &store,
 }
 
 void KoMaClustering::preprocess()  {
-
-	auto state = detail::KoMaClustering::State(store, items, keyExclusions, keyValueExclusions, keyValueItemMap, threadCount);
-
-	sserialize::ThreadPool::execute(detail::KoMaClustering::Worker(&state), threadCount,
-	        sserialize::ThreadPool::CopyTaskTag());
-	state.merge();
+	// the exclusions are checked for every pair in topKeyValues()
+	keyExclusions.preprocess();
+	keyValueExclusions.preprocess();
+	// first pass: count all key-value pairs, the result is sorted by key-value
+	{
+		detail::KVStats::State state(store, items);
+		sserialize::ThreadPool::execute(detail::KVStats::SortWorker(&state), threadCount,
+		        sserialize::ThreadPool::CopyTaskTag());
+		auto counts = detail::KVStats::SortedData::merge(std::move(state.d), threadCount);
+		keyValueCountVec.assign(counts.keyValueCount.begin(), counts.keyValueCount.end());
+	}
+	std::vector<uint64_t> keyValues;
+	std::vector<uint32_t> keyValueCounts;
+	keyValues.reserve(keyValueCountVec.size());
+	keyValueCounts.reserve(keyValueCountVec.size());
+	for(const auto & x : keyValueCountVec) {
+		keyValues.push_back(detail::KVStats::packKeyValue(x.first.first, x.first.second));
+		keyValueCounts.push_back(x.second);
+	}
+	keyValueCountVecSortedByIds = keyValueCountVec;
 	sort();
+
+	// itemSets are ordered like keyValueCountVec
+	std::vector<uint32_t> itemSetPositions(keyValues.size());
+	for(std::size_t i(0), s(keyValueCountVec.size()); i < s; ++i) {
+		const auto & kv = keyValueCountVec[i].first;
+		auto it = std::lower_bound(keyValues.begin(), keyValues.end(), detail::KVStats::packKeyValue(kv.first, kv.second));
+		itemSetPositions[it - keyValues.begin()] = i;
+	}
+	itemSets.resize(keyValueCountVec.size());
+
+	// compresses the item positions of each key-value pair of a batch into its item set
+	struct ConversionState {
+		detail::KoMaClustering::State & state;
+		std::vector<detail::KoMaClustering::ItemSet> & itemSets;
+		const uint32_t * itemSetPositions;
+		std::atomic<std::size_t> pos{0};
+		ConversionState(detail::KoMaClustering::State & state, std::vector<detail::KoMaClustering::ItemSet> & itemSets, const uint32_t * itemSetPositions) :
+		state(state), itemSets(itemSets), itemSetPositions(itemSetPositions)
+		{}
+	};
+	struct ConversionWorker {
+		ConversionState * cs;
+		ConversionWorker(ConversionState * cs) : cs(cs) {}
+		ConversionWorker(const ConversionWorker & other) : cs(other.cs) {}
+		void operator()() {
+			auto & state = cs->state;
+			std::size_t size = state.offsets.size()-1;
+			while (true) {
+				std::size_t p = cs->pos.fetch_add(1, std::memory_order_relaxed);
+				if (p >= size) {
+					break;
+				}
+				uint32_t * begin = state.itemPositions.data() + state.offsets[p];
+				uint32_t * end = state.itemPositions.data() + state.offsets[p+1];
+				std::sort(begin, end);
+				end = std::unique(begin, end);
+				cs->itemSets[cs->itemSetPositions[p]] = detail::KoMaClustering::ItemSet(begin, end);
+			}
+		}
+	};
+
+	// second pass: collect the item positions of batches of key-value pairs
+	// a batch always contains at least one pair, even if its items exceed the limit
+	std::size_t maxBatchSize = std::max<std::size_t>(1, memoryLimit/sizeof(uint32_t));
+	for(std::size_t begin(0), s(keyValues.size()); begin < s;) {
+		std::size_t end = begin;
+		std::size_t batchSize = 0;
+		do {
+			batchSize += keyValueCounts[end];
+			++end;
+		} while (end < s && batchSize + keyValueCounts[end] <= maxBatchSize);
+
+		detail::KoMaClustering::State state(store, items, keyValues.data()+begin, keyValues.data()+end, keyValueCounts.data()+begin);
+		sserialize::ThreadPool::execute(detail::KoMaClustering::Worker(&state), threadCount,
+		        sserialize::ThreadPool::CopyTaskTag());
+		ConversionState cs(state, itemSets, itemSetPositions.data()+begin);
+		sserialize::ThreadPool::execute(ConversionWorker(&cs), threadCount,
+		        sserialize::ThreadPool::CopyTaskTag());
+		begin = end;
+	}
 }
 
 void KoMaClustering::exclude(const kvclustering::KeyExclusions &e) {
@@ -106,33 +363,36 @@ std::vector<KoMaClustering::KeyInfo> KoMaClustering::topKeys(uint32_t /*k*/) {
 
 std::vector<KoMaClustering::KeyValueInfo> KoMaClustering::topKeyValues(uint32_t k) {
 	std::vector<std::pair<KeyValuePair, std::uint32_t>> result;
+	//positions of the entries of result in countVec
+	std::vector<std::size_t> resultPositions;
 	auto &countVec = keyValueCountVec;
-	auto &itemMap = keyValueItemMap;
-	auto itI = countVec.begin();
+	std::size_t i = 0;
 	bool startParentsFound = false;
 	std::float_t maxNumberOfIntersections;
 
-	for (; itI < countVec.end(); ++itI) {
-		if(keyExclusions.contains(itI->first.first))
+	for (; i < countVec.size(); ++i) {
+		if(keyExclusions.contains(countVec[i].first.first))
 			continue;
-		if(keyValueExclusions.contains(itI -> first.first, itI->first.second))
+		if(keyValueExclusions.contains(countVec[i].first.first, countVec[i].first.second))
 			continue;
 
 
-		for (auto itJ = countVec.begin(); itJ < itI; ++itJ) {
-			if(keyExclusions.contains(itJ->first.first))
+		for (std::size_t j = 0; j < i; ++j) {
+			if(keyExclusions.contains(countVec[j].first.first))
 				continue;
-			if(keyValueExclusions.contains(itJ -> first.first, itJ->first.second))
+			if(keyValueExclusions.contains(countVec[j].first.first, countVec[j].first.second))
 				continue;
-			const std::vector<uint32_t> &setI = itemMap[itI->first];
-			const std::vector<uint32_t> &setJ = itemMap[itJ->first];
+			const detail::KoMaClustering::ItemSet &setI = itemSets[i];
+			const detail::KoMaClustering::ItemSet &setJ = itemSets[j];
 
 			maxNumberOfIntersections = (setI.size() + setJ.size()) / 200.0f;
-			if (!hasIntersection(setI.begin(), setI.end(), setJ.begin(), setJ.end(), maxNumberOfIntersections)) {
+			if (!setI.hasIntersection(setJ, maxNumberOfIntersections)) {
 				// no required amount of intersections
 				// add both parents to results
-				result.emplace_back(itJ->first, itJ->second);
-				result.emplace_back(itI->first, itI->second);
+				result.emplace_back(countVec[j]);
+				result.emplace_back(countVec[i]);
+				resultPositions.emplace_back(j);
+				resultPositions.emplace_back(i);
 				//end the algorithm
 				startParentsFound = true;
 				break;
@@ -145,26 +405,27 @@ std::vector<KoMaClustering::KeyValueInfo> KoMaClustering::topKeyValues(uint32_t
 
 
 	if (startParentsFound) {
-		for (auto itK = itI + 1; itK < countVec.end() && result.size() < k; ++itK) {
-			if(keyExclusions.contains(itK->first.first)) {
+		for (std::size_t l = i + 1; l < countVec.size() && result.size() < k; ++l) {
+			if(keyExclusions.contains(countVec[l].first.first)) {
 				continue;
 			}
-			if(keyValueExclusions.contains(itK -> first.first, itK->first.second)) {
+			if(keyValueExclusions.contains(countVec[l].first.first, countVec[l].first.second)) {
 				continue;
 			}
 			bool discarded = false;
-			for (auto &parentPair : result) {
-				maxNumberOfIntersections = (parentPair.second + (*itK).second) / 200.0f;
-				const std::vector<uint32_t> &setI = itemMap[(*itK).first];
-				const std::vector<uint32_t> &setJ = itemMap[parentPair.first];
-				if (hasIntersection(setI.begin(), setI.end(), setJ.begin(), setJ.end(), maxNumberOfIntersections)) {
+			for (std::size_t parent = 0; parent < result.size(); ++parent) {
+				maxNumberOfIntersections = (result[parent].second + countVec[l].second) / 200.0f;
+				const detail::KoMaClustering::ItemSet &setI = itemSets[l];
+				const detail::KoMaClustering::ItemSet &setJ = itemSets[resultPositions[parent]];
+				if (setI.hasIntersection(setJ, maxNumberOfIntersections)) {
 					discarded = true;
 					break;
 				}
 			}
 			if (!discarded) {
 				//parent does not intersect with previous found parents; add to results
-				result.emplace_back(*itK);
+				result.emplace_back(countVec[l]);
+				resultPositions.emplace_back(l);
 			}
 		}
 	}
@@ -268,12 +529,6 @@ std::list<KoMaClustering::ValueCountPair> KoMaClustering::findValuesToKey(std::u
 }
 
 void KoMaClustering::sort() {
-	// sort
-	for (auto &keyValueItems : keyValueItemMap){
-		std::sort(keyValueItems.second.begin(), keyValueItems.second.end());
-		keyValueCountVec.emplace_back(std::make_pair(keyValueItems.first, keyValueItems.second.size()));
-		keyValueCountVecSortedByIds.emplace_back(std::make_pair(keyValueItems.first, keyValueItems.second.size()));
-	}
 	using KeyValue = std::pair<std::uint32_t, std::uint32_t>;
 	// sort all keyValues descending by itemCount to find the top KeyValues faster
 	std::sort(keyValueCountVec.begin(), keyValueCountVec.end(),
@@ -286,7 +541,6 @@ void KoMaClustering::sort() {
 				 std::pair<KeyValue, std::uint32_t> const &b) {
 				  return a.first.first != b.first.first ? a.first.first < b.first.first : a.second > b.second;
 			  });
-
 }
 
 } //end namespace liboscar
@@ -0,0 +1,275 @@
+#include <liboscar/MemoryPolicy.h>
+#include <liboscar/constants.h>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#if defined(__unix__) || defined(__APPLE__)
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+namespace liboscar {
+namespace {
+
+//cgroup v1 reports a value close to 2^63 if there is no limit
+constexpr uint64_t CgroupNoLimit = uint64_t(1) << 62;
+
+//@return pointer to the data if it is directly addressable
+inline const uint8_t * dataPtr(const sserialize::UByteArrayAdapter & d) {
+	if (!d.size() || !d.isContiguous()) {
+		return nullptr;
+	}
+	return d.getMemView(0, 1).data();
+}
+
+//@return value in fileName, 0 if it does not exist or is "max"
+uint64_t readLimit(const std::string & fileName) {
+	std::ifstream file(fileName);
+	std::string value;
+	if (!(file >> value) || value == "max") {
+		return 0;
+	}
+	try {
+		uint64_t v = std::stoull(value);
+		return v >= CgroupNoLimit ? 0 : v;
+	}
+	catch (std::exception &) {
+		return 0;
+	}
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+inline uintptr_t pageSize() {
+	static const uintptr_t ps = uintptr_t(::sysconf(_SC_PAGESIZE));
+	return ps;
+}
+
+//calls func(begin, size) for the pages of [ptr+offset, ptr+offset+size)
+template<typename TFunc>
+bool onPages(const uint8_t * ptr, uint64_t offset, uint64_t size, TFunc func) {
+	uintptr_t b = (uintptr_t(ptr) + offset) & ~(pageSize()-1);
+	uintptr_t e = uintptr_t(ptr) + offset + size;
+	return func(reinterpret_cast<void*>(b), std::size_t(e-b)) == 0;
+}
+#endif
+
+}//end namespace
+
+uint64_t MemoryPolicy::physicalMemory() {
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+	long pages = ::sysconf(_SC_PHYS_PAGES);
+	long ps = ::sysconf(_SC_PAGESIZE);
+	if (pages > 0 && ps > 0) {
+		return uint64_t(pages)*uint64_t(ps);
+	}
+#endif
+	return 0;
+}
+
+uint64_t MemoryPolicy::cgroupMemoryLimit() {
+	//cgroup v2, the path of our cgroup is in the line starting with "0::"
+	std::ifstream cgroups("/proc/self/cgroup");
+	std::string line;
+	while (std::getline(cgroups, line)) {
+		if (line.compare(0, 3, "0::") == 0) {
+			uint64_t limit = readLimit("/sys/fs/cgroup" + line.substr(3) + "/memory.max");
+			if (limit) {
+				return limit;
+			}
+		}
+	}
+	uint64_t limit = readLimit("/sys/fs/cgroup/memory.max");
+	if (limit) {
+		return limit;
+	}
+	//cgroup v1
+	return readLimit("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+}
+
+uint64_t MemoryPolicy::availableMemory() {
+	uint64_t phys = physicalMemory();
+	uint64_t cgroup = cgroupMemoryLimit();
+	if (phys && cgroup) {
+		return std::min(phys, cgroup);
+	}
+	return std::max(phys, cgroup);
+}
+
+uint64_t MemoryPolicy::addressSpace() {
+	#ifdef __LP64__
+	//use up to 1 TiB of address space on 64 Bit machines
+	return uint64_t(1024*1024)*uint64_t(1024*1024);
+	#else
+	//use up to 1 GiB of address space on 32 Bit machines
+	return 1024*1024*1024;
+	#endif
+}
+
+std::string MemoryPolicy::toString(Placement p) {
+	switch (p) {
+	case MP_MMAP:
+		return "mmap";
+	case MP_CHUNKED:
+		return "chunked";
+	case MP_IN_MEMORY:
+		return "in-memory";
+	default:
+		return "invalid";
+	}
+}
+
+sserialize::UByteArrayAdapter MemoryPolicy::copyToMemory(const sserialize::UByteArrayAdapter & data, bool hugePages) {
+	sserialize::UByteArrayAdapter mem(sserialize::UByteArrayAdapter::createCache(data.size(), sserialize::MM_PROGRAM_MEMORY));
+#if (defined(__unix__) || defined(__APPLE__)) && defined(MADV_HUGEPAGE)
+	//advise before the pages are touched, otherwise they have to be collapsed later
+	if (hugePages && dataPtr(mem)) {
+		onPages(dataPtr(mem), 0, mem.size(), [](void * b, std::size_t s) { return ::madvise(b, s, MADV_HUGEPAGE); });
+	}
+#else
+	(void) hugePages;
+#endif
+	mem.putData(data);
+	mem.resetPtrs();
+	return mem;
+}
+
+MemoryPolicy::Report MemoryPolicy::apply(uint32_t fc, const sserialize::UByteArrayAdapter & data, const Decision & decision) {
+	Report report;
+	report.fc = fc;
+	report.size = data.size();
+	report.placement = decision.placement;
+	const uint8_t * ptr = dataPtr(data);
+	for(const Section & s : decision.sections) {
+		if (s.offset >= data.size()) {
+			continue;
+		}
+		uint64_t size = std::min(s.size, data.size() - s.offset);
+		if (!ptr) {
+			report.failedBytes += size;
+			continue;
+		}
+#if defined(__unix__) || defined(__APPLE__)
+		if (s.hugePages) {
+	#ifdef MADV_HUGEPAGE
+			if (onPages(ptr, s.offset, size, [](void * b, std::size_t l) { return ::madvise(b, l, MADV_HUGEPAGE); })) {
+				report.hugePageBytes += size;
+			}
+			else {
+				report.failedBytes += size;
+			}
+	#else
+			report.failedBytes += size;
+	#endif
+		}
+		if (s.lock) {
+			if (onPages(ptr, s.offset, size, [](void * b, std::size_t l) { return ::mlock(b, l); })) {
+				report.lockedBytes += size;
+			}
+			else {
+				report.failedBytes += size;
+			}
+		}
+#else
+		report.failedBytes += size;
+#endif
+	}
+	return report;
+}
+
+std::ostream & MemoryPolicy::printStats(std::ostream & out, const std::vector<Report> & reports) {
+	out << "MemoryPolicy::printStats -- BEGIN" << std::endl;
+	out << "Physical memory: " << physicalMemory() << " Bytes\n";
+	out << "Cgroup memory limit: " << cgroupMemoryLimit() << " Bytes\n";
+	Report total;
+	for(const Report & r : reports) {
+		out << liboscar::toString(FileConfig(r.fc)) << ": size=" << r.size << ", placement=" << toString(r.placement);
+		out << ", locked=" << r.lockedBytes << ", hugePages=" << r.hugePageBytes << ", failed=" << r.failedBytes << "\n";
+		if (r.placement == MP_IN_MEMORY) {
+			total.size += r.size;
+		}
+		total.lockedBytes += r.lockedBytes;
+	}
+	out << "Total in memory: " << total.size << " Bytes, total locked: " << total.lockedBytes << " Bytes\n";
+	out << "MemoryPolicy::printStats -- END" << std::endl;
+	return out;
+}
+
+DefaultMemoryPolicy::DefaultMemoryPolicy() {}
+
+DefaultMemoryPolicy::~DefaultMemoryPolicy() {}
+
+void DefaultMemoryPolicy::setPlacement(uint32_t fc, Placement p) {
+	m_placements[fc] = p;
+}
+
+void DefaultMemoryPolicy::setInMemoryBudget(uint64_t budget) {
+	m_inMemoryBudget = budget;
+}
+
+void DefaultMemoryPolicy::setLockBudget(uint64_t budget, const std::vector<AccessProfile::Range> & hotRanges) {
+	m_lockBudget = budget;
+	m_hotRanges = hotRanges;
+}
+
+void DefaultMemoryPolicy::setHugePages(bool enable) {
+	m_hugePages = enable;
+}
+
+std::vector<MemoryPolicy::Decision> DefaultMemoryPolicy::decide(const std::vector<FileInfo> & files) const {
+	uint64_t available = availableMemory();
+	uint64_t addressSpaceLeft = addressSpace();
+	uint64_t inMemoryLeft = available ? std::min(m_inMemoryBudget, available/2) : m_inMemoryBudget;
+	uint64_t lockLeft = available ? std::min(m_lockBudget, available/2) : m_lockBudget;
+	std::vector<Decision> result(files.size());
+	std::unordered_map<uint32_t, std::size_t> fileIndex;
+	for(std::size_t i(0), s(files.size()); i < s; ++i) {
+		const FileInfo & f = files[i];
+		Decision & d = result[i];
+		fileIndex[f.fc] = i;
+		auto it = m_placements.find(f.fc);
+		if (it != m_placements.end()) {
+			d.placement = it->second;
+		}
+		else if (!f.compressed && f.size <= inMemoryLeft) {
+			d.placement = MP_IN_MEMORY;
+			inMemoryLeft -= f.size;
+		}
+		else if (f.size < addressSpaceLeft) {
+			d.placement = MP_MMAP;
+		}
+		else {
+			d.placement = MP_CHUNKED;
+		}
+		if (d.placement == MP_MMAP) {
+			if (f.size < addressSpaceLeft) {
+				addressSpaceLeft -= f.size;
+			}
+			else {
+				d.placement = MP_CHUNKED;
+			}
+		}
+		if (d.placement == MP_IN_MEMORY && m_hugePages) {
+			d.sections.push_back(Section{0, f.size, false, true});
+		}
+	}
+	for(const AccessProfile::Range & r : m_hotRanges) {
+		if (!lockLeft) {
+			break;
+		}
+		auto it = fileIndex.find(r.fc);
+		if (it == fileIndex.end()) {
+			continue;
+		}
+		const FileInfo & f = files[it->second];
+		Decision & d = result[it->second];
+		if (f.compressed || d.placement == MP_CHUNKED || r.offset >= f.size) {
+			continue;
+		}
+		uint64_t size = std::min(std::min(r.size, f.size - r.offset), lockLeft);
+		d.sections.push_back(Section{r.offset, size, true, false});
+		lockLeft -= size;
+	}
+	return result;
+}
+
+}//end namespace liboscar
@@ -0,0 +1,106 @@
+#include <liboscar/OsmCompleterHandle.h>
+#include <sserialize/utility/exceptions.h>
+#include <sserialize/utility/log.h>
+#include <thread>
+
+namespace liboscar {
+namespace Static {
+
+OsmCompleterHandle::OsmCompleterHandle() {}
+
+OsmCompleterHandle::OsmCompleterHandle(const CompleterPtr & completer) {
+	publish(completer);
+}
+
+OsmCompleterHandle::~OsmCompleterHandle() {
+	//wait for running loads, they reference this handle
+	//loads started by loadAsync() may not have taken m_loadLock yet
+	std::unique_lock<std::mutex> asyncLck(m_asyncLock);
+	m_asyncDone.wait(asyncLck, [this]() { return !m_asyncLoads; });
+	asyncLck.unlock();
+	std::lock_guard<std::mutex> lck(m_loadLock);
+}
+
+OsmCompleterHandle::CompleterPtr OsmCompleterHandle::get() const {
+	return std::atomic_load_explicit(&m_completer, std::memory_order_acquire);
+}
+
+void OsmCompleterHandle::publish(const CompleterPtr & completer) {
+	//the old completer is released by the last snapshot holding it, not necessarily here
+	std::atomic_store_explicit(&m_completer, completer, std::memory_order_release);
+	m_version.fetch_add(1, std::memory_order_acq_rel);
+}
+
+bool OsmCompleterHandle::load(
+	const std::string & filesDir,
+	sserialize::spatial::GeoHierarchySubGraph::Type ghsgType,
+	uint32_t threadCount,
+	const Configurator & prepare,
+	const Configurator & finish)
+{
+	std::lock_guard<std::mutex> lck(m_loadLock);
+	CompleterPtr completer(std::make_shared<OsmCompleter>());
+	try {
+		if (!completer->setAllFilesFromPrefix(filesDir)) {
+			sserialize::err("liboscar::Static::OsmCompleterHandle", "Not a directory: " + filesDir);
+			return false;
+		}
+		if (prepare) {
+			prepare(*completer);
+		}
+		completer->energize(ghsgType, threadCount);
+		if (finish) {
+			finish(*completer);
+		}
+	}
+	catch (std::exception & e) {
+		sserialize::err("liboscar::Static::OsmCompleterHandle", "Failed to load " + filesDir + " with the following error:\n" + e.what());
+		return false;
+	}
+	publish(completer);
+	return true;
+}
+
+std::future<bool> OsmCompleterHandle::loadAsync(
+	const std::string & filesDir,
+	sserialize::spatial::GeoHierarchySubGraph::Type ghsgType,
+	uint32_t threadCount,
+	const Configurator & prepare,
+	const Configurator & finish)
+{
+	{
+		std::lock_guard<std::mutex> lck(m_asyncLock);
+		++m_asyncLoads;
+	}
+	//signals the destructor while holding the lock, this is not used afterwards
+	struct Done {
+		OsmCompleterHandle * handle;
+		~Done() {
+			std::lock_guard<std::mutex> lck(handle->m_asyncLock);
+			--handle->m_asyncLoads;
+			handle->m_asyncDone.notify_all();
+		}
+	};
+	//a detached thread fulfils the promise, unlike the future of std::async the returned one does not block in its destructor
+	std::shared_ptr< std::promise<bool> > promise(std::make_shared< std::promise<bool> >());
+	std::future<bool> result(promise->get_future());
+	try {
+		std::thread([this, promise, filesDir, ghsgType, threadCount, prepare, finish]() {
+			Done done{this};
+			try {
+				promise->set_value(load(filesDir, ghsgType, threadCount, prepare, finish));
+			}
+			catch (...) {
+				promise->set_exception(std::current_exception());
+			}
+		}).detach();
+	}
+	catch (...) {
+		//the thread was not started
+		Done{this};
+		throw;
+	}
+	return result;
+}
+
+}}//end namespace liboscar::Static
@@ -0,0 +1,143 @@
+#include <liboscar/OsmIdIndex.h>
+#include <liboscar/OsmKeyValueObjectStore.h>
+#include <sserialize/utility/exceptions.h>
+#include <sserialize/utility/VersionChecker.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+namespace liboscar {
+namespace Static {
+namespace {
+
+using sidecar::OffsetType;
+using sidecar::alignOffset;
+
+constexpr OffsetType HeaderSize = 1+4+4;
+
+inline OffsetType keysOffset() {
+	return alignOffset(HeaderSize);
+}
+
+inline OffsetType itemIdsOffset(uint32_t size) {
+	return alignOffset(keysOffset() + (OffsetType(size)+1)*sizeof(int64_t));
+}
+
+inline OffsetType endOffset(uint32_t size) {
+	return itemIdsOffset(size) + OffsetType(size)*sizeof(uint32_t);
+}
+
+//writes src in sorted order to the 1-based Eytzinger positions starting at k
+//keys[k] is node k, itemIds[k-1] its item id
+void toEytzinger(const std::vector< std::pair<int64_t, uint32_t> > & src, std::size_t & i, std::size_t k, std::vector<int64_t> & keys, std::vector<uint32_t> & itemIds) {
+	if (k <= src.size()) {
+		toEytzinger(src, i, 2*k, keys, itemIds);
+		keys[k] = src[i].first;
+		itemIds[k-1] = src[i].second;
+		++i;
+		toEytzinger(src, i, 2*k+1, keys, itemIds);
+	}
+}
+
+} //end namespace
+
+constexpr uint32_t OsmIdIndex::npos;
+
+OsmIdIndex::OsmIdIndex() {}
+
+OsmIdIndex::OsmIdIndex(const sserialize::UByteArrayAdapter & data) {
+	sserialize::VersionChecker::check(data, LIBOSCAR_OSM_ID_INDEX_VERSION, data.at(0), "OsmIdIndex");
+	uint32_t size = data.getUint32(1);
+	m_view = sidecar::View(data, HeaderSize, endOffset(size), "OsmIdIndex");
+	m_size = size;
+	m_keys = m_view.array<int64_t>(keysOffset());
+	m_itemIds = m_view.array<uint32_t>(itemIdsOffset(size));
+}
+
+OsmIdIndex::~OsmIdIndex() {}
+
+sserialize::UByteArrayAdapter::OffsetType OsmIdIndex::getSizeInBytes() const {
+	return m_view.size();
+}
+
+void OsmIdIndex::find(const OsmIdType * osmIdTypes, uint32_t count, uint32_t * result) const {
+	//descend the tree with a block of keys at once so that their cache misses overlap
+	constexpr uint32_t BlockSize = 16;
+	uint64_t k[BlockSize];
+	for(uint32_t b(0); b < count; b += BlockSize) {
+		uint32_t bs = std::min<uint32_t>(BlockSize, count-b);
+		const OsmIdType * keys = osmIdTypes + b;
+		std::fill(k, k+bs, uint64_t(1));
+		for(uint64_t depth(1); depth <= m_size; depth = 2*depth+1) {
+			for(uint32_t i(0); i < bs; ++i) {
+				__builtin_prefetch(m_keys + k[i]*8);
+				k[i] = 2*k[i] + (m_keys[k[i]] < keys[i].raw());
+			}
+		}
+		for(uint32_t i(0); i < bs; ++i) {
+			//all paths of a complete tree have the same length, the last level might be incomplete
+			uint64_t x = k[i];
+			if (x <= m_size) {
+				x = 2*x + (m_keys[x] < keys[i].raw());
+			}
+			x >>= __builtin_ffsll(~x);
+			result[b+i] = (x && m_keys[x] == keys[i].raw()) ? m_itemIds[x-1] : npos;
+		}
+	}
+}
+
+sserialize::UByteArrayAdapter::OffsetType
+OsmIdIndex::create(const OsmKeyValueObjectStore & store, sserialize::UByteArrayAdapter & dest, uint32_t threadCount) {
+	struct State {
+		const OsmKeyValueObjectStore & store;
+		std::atomic<uint32_t> pos{0};
+		std::vector< std::pair<int64_t, uint32_t> > entries;
+		State(const OsmKeyValueObjectStore & store) : store(store), entries(store.size()) {}
+	};
+	struct Worker {
+		static constexpr uint32_t BlockSize = 1000;
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			uint32_t size = state->store.size();
+			while (true) {
+				uint32_t p = state->pos.fetch_add(BlockSize, std::memory_order_relaxed);
+				if (p >= size) {
+					break;
+				}
+				for(uint32_t end(std::min(p+BlockSize, size)); p < end; ++p) {
+					OsmKeyValueObjectStorePayload pl(state->store.payload(p));
+					state->entries[p] = std::make_pair(OsmIdType(pl.osmId(), pl.type()).raw(), p);
+				}
+			}
+		}
+	};
+	State state(store);
+	sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+
+	std::vector< std::pair<int64_t, uint32_t> > & entries = state.entries;
+	std::sort(entries.begin(), entries.end());
+	entries.erase(std::unique(entries.begin(), entries.end(),
+		[](const std::pair<int64_t, uint32_t> & a, const std::pair<int64_t, uint32_t> & b) { return a.first == b.first; }
+	), entries.end());
+
+	uint32_t size = (uint32_t) entries.size();
+	//keys[0] only pads the cache lines
+	std::vector<int64_t> keys(OffsetType(size)+1, std::numeric_limits<int64_t>::min());
+	std::vector<uint32_t> itemIds(size);
+	std::size_t i = 0;
+	toEytzinger(entries, i, 1, keys, itemIds);
+
+	OffsetType begin = dest.tellPutPtr();
+	dest.putUint8(LIBOSCAR_OSM_ID_INDEX_VERSION);
+	dest.putUint32(size);
+	sidecar::putByteOrderMark(dest);
+	sidecar::putArray(dest, begin, keysOffset(), keys);
+	sidecar::putArray(dest, begin, itemIdsOffset(size), itemIds);
+	SSERIALIZE_CHEAP_ASSERT_EQUAL(dest.tellPutPtr() - begin, endOffset(size));
+	return begin;
+}
+
+}}//end namespace liboscar::Static
@@ -3,6 +3,18 @@
 #include <sserialize/Static/GeoWay.h>
 #include <sserialize/Static/GeoMultiPolygon.h>
 #include <sserialize/utility/VersionChecker.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <sserialize/storage/pack_unpack_functions.h>
+#include <array>
+#include <atomic>
+#include <sstream>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#if defined(__unix__) || defined(__APPLE__)
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
 
 namespace liboscar {
 namespace Static {
@@ -14,6 +26,191 @@ OsmKeyValueObjectStore::Item ItemId2OsmId::operator()(uint32_t id) const {
 
 }//end namespace detail
 
+namespace {
+
+//number of items whose payload is prefetched ahead of decoding it
+constexpr uint32_t ItemsPrefetchDistance = 16;
+//number of items whose payload pages are requested from the os at once
+constexpr uint32_t ItemsAdviseBlockSize = 256;
+//larger spans are not worth a madvise since most of their pages are not needed
+constexpr uintptr_t ItemsMaxAdviseSpan = 4*1024*1024;
+//filter() uses the rtree if the partner has more than size()/RTreeFilterMinPartnerFraction items
+constexpr uint32_t RTreeFilterMinPartnerFraction = 64;
+
+//number of items processed at once by the parallel scans over the store
+constexpr uint32_t ScanBlockSize = 4096;
+
+//calls func(blockId, begin, end) for the blocks of ScanBlockSize items of [0, size) using threadCount threads
+template<typename TFunc>
+void forEachBlock(uint32_t size, uint32_t threadCount, TFunc & func) {
+	struct State {
+		TFunc & func;
+		uint32_t size;
+		std::atomic<uint32_t> block{0};
+		State(TFunc & func, uint32_t size) : func(func), size(size) {}
+	};
+	struct Worker {
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			while (true) {
+				uint32_t b = state->block.fetch_add(1, std::memory_order_relaxed);
+				if (uint64_t(b)*ScanBlockSize >= state->size) {
+					break;
+				}
+				uint32_t begin = b*ScanBlockSize;
+				state->func(b, begin, std::min(begin+ScanBlockSize, state->size));
+			}
+		}
+	};
+	State state(func, size);
+	if (threadCount > 1) {
+		sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	}
+	else {
+		Worker(&state)();
+	}
+}
+
+inline uint32_t blockCount(uint32_t size) {
+	return size/ScanBlockSize + 1;
+}
+
+//@return pointer to the payload data if it is directly addressable
+inline const uint8_t * payloadPtr(const sserialize::UByteArrayAdapter & d) {
+	if (!d.size() || !d.isContiguous()) {
+		return nullptr;
+	}
+	return d.getMemView(0, 1).data();
+}
+
+//decodes the osm id and the score at the beginning of a serialized OsmKeyValueObjectStorePayload of size bytes
+//@return the size of the decoded part, the shape follows it
+inline uint32_t decodePayloadHeader(const uint8_t * d, uint64_t size, OsmIdType & osmIdType, uint32_t & score) {
+	int len = int(std::min<uint64_t>(size, 9));
+	osmIdType = OsmIdType(sserialize::up_vs64(d, &len));
+	if (len < 0) {
+		throw sserialize::CorruptDataException("OsmKeyValueObjectStorePayload: invalid osm id");
+	}
+	uint32_t headerSize = uint32_t(len);
+	len = int(std::min<uint64_t>(size-headerSize, 5));
+	score = sserialize::up_vu32(d+headerSize, &len);
+	if (len < 0) {
+		throw sserialize::CorruptDataException("OsmKeyValueObjectStorePayload: invalid score");
+	}
+	return headerSize + uint32_t(len);
+}
+
+inline void adviseWillNeed(const uint8_t * begin, const uint8_t * end) {
+#if defined(__unix__) || defined(__APPLE__)
+	if (!begin || !end || end < begin) {
+		return;
+	}
+	static const uintptr_t pageSize = uintptr_t(::sysconf(_SC_PAGESIZE));
+	uintptr_t b = uintptr_t(begin) & ~(pageSize-1);
+	uintptr_t e = uintptr_t(end)+1;
+	if (e - b <= ItemsMaxAdviseSpan) {
+		::madvise(reinterpret_cast<void*>(b), e-b, MADV_WILLNEED);
+	}
+#else
+	(void) begin;
+	(void) end;
+#endif
+}
+
+}//end namespace
+
+void OsmKeyValueObjectStoreItemBatch::clear() {
+	fields = F_NONE;
+	itemIds.clear();
+	osmIdTypes.clear();
+	scores.clear();
+	shapeTypes.clear();
+	boundaries.clear();
+	keyValueOffsets.clear();
+	keyValues.clear();
+	cellOffsets.clear();
+	cells.clear();
+}
+
+OsmKeyValueObjectStorePayloadCache::OsmKeyValueObjectStorePayloadCache(uint64_t byteBudget, uint32_t shardCount) :
+m_byteBudget(byteBudget),
+m_shardMask(0)
+{
+	while (m_shardMask+1 < shardCount) {
+		m_shardMask = 2*m_shardMask+1;
+	}
+	m_shardBudget = m_byteBudget/(m_shardMask+1);
+	m_shards.reset(new Shard[m_shardMask+1]);
+}
+
+constexpr uint64_t OsmKeyValueObjectStorePayloadCache::EntryBytes;
+
+OsmKeyValueObjectStorePayloadCache::~OsmKeyValueObjectStorePayloadCache() {}
+
+bool OsmKeyValueObjectStorePayloadCache::get(uint32_t itemPos, OsmKeyValueObjectStorePayload & payload) {
+	Shard & s = shard(itemPos);
+	std::lock_guard<std::mutex> lck(s.lock);
+	auto it = s.entries.find(itemPos);
+	if (it == s.entries.end()) {
+		++s.stats.misses;
+		return false;
+	}
+	++s.stats.hits;
+	it->second->referenced = true;
+	payload = it->second->payload;
+	return true;
+}
+
+void OsmKeyValueObjectStorePayloadCache::put(uint32_t itemPos, const OsmKeyValueObjectStorePayload & payload) {
+	if (EntryBytes > m_shardBudget) {
+		return;
+	}
+	Shard & s = shard(itemPos);
+	std::lock_guard<std::mutex> lck(s.lock);
+	if (s.entries.count(itemPos)) {
+		return;
+	}
+	s.lru.push_front(Entry{itemPos, false, payload});
+	s.entries[itemPos] = s.lru.begin();
+	s.stats.bytes += EntryBytes;
+	while (s.stats.bytes > m_shardBudget) {
+		Entry & e = s.lru.back();
+		if (e.referenced) {
+			e.referenced = false;
+			s.lru.splice(s.lru.begin(), s.lru, std::prev(s.lru.end()));
+			continue;
+		}
+		s.stats.bytes -= EntryBytes;
+		s.entries.erase(e.itemPos);
+		s.lru.pop_back();
+		++s.stats.evictions;
+	}
+	s.stats.entries = s.entries.size();
+}
+
+void OsmKeyValueObjectStorePayloadCache::clear() {
+	for(uint32_t i(0); i <= m_shardMask; ++i) {
+		Shard & s = m_shards[i];
+		std::lock_guard<std::mutex> lck(s.lock);
+		s.lru.clear();
+		s.entries.clear();
+		s.stats.entries = 0;
+		s.stats.bytes = 0;
+	}
+}
+
+std::vector<OsmKeyValueObjectStorePayloadCache::ShardStats> OsmKeyValueObjectStorePayloadCache::stats() const {
+	std::vector<ShardStats> result;
+	for(uint32_t i(0); i <= m_shardMask; ++i) {
+		Shard & s = m_shards[i];
+		std::lock_guard<std::mutex> lck(s.lock);
+		result.push_back(s.stats);
+	}
+	return result;
+}
+
 constexpr uint32_t OsmKeyValueObjectStore::npos;
 
 OsmKeyValueObjectStore::OsmKeyValueObjectStore(OsmKeyValueObjectStorePrivate * data): m_priv(data) {}
@@ -153,7 +350,11 @@ sserialize::ItemIndex OsmKeyValueObjectStore::complete(const sserialize::spatial
 }
 
 sserialize::ItemIndex OsmKeyValueObjectStore::filter(const sserialize::spatial::GeoRect & rect, bool approximate, const sserialize::ItemIndex & partner) const {
-	return priv()->filter(rect, approximate, partner);
+	return priv()->filter(rect, approximate, partner, npos);
+}
+
+sserialize::ItemIndex OsmKeyValueObjectStore::filter(const sserialize::spatial::GeoRect & rect, bool approximate, const sserialize::ItemIndex & partner, uint32_t maxResultSize) const {
+	return priv()->filter(rect, approximate, partner, maxResultSize);
 }
 
 sserialize::ItemIndexIterator OsmKeyValueObjectStore::filter(const sserialize::spatial::GeoRect & rect, bool /*approximate*/, const sserialize::ItemIndexIterator & partner) const {
@@ -182,6 +383,10 @@ sserialize::Static::spatial::GeoShape OsmKeyValueObjectStore::geoShape(uint32_t
 	return priv()->geoShapeAt(itemPos);	
 }
 
+sserialize::Static::spatial::GeoShape OsmKeyValueObjectStore::geoShape(uint32_t itemPos, double tolerance) const {
+	return priv()->geoShapeAt(itemPos, tolerance);
+}
+
 int64_t OsmKeyValueObjectStore::osmId(uint32_t itemPos) const {
 	return priv()->osmId(itemPos);
 }
@@ -202,28 +407,98 @@ OsmKeyValueObjectStorePayload OsmKeyValueObjectStore::payload(uint32_t itemPos)
 	return priv()->payload(itemPos);
 }
 
-sserialize::spatial::GeoRect OsmKeyValueObjectStore::boundary() const {
-	if (!size())
-		return sserialize::spatial::GeoRect();
-	sserialize::spatial::GeoRect rect;
-	uint32_t i = 0;
+sserialize::UByteArrayAdapter OsmKeyValueObjectStore::payloadData(uint32_t itemPos) const {
+	return priv()->payloadData(itemPos);
+}
+
+void OsmKeyValueObjectStore::items(const sserialize::ItemIndex & idx, uint32_t fields, OsmKeyValueObjectStoreItemBatch & out) const {
+	priv()->items(idx, fields, out);
+}
 
-	//find the first valid rect
-	for(uint32_t s = size(); i < s; ++i) {
-		sserialize::Static::spatial::GeoShape shape = geoShape(i);
-		if (shape.type() != sserialize::spatial::GS_NONE) {
-			rect = shape.boundary();
-			break;
-		}
+void OsmKeyValueObjectStore::setColumns(const OsmKeyValueObjectStoreColumns & columns) {
+	priv()->setColumns(columns);
+}
+
+const OsmKeyValueObjectStoreColumns & OsmKeyValueObjectStore::columns() const {
+	return priv()->columns();
+}
+
+void OsmKeyValueObjectStore::setOsmIdIndex(const OsmIdIndex & index) {
+	priv()->setOsmIdIndex(index);
+}
+
+const OsmIdIndex & OsmKeyValueObjectStore::osmIdIndex() const {
+	return priv()->osmIdIndex();
+}
+
+uint32_t OsmKeyValueObjectStore::findByOsmId(const OsmIdType & osmIdType) const {
+	return priv()->findByOsmId(osmIdType);
+}
+
+uint32_t OsmKeyValueObjectStore::findByOsmId(liboscar::OsmItemTypes type, int64_t osmId) const {
+	return priv()->findByOsmId(OsmIdType(osmId, type));
+}
+
+std::vector<uint32_t> OsmKeyValueObjectStore::findByOsmId(const std::vector<OsmIdType> & osmIdTypes) const {
+	return priv()->findByOsmId(osmIdTypes);
+}
+
+void OsmKeyValueObjectStore::setRTree(const ItemRTree & rtree) {
+	priv()->setRTree(rtree);
+}
+
+const ItemRTree & OsmKeyValueObjectStore::rtree() const {
+	return priv()->rtree();
+}
+
+void OsmKeyValueObjectStore::setCompressedGeometry(const CompressedGeometryStore & geometries) {
+	priv()->setCompressedGeometry(geometries);
+}
+
+const CompressedGeometryStore & OsmKeyValueObjectStore::compressedGeometry() const {
+	return priv()->compressedGeometry();
+}
+
+void OsmKeyValueObjectStore::setSimplifiedGeometry(const SimplifiedGeometryStore & geometries) {
+	priv()->setSimplifiedGeometry(geometries);
+}
+
+const SimplifiedGeometryStore & OsmKeyValueObjectStore::simplifiedGeometry() const {
+	return priv()->simplifiedGeometry();
+}
+
+void OsmKeyValueObjectStore::setSpatialPayloads(const SpatialPayloadStore & payloads) {
+	priv()->setSpatialPayloads(payloads);
+}
+
+const SpatialPayloadStore & OsmKeyValueObjectStore::spatialPayloads() const {
+	return priv()->spatialPayloads();
+}
+
+void OsmKeyValueObjectStore::setPayloadCache(uint64_t byteBudget, uint32_t shardCount) {
+	priv()->setPayloadCache(byteBudget, shardCount);
+}
+
+std::vector<OsmKeyValueObjectStorePayloadCache::ShardStats> OsmKeyValueObjectStore::payloadCacheStats() const {
+	if (std::shared_ptr<OsmKeyValueObjectStorePayloadCache> cache = priv()->payloadCache()) {
+		return cache->stats();
 	}
-	
-	for(uint32_t s = size(); i < s; ++i) {
-		sserialize::Static::spatial::GeoShape shape = geoShape(i);
-		if (shape.type() != sserialize::spatial::GS_NONE) {
-			rect.enlarge(shape.boundary());
+	return std::vector<OsmKeyValueObjectStorePayloadCache::ShardStats>();
+}
+
+void OsmKeyValueObjectStore::warmPayloadCache(const std::vector<uint32_t> & itemIds) const {
+	if (!priv()->payloadCache()) {
+		return;
+	}
+	for(uint32_t itemId : itemIds) {
+		if (itemId < size()) {
+			priv()->payload(itemId);
 		}
 	}
-	return rect;
+}
+
+sserialize::spatial::GeoRect OsmKeyValueObjectStore::boundary(uint32_t threadCount) const {
+	return priv()->boundary(threadCount);
 }
 
 sserialize::ItemIndex OsmKeyValueObjectStore::complete(const std::string & /*str*/, sserialize::StringCompleter::QuerryType /*qtype*/) const {
@@ -267,28 +542,12 @@ std::string OsmKeyValueObjectStore::getName() const {
 	return std::string("OsmKeyValueObjectStore");
 }
 
-std::ostream & OsmKeyValueObjectStore::printStats(std::ostream & out) const {
-	return priv()->printStats(out);
+std::ostream & OsmKeyValueObjectStore::printStats(std::ostream & out, uint32_t threadCount) const {
+	return priv()->printStats(out, threadCount);
 }
 
-bool OsmKeyValueObjectStore::sanityCheck() const {
-	auto keysSize = keyStringTable().size();
-	auto valuesSize = valueStringTable().size();
-
-	for(uint32_t i = 0, s = size(); i < s; ++i) {
-		Item item(at(i));
-		for(uint32_t j = 0, sj = item.size(); j < sj; ++j) {
-			if (item.keyId(j) >= keysSize) {
-				std::cout << "Invalid keyid=" << item.keyId(j) << ">=" << keysSize << " in item " << i << std::endl;
-// 				return false;
-			}
-			if (item.valueId(j) >= valuesSize) {
-				std::cout << "Invalid valueid=" << item.valueId(j) << ">=" << valuesSize << " in item " << i << std::endl;
-// 				return false;
-			}
-		}
-	}
-	return true;
+bool OsmKeyValueObjectStore::sanityCheck(uint32_t threadCount) const {
+	return priv()->sanityCheck(threadCount);
 }
 
 
@@ -428,10 +687,30 @@ sserialize::StringCompleter::SupportedQuerries OsmKeyValueObjectStorePrivate::ge
 bool OsmKeyValueObjectStorePrivate::match(uint32_t itemPos, const sserialize::spatial::GeoRect & boundary) const {
 	if (itemPos >= size())
 		return false;
-	return payload(itemPos).shape().intersects(boundary);
+	if (m_columns.valid()) {
+		switch (m_columns.match(itemPos, boundary)) {
+		case OsmKeyValueObjectStoreColumns::MR_DISJOINT:
+			return false;
+		case OsmKeyValueObjectStoreColumns::MR_CONTAINED:
+			return true;
+		default:
+			break;
+		}
+	}
+	return shapeIntersects(itemPos, boundary);
+}
+
+bool OsmKeyValueObjectStorePrivate::shapeIntersects(uint32_t itemPos, const sserialize::spatial::GeoRect & rect) const {
+	if (m_geometry.valid()) {
+		return m_geometry.at(itemPos).intersects(rect);
+	}
+	return payload(itemPos).shape().intersects(rect);
 }
 
 sserialize::spatial::GeoShapeType OsmKeyValueObjectStorePrivate::geoShapeType(uint32_t itemPos) const {
+	if (m_columns.valid()) {
+		return m_columns.geoShapeType(itemPos);
+	}
 	return payload(itemPos).shape().type();
 }
 uint32_t OsmKeyValueObjectStorePrivate::geoPointCount(uint32_t itemPos) const {
@@ -445,11 +724,25 @@ sserialize::Static::spatial::GeoShape OsmKeyValueObjectStorePrivate::geoShapeAt(
 	return payload(itemPos).shape();
 }
 
+sserialize::Static::spatial::GeoShape OsmKeyValueObjectStorePrivate::geoShapeAt(uint32_t itemPos, double tolerance) const {
+	sserialize::Static::spatial::GeoShape result;
+	if (m_simplifiedGeometry.valid() && m_simplifiedGeometry.at(itemPos, tolerance, result)) {
+		return result;
+	}
+	return geoShapeAt(itemPos);
+}
+
 int64_t OsmKeyValueObjectStorePrivate::osmId(uint32_t itemPos) const {
+	if (m_columns.valid()) {
+		return m_columns.osmId(itemPos);
+	}
 	return payload(itemPos).osmId();
 }
 
 uint32_t OsmKeyValueObjectStorePrivate::score(uint32_t itemPos) const {
+	if (m_columns.valid()) {
+		return m_columns.score(itemPos);
+	}
 	return payload(itemPos).score();
 }
 
@@ -462,10 +755,289 @@ sserialize::BoundedCompactUintArray OsmKeyValueObjectStorePrivate::cells(uint32_
 }
 
 OsmKeyValueObjectStorePayload OsmKeyValueObjectStorePrivate::payload(uint32_t itemPos) const {
-	return m_payload.at(toInternalId(itemPos));
+	if (std::shared_ptr<OsmKeyValueObjectStorePayloadCache> cache = payloadCache()) {
+		OsmKeyValueObjectStorePayload result;
+		if (!cache->get(itemPos, result)) {
+			result = OsmKeyValueObjectStorePayload(payloadData(itemPos));
+			cache->put(itemPos, result);
+		}
+		return result;
+	}
+	return OsmKeyValueObjectStorePayload(payloadData(itemPos));
+}
+
+sserialize::UByteArrayAdapter OsmKeyValueObjectStorePrivate::payloadData(uint32_t itemPos) const {
+	if (m_spatialPayloads.valid()) {
+		return m_spatialPayloads.dataAt(m_spatialPayloads.position(itemPos));
+	}
+	return m_payload.dataAt(toInternalId(itemPos));
+}
+
+void OsmKeyValueObjectStorePrivate::items(const sserialize::ItemIndex & idx, uint32_t fields, OsmKeyValueObjectStoreItemBatch & out) const {
+	typedef OsmKeyValueObjectStoreItemBatch Batch;
+	out.clear();
+	out.fields = fields;
+	uint32_t n = idx.size();
+	//(storage position, position in out), payloads are stored in the order of their internalId or in spatial order
+	bool spatialPayloads = m_spatialPayloads.valid();
+	auto payloadAt = [this, spatialPayloads](uint32_t storagePos) {
+		return spatialPayloads ? m_spatialPayloads.dataAt(storagePos) : m_payload.dataAt(storagePos);
+	};
+	//spatial payloads are decoded directly from their memory, resolved once for the batch
+	const uint8_t * rawPayloads = spatialPayloads ? m_spatialPayloads.rawData() : nullptr;
+	const uint64_t * rawOffsets = spatialPayloads ? m_spatialPayloads.offsets() : nullptr;
+	const sserialize::UByteArrayAdapter & rawPayloadData = m_spatialPayloads.data();
+	auto payloadBegin = [&](uint32_t storagePos) -> const uint8_t * {
+		return rawPayloads ? rawPayloads + rawOffsets[storagePos] : payloadPtr(payloadAt(storagePos));
+	};
+	std::vector< std::pair<uint32_t, uint32_t> > order;
+	order.reserve(n);
+	out.itemIds.reserve(n);
+	for(uint32_t itemId : idx) {
+		if (itemId >= size()) {
+			throw sserialize::OutOfBoundsException("OsmKeyValueObjectStore::items");
+		}
+		order.emplace_back(spatialPayloads ? m_spatialPayloads.position(itemId) : toInternalId(itemId), (uint32_t) out.itemIds.size());
+		out.itemIds.push_back(itemId);
+	}
+	std::sort(order.begin(), order.end());
+	
+	bool useColumns = m_columns.valid();
+	bool needPayload = (fields & (Batch::F_BOUNDARY | Batch::F_CELLS)) ||
+		(!useColumns && (fields & (Batch::F_OSM_ID | Batch::F_SCORE | Batch::F_SHAPE_TYPE)));
+	if (fields & Batch::F_OSM_ID) {
+		out.osmIdTypes.resize(n);
+	}
+	if (fields & Batch::F_SCORE) {
+		out.scores.resize(n);
+	}
+	if (fields & Batch::F_SHAPE_TYPE) {
+		out.shapeTypes.resize(n);
+	}
+	if (fields & Batch::F_BOUNDARY) {
+		out.boundaries.resize(n);
+	}
+	//variable length fields are decoded in storage order and reordered afterwards
+	std::vector<uint32_t> kvBegin, cellsBegin;
+	std::vector<Batch::KeyValue> kvTmp;
+	std::vector<uint32_t> cellsTmp;
+	if (fields & Batch::F_KEY_VALUES) {
+		kvBegin.resize(n);
+	}
+	if (fields & Batch::F_CELLS) {
+		cellsBegin.resize(n);
+	}
+	
+	for(uint32_t i(0); i < n; ++i) {
+		uint32_t storagePos = order[i].first;
+		uint32_t pos = order[i].second;
+		uint32_t itemId = out.itemIds[pos];
+		if (needPayload) {
+			if (i % ItemsAdviseBlockSize == 0) {
+				uint32_t last = std::min(i+ItemsAdviseBlockSize, n)-1;
+				adviseWillNeed(payloadBegin(storagePos), payloadBegin(order[last].first));
+			}
+			if (i+ItemsPrefetchDistance < n) {
+				const uint8_t * d = payloadBegin(order[i+ItemsPrefetchDistance].first);
+				if (d) {
+					__builtin_prefetch(d);
+				}
+			}
+			OsmIdType osmIdType;
+			uint32_t score;
+			//shape and cells need an adapter, the header is decoded from the raw memory if possible
+			sserialize::UByteArrayAdapter shapeData;
+			if (rawPayloads) {
+				uint64_t plBegin = rawOffsets[storagePos];
+				uint64_t plSize = rawOffsets[storagePos+1] - plBegin;
+				uint32_t headerSize = decodePayloadHeader(rawPayloads + plBegin, plSize, osmIdType, score);
+				if (fields & (Batch::F_SHAPE_TYPE | Batch::F_BOUNDARY | Batch::F_CELLS)) {
+					shapeData = sserialize::UByteArrayAdapter(rawPayloadData, plBegin + headerSize, plSize - headerSize);
+				}
+			}
+			else {
+				shapeData = payloadAt(storagePos);
+				osmIdType = OsmIdType(shapeData.resetGetPtr().getVlPackedInt64());
+				score = shapeData.getVlPackedUint32();
+				shapeData.shrinkToGetPtr();
+			}
+			if (fields & Batch::F_OSM_ID) {
+				out.osmIdTypes[pos] = osmIdType;
+			}
+			if (fields & Batch::F_SCORE) {
+				out.scores[pos] = score;
+			}
+			sserialize::Static::spatial::GeoShape shape;
+			if (fields & (Batch::F_SHAPE_TYPE | Batch::F_BOUNDARY | Batch::F_CELLS)) {
+				shape = sserialize::Static::spatial::GeoShape(shapeData);
+			}
+			if (fields & Batch::F_SHAPE_TYPE) {
+				out.shapeTypes[pos] = shape.type();
+			}
+			if (fields & Batch::F_BOUNDARY && shape.type() != sserialize::spatial::GS_NONE) {
+				out.boundaries[pos] = shape.boundary();
+			}
+			if (fields & Batch::F_CELLS) {
+				sserialize::BoundedCompactUintArray itemCells(shapeData + shape.getSizeInBytes());
+				cellsBegin[pos] = (uint32_t) cellsTmp.size();
+				for(uint32_t j(0), js(itemCells.size()); j < js; ++j) {
+					cellsTmp.push_back(itemCells.at(j));
+				}
+			}
+		}
+		else {
+			if (fields & Batch::F_OSM_ID) {
+				out.osmIdTypes[pos] = m_columns.osmIdType(itemId);
+			}
+			if (fields & Batch::F_SCORE) {
+				out.scores[pos] = m_columns.score(itemId);
+			}
+			if (fields & Batch::F_SHAPE_TYPE) {
+				out.shapeTypes[pos] = m_columns.geoShapeType(itemId);
+			}
+		}
+		if (fields & Batch::F_KEY_VALUES) {
+			sserialize::Static::KeyValueObjectStoreItemBase kvi(m_kv.baseItem(spatialPayloads ? toInternalId(itemId) : storagePos));
+			kvBegin[pos] = (uint32_t) kvTmp.size();
+			for(uint32_t j(0), js(kvi.size()); j < js; ++j) {
+				kvTmp.push_back(Batch::KeyValue{kvi.keyId(j), kvi.valueId(j)});
+			}
+		}
+	}
+	
+	//the end of the data of the item at pos is the begin of its successor in storage order
+	auto reorder = [&order, n](std::vector<uint32_t> & begin, std::size_t total, std::vector<uint32_t> & offsets, auto & dest, const auto & src) {
+		std::vector<uint32_t> end(n);
+		for(uint32_t i(0); i < n; ++i) {
+			end[order[i].second] = (i+1 < n ? begin[order[i+1].second] : (uint32_t) total);
+		}
+		offsets.resize(n+1);
+		offsets[0] = 0;
+		dest.reserve(total);
+		for(uint32_t pos(0); pos < n; ++pos) {
+			dest.insert(dest.end(), src.begin()+begin[pos], src.begin()+end[pos]);
+			offsets[pos+1] = (uint32_t) dest.size();
+		}
+	};
+	if (fields & Batch::F_KEY_VALUES) {
+		reorder(kvBegin, kvTmp.size(), out.keyValueOffsets, out.keyValues, kvTmp);
+	}
+	if (fields & Batch::F_CELLS) {
+		reorder(cellsBegin, cellsTmp.size(), out.cellOffsets, out.cells, cellsTmp);
+	}
+}
+
+void OsmKeyValueObjectStorePrivate::setColumns(const OsmKeyValueObjectStoreColumns & columns) {
+	if (columns.valid() && columns.size() != size()) {
+		throw sserialize::CorruptDataException("OsmKeyValueObjectStore: columns.size() != size()");
+	}
+	m_columns = columns;
+}
+
+void OsmKeyValueObjectStorePrivate::setOsmIdIndex(const OsmIdIndex & index) {
+	if (index.valid() && index.size() > size()) {
+		throw sserialize::CorruptDataException("OsmKeyValueObjectStore: osmIdIndex.size() > size()");
+	}
+	m_osmIdIndex = index;
+}
+
+void OsmKeyValueObjectStorePrivate::setRTree(const ItemRTree & rtree) {
+	if (rtree.valid() && rtree.size() > size()) {
+		throw sserialize::CorruptDataException("OsmKeyValueObjectStore: rtree.size() > size()");
+	}
+	m_rtree = rtree;
+}
+
+void OsmKeyValueObjectStorePrivate::setCompressedGeometry(const CompressedGeometryStore & geometries) {
+	if (geometries.valid() && geometries.size() != size()) {
+		throw sserialize::CorruptDataException("OsmKeyValueObjectStore: compressedGeometry.size() != size()");
+	}
+	m_geometry = geometries;
+}
+
+void OsmKeyValueObjectStorePrivate::setSimplifiedGeometry(const SimplifiedGeometryStore & geometries) {
+	if (geometries.valid() && geometries.size() != size()) {
+		throw sserialize::CorruptDataException("OsmKeyValueObjectStore: simplifiedGeometry.size() != size()");
+	}
+	m_simplifiedGeometry = geometries;
+}
+
+void OsmKeyValueObjectStorePrivate::setSpatialPayloads(const SpatialPayloadStore & payloads) {
+	if (payloads.valid() && payloads.size() != size()) {
+		throw sserialize::CorruptDataException("OsmKeyValueObjectStore: spatialPayloads.size() != size()");
+	}
+	m_spatialPayloads = payloads;
+}
+
+void OsmKeyValueObjectStorePrivate::setPayloadCache(uint64_t byteBudget, uint32_t shardCount) {
+	std::shared_ptr<OsmKeyValueObjectStorePayloadCache> cache;
+	if (byteBudget) {
+		cache = std::make_shared<OsmKeyValueObjectStorePayloadCache>(byteBudget, shardCount);
+	}
+	std::atomic_store_explicit(&m_payloadCache, cache, std::memory_order_release);
+}
+
+uint32_t OsmKeyValueObjectStorePrivate::findByOsmId(const OsmIdType & osmIdType) const {
+	if (m_osmIdIndex.valid()) {
+		return m_osmIdIndex.find(osmIdType);
+	}
+	for(uint32_t i(0), s(size()); i < s; ++i) {
+		if (m_columns.valid()) {
+			if (m_columns.osmIdType(i) == osmIdType) {
+				return i;
+			}
+		}
+		else {
+			OsmKeyValueObjectStorePayload pl(payload(i));
+			if (OsmIdType(pl.osmId(), pl.type()) == osmIdType) {
+				return i;
+			}
+		}
+	}
+	return OsmKeyValueObjectStore::npos;
+}
+
+std::vector<uint32_t> OsmKeyValueObjectStorePrivate::findByOsmId(const std::vector<OsmIdType> & osmIdTypes) const {
+	std::vector<uint32_t> result(osmIdTypes.size(), OsmKeyValueObjectStore::npos);
+	if (m_osmIdIndex.valid()) {
+		m_osmIdIndex.find(osmIdTypes.data(), (uint32_t) osmIdTypes.size(), result.data());
+		return result;
+	}
+	std::unordered_map<OsmIdType, std::vector<uint32_t> > positions;
+	for(uint32_t i(0), s((uint32_t) osmIdTypes.size()); i < s; ++i) {
+		positions[osmIdTypes[i]].push_back(i);
+	}
+	for(uint32_t i(0), s(size()); i < s && positions.size(); ++i) {
+		OsmIdType osmIdType;
+		if (m_columns.valid()) {
+			osmIdType = m_columns.osmIdType(i);
+		}
+		else {
+			OsmKeyValueObjectStorePayload pl(payload(i));
+			osmIdType = OsmIdType(pl.osmId(), pl.type());
+		}
+		auto it = positions.find(osmIdType);
+		if (it != positions.end()) {
+			for(uint32_t p : it->second) {
+				result[p] = i;
+			}
+			positions.erase(it);
+		}
+	}
+	return result;
 }
 
 sserialize::ItemIndex OsmKeyValueObjectStorePrivate::complete(const sserialize::spatial::GeoRect & rect) const {
+	if (m_rtree.valid()) {
+		std::vector<uint32_t> result;
+		m_rtree.visit(ItemRTree::QuantizedRect(rect), [this, &rect, &result](uint32_t itemId, bool contained) {
+			if (contained || shapeIntersects(itemId, rect)) {
+				result.push_back(itemId);
+			}
+		});
+		std::sort(result.begin(), result.end());
+		return sserialize::ItemIndex(std::move(result));
+	}
 	uint32_t s = size();
 	sserialize::UByteArrayAdapter cache( sserialize::UByteArrayAdapter::createCache(1, sserialize::MM_PROGRAM_MEMORY) );
 	sserialize::ItemIndexPrivateSimpleCreator creator(0, s, s, cache);
@@ -477,96 +1049,253 @@ sserialize::ItemIndex OsmKeyValueObjectStorePrivate::complete(const sserialize::
 	return creator.getIndex();
 }
 
-sserialize::ItemIndex OsmKeyValueObjectStorePrivate::filter(const sserialize::spatial::GeoRect & rect, bool /*approximate*/, const sserialize::ItemIndex & partner) const {
-	if (!partner.size())
-		return partner;
-	sserialize::UByteArrayAdapter cache( sserialize::UByteArrayAdapter::createCache(1, sserialize::MM_PROGRAM_MEMORY) );
-	sserialize::ItemIndexPrivateSimpleCreator creator(partner.front(), partner.back(), partner.size(), cache);
-	for(uint32_t i = 0; i < partner.size(); i++) {
-		uint32_t itemId = partner.at(i);
-		if (match(itemId, rect))
-			creator.push_back(itemId);
+sserialize::ItemIndex OsmKeyValueObjectStorePrivate::filter(const sserialize::spatial::GeoRect & rect, bool /*approximate*/, const sserialize::ItemIndex & partner, uint32_t maxResultSize) const {
+	if (!partner.size() || !maxResultSize)
+		return sserialize::ItemIndex();
+	//large partners are cheaper to intersect with the candidates of the spatial index
+	//only candidates that are in partner and whose bounding box is not within rect need a shape test
+	if (m_rtree.valid() && partner.size() > size()/RTreeFilterMinPartnerFraction) {
+		//(itemId, contained)
+		std::vector< std::pair<uint32_t, bool> > candidates;
+		m_rtree.visit(ItemRTree::QuantizedRect(rect), [&candidates](uint32_t itemId, bool contained) {
+			candidates.emplace_back(itemId, contained);
+		});
+		std::sort(candidates.begin(), candidates.end());
+		std::vector<uint32_t> result;
+		auto cit = candidates.cbegin();
+		auto cend = candidates.cend();
+		auto pit = partner.begin();
+		auto pend = partner.end();
+		while (cit != cend && pit != pend && result.size() < maxResultSize) {
+			if (cit->first < *pit) {
+				++cit;
+			}
+			else if (*pit < cit->first) {
+				++pit;
+			}
+			else {
+				if (cit->second || shapeIntersects(cit->first, rect)) {
+					result.push_back(cit->first);
+				}
+				++cit;
+				++pit;
+			}
+		}
+		return sserialize::ItemIndex(std::move(result));
 	}
-	creator.flush();
-	return creator.getIndex();
+	if (!m_columns.valid()) {
+		std::vector<uint32_t> result;
+		for(uint32_t itemId : partner) {
+			if (result.size() >= maxResultSize)
+				break;
+			if (match(itemId, rect))
+				result.push_back(itemId);
+		}
+		return sserialize::ItemIndex(std::move(result));
+	}
+	constexpr uint32_t BlockSize = 1024;
+	OsmKeyValueObjectStoreColumns::QuantizedRect qrect(rect);
+	std::vector<uint32_t> result;
+	std::array<uint32_t, BlockSize> ids;
+	std::array<uint8_t, BlockSize> matches;
+	auto it = partner.begin();
+	auto end = partner.end();
+	while (it != end && result.size() < maxResultSize) {
+		uint32_t blockSize = 0;
+		for(; it != end && blockSize < BlockSize; ++it) {
+			//invalid ids never match
+			if (*it < m_size) {
+				ids[blockSize] = *it;
+				++blockSize;
+			}
+		}
+		m_columns.match(ids.data(), blockSize, qrect, matches.data());
+		for(uint32_t i(0); i < blockSize && result.size() < maxResultSize; ++i) {
+			switch (matches[i]) {
+			case OsmKeyValueObjectStoreColumns::MR_CONTAINED:
+				result.push_back(ids[i]);
+				break;
+			case OsmKeyValueObjectStoreColumns::MR_UNDECIDED:
+				if (shapeIntersects(ids[i], rect)) {
+					result.push_back(ids[i]);
+				}
+				break;
+			default:
+				break;
+			}
+		}
+	}
+	return sserialize::ItemIndex(std::move(result));
 }
 
 bool OsmKeyValueObjectStorePrivate::match(uint32_t pos, const std::pair< std::string, sserialize::StringCompleter::QuerryType >& querry) const {
 	return m_kv.matchValues(pos, querry);
 }
 
-std::ostream & OsmKeyValueObjectStorePrivate::printStats(std::ostream & out) const {
-	out << "OsmKeyValueObjectStore::printStats -- BEGIN" << std::endl;
-	out << "Size of payload: " << m_payload.getSizeInBytes() << "(" << ((double)m_payload.getSizeInBytes())/getSizeInBytes()*100.0 << "%)" << std::endl;
-	uint64_t geoShapeSizeInBytes = 0;
-	for(uint32_t i(0), s(size()); i < s; ++i) {
-		 geoShapeSizeInBytes += geoShapeAt(i).getSizeInBytes();
+sserialize::spatial::GeoRect OsmKeyValueObjectStorePrivate::boundary(uint32_t threadCount) const {
+	if (m_rtree.valid() && m_rtree.size()) {
+		return m_rtree.boundary();
+	}
+	std::call_once(m_boundaryFlag, [this, threadCount]() {
+		std::vector<sserialize::spatial::GeoRect> rects(blockCount(size()));
+		std::vector<char> valid(rects.size(), 0);
+		auto func = [this, &rects, &valid](uint32_t blockId, uint32_t begin, uint32_t end) {
+			sserialize::spatial::GeoRect & rect = rects[blockId];
+			for(uint32_t i(begin); i < end; ++i) {
+				sserialize::spatial::GeoRect itemRect;
+				if (m_columns.valid()) {
+					const OsmKeyValueObjectStoreColumns::BBoxColumns & bboxes = m_columns.bboxes();
+					if (bboxes.minLat[i] > bboxes.maxLat[i]) {
+						continue;
+					}
+					double s = OsmKeyValueObjectStoreColumns::CoordinateScale;
+					itemRect = sserialize::spatial::GeoRect(bboxes.minLat[i]/s, bboxes.maxLat[i]/s, bboxes.minLon[i]/s, bboxes.maxLon[i]/s);
+				}
+				else {
+					sserialize::Static::spatial::GeoShape shape(m_payload.at(toInternalId(i)).shape());
+					if (shape.type() == sserialize::spatial::GS_NONE) {
+						continue;
+					}
+					itemRect = shape.boundary();
+				}
+				if (valid[blockId]) {
+					rect.enlarge(itemRect);
+				}
+				else {
+					rect = itemRect;
+					valid[blockId] = 1;
+				}
+			}
+		};
+		forEachBlock(size(), threadCount, func);
+		bool haveRect = false;
+		for(std::size_t i(0), s(rects.size()); i < s; ++i) {
+			if (!valid[i]) {
+				continue;
+			}
+			if (haveRect) {
+				m_boundary.enlarge(rects[i]);
+			}
+			else {
+				m_boundary = rects[i];
+				haveRect = true;
+			}
+		}
+	});
+	return m_boundary;
+}
+
+bool OsmKeyValueObjectStorePrivate::sanityCheck(uint32_t threadCount) const {
+	auto keysSize = keyStringTable().size();
+	auto valuesSize = valueStringTable().size();
+	//messages are collected per block to print them in order
+	std::vector<std::string> messages(blockCount(size()));
+	auto func = [this, keysSize, valuesSize, &messages](uint32_t blockId, uint32_t begin, uint32_t end) {
+		std::stringstream ss;
+		for(uint32_t i(begin); i < end; ++i) {
+			sserialize::Static::KeyValueObjectStore::Item kvitem(kvItem(i));
+			for(uint32_t j = 0, sj = kvitem.size(); j < sj; ++j) {
+				if (kvitem.keyId(j) >= keysSize) {
+					ss << "Invalid keyid=" << kvitem.keyId(j) << ">=" << keysSize << " in item " << i << std::endl;
+				}
+				if (kvitem.valueId(j) >= valuesSize) {
+					ss << "Invalid valueid=" << kvitem.valueId(j) << ">=" << valuesSize << " in item " << i << std::endl;
+				}
+			}
+		}
+		messages[blockId] = ss.str();
+	};
+	forEachBlock(size(), threadCount, func);
+	for(const std::string & msg : messages) {
+		std::cout << msg;
 	}
-	out << "Size of geoshapes: " << geoShapeSizeInBytes << "(" << (double)geoShapeSizeInBytes/getSizeInBytes()*100.0 << "%)" << std::endl;
-	uint64_t totalKeyValueStringSize = 0;
-	{
+	return true;
+}
+
+std::ostream & OsmKeyValueObjectStorePrivate::printStats(std::ostream & out, uint32_t threadCount) const {
+	struct BlockStats {
+		uint64_t geoShapeSizeInBytes{0};
+		uint64_t keyValueStringSize{0};
+		uint64_t geoPoints{0};
+		uint64_t regionPoints{0};
+		uint64_t regionPolygons{0};
+	};
+	std::vector<BlockStats> blockStats(blockCount(size()));
+	auto func = [this, &blockStats](uint32_t blockId, uint32_t begin, uint32_t end) {
 		const KeyStringTable & kst = keyStringTable();
 		const ValueStringTable & vst = valueStringTable();
-		for(uint32_t i(0), s(size()); i < s; ++i) {
+		uint32_t regionSize = m_gh.regionSize();
+		BlockStats & bs = blockStats[blockId];
+		for(uint32_t i(begin); i < end; ++i) {
+			//bypasses the payload cache
+			sserialize::Static::spatial::GeoShape gs(m_payload.at(toInternalId(i)).shape());
+			bs.geoShapeSizeInBytes += gs.getSizeInBytes();
 			sserialize::Static::KeyValueObjectStore::Item kvitem(m_kv.at(i));
 			for(uint32_t j(0), js(kvitem.size()); j < js; ++j) {
-				uint32_t keyStrSize = kst.strSize(kvitem.keyId(j));
-				uint32_t valueStrSize = vst.strSize(kvitem.valueId(j));
-				totalKeyValueStringSize += keyStrSize + valueStrSize;
+				bs.keyValueStringSize += kst.strSize(kvitem.keyId(j)) + vst.strSize(kvitem.valueId(j));
 			}
-		}
-	}
-	out << "Total concatenated size of key:value strings: " << totalKeyValueStringSize << "\n";
-	m_kv.printStats(out);
-	uint64_t totalRegionPoints = 0;
-	uint64_t totalGeoPoints = 0;
-	uint64_t totalRegionPolygons = 0;
-	{
-		uint64_t tmp = 0;
-		uint64_t tmp2 = 0;
-		auto myf = [&tmp, &tmp2](const sserialize::Static::spatial::GeoShape & gs) {
+			uint64_t points = 0;
+			uint64_t polygons = 0;
 			switch (gs.type()) {
 				case sserialize::spatial::GS_POINT:
-					tmp += 1;
+					points = 1;
 					break;
 				case sserialize::spatial::GS_POLYGON:
-					++tmp2;
+					polygons = 1;
 					[[fallthrough]];
 				case sserialize::spatial::GS_WAY:
-					tmp += gs.get<sserialize::spatial::GS_WAY>()->size();
+					points = gs.get<sserialize::spatial::GS_WAY>()->size();
 					break;
 				case sserialize::spatial::GS_MULTI_POLYGON:
 				{
 					auto gmp = gs.get<sserialize::spatial::GS_MULTI_POLYGON>();
 					for(uint32_t j(0), js((uint32_t) gmp->outerPolygons().size()); j < js; ++j) {
-						tmp += gmp->outerPolygons().at(j).size();
+						points += gmp->outerPolygons().at(j).size();
 					}
 					for(uint32_t j(0), js((uint32_t) gmp->innerPolygons().size()); j < js; ++j) {
-						tmp += gmp->innerPolygons().at(j).size();
+						points += gmp->innerPolygons().at(j).size();
 					}
-					tmp2 += gmp->outerPolygons().size() + gmp->innerPolygons().size();
+					polygons = gmp->outerPolygons().size() + gmp->innerPolygons().size();
 					break;
 				}
 				default:
 					break;
 			}
-		};
-		uint32_t i(0);
-		for(uint32_t s(m_gh.regionSize()); i < s; ++i) {
-			myf(geoShapeAt(i));
-		}
-		totalRegionPoints = tmp;
-		totalRegionPolygons = tmp2;
-		for(uint32_t s(size()); i < s; ++i) {
-			myf(geoShapeAt(i));
+			bs.geoPoints += points;
+			if (i < regionSize) {
+				bs.regionPoints += points;
+				bs.regionPolygons += polygons;
+			}
 		}
-		totalGeoPoints = tmp;
+	};
+	forEachBlock(size(), threadCount, func);
+	BlockStats total;
+	for(const BlockStats & bs : blockStats) {
+		total.geoShapeSizeInBytes += bs.geoShapeSizeInBytes;
+		total.keyValueStringSize += bs.keyValueStringSize;
+		total.geoPoints += bs.geoPoints;
+		total.regionPoints += bs.regionPoints;
+		total.regionPolygons += bs.regionPolygons;
 	}
-	out << "Total number of polygons regions are made out of: " << totalRegionPolygons << "\n";
-	out << "Total number of points in regions: " << totalRegionPoints << "\n";
-	out << "Total number of points in all items: " << totalGeoPoints << "\n";
+	out << "OsmKeyValueObjectStore::printStats -- BEGIN" << std::endl;
+	out << "Size of payload: " << m_payload.getSizeInBytes() << "(" << ((double)m_payload.getSizeInBytes())/getSizeInBytes()*100.0 << "%)" << std::endl;
+	out << "Size of geoshapes: " << total.geoShapeSizeInBytes << "(" << (double)total.geoShapeSizeInBytes/getSizeInBytes()*100.0 << "%)" << std::endl;
+	out << "Total concatenated size of key:value strings: " << total.keyValueStringSize << "\n";
+	m_kv.printStats(out);
+	out << "Total number of polygons regions are made out of: " << total.regionPolygons << "\n";
+	out << "Total number of points in regions: " << total.regionPoints << "\n";
+	out << "Total number of points in all items: " << total.geoPoints << "\n";
 	m_ra.tds().printStats(out);
 	out << "\n";
+	if (std::shared_ptr<OsmKeyValueObjectStorePayloadCache> cache = payloadCache()) {
+		std::vector<OsmKeyValueObjectStorePayloadCache::ShardStats> stats(cache->stats());
+		out << "Payload cache with a budget of " << cache->byteBudget() << " Bytes:\n";
+		for(std::size_t i(0), s(stats.size()); i < s; ++i) {
+			const OsmKeyValueObjectStorePayloadCache::ShardStats & ss = stats[i];
+			out << "\tShard " << i << ": hits=" << ss.hits << ", misses=" << ss.misses << ", evictions=" << ss.evictions;
+			out << ", entries=" << ss.entries << ", bytes=" << ss.bytes << "\n";
+		}
+	}
 	out << "OsmKeyValueObjectStore::printStats -- END" << std::endl;
 	return out;
 }
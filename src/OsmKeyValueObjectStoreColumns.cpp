@@ -0,0 +1,281 @@
+#include <liboscar/OsmKeyValueObjectStoreColumns.h>
+#include <liboscar/OsmKeyValueObjectStore.h>
+#include <sserialize/utility/exceptions.h>
+#include <sserialize/utility/VersionChecker.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define LIBOSCAR_KV_STORE_COLUMNS_X86_SIMD
+	#include <immintrin.h>
+#endif
+
+namespace liboscar {
+namespace Static {
+namespace {
+
+using sidecar::OffsetType;
+using sidecar::alignOffset;
+
+//offsets of the columns relative to the beginning of the data
+struct ColumnOffsets {
+	static constexpr OffsetType HeaderSize = 1+4+4;
+	OffsetType osmIdTypes;
+	OffsetType scores;
+	OffsetType shapeTypes;
+	OffsetType minLat;
+	OffsetType maxLat;
+	OffsetType minLon;
+	OffsetType maxLon;
+	OffsetType end;
+	ColumnOffsets(uint32_t size) {
+		osmIdTypes = alignOffset(HeaderSize);
+		scores = alignOffset(osmIdTypes + OffsetType(size)*sizeof(int64_t));
+		shapeTypes = alignOffset(scores + OffsetType(size)*sizeof(uint32_t));
+		minLat = alignOffset(shapeTypes + OffsetType(size)*sizeof(uint8_t));
+		maxLat = alignOffset(minLat + OffsetType(size)*sizeof(int32_t));
+		minLon = alignOffset(maxLat + OffsetType(size)*sizeof(int32_t));
+		maxLon = alignOffset(minLon + OffsetType(size)*sizeof(int32_t));
+		end = maxLon + OffsetType(size)*sizeof(int32_t);
+	}
+};
+
+using BBoxColumns = OsmKeyValueObjectStoreColumns::BBoxColumns;
+using QuantizedRect = OsmKeyValueObjectStoreColumns::QuantizedRect;
+
+#ifdef LIBOSCAR_KV_STORE_COLUMNS_X86_SIMD
+
+//result = disjoint ? MR_DISJOINT : (contained ? MR_CONTAINED : MR_UNDECIDED)
+inline void writeMatchResults(uint32_t disjoint, uint32_t contained, uint32_t count, uint8_t * result) {
+	for(uint32_t j(0); j < count; ++j) {
+		result[j] = ((disjoint >> j) & 1) ? OsmKeyValueObjectStoreColumns::MR_DISJOINT :
+			(((contained >> j) & 1) ? OsmKeyValueObjectStoreColumns::MR_CONTAINED : OsmKeyValueObjectStoreColumns::MR_UNDECIDED);
+	}
+}
+
+//8 items per iteration, returns the number of processed items
+__attribute__((target("avx2")))
+uint32_t matchAVX2(const BBoxColumns & bboxes, const uint32_t * itemPos, uint32_t count, const QuantizedRect & rect, uint8_t * result) {
+	const __m256i rMinLat = _mm256_set1_epi32(rect.minLat);
+	const __m256i rMaxLat = _mm256_set1_epi32(rect.maxLat);
+	const __m256i rMinLon = _mm256_set1_epi32(rect.minLon);
+	const __m256i rMaxLon = _mm256_set1_epi32(rect.maxLon);
+	uint32_t i = 0;
+	for(; i+8 <= count; i += 8) {
+		__m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(itemPos+i));
+		__m256i minLat = _mm256_i32gather_epi32(reinterpret_cast<const int*>(bboxes.minLat), idx, 4);
+		__m256i maxLat = _mm256_i32gather_epi32(reinterpret_cast<const int*>(bboxes.maxLat), idx, 4);
+		__m256i minLon = _mm256_i32gather_epi32(reinterpret_cast<const int*>(bboxes.minLon), idx, 4);
+		__m256i maxLon = _mm256_i32gather_epi32(reinterpret_cast<const int*>(bboxes.maxLon), idx, 4);
+		__m256i disjoint = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpgt_epi32(minLat, maxLat), _mm256_cmpgt_epi32(rMinLat, maxLat)),
+			_mm256_or_si256(_mm256_cmpgt_epi32(minLat, rMaxLat),
+				_mm256_or_si256(_mm256_cmpgt_epi32(rMinLon, maxLon), _mm256_cmpgt_epi32(minLon, rMaxLon))
+			)
+		);
+		__m256i notContained = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpgt_epi32(rMinLat, minLat), _mm256_cmpgt_epi32(maxLat, rMaxLat)),
+			_mm256_or_si256(_mm256_cmpgt_epi32(rMinLon, minLon), _mm256_cmpgt_epi32(maxLon, rMaxLon))
+		);
+		uint32_t disjointMask = _mm256_movemask_ps(_mm256_castsi256_ps(disjoint));
+		uint32_t containedMask = ~uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(notContained)));
+		writeMatchResults(disjointMask, containedMask, 8, result+i);
+	}
+	return i;
+}
+
+//16 items per iteration, returns the number of processed items
+__attribute__((target("avx512f")))
+uint32_t matchAVX512(const BBoxColumns & bboxes, const uint32_t * itemPos, uint32_t count, const QuantizedRect & rect, uint8_t * result) {
+	const __m512i rMinLat = _mm512_set1_epi32(rect.minLat);
+	const __m512i rMaxLat = _mm512_set1_epi32(rect.maxLat);
+	const __m512i rMinLon = _mm512_set1_epi32(rect.minLon);
+	const __m512i rMaxLon = _mm512_set1_epi32(rect.maxLon);
+	const __m512i zero = _mm512_setzero_si512();
+	uint32_t i = 0;
+	for(; i+16 <= count; i += 16) {
+		__m512i idx = _mm512_loadu_si512(itemPos+i);
+		__m512i minLat = _mm512_mask_i32gather_epi32(zero, 0xFFFF, idx, bboxes.minLat, 4);
+		__m512i maxLat = _mm512_mask_i32gather_epi32(zero, 0xFFFF, idx, bboxes.maxLat, 4);
+		__m512i minLon = _mm512_mask_i32gather_epi32(zero, 0xFFFF, idx, bboxes.minLon, 4);
+		__m512i maxLon = _mm512_mask_i32gather_epi32(zero, 0xFFFF, idx, bboxes.maxLon, 4);
+		__mmask16 disjoint = _mm512_cmpgt_epi32_mask(minLat, maxLat) |
+			_mm512_cmpgt_epi32_mask(rMinLat, maxLat) | _mm512_cmpgt_epi32_mask(minLat, rMaxLat) |
+			_mm512_cmpgt_epi32_mask(rMinLon, maxLon) | _mm512_cmpgt_epi32_mask(minLon, rMaxLon);
+		__mmask16 notContained = _mm512_cmpgt_epi32_mask(rMinLat, minLat) | _mm512_cmpgt_epi32_mask(maxLat, rMaxLat) |
+			_mm512_cmpgt_epi32_mask(rMinLon, minLon) | _mm512_cmpgt_epi32_mask(maxLon, rMaxLon);
+		writeMatchResults(disjoint, ~uint32_t(notContained), 16, result+i);
+	}
+	return i;
+}
+
+enum SimdLevel { SL_NONE, SL_AVX2, SL_AVX512 };
+
+SimdLevel simdLevel() {
+	static const SimdLevel level = []() {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f")) {
+			return SL_AVX512;
+		}
+		if (__builtin_cpu_supports("avx2")) {
+			return SL_AVX2;
+		}
+		return SL_NONE;
+	}();
+	return level;
+}
+
+#endif
+
+} //end namespace
+
+OsmKeyValueObjectStoreColumns::QuantizedRect::QuantizedRect(const sserialize::spatial::GeoRect & rect) :
+minLat(quantizeUpper(std::max(-90.0, std::min(90.0, rect.minLat())))),
+maxLat(quantizeLower(std::max(-90.0, std::min(90.0, rect.maxLat())))),
+minLon(quantizeUpper(std::max(-180.0, std::min(180.0, rect.minLon())))),
+maxLon(quantizeLower(std::max(-180.0, std::min(180.0, rect.maxLon()))))
+{}
+
+constexpr double OsmKeyValueObjectStoreColumns::CoordinateScale;
+
+OsmKeyValueObjectStoreColumns::OsmKeyValueObjectStoreColumns() {}
+
+OsmKeyValueObjectStoreColumns::OsmKeyValueObjectStoreColumns(const sserialize::UByteArrayAdapter & data) {
+	sserialize::VersionChecker::check(data, LIBOSCAR_OSM_KEY_VALUE_OBJECT_STORE_COLUMNS_VERSION, data.at(0), "OsmKeyValueObjectStoreColumns");
+	uint32_t size = data.getUint32(1);
+	ColumnOffsets offsets(size);
+	m_view = sidecar::View(data, ColumnOffsets::HeaderSize, offsets.end, "OsmKeyValueObjectStoreColumns");
+	m_size = size;
+	m_osmIdTypes = m_view.array<int64_t>(offsets.osmIdTypes);
+	m_scores = m_view.array<uint32_t>(offsets.scores);
+	m_shapeTypes = m_view.array<uint8_t>(offsets.shapeTypes);
+	m_bboxes.minLat = m_view.array<int32_t>(offsets.minLat);
+	m_bboxes.maxLat = m_view.array<int32_t>(offsets.maxLat);
+	m_bboxes.minLon = m_view.array<int32_t>(offsets.minLon);
+	m_bboxes.maxLon = m_view.array<int32_t>(offsets.maxLon);
+}
+
+OsmKeyValueObjectStoreColumns::~OsmKeyValueObjectStoreColumns() {}
+
+sserialize::UByteArrayAdapter::OffsetType OsmKeyValueObjectStoreColumns::getSizeInBytes() const {
+	return m_view.size();
+}
+
+sserialize::spatial::GeoRect OsmKeyValueObjectStoreColumns::boundary(uint32_t itemPos) const {
+	if (m_bboxes.minLat[itemPos] > m_bboxes.maxLat[itemPos]) {
+		return sserialize::spatial::GeoRect();
+	}
+	return sserialize::spatial::GeoRect(
+		m_bboxes.minLat[itemPos]/CoordinateScale,
+		m_bboxes.maxLat[itemPos]/CoordinateScale,
+		m_bboxes.minLon[itemPos]/CoordinateScale,
+		m_bboxes.maxLon[itemPos]/CoordinateScale
+	);
+}
+
+void OsmKeyValueObjectStoreColumns::match(const uint32_t * itemPos, uint32_t count, const QuantizedRect & rect, uint8_t * result) const {
+	uint32_t i = 0;
+#ifdef LIBOSCAR_KV_STORE_COLUMNS_X86_SIMD
+	//gather instructions use signed 32 Bit indices
+	if (m_size <= uint32_t(std::numeric_limits<int32_t>::max())) {
+		switch (simdLevel()) {
+		case SL_AVX512:
+			i = matchAVX512(m_bboxes, itemPos, count, rect, result);
+			break;
+		case SL_AVX2:
+			i = matchAVX2(m_bboxes, itemPos, count, rect, result);
+			break;
+		default:
+			break;
+		}
+	}
+#endif
+	matchScalar(itemPos+i, count-i, rect, result+i);
+}
+
+void OsmKeyValueObjectStoreColumns::matchScalar(const uint32_t * itemPos, uint32_t count, const QuantizedRect & rect, uint8_t * result) const {
+	for(uint32_t i(0); i < count; ++i) {
+		result[i] = match(itemPos[i], rect);
+	}
+}
+
+sserialize::UByteArrayAdapter::OffsetType
+OsmKeyValueObjectStoreColumns::create(const OsmKeyValueObjectStore & store, sserialize::UByteArrayAdapter & dest, uint32_t threadCount) {
+	struct State {
+		const OsmKeyValueObjectStore & store;
+		std::atomic<uint32_t> pos{0};
+		std::vector<int64_t> osmIdTypes;
+		std::vector<uint32_t> scores;
+		std::vector<uint8_t> shapeTypes;
+		std::vector<int32_t> minLat;
+		std::vector<int32_t> maxLat;
+		std::vector<int32_t> minLon;
+		std::vector<int32_t> maxLon;
+		State(const OsmKeyValueObjectStore & store) :
+		store(store),
+		osmIdTypes(store.size()),
+		scores(store.size()),
+		shapeTypes(store.size()),
+		minLat(store.size()),
+		maxLat(store.size()),
+		minLon(store.size()),
+		maxLon(store.size())
+		{}
+	};
+	struct Worker {
+		static constexpr uint32_t BlockSize = 1000;
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			uint32_t size = state->store.size();
+			while (true) {
+				uint32_t p = state->pos.fetch_add(BlockSize, std::memory_order_relaxed);
+				if (p >= size) {
+					break;
+				}
+				for(uint32_t end(std::min(p+BlockSize, size)); p < end; ++p) {
+					OsmKeyValueObjectStorePayload pl(state->store.payload(p));
+					state->osmIdTypes[p] = OsmIdType(pl.osmId(), pl.type()).raw();
+					state->scores[p] = pl.score();
+					state->shapeTypes[p] = pl.shape().type();
+					if (pl.shape().type() != sserialize::spatial::GS_NONE) {
+						sserialize::spatial::GeoRect rect(pl.shape().boundary());
+						state->minLat[p] = quantizeLower(rect.minLat());
+						state->maxLat[p] = quantizeUpper(rect.maxLat());
+						state->minLon[p] = quantizeLower(rect.minLon());
+						state->maxLon[p] = quantizeUpper(rect.maxLon());
+					}
+					else {
+						state->minLat[p] = 1;
+						state->maxLat[p] = 0;
+						state->minLon[p] = 1;
+						state->maxLon[p] = 0;
+					}
+				}
+			}
+		}
+	};
+
+	State state(store);
+	sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+
+	ColumnOffsets offsets(store.size());
+	OffsetType begin = dest.tellPutPtr();
+	dest.putUint8(LIBOSCAR_OSM_KEY_VALUE_OBJECT_STORE_COLUMNS_VERSION);
+	dest.putUint32(store.size());
+	sidecar::putByteOrderMark(dest);
+	sidecar::putArray(dest, begin, offsets.osmIdTypes, state.osmIdTypes);
+	sidecar::putArray(dest, begin, offsets.scores, state.scores);
+	sidecar::putArray(dest, begin, offsets.shapeTypes, state.shapeTypes);
+	sidecar::putArray(dest, begin, offsets.minLat, state.minLat);
+	sidecar::putArray(dest, begin, offsets.maxLat, state.maxLat);
+	sidecar::putArray(dest, begin, offsets.minLon, state.minLon);
+	sidecar::putArray(dest, begin, offsets.maxLon, state.maxLon);
+	SSERIALIZE_CHEAP_ASSERT_EQUAL(dest.tellPutPtr() - begin, offsets.end);
+	return begin;
+}
+
+}}//end namespace liboscar::Static
@@ -0,0 +1,89 @@
+#include <liboscar/OsmQueryContext.h>
+#include <sserialize/utility/exceptions.h>
+
+namespace liboscar {
+namespace Static {
+
+OsmQueryContext::OsmQueryContext(const OsmCompleter & completer) :
+m_completer(completer),
+m_ci(sserialize::Static::spatial::GeoHierarchyCellInfo::makeRc(completer.store().geoHierarchy()))
+{
+	if (m_completer.textSearch().hasSearch(liboscar::TextSearch::Type::GEOCELL)) {
+		sserialize::Static::CellTextCompleter cmp( m_completer.textSearch().get<liboscar::TextSearch::Type::GEOCELL>() );
+		CQRFromPolygon cqrfp(m_completer.store(), m_completer.indexStore());
+		CQRFromComplexSpatialQuery csq(m_completer.ghsg(), cqrfp, m_completer.cellGraph());
+		m_opTree.reset(new AdvancedCellOpTree(cmp, m_completer.cqrd(), csq, m_completer.ghsg(), m_completer.cqrr(), m_completer.cellGraph()));
+	}
+}
+
+OsmQueryContext::~OsmQueryContext() {}
+
+const sserialize::StringCompleter & OsmQueryContext::itemsCompleter() {
+	uint32_t caps = m_completer.itemsCapabilities();
+	if (!m_hasItemsCompleter || caps != m_itemsCapabilities) {
+		m_itemsCompleter = m_completer.getItemsCompleter(caps);
+		m_itemsCapabilities = caps;
+		//filters can not be unregistered, start with fresh trees
+		m_complexSetOpTree = sserialize::SetOpTree(sserialize::SetOpTree::SOT_COMPLEX);
+		m_simpleSetOpTree = sserialize::SetOpTree(sserialize::SetOpTree::SOT_SIMPLE);
+		for(sserialize::SetOpTree * opTree : {&m_complexSetOpTree, &m_simpleSetOpTree}) {
+			opTree->registerStringCompleter(m_itemsCompleter);
+			m_completer.registerFilters(*opTree, caps);
+		}
+		m_hasItemsCompleter = true;
+	}
+	return m_itemsCompleter;
+}
+
+OsmItemSet OsmQueryContext::complete(const std::string & query) {
+	itemsCompleter();
+	OsmItemSet itemSet(query, m_completer.store(), m_complexSetOpTree);
+	itemSet.execute();
+	return itemSet;
+}
+
+OsmItemSet OsmQueryContext::simpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen) {
+	itemsCompleter();
+	OsmItemSet itemSet(query, m_completer.store(), m_simpleSetOpTree);
+	itemSet.setMaxResultSetSize(maxResultSetSize);
+	itemSet.setMinStrLen(minStrLen);
+	itemSet.execute();
+	return itemSet;
+}
+
+OsmItemSet OsmQueryContext::simpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen, const sserialize::spatial::GeoRect & rect) {
+	const sserialize::StringCompleter & strCmp = itemsCompleter();
+	return m_completer.doSimpleComplete(query, maxResultSetSize, minStrLen, rect, strCmp, m_itemsCapabilities);
+}
+
+OsmItemSetIterator OsmQueryContext::partialComplete(const std::string & query, const sserialize::spatial::GeoRect & rect) {
+	const sserialize::StringCompleter & strCmp = itemsCompleter();
+	return m_completer.doPartialComplete(query, rect, strCmp, m_itemsCapabilities);
+}
+
+sserialize::CellQueryResult
+OsmQueryContext::cqrComplete(const std::string & query, bool treedCQR, uint32_t threadCount) {
+	if (!m_opTree) {
+		throw sserialize::UnsupportedFeatureException("OsmQueryContext::cqrComplete data has no CellTextCompleter");
+	}
+	m_opTree->parse(query);
+	if (!treedCQR) {
+		return m_opTree->calc<sserialize::CellQueryResult>();
+	}
+	else {
+		return m_opTree->calc<sserialize::TreedCellQueryResult>(threadCount).toCQR(threadCount);
+	}
+}
+
+sserialize::Static::spatial::GeoHierarchy::SubSet
+OsmQueryContext::clusteredComplete(const std::string & query, uint32_t minCq4SparseSubSet, bool treedCQR, uint32_t threadCount) {
+	sserialize::CellQueryResult r = cqrComplete(query, treedCQR, threadCount);
+	return m_completer.subSet(r, m_completer.ghsg(), r.cellCount() > minCq4SparseSubSet, threadCount);
+}
+
+sserialize::CellQueryResult
+OsmQueryContext::cqr(const sserialize::ItemIndex & fullMatchCells) const {
+	return sserialize::CellQueryResult(fullMatchCells, m_ci, m_completer.indexStore(), sserialize::CellQueryResult::FF_CELL_GLOBAL_ITEM_IDS);
+}
+
+}}//end namespace liboscar::Static
@@ -1,8 +1,17 @@
 #include <liboscar/SetOpTreePrivateGeo.h>
 #include <sserialize/containers/ItemIndex.h>
+#include <algorithm>
 
 namespace liboscar {
 namespace Static {
+namespace {
+
+//The fused set operations stop after maxResultSetSize items passed the filter.
+//Filtering in blocks needs the complete result of the set operations and is only used
+//if the limit is not much smaller than the smallest intersected set.
+constexpr uint64_t FusedResultSetSizeFactor = 16;
+
+} //end namespace
 
 SetOpTreePrivateGeo::SetOpTreePrivateGeo(const std::shared_ptr<sserialize::ItemIndex::ItemFilter> & filter) :
 SetOpTreePrivateSimple(),
@@ -37,6 +46,18 @@ sserialize::ItemIndex SetOpTreePrivateGeo::doSetOperations() {
 		}
 		
 		if (intersectIdx.size() > 0) {
+			uint32_t minSize = std::min_element(intersectIdx.begin(), intersectIdx.end(),
+				[](const sserialize::ItemIndex & a, const sserialize::ItemIndex & b) { return a.size() < b.size(); }
+			)->size();
+			const BatchItemFilter * batchFilter = dynamic_cast<const BatchItemFilter*>(m_filter.get());
+			//filter the result of the set operations in blocks instead of item by item
+			if (batchFilter && uint64_t(maxResultSetSize())*FusedResultSetSizeFactor >= minSize) {
+				sserialize::ItemIndex result = sserialize::ItemIndex::intersect(intersectIdx);
+				if (diffIdx.size()) {
+					result = result - sserialize::ItemIndex::unite(diffIdx);
+				}
+				return (*batchFilter)(result, maxResultSetSize());
+			}
 			if (diffIdx.size())
 				return sserialize::ItemIndex::fusedIntersectDifference(intersectIdx, diffIdx, maxResultSetSize(), m_filter.get());
 			else
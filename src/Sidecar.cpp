@@ -0,0 +1,46 @@
+#include <liboscar/Sidecar.h>
+#include <sserialize/utility/exceptions.h>
+#include <cstdint>
+#include <cstring>
+
+namespace liboscar {
+namespace Static {
+namespace sidecar {
+
+View::View() {}
+
+View::View(const sserialize::UByteArrayAdapter & data, OffsetType headerSize, OffsetType size, const char * name) {
+	if (size < headerSize || data.size() < size) {
+		throw sserialize::CorruptDataException(std::string(name) + ": data is too small");
+	}
+	m_mem = data.getMemView(0, size);
+	const uint8_t * base = m_mem.data();
+	//the widest array entries are 64 Bit
+	if (reinterpret_cast<std::uintptr_t>(base) % alignof(uint64_t)) {
+		m_alignedCopy = std::make_shared< std::vector<uint64_t> >(size/sizeof(uint64_t)+1);
+		std::memcpy(m_alignedCopy->data(), base, size);
+		base = reinterpret_cast<const uint8_t*>(m_alignedCopy->data());
+	}
+	uint32_t bom;
+	std::memcpy(&bom, base + headerSize - sizeof(bom), sizeof(bom));
+	if (bom != ByteOrderMark) {
+		throw sserialize::CorruptDataException(std::string(name) + ": data was created on a machine with a different byte order");
+	}
+	m_base = base;
+	m_size = size;
+}
+
+View::~View() {}
+
+void putByteOrderMark(sserialize::UByteArrayAdapter & dest) {
+	uint32_t bom = ByteOrderMark;
+	dest.putData(reinterpret_cast<const uint8_t*>(&bom), sizeof(bom));
+}
+
+void putPadding(sserialize::UByteArrayAdapter & dest, OffsetType begin, OffsetType offset) {
+	while (dest.tellPutPtr() - begin < offset) {
+		dest.putUint8(0);
+	}
+}
+
+}}}//end namespace liboscar::Static::sidecar
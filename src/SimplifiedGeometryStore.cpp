@@ -0,0 +1,362 @@
+#include <liboscar/SimplifiedGeometryStore.h>
+#include <liboscar/OsmKeyValueObjectStore.h>
+#include <sserialize/spatial/GeoPoint.h>
+#include <sserialize/spatial/GeoWay.h>
+#include <sserialize/spatial/GeoPolygon.h>
+#include <sserialize/spatial/GeoMultiPolygon.h>
+#include <sserialize/Static/GeoWay.h>
+#include <sserialize/Static/GeoPolygon.h>
+#include <sserialize/Static/GeoMultiPolygon.h>
+#include <sserialize/utility/exceptions.h>
+#include <sserialize/utility/VersionChecker.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <algorithm>
+#include <atomic>
+
+namespace liboscar {
+namespace Static {
+namespace {
+
+using sidecar::OffsetType;
+using sidecar::alignOffset;
+
+constexpr OffsetType HeaderSize = 1+4+4+4+4;
+
+//offsets of the arrays relative to the beginning of the data
+struct ArrayOffsets {
+	OffsetType tolerances;
+	OffsetType itemIds;
+	OffsetType offsets;
+	OffsetType data;
+	ArrayOffsets(uint32_t levelCount, uint32_t entryCount) {
+		tolerances = alignOffset(HeaderSize);
+		itemIds = alignOffset(tolerances + OffsetType(levelCount)*sizeof(double));
+		offsets = alignOffset(itemIds + OffsetType(entryCount)*sizeof(uint32_t));
+		data = offsets + (OffsetType(entryCount)*levelCount+1)*sizeof(uint64_t);
+	}
+};
+
+using Ring = std::vector<sserialize::spatial::GeoPoint>;
+
+template<typename TWay>
+Ring toRing(const TWay & way) {
+	Ring result;
+	result.reserve(way.size());
+	for(uint32_t i(0), s((uint32_t) way.size()); i < s; ++i) {
+		auto gp = way.at(i);
+		result.emplace_back(gp.lat(), gp.lon());
+	}
+	return result;
+}
+
+//squared distance of p to the segment a->b in the lat/lon plane
+double sqDistance(const sserialize::spatial::GeoPoint & p, const sserialize::spatial::GeoPoint & a, const sserialize::spatial::GeoPoint & b) {
+	double dLat = b.lat() - a.lat();
+	double dLon = b.lon() - a.lon();
+	double t = 0;
+	double len = dLat*dLat + dLon*dLon;
+	if (len > 0) {
+		t = ((p.lat() - a.lat())*dLat + (p.lon() - a.lon())*dLon) / len;
+		t = std::max(0.0, std::min(1.0, t));
+	}
+	double eLat = a.lat() + t*dLat - p.lat();
+	double eLon = a.lon() + t*dLon - p.lon();
+	return eLat*eLat + eLon*eLon;
+}
+
+//Douglas-Peucker, keeps the first and the last point
+Ring simplify(const Ring & src, double tolerance) {
+	if (src.size() < 3) {
+		return src;
+	}
+	double sqTolerance = tolerance*tolerance;
+	std::vector<bool> keep(src.size(), false);
+	keep.front() = keep.back() = true;
+	std::vector< std::pair<std::size_t, std::size_t> > stack;
+	stack.emplace_back(0, src.size()-1);
+	while (stack.size()) {
+		std::size_t first = stack.back().first;
+		std::size_t last = stack.back().second;
+		stack.pop_back();
+		double maxDist = 0;
+		std::size_t maxPos = first;
+		for(std::size_t i(first+1); i < last; ++i) {
+			double dist = sqDistance(src[i], src[first], src[last]);
+			if (dist > maxDist) {
+				maxDist = dist;
+				maxPos = i;
+			}
+		}
+		if (maxDist > sqTolerance) {
+			keep[maxPos] = true;
+			stack.emplace_back(first, maxPos);
+			stack.emplace_back(maxPos, last);
+		}
+	}
+	Ring result;
+	for(std::size_t i(0), s(src.size()); i < s; ++i) {
+		if (keep[i]) {
+			result.push_back(src[i]);
+		}
+	}
+	return result;
+}
+
+//a closed ring needs at least a triangle
+inline bool collapsed(const Ring & ring) {
+	return ring.size() < 4;
+}
+
+struct Shape {
+	sserialize::spatial::GeoShapeType type{sserialize::spatial::GS_NONE};
+	std::vector<Ring> outer;
+	std::vector<Ring> inner;
+	std::size_t pointCount() const {
+		std::size_t result = 0;
+		for(const Ring & r : outer) {
+			result += r.size();
+		}
+		for(const Ring & r : inner) {
+			result += r.size();
+		}
+		return result;
+	}
+};
+
+Shape toShape(const sserialize::Static::spatial::GeoShape & shape) {
+	Shape result;
+	result.type = shape.type();
+	switch (result.type) {
+	case sserialize::spatial::GS_WAY:
+		result.outer.push_back(toRing(*shape.get<sserialize::spatial::GS_WAY>()));
+		break;
+	case sserialize::spatial::GS_POLYGON:
+		result.outer.push_back(toRing(*shape.get<sserialize::spatial::GS_POLYGON>()));
+		break;
+	case sserialize::spatial::GS_MULTI_POLYGON:
+	{
+		auto gmp = shape.get<sserialize::spatial::GS_MULTI_POLYGON>();
+		for(uint32_t i(0), s((uint32_t) gmp->outerPolygons().size()); i < s; ++i) {
+			result.outer.push_back(toRing(gmp->outerPolygons().at(i)));
+		}
+		for(uint32_t i(0), s((uint32_t) gmp->innerPolygons().size()); i < s; ++i) {
+			result.inner.push_back(toRing(gmp->innerPolygons().at(i)));
+		}
+		break;
+	}
+	default:
+		//points can not be simplified
+		result.type = sserialize::spatial::GS_NONE;
+		break;
+	}
+	return result;
+}
+
+//@return false if the shape collapses
+bool simplify(const Shape & src, double tolerance, Shape & dest) {
+	dest.type = src.type;
+	dest.outer.clear();
+	dest.inner.clear();
+	if (src.type == sserialize::spatial::GS_WAY) {
+		dest.outer.push_back(simplify(src.outer.front(), tolerance));
+		return true;
+	}
+	//rings that collapse are dropped from multi polygons
+	for(const Ring & r : src.outer) {
+		Ring tmp(simplify(r, tolerance));
+		if (!collapsed(tmp)) {
+			dest.outer.push_back(std::move(tmp));
+		}
+	}
+	for(const Ring & r : src.inner) {
+		Ring tmp(simplify(r, tolerance));
+		if (!collapsed(tmp)) {
+			dest.inner.push_back(std::move(tmp));
+		}
+	}
+	return dest.outer.size() == src.outer.size() || (src.type == sserialize::spatial::GS_MULTI_POLYGON && dest.outer.size());
+}
+
+void append(const Shape & shape, sserialize::UByteArrayAdapter & dest) {
+	switch (shape.type) {
+	case sserialize::spatial::GS_WAY:
+		sserialize::spatial::GeoWay(shape.outer.front()).appendWithTypeInfo(dest);
+		break;
+	case sserialize::spatial::GS_POLYGON:
+		sserialize::spatial::GeoPolygon(shape.outer.front()).appendWithTypeInfo(dest);
+		break;
+	case sserialize::spatial::GS_MULTI_POLYGON:
+	{
+		sserialize::spatial::GeoMultiPolygon gmp;
+		for(const Ring & r : shape.outer) {
+			gmp.outerPolygons().push_back(sserialize::spatial::GeoPolygon(r));
+		}
+		for(const Ring & r : shape.inner) {
+			gmp.innerPolygons().push_back(sserialize::spatial::GeoPolygon(r));
+		}
+		gmp.recalculateBoundary();
+		gmp.appendWithTypeInfo(dest);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+} //end namespace
+
+constexpr uint32_t SimplifiedGeometryStore::MinPointCount;
+
+SimplifiedGeometryStore::SimplifiedGeometryStore() {}
+
+SimplifiedGeometryStore::SimplifiedGeometryStore(const sserialize::UByteArrayAdapter & data) {
+	sserialize::VersionChecker::check(data, LIBOSCAR_SIMPLIFIED_GEOMETRY_STORE_VERSION, data.at(0), "SimplifiedGeometryStore");
+	uint32_t size = data.getUint32(1);
+	uint32_t levelCount = data.getUint32(5);
+	uint32_t entryCount = data.getUint32(9);
+	if (!levelCount) {
+		throw sserialize::CorruptDataException("SimplifiedGeometryStore: no levels");
+	}
+	ArrayOffsets offsets(levelCount, entryCount);
+	sidecar::View view(data, HeaderSize, offsets.data, "SimplifiedGeometryStore");
+	const double * tolerances = view.array<double>(offsets.tolerances);
+	const uint32_t * itemIds = view.array<uint32_t>(offsets.itemIds);
+	const uint64_t * dataOffsets = view.array<uint64_t>(offsets.offsets);
+	if (!std::is_sorted(tolerances, tolerances+levelCount) || (entryCount && itemIds[entryCount-1] >= size)) {
+		throw sserialize::CorruptDataException("SimplifiedGeometryStore: invalid tolerances or item ids");
+	}
+	uint64_t dataSize = dataOffsets[OffsetType(entryCount)*levelCount];
+	if (data.size() < offsets.data + dataSize) {
+		throw sserialize::CorruptDataException("SimplifiedGeometryStore: data is too small");
+	}
+	m_size = size;
+	m_levelCount = levelCount;
+	m_entryCount = entryCount;
+	m_sizeInBytes = offsets.data + dataSize;
+	m_view = view;
+	m_tolerances = tolerances;
+	m_itemIds = itemIds;
+	m_offsets = dataOffsets;
+	m_shapes = sserialize::UByteArrayAdapter(data, offsets.data, dataSize);
+}
+
+SimplifiedGeometryStore::~SimplifiedGeometryStore() {}
+
+sserialize::UByteArrayAdapter::OffsetType SimplifiedGeometryStore::getSizeInBytes() const {
+	return m_sizeInBytes;
+}
+
+bool SimplifiedGeometryStore::at(uint32_t itemPos, double tolerance, sserialize::Static::spatial::GeoShape & shape) const {
+	const uint32_t * it = std::lower_bound(m_itemIds, m_itemIds+m_entryCount, itemPos);
+	if (it == m_itemIds+m_entryCount || *it != itemPos) {
+		return false;
+	}
+	const uint64_t * levelOffsets = m_offsets + OffsetType(it - m_itemIds)*m_levelCount;
+	for(uint32_t l(m_levelCount); l > 0; --l) {
+		uint64_t begin = levelOffsets[l-1];
+		uint64_t end = levelOffsets[l];
+		if (m_tolerances[l-1] <= tolerance && begin != end) {
+			shape = sserialize::Static::spatial::GeoShape(sserialize::UByteArrayAdapter(m_shapes, begin, end-begin));
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<double> SimplifiedGeometryStore::defaultTolerances() {
+	return std::vector<double>({0.00001, 0.0001, 0.001, 0.01, 0.1});
+}
+
+sserialize::UByteArrayAdapter::OffsetType
+SimplifiedGeometryStore::create(const OsmKeyValueObjectStore & store, const std::vector<double> & tolerances, sserialize::UByteArrayAdapter & dest, uint32_t threadCount) {
+	SSERIALIZE_CHEAP_ASSERT(tolerances.size());
+	SSERIALIZE_CHEAP_ASSERT(std::is_sorted(tolerances.begin(), tolerances.end()));
+	//items are simplified in blocks which are concatenated in order
+	struct Block {
+		std::vector<uint32_t> itemIds;
+		//LEVEL_COUNT begin offsets per entry, relative to data
+		std::vector<uint64_t> offsets;
+		sserialize::UByteArrayAdapter data{sserialize::UByteArrayAdapter::createCache(0, sserialize::MM_PROGRAM_MEMORY)};
+	};
+	struct State {
+		static constexpr uint32_t BlockSize = 1024;
+		const OsmKeyValueObjectStore & store;
+		const std::vector<double> & tolerances;
+		std::atomic<uint32_t> block{0};
+		std::vector<Block> blocks;
+		State(const OsmKeyValueObjectStore & store, const std::vector<double> & tolerances) :
+		store(store),
+		tolerances(tolerances),
+		blocks(store.size()/BlockSize+1)
+		{}
+	};
+	struct Worker {
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			uint32_t size = state->store.size();
+			Shape simplified;
+			while (true) {
+				uint32_t b = state->block.fetch_add(1, std::memory_order_relaxed);
+				uint32_t p = b*State::BlockSize;
+				if (p >= size) {
+					break;
+				}
+				Block & block = state->blocks[b];
+				for(uint32_t end(std::min(p+State::BlockSize, size)); p < end; ++p) {
+					sserialize::Static::spatial::GeoShape gs(state->store.geoShape(p));
+					if (gs.type() == sserialize::spatial::GS_NONE || gs.type() == sserialize::spatial::GS_POINT || gs.size() < MinPointCount) {
+						continue;
+					}
+					Shape shape(toShape(gs));
+					//a level is only stored if it has at most 3/4 of the points of the next finer one
+					std::size_t finerPointCount = shape.pointCount();
+					block.itemIds.push_back(p);
+					for(double tolerance : state->tolerances) {
+						block.offsets.push_back(block.data.tellPutPtr());
+						if (simplify(shape, tolerance, simplified) && 4*simplified.pointCount() <= 3*finerPointCount) {
+							append(simplified, block.data);
+							finerPointCount = simplified.pointCount();
+						}
+					}
+				}
+			}
+		}
+	};
+	State state(store, tolerances);
+	sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+
+	std::vector<uint32_t> itemIds;
+	std::vector<uint64_t> offsets;
+	uint64_t blockBegin = 0;
+	for(const Block & block : state.blocks) {
+		itemIds.insert(itemIds.end(), block.itemIds.begin(), block.itemIds.end());
+		for(uint64_t o : block.offsets) {
+			offsets.push_back(blockBegin + o);
+		}
+		blockBegin += block.data.tellPutPtr();
+	}
+	offsets.push_back(blockBegin);
+	uint32_t levelCount = (uint32_t) tolerances.size();
+	uint32_t entryCount = (uint32_t) itemIds.size();
+	SSERIALIZE_CHEAP_ASSERT_EQUAL(offsets.size(), std::size_t(entryCount)*levelCount+1);
+
+	ArrayOffsets arrayOffsets(levelCount, entryCount);
+	OffsetType begin = dest.tellPutPtr();
+	dest.putUint8(LIBOSCAR_SIMPLIFIED_GEOMETRY_STORE_VERSION);
+	dest.putUint32(store.size());
+	dest.putUint32(levelCount);
+	dest.putUint32(entryCount);
+	sidecar::putByteOrderMark(dest);
+	sidecar::putArray(dest, begin, arrayOffsets.tolerances, tolerances);
+	sidecar::putArray(dest, begin, arrayOffsets.itemIds, itemIds);
+	sidecar::putArray(dest, begin, arrayOffsets.offsets, offsets);
+	for(Block & block : state.blocks) {
+		dest.putData(sserialize::UByteArrayAdapter(block.data, 0, block.data.tellPutPtr()));
+	}
+	SSERIALIZE_CHEAP_ASSERT_EQUAL(dest.tellPutPtr() - begin, arrayOffsets.data + blockBegin);
+	return begin;
+}
+
+}}//end namespace liboscar::Static
@@ -0,0 +1,143 @@
+#include <liboscar/SpatialPayloadStore.h>
+#include <liboscar/OsmKeyValueObjectStore.h>
+#include <liboscar/HilbertCurve.h>
+#include <sserialize/utility/exceptions.h>
+#include <sserialize/utility/VersionChecker.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+namespace liboscar {
+namespace Static {
+namespace {
+
+using sidecar::OffsetType;
+using sidecar::alignOffset;
+
+constexpr OffsetType HeaderSize = 1+4+4;
+
+inline OffsetType positionsOffset() {
+	return alignOffset(HeaderSize);
+}
+
+inline OffsetType offsetsOffset(uint32_t size) {
+	return alignOffset(positionsOffset() + OffsetType(size)*sizeof(uint32_t));
+}
+
+inline OffsetType dataOffset(uint32_t size) {
+	return offsetsOffset(size) + (OffsetType(size)+1)*sizeof(uint64_t);
+}
+
+} //end namespace
+
+SpatialPayloadStore::SpatialPayloadStore() {}
+
+SpatialPayloadStore::SpatialPayloadStore(const sserialize::UByteArrayAdapter & data) {
+	sserialize::VersionChecker::check(data, LIBOSCAR_SPATIAL_PAYLOAD_STORE_VERSION, data.at(0), "SpatialPayloadStore");
+	uint32_t size = data.getUint32(1);
+	OffsetType arraysEnd = dataOffset(size);
+	sidecar::View view(data, HeaderSize, arraysEnd, "SpatialPayloadStore");
+	const uint64_t * offsets = view.array<uint64_t>(offsetsOffset(size));
+	uint64_t dataSize = offsets[size];
+	if (data.size() < arraysEnd + dataSize) {
+		throw sserialize::CorruptDataException("SpatialPayloadStore: data is too small");
+	}
+	m_size = size;
+	m_sizeInBytes = arraysEnd + dataSize;
+	m_view = view;
+	m_positions = view.array<uint32_t>(positionsOffset());
+	m_offsets = offsets;
+	m_data = sserialize::UByteArrayAdapter(data, arraysEnd, dataSize);
+	if (dataSize && m_data.isContiguous()) {
+		m_rawDataMem = m_data.getMemView(0, dataSize);
+		m_rawData = m_rawDataMem.data();
+	}
+}
+
+SpatialPayloadStore::~SpatialPayloadStore() {}
+
+sserialize::UByteArrayAdapter::OffsetType SpatialPayloadStore::getSizeInBytes() const {
+	return m_sizeInBytes;
+}
+
+sserialize::UByteArrayAdapter SpatialPayloadStore::dataAt(uint32_t position) const {
+	return sserialize::UByteArrayAdapter(m_data, m_offsets[position], m_offsets[position+1] - m_offsets[position]);
+}
+
+sserialize::UByteArrayAdapter::OffsetType
+SpatialPayloadStore::create(const OsmKeyValueObjectStore & store, sserialize::UByteArrayAdapter & dest, uint32_t threadCount) {
+	struct State {
+		const OsmKeyValueObjectStore & store;
+		std::atomic<uint32_t> pos{0};
+		//(hilbert index, item id)
+		std::vector< std::pair<uint64_t, uint32_t> > keys;
+		State(const OsmKeyValueObjectStore & store) : store(store), keys(store.size()) {}
+	};
+	struct Worker {
+		static constexpr uint32_t BlockSize = 1000;
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			const OsmKeyValueObjectStoreColumns & columns = state->store.columns();
+			uint32_t size = state->store.size();
+			while (true) {
+				uint32_t p = state->pos.fetch_add(BlockSize, std::memory_order_relaxed);
+				if (p >= size) {
+					break;
+				}
+				for(uint32_t end(std::min(p+BlockSize, size)); p < end; ++p) {
+					uint64_t key = std::numeric_limits<uint64_t>::max();
+					if (columns.valid()) {
+						const OsmKeyValueObjectStoreColumns::BBoxColumns & bboxes = columns.bboxes();
+						if (bboxes.minLat[p] <= bboxes.maxLat[p]) {
+							key = detail::HilbertCurve::index(bboxes.minLat[p], bboxes.maxLat[p], bboxes.minLon[p], bboxes.maxLon[p]);
+						}
+					}
+					else {
+						sserialize::Static::spatial::GeoShape shape(state->store.geoShape(p));
+						if (shape.type() != sserialize::spatial::GS_NONE) {
+							sserialize::spatial::GeoRect rect(shape.boundary());
+							key = detail::HilbertCurve::index(
+								OsmKeyValueObjectStoreColumns::quantizeLower(rect.minLat()),
+								OsmKeyValueObjectStoreColumns::quantizeUpper(rect.maxLat()),
+								OsmKeyValueObjectStoreColumns::quantizeLower(rect.minLon()),
+								OsmKeyValueObjectStoreColumns::quantizeUpper(rect.maxLon())
+							);
+						}
+					}
+					state->keys[p] = std::make_pair(key, p);
+				}
+			}
+		}
+	};
+	State state(store);
+	sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	std::sort(state.keys.begin(), state.keys.end());
+
+	uint32_t size = store.size();
+	std::vector<uint32_t> positions(size);
+	std::vector<uint64_t> offsets;
+	offsets.reserve(size+1);
+	offsets.push_back(0);
+	for(uint32_t i(0); i < size; ++i) {
+		uint32_t itemId = state.keys[i].second;
+		positions[itemId] = i;
+		offsets.push_back(offsets.back() + store.payloadData(itemId).size());
+	}
+
+	OffsetType begin = dest.tellPutPtr();
+	dest.putUint8(LIBOSCAR_SPATIAL_PAYLOAD_STORE_VERSION);
+	dest.putUint32(size);
+	sidecar::putByteOrderMark(dest);
+	sidecar::putArray(dest, begin, positionsOffset(), positions);
+	sidecar::putArray(dest, begin, offsetsOffset(size), offsets);
+	for(uint32_t i(0); i < size; ++i) {
+		dest.putData(store.payloadData(state.keys[i].second));
+	}
+	SSERIALIZE_CHEAP_ASSERT_EQUAL(dest.tellPutPtr() - begin, dataOffset(size) + offsets.back());
+	return begin;
+}
+
+}}//end namespace liboscar::Static
@@ -4,6 +4,12 @@
 #include <iostream>
 #include <istream>
 #include <fstream>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <chrono>
+#include <limits>
+#include <sys/stat.h>
 #include <liboscar/constants.h>
 #include <liboscar/SetOpTreePrivateGeo.h>
 #include <liboscar/tagcompleters.h>
@@ -17,6 +23,8 @@
 #include <sserialize/Static/GeoCompleter.h>
 #include <sserialize/storage/MmappedFile.h>
 #include <sserialize/stats/TimeMeasuerer.h>
+#include <sserialize/mt/ThreadPool.h>
+#include <sserialize/utility/assert.h>
 #ifdef __ANDROID__
 	#define MEMORY_BASED_SUBSET_CREATOR_MIN_CELL_COUNT static_cast<uint32_t>(0xFFFFFFFFF)
 #else
@@ -27,15 +35,22 @@ namespace liboscar {
 namespace Static {
 
 std::ostream & OsmCompleter::printStats(std::ostream & out) const {
+	waitFor(CAP_TAGS);
 	m_tagCompleter->tagStore().printStats(out);
+	MemoryPolicy::printStats(out, m_memoryReports);
 	return out;
 }
 
 OsmCompleter::OsmCompleter() :
-m_selectedGeoCompleter(0)
+m_selectedGeoCompleter(0),
+m_readiness(std::make_shared<Readiness>()),
+m_profiling(std::make_shared<Profiling>())
 {}
 
 OsmCompleter::~OsmCompleter() {
+	stopPrefetch();
+	stopRecorder();
+	joinBackground();
 #ifdef LIBOSCAR_NO_DATA_REFCOUNTING
 	for(auto & d : m_data) {
 		d.second.enableRefCounting();
@@ -60,6 +75,7 @@ bool OsmCompleter::setAllFilesFromPrefix(const std::string & filePrefix) {
 }
 
 bool OsmCompleter::setGeoCompleter(uint8_t pos) {
+	waitFor(CAP_GEO_SEARCH);
 	if (pos < m_geoCompleters.size()) {
 		m_selectedGeoCompleter = pos;
 		return true;
@@ -112,6 +128,108 @@ void OsmCompleter::setCQRDilatorCache(uint32_t threshold, uint32_t threadCount)
 	}
 }
 
+void OsmCompleter::setPayloadCache(uint64_t byteBudget) {
+	m_store.setPayloadCache(byteBudget);
+	bool cmp;
+	std::string warmUpFn;
+	if (!byteBudget || !fileNameFromPrefix(m_filesDir, FC_KV_STORE_WARMUP, warmUpFn, cmp) || cmp) {
+		return;
+	}
+	std::ifstream warmUpFile(warmUpFn);
+	std::vector<uint32_t> itemIds;
+	uint32_t itemId;
+	while (warmUpFile >> itemId) {
+		itemIds.push_back(itemId);
+	}
+	m_store.warmPayloadCache(itemIds);
+}
+
+void OsmCompleter::setMemoryPolicy(std::shared_ptr<MemoryPolicy> policy) {
+	m_memoryPolicy = policy;
+}
+
+void OsmCompleter::startAccessProfile(uint32_t sampleInterval) {
+	if (m_profiling->recorder.joinable()) {
+		return;
+	}
+	m_profiling->profile.clear();
+	//the prefetched pages are resident without being accessed
+	m_profiling->profile.carryOver(m_profiling->prefetched);
+	m_profiling->stopRecorder = false;
+	std::shared_ptr<Profiling> profiling(m_profiling);
+	AccessProfile::DataMap data(m_data);
+	m_profiling->recorder = std::thread([profiling, data, sampleInterval]() {
+		std::unique_lock<std::mutex> lck(profiling->lock);
+		while (!profiling->stopRecorder) {
+			lck.unlock();
+			profiling->profile.sample(data);
+			lck.lock();
+			profiling->cv.wait_for(lck, std::chrono::seconds(sampleInterval), [&profiling]() {
+				return profiling->stopRecorder.load();
+			});
+		}
+	});
+}
+
+bool OsmCompleter::stopRecorder() {
+	if (!m_profiling->recorder.joinable()) {
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> lck(m_profiling->lock);
+		m_profiling->stopRecorder = true;
+	}
+	m_profiling->cv.notify_all();
+	m_profiling->recorder.join();
+	return true;
+}
+
+bool OsmCompleter::stopAccessProfile() {
+	if (!stopRecorder()) {
+		return false;
+	}
+	//take a last sample to include the pages touched since the last one
+	m_profiling->profile.sample(m_data);
+	return m_profiling->profile.save(fileNameFromFileConfig(m_filesDir, FC_ACCESS_PROFILE, false));
+}
+
+void OsmCompleter::stopPrefetch() {
+	m_profiling->stopPrefetcher = true;
+	if (m_profiling->prefetcher.joinable()) {
+		m_profiling->prefetcher.join();
+	}
+}
+
+void OsmCompleter::prefetch() {
+	stopPrefetch();
+	m_profiling->stopPrefetcher = false;
+	
+	AccessProfile profile;
+	std::string profileFn;
+	bool cmp;
+	if (fileNameFromPrefix(m_filesDir, FC_ACCESS_PROFILE, profileFn, cmp) && !cmp) {
+		profile.load(profileFn);
+	}
+	//the hints below are added by every prefetch() and are not carried over
+	m_profiling->prefetched = profile.ranges();
+	if (m_profiling->recorder.joinable()) {
+		m_profiling->profile.carryOver(m_profiling->prefetched);
+	}
+	//the sidecars of the kvstore are small compared to the kvstore and touched by most spatial queries
+	for(uint32_t fc : {FC_KV_STORE_COLUMNS, FC_KV_STORE_RTREE, FC_KV_STORE_OSM_ID_INDEX}) {
+		if (m_data.count(fc)) {
+			profile.addHint(fc, 0, m_data.at(fc).size(), std::numeric_limits<uint32_t>::max());
+		}
+	}
+	
+	std::shared_ptr<Profiling> profiling(m_profiling);
+	std::vector<AccessProfile::Range> ranges(profile.ranges());
+	AccessProfile::DataMap data(m_data);
+	m_profiling->prefetcher = std::thread([profiling, ranges, data]() {
+		AccessProfile::replay(ranges, data, profiling->stopPrefetcher);
+	});
+}
+
 bool OsmCompleter::setTextSearcher(TextSearch::Type t, uint8_t pos) {
 	return m_textSearch.select(t, pos);
 }
@@ -125,9 +243,15 @@ void OsmCompleter::setCQRFromRouting(liboscar::adaptors::CQRFromRoutingFromCellL
 	setCQRFromRouting(liboscar::adaptors::CQRFromRoutingFromCellList::make_shared(indexStore(), ci, v));
 }
 
-sserialize::StringCompleter OsmCompleter::getItemsCompleter() const {
+uint32_t OsmCompleter::itemsCapabilities() const {
+	//string queries only need the text search, the filters of the background tasks are added once they are ready
+	waitFor(CAP_TEXT_SEARCH);
+	return capabilities() & (CAP_GEO_SEARCH | CAP_TAGS);
+}
+
+sserialize::StringCompleter OsmCompleter::getItemsCompleter(uint32_t caps) const {
 	sserialize::StringCompleter strCmp;
-	if (m_data.count(FC_TAGSTORE)) {
+	if (m_data.count(FC_TAGSTORE) && (caps & CAP_TAGS)) {
 		sserialize::StringCompleterPrivateMulti * myscmp = new sserialize::StringCompleterPrivateMulti();
 		myscmp->addCompleter( sserialize::RCPtrWrapper<sserialize::StringCompleterPrivate>(textSearch().get<liboscar::TextSearch::ITEMS>().getPrivate()) );
 		myscmp->addCompleter( sserialize::RCPtrWrapper<sserialize::StringCompleterPrivate>(new StringCompleterPrivateTagPhrase(m_tagPhraseCompleter)) );
@@ -140,29 +264,48 @@ sserialize::StringCompleter OsmCompleter::getItemsCompleter() const {
 }
 
 
-OsmItemSet OsmCompleter::complete(const std::string & query) {
-	OsmItemSet itemSet(query, getItemsCompleter(), store(), sserialize::SetOpTree::SOT_COMPLEX);
-	registerFilters(itemSet);
+OsmItemSet OsmCompleter::complete(const std::string & query) const {
+	uint32_t caps = itemsCapabilities();
+	return doComplete(query, getItemsCompleter(caps), caps);
+}
+
+OsmItemSet OsmCompleter::simpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen) const {
+	uint32_t caps = itemsCapabilities();
+	return doSimpleComplete(query, maxResultSetSize, minStrLen, getItemsCompleter(caps), caps);
+}
+
+OsmItemSet OsmCompleter::simpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen, const sserialize::spatial::GeoRect & rect) const {
+	uint32_t caps = itemsCapabilities();
+	return doSimpleComplete(query, maxResultSetSize, minStrLen, rect, getItemsCompleter(caps), caps);
+}
+
+OsmItemSetIterator OsmCompleter::partialComplete(const std::string & query, const sserialize::spatial::GeoRect & rect) const {
+	uint32_t caps = itemsCapabilities();
+	return doPartialComplete(query, rect, getItemsCompleter(caps), caps);
+}
+
+OsmItemSet OsmCompleter::doComplete(const std::string & query, const sserialize::StringCompleter & strCmp, uint32_t caps) const {
+	OsmItemSet itemSet(query, strCmp, store(), sserialize::SetOpTree::SOT_COMPLEX);
+	registerFilters(itemSet, caps);
 	itemSet.execute();
 	return itemSet;
 }
 
-OsmItemSet OsmCompleter::simpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen) {
-	OsmItemSet itemSet(query, getItemsCompleter(), store(), sserialize::SetOpTree::SOT_SIMPLE);
-	registerFilters(itemSet);
+OsmItemSet OsmCompleter::doSimpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen, const sserialize::StringCompleter & strCmp, uint32_t caps) const {
+	OsmItemSet itemSet(query, strCmp, store(), sserialize::SetOpTree::SOT_SIMPLE);
+	registerFilters(itemSet, caps);
 	itemSet.setMaxResultSetSize(maxResultSetSize);
 	itemSet.setMinStrLen(minStrLen);
 	itemSet.execute();
 	return itemSet;
 }
 
-OsmItemSet OsmCompleter::simpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen, const sserialize::spatial::GeoRect & rect) {
-	sserialize::StringCompleter strCmp(getItemsCompleter());
+OsmItemSet OsmCompleter::doSimpleComplete(const std::string & query, uint32_t maxResultSetSize, uint32_t minStrLen, const sserialize::spatial::GeoRect & rect, const sserialize::StringCompleter & strCmp, uint32_t caps) const {
 	std::shared_ptr<sserialize::ItemIndex::ItemFilter> geoFilter(new GeoConstraintFilter<liboscar::Static::OsmKeyValueObjectStore>(store(), rect));
 	if (rect.length() < 0.1) {
 		OsmItemSet itemSet(sserialize::toString(query," $GEO[",rect.minLat(),";",rect.maxLat(),";",rect.minLon(),";",rect.maxLon(),";]"), store(), sserialize::SetOpTree(new SetOpTreePrivateGeo(geoFilter)));
 		itemSet.registerStringCompleter(strCmp);
-		registerFilters(itemSet);
+		registerFilters(itemSet, caps);
 		itemSet.setMaxResultSetSize(maxResultSetSize);
 		itemSet.setMinStrLen(minStrLen);
 		itemSet.execute();
@@ -171,7 +314,7 @@ OsmItemSet OsmCompleter::simpleComplete(const std::string & query, uint32_t maxR
 	else {
 		OsmItemSet itemSet(query, store(), sserialize::SetOpTree(new SetOpTreePrivateGeo(geoFilter)));
 		itemSet.registerStringCompleter(strCmp);
-		registerFilters(itemSet);
+		registerFilters(itemSet, caps);
 		itemSet.setMaxResultSetSize(maxResultSetSize);
 		itemSet.setMinStrLen(minStrLen);
 		itemSet.execute();
@@ -179,46 +322,216 @@ OsmItemSet OsmCompleter::simpleComplete(const std::string & query, uint32_t maxR
 	}
 }
 
-OsmItemSetIterator OsmCompleter::partialComplete(const std::string & query, const sserialize::spatial::GeoRect & rect) {
-	sserialize::StringCompleter strCmp(getItemsCompleter());
+OsmItemSetIterator OsmCompleter::doPartialComplete(const std::string & query, const sserialize::spatial::GeoRect & rect, const sserialize::StringCompleter & strCmp, uint32_t caps) const {
 	std::shared_ptr<sserialize::ItemIndex::ItemFilter> geoFilter(new GeoConstraintFilter<liboscar::Static::OsmKeyValueObjectStore>(store(), rect));
 	if (rect.length() < 0.1) {
 		OsmItemSetIterator itemSet(sserialize::toString(query," $GEO[",rect.minLat(),";",rect.maxLat(),";",rect.minLon(),";",rect.maxLon(),";]"), store(), sserialize::SetOpTree::SOT_COMPLEX, geoFilter);
 		itemSet.registerStringCompleter(strCmp);
-		registerFilters(itemSet);
+		registerFilters(itemSet, caps);
 		itemSet.execute();
 		return itemSet;
 	}
 	else {
 		OsmItemSetIterator itemSet(query, store(), sserialize::SetOpTree::SOT_COMPLEX, geoFilter);
 		itemSet.registerStringCompleter(strCmp);
-		registerFilters(itemSet);
+		registerFilters(itemSet, caps);
 		itemSet.execute();
 		return itemSet;
 	}
 }
 
-void OsmCompleter::energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsgType) {
-	#ifdef __LP64__
-	//use up to 1 TiB of address space on 64 Bit machines
-	uint64_t maxFullMmapSize = uint64_t(1024*1024)*uint64_t(1024*1024);
-	#else
-	//use up to 1 GiB of address space on 32 Bit machines
-	uint64_t maxFullMmapSize = 1024*1024*1024; 
-	#endif
+namespace {
+
+//number of bytes hashed per sample of the dataset fingerprint
+constexpr uint64_t DatasetFingerprintSampleSize = 64;
+
+//splitmix64 finalizer
+inline uint64_t mix(uint64_t x) {
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+inline uint64_t hashCombine(uint64_t seed, uint64_t v) {
+	return mix(seed ^ (v + 0x9E3779B97F4A7C15ULL + (seed << 6) + (seed >> 2)));
+}
+
+///Runs tasks with up to threadCount threads, rethrows the first exception thrown by a task
+void runTasks(const std::vector< std::function<void()> > & tasks, uint32_t threadCount) {
+	struct State {
+		const std::vector< std::function<void()> > & tasks;
+		std::atomic<std::size_t> pos{0};
+		std::mutex lock;
+		std::exception_ptr error;
+		State(const std::vector< std::function<void()> > & tasks) : tasks(tasks) {}
+	};
+	struct Worker {
+		State * state;
+		Worker(State * state) : state(state) {}
+		Worker(const Worker & other) : state(other.state) {}
+		void operator()() {
+			while (true) {
+				std::size_t p = state->pos.fetch_add(1, std::memory_order_relaxed);
+				if (p >= state->tasks.size()) {
+					break;
+				}
+				try {
+					state->tasks[p]();
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lck(state->lock);
+					if (!state->error) {
+						state->error = std::current_exception();
+					}
+				}
+			}
+		}
+	};
+	State state(tasks);
+	threadCount = std::max<uint32_t>(1, std::min<uint32_t>(threadCount, tasks.size()));
+	if (threadCount == 1) {
+		Worker worker(&state);
+		worker();
+	}
+	else {
+		sserialize::ThreadPool::execute(Worker(&state), threadCount, sserialize::ThreadPool::CopyTaskTag());
+	}
+	if (state.error) {
+		std::rethrow_exception(state.error);
+	}
+}
+
+} //end namespace
+
+void OsmCompleter::setCapability(Capability c) {
+	std::lock_guard<std::mutex> lck(m_readiness->lock);
+	m_readiness->capabilities.fetch_or(c, std::memory_order_release);
+	m_readiness->cv.notify_all();
+}
+
+void OsmCompleter::setFinished() {
+	std::lock_guard<std::mutex> lck(m_readiness->lock);
+	m_readiness->finished = true;
+	m_readiness->cv.notify_all();
+}
+
+void OsmCompleter::joinBackground() {
+	if (m_readiness->background.joinable()) {
+		m_readiness->background.join();
+	}
+}
+
+bool OsmCompleter::waitFor(uint32_t caps) const {
+	//capabilities are only ever added, every query calls this once initialization is done
+	if (hasCapabilities(caps)) {
+		return true;
+	}
+	std::unique_lock<std::mutex> lck(m_readiness->lock);
+	m_readiness->cv.wait(lck, [this, caps]() { return hasCapabilities(caps) || m_readiness->finished; });
+	return hasCapabilities(caps);
+}
+
+void OsmCompleter::openFiles(uint32_t threadCount) {
+	struct File {
+		uint32_t fc;
+		std::string fn;
+		bool cmp;
+		//the sidecars of the kvstore are optional
+		bool optional;
+		MemoryPolicy::Decision decision;
+		sserialize::UByteArrayAdapter data;
+		MemoryPolicy::Report report;
+	};
 	
+	//files are passed to the policy in order of their importance
+	std::vector<File> files;
+	std::vector<MemoryPolicy::FileInfo> infos;
+	auto addFile = [this, &files, &infos](uint32_t fc, bool optional) {
+		File f;
+		f.fc = fc;
+		f.optional = optional;
+		if (fileNameFromPrefix(m_filesDir, (FileConfig)fc, f.fn, f.cmp)) {
+			infos.push_back(MemoryPolicy::FileInfo{fc, sserialize::MmappedFile::fileSize(f.fn), f.cmp});
+			files.push_back(f);
+		}
+	};
 	for(uint32_t i = FC_BEGIN; i < FC_END; ++i) {
-		bool cmp;
-		std::string fn;
-		if (fileNameFromPrefix(m_filesDir, (FileConfig)i, fn, cmp)) {
-			uint64_t fileSize = sserialize::MmappedFile::fileSize(fn);
-			
-			if (fileSize >= maxFullMmapSize) {
-				m_data[i] = sserialize::UByteArrayAdapter::openRo(fn, cmp, 0, 0);
+		addFile(i, false);
+	}
+	for(uint32_t fc : {FC_KV_STORE_COLUMNS, FC_KV_STORE_OSM_ID_INDEX, FC_KV_STORE_RTREE, FC_KV_STORE_GEOMETRY, FC_KV_STORE_SIMPLIFIED_GEOMETRY, FC_KV_STORE_SPATIAL_PAYLOADS, FC_CELL_GRAPH}) {
+		addFile(fc, true);
+	}
+	
+	std::shared_ptr<MemoryPolicy> policy(m_memoryPolicy);
+	if (!policy) {
+		policy = std::make_shared<DefaultMemoryPolicy>();
+	}
+	std::vector<MemoryPolicy::Decision> decisions(policy->decide(infos));
+	SSERIALIZE_CHEAP_ASSERT_EQUAL(decisions.size(), files.size());
+	for(std::size_t i(0), s(std::min(files.size(), decisions.size())); i < s; ++i) {
+		files[i].decision = decisions[i];
+	}
+	
+	std::vector< std::function<void()> > tasks;
+	for(File & f : files) {
+		tasks.emplace_back([&f]() {
+			try {
+				uint64_t maxFullMmapSize = (f.decision.placement == MemoryPolicy::MP_CHUNKED ? 0 : MemoryPolicy::addressSpace());
+				f.data = sserialize::UByteArrayAdapter::openRo(f.fn, f.cmp, maxFullMmapSize, 0);
+				if (f.decision.placement == MemoryPolicy::MP_IN_MEMORY) {
+					bool hugePages = std::any_of(f.decision.sections.begin(), f.decision.sections.end(), [](const MemoryPolicy::Section & s) {
+						return s.hugePages;
+					});
+					f.data = MemoryPolicy::copyToMemory(f.data, hugePages);
+				}
+				f.report = MemoryPolicy::apply(f.fc, f.data, f.decision);
 			}
-			else {
-				m_data[i] = sserialize::UByteArrayAdapter::openRo(fn, cmp, maxFullMmapSize, 0);
-				maxFullMmapSize -= fileSize;
+			catch (sserialize::Exception & e) {
+				if (!f.optional) {
+					throw;
+				}
+				sserialize::err("liboscar::Static::OsmCompleter", "Failed to open " + f.fn + " with the following error:\n" + e.what());
+				f.data = sserialize::UByteArrayAdapter();
+			}
+		});
+	}
+	runTasks(tasks, threadCount);
+	
+	m_memoryReports.clear();
+	for(File & f : files) {
+		if (f.data.size() || !f.optional) {
+			m_data[f.fc] = f.data;
+			m_memoryReports.push_back(f.report);
+		}
+	}
+	
+	//files are identified by their inode, modification time, size and a few bytes at their beginning, middle and end
+	//the inode and the modification time catch files that are rewritten in place with the same size
+	m_datasetFingerprint = 0;
+	for(const File & f : files) {
+		auto it = m_data.find(f.fc);
+		if (it == m_data.end()) {
+			continue;
+		}
+		const sserialize::UByteArrayAdapter & d = it->second;
+		uint64_t size = d.size();
+		m_datasetFingerprint = hashCombine(m_datasetFingerprint, f.fc);
+		m_datasetFingerprint = hashCombine(m_datasetFingerprint, size);
+		struct ::stat st;
+		if (::stat(f.fn.c_str(), &st) == 0) {
+			m_datasetFingerprint = hashCombine(m_datasetFingerprint, uint64_t(st.st_dev));
+			m_datasetFingerprint = hashCombine(m_datasetFingerprint, uint64_t(st.st_ino));
+			m_datasetFingerprint = hashCombine(m_datasetFingerprint, uint64_t(st.st_mtim.tv_sec));
+			m_datasetFingerprint = hashCombine(m_datasetFingerprint, uint64_t(st.st_mtim.tv_nsec));
+		}
+		for(uint64_t offset : {uint64_t(0), size/2, size - std::min(size, DatasetFingerprintSampleSize)}) {
+			uint64_t len = std::min(DatasetFingerprintSampleSize, size - offset);
+			if (!len) {
+				continue;
+			}
+			sserialize::UByteArrayAdapter::MemoryView mv(d.getMemView(offset, len));
+			for(uint64_t i(0); i < len; ++i) {
+				m_datasetFingerprint = hashCombine(m_datasetFingerprint, mv.data()[i]);
 			}
 		}
 	}
@@ -228,7 +541,9 @@ void OsmCompleter::energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsg
 		d.second.disableRefCounting();
 	}
 #endif
-	
+}
+
+void OsmCompleter::initStore() {
 	bool haveNeededData = m_data.count(FC_KV_STORE);
 	if (haveNeededData) {
 		try {
@@ -247,15 +562,46 @@ void OsmCompleter::energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsg
 	m_store.disableRefCounting();
 #endif
 	
-	m_geoCompleters.push_back(
-		sserialize::RCPtrWrapper<sserialize::SetOpTree::SelectableOpFilter>(
-			new sserialize::spatial::GeoConstraintSetOpTreeSF<sserialize::GeoCompleter>(
-				sserialize::Static::GeoCompleter::fromDB(m_store)
-			)
+	//the sidecars are optional, the store falls back to decoding the payloads
+	struct Sidecar {
+		FileConfig fc;
+		const char * name;
+		std::function<void(const sserialize::UByteArrayAdapter &)> set;
+	};
+	const Sidecar sidecars[] = {
+		{FC_KV_STORE_COLUMNS, "columns", [this](const sserialize::UByteArrayAdapter & d) { m_store.setColumns(OsmKeyValueObjectStoreColumns(d)); }},
+		{FC_KV_STORE_OSM_ID_INDEX, "osm id index", [this](const sserialize::UByteArrayAdapter & d) { m_store.setOsmIdIndex(OsmIdIndex(d)); }},
+		{FC_KV_STORE_RTREE, "rtree", [this](const sserialize::UByteArrayAdapter & d) { m_store.setRTree(ItemRTree(d)); }},
+		{FC_KV_STORE_GEOMETRY, "geometry", [this](const sserialize::UByteArrayAdapter & d) { m_store.setCompressedGeometry(CompressedGeometryStore(d)); }},
+		{FC_KV_STORE_SIMPLIFIED_GEOMETRY, "simplified geometry", [this](const sserialize::UByteArrayAdapter & d) { m_store.setSimplifiedGeometry(SimplifiedGeometryStore(d)); }},
+		{FC_KV_STORE_SPATIAL_PAYLOADS, "spatial payloads", [this](const sserialize::UByteArrayAdapter & d) { m_store.setSpatialPayloads(SpatialPayloadStore(d)); }}
+	};
+	for(const Sidecar & sidecar : sidecars) {
+		if (!m_data.count(sidecar.fc)) {
+			continue;
+		}
+		try {
+			sidecar.set(m_data[sidecar.fc]);
+		}
+		catch (sserialize::Exception & e) {
+			sserialize::err("liboscar::Static::OsmCompleter", std::string("Failed to initialize kvstore ") + sidecar.name + " with the following error:\n" + e.what());
+		}
+	}
+	
+	//a new data set invalidates all cached stats
+	m_kvStatsCache = std::make_shared<KVStatsCache>(m_store, m_kvStatsCache ? m_kvStatsCache->byteBudget() : KVStatsCache::DefaultByteBudget, m_datasetFingerprint);
+	
+	m_storeGeoCompleter = sserialize::RCPtrWrapper<sserialize::SetOpTree::SelectableOpFilter>(
+		new sserialize::spatial::GeoConstraintSetOpTreeSF<sserialize::GeoCompleter>(
+			sserialize::Static::GeoCompleter::fromDB(m_store)
 		)
 	);
-	
-	haveNeededData = m_data.count(FC_INDEX);
+	m_geoCompleters.push_back(m_storeGeoCompleter);
+	setCapability(CAP_STORE);
+}
+
+bool OsmCompleter::initIndex() {
+	bool haveNeededData = m_data.count(FC_INDEX);
 	if (haveNeededData) {
 		try {
 			m_indexStore = sserialize::Static::ItemIndexStore(m_data[FC_INDEX]);
@@ -265,20 +611,25 @@ void OsmCompleter::energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsg
 			haveNeededData = false;
 		}
 	}
-	if(!haveNeededData) {
-		std::cout << "OsmCompleter: No index available" << std::endl;
-		return;
+	if (haveNeededData) {
+		setCapability(CAP_INDEX);
 	}
+	return haveNeededData;
+}
 
+void OsmCompleter::initTextSearch() {
 	if (m_data.count(FC_TEXT_SEARCH)) {
 		try {
 			m_textSearch = liboscar::TextSearch(m_data[FC_TEXT_SEARCH], m_indexStore, m_store.geoHierarchy(), m_store.regionArrangement());
+			setCapability(CAP_TEXT_SEARCH);
 		}
 		catch (sserialize::Exception & e) {
 			sserialize::err("liboscar::Static::OsmCompleter", std::string("Failed to initialize textsearch with the following error:\n") + e.what());
 		}
 	}
-	
+}
+
+void OsmCompleter::initGeoSearch() {
 	if (m_data.count(FC_GEO_SEARCH)) {
 		try {
 			m_geoSearch = liboscar::GeoSearch(m_data[FC_GEO_SEARCH], m_indexStore, m_store);
@@ -291,12 +642,15 @@ void OsmCompleter::energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsg
 					);
 				}
 			}
+			setCapability(CAP_GEO_SEARCH);
 		}
 		catch (sserialize::Exception & e) {
 			sserialize::err("liboscar::Static::OsmCompleter", std::string("Failed to initialize geosearch with the following error:\n") + e.what());
 		}
 	}
-	
+}
+
+void OsmCompleter::initTags() {
 	if (m_data.count(FC_TAGSTORE)) {
 		try {
 			TagStore tagStore(m_data[FC_TAGSTORE], m_indexStore);
@@ -313,6 +667,7 @@ void OsmCompleter::energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsg
 			else {
 				m_tagPhraseCompleter = sserialize::RCPtrWrapper<TagPhraseCompleter>( new TagPhraseCompleter() );
 			}
+			setCapability(CAP_TAGS);
 		}
 		catch (sserialize::Exception & e) {
 			sserialize::err("liboscar::Static::OsmCompleter", std::string("Failed to initialize tagstore with the following error:\n") + e.what());
@@ -322,13 +677,43 @@ void OsmCompleter::energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsg
 		m_tagCompleter = sserialize::RCPtrWrapper<TagCompleter>( new TagCompleter() );
 		m_tagNameCompleter = sserialize::RCPtrWrapper<TagNameCompleter>( new TagNameCompleter() );
 		m_tagPhraseCompleter = sserialize::RCPtrWrapper<TagPhraseCompleter>( new TagPhraseCompleter() );
+		setCapability(CAP_TAGS);
 	}
+}
 
-	if (ghsgType == sserialize::spatial::GeoHierarchySubGraph::T_INVALID && m_store.geoHierarchy().cellSize() >= MEMORY_BASED_SUBSET_CREATOR_MIN_CELL_COUNT) {
-		ghsgType = sserialize::spatial::GeoHierarchySubGraph::T_IN_MEMORY;
+void OsmCompleter::initGhsg(sserialize::spatial::GeoHierarchySubGraph::Type ghsgType, uint32_t threadCount) {
+	if (m_data.count(FC_CELL_GRAPH)) {
+		try {
+			m_cellGraph = liboscar::Static::GeoHierarchyCellGraph(m_data[FC_CELL_GRAPH]);
+			if (m_cellGraph.cellSize() != m_store.geoHierarchy().cellSize() || m_cellGraph.regionSize() != m_store.geoHierarchy().regionSize()) {
+				throw sserialize::CorruptDataException("GeoHierarchyCellGraph does not match the GeoHierarchy of the kvstore");
+			}
+		}
+		catch (sserialize::Exception & e) {
+			m_cellGraph = liboscar::Static::GeoHierarchyCellGraph();
+			sserialize::err("liboscar::Static::OsmCompleter", std::string("Failed to initialize cell graph with the following error:\n") + e.what());
+		}
+	}
+	//Large hierarchies need the per cell lookups and subSet() of the cell graph.
+	//Without a cellgraph file it is built in parallel instead of the single threaded in-memory sub graph.
+	if (ghsgType == sserialize::spatial::GeoHierarchySubGraph::T_INVALID) {
+		if (!m_cellGraph.valid() && m_store.geoHierarchy().cellSize() >= MEMORY_BASED_SUBSET_CREATOR_MIN_CELL_COUNT) {
+			try {
+				sserialize::UByteArrayAdapter data(sserialize::UByteArrayAdapter::createCache(0, sserialize::MM_PROGRAM_MEMORY));
+				liboscar::Static::GeoHierarchyCellGraph::create(m_store.geoHierarchy(), indexStore(), data, threadCount);
+				m_cellGraph = liboscar::Static::GeoHierarchyCellGraph(data);
+			}
+			catch (sserialize::Exception & e) {
+				sserialize::err("liboscar::Static::OsmCompleter", std::string("Failed to create cell graph with the following error:\n") + e.what());
+			}
+		}
+		ghsgType = (m_cellGraph.valid() || m_store.geoHierarchy().cellSize() < MEMORY_BASED_SUBSET_CREATOR_MIN_CELL_COUNT ? sserialize::spatial::GeoHierarchySubGraph::T_PASS_THROUGH : sserialize::spatial::GeoHierarchySubGraph::T_IN_MEMORY);
 	}
 	m_ghsg = sserialize::spatial::GeoHierarchySubGraph(m_store.geoHierarchy(), indexStore(), ghsgType);
-	
+	setCapability(CAP_GHSG);
+}
+
+void OsmCompleter::initCellDistance() {
 	setCellDistance(CDT_CENTER_OF_MASS, 1);
 
 	if (!m_cqrr) {
@@ -340,6 +725,72 @@ void OsmCompleter::energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsg
 			}
 		);
 	}
+	setCapability(CAP_CELL_DISTANCE);
+}
+
+void OsmCompleter::energize(sserialize::spatial::GeoHierarchySubGraph::Type ghsgType, uint32_t threadCount, bool background) {
+	joinBackground();
+	{
+		std::lock_guard<std::mutex> lck(m_readiness->lock);
+		m_readiness->capabilities.store(CAP_NONE, std::memory_order_release);
+		m_readiness->finished = false;
+	}
+	
+	//Everything depends on the store and most parts on the index.
+	//The sidecars of the store are set in initStore() since they change the store.
+	try {
+		openFiles(threadCount);
+		initStore();
+		if (!initIndex()) {
+			std::cout << "OsmCompleter: No index available" << std::endl;
+			setFinished();
+			return;
+		}
+	}
+	catch (...) {
+		setFinished();
+		throw;
+	}
+	
+	//These only depend on the store and the index and write to distinct members
+	std::vector< std::function<void()> > tasks = {
+		[this]() { initTextSearch(); },
+		[this, ghsgType, threadCount]() { initGhsg(ghsgType, threadCount); },
+		[this]() { initCellDistance(); }
+	};
+	std::vector< std::function<void()> > backgroundTasks = {
+		[this]() { initGeoSearch(); },
+		[this]() { initTags(); }
+	};
+	
+	if (!background) {
+		tasks.insert(tasks.end(), backgroundTasks.begin(), backgroundTasks.end());
+	}
+	try {
+		runTasks(tasks, threadCount);
+	}
+	catch (...) {
+		setFinished();
+		throw;
+	}
+	if (!background) {
+		setFinished();
+		return;
+	}
+	
+	m_readiness->background = std::thread([this, backgroundTasks, threadCount]() {
+		try {
+			runTasks(backgroundTasks, threadCount);
+		}
+		catch (std::exception & e) {
+			sserialize::err("liboscar::Static::OsmCompleter", std::string("Background initialization failed with the following error:\n") + e.what());
+		}
+		catch (...) {
+			sserialize::err("liboscar::Static::OsmCompleter", "Background initialization failed with an unknown error");
+		}
+		//release the waiters in any case
+		setFinished();
+	});
 }
 
 void processCompletionToken(std::string & q, sserialize::StringCompleter::QuerryType & qt) {
@@ -356,26 +807,37 @@ OsmCompleter::cqrComplete(
 	const std::string& query,
 	const sserialize::spatial::GeoHierarchySubGraph & ghsg,
 	bool treedCQR,
-	uint32_t threadCount)
+	uint32_t threadCount) const
 {
 	if (!m_textSearch.hasSearch(liboscar::TextSearch::Type::GEOCELL)) {
 		throw sserialize::UnsupportedFeatureException("OsmCompleter::cqrComplete data has no CellTextCompleter");
 	}
 	sserialize::Static::CellTextCompleter cmp( m_textSearch.get<liboscar::TextSearch::Type::GEOCELL>() );
 	CQRFromPolygon cqrfp(store(), indexStore());
-	CQRFromComplexSpatialQuery csq(ghsg, cqrfp);
+	//the cell graph describes the full hierarchy and can't be used with a caller supplied sub graph
+	const liboscar::Static::GeoHierarchyCellGraph & cellGraph = (&ghsg == &m_ghsg ? m_cellGraph : liboscar::Static::GeoHierarchyCellGraph());
+	CQRFromComplexSpatialQuery csq(ghsg, cqrfp, cellGraph);
 	if (!treedCQR) {
-		AdvancedCellOpTree opTree(cmp, cqrd(), csq, ghsg, cqrr());
+		AdvancedCellOpTree opTree(cmp, cqrd(), csq, ghsg, cqrr(), cellGraph);
 		opTree.parse(query);
 		return opTree.calc<sserialize::CellQueryResult>();
 	}
 	else {
-		AdvancedCellOpTree opTree(cmp, cqrd(), csq, ghsg, cqrr());
+		AdvancedCellOpTree opTree(cmp, cqrd(), csq, ghsg, cqrr(), cellGraph);
 		opTree.parse(query);
 		return opTree.calc<sserialize::TreedCellQueryResult>(threadCount).toCQR(threadCount);
 	}
 }
 
+sserialize::Static::spatial::GeoHierarchy::SubSet
+OsmCompleter::subSet(const sserialize::CellQueryResult & cqr, const sserialize::spatial::GeoHierarchySubGraph & ghsg, bool sparse, uint32_t threadCount) const {
+	//the cell graph describes the full hierarchy and can't be used with a caller supplied sub graph
+	if (&ghsg == &m_ghsg && m_cellGraph.valid()) {
+		return m_cellGraph.subSet(store().geoHierarchy(), cqr, sparse);
+	}
+	return ghsg.subSet(cqr, sparse, threadCount);
+}
+
 sserialize::CellQueryResult
 OsmCompleter::cqr(sserialize::ItemIndex const & fullMatchCells) const {
 	auto idxStore = indexStore();
@@ -383,11 +845,16 @@ OsmCompleter::cqr(sserialize::ItemIndex const & fullMatchCells) const {
 	return sserialize::CellQueryResult(fullMatchCells, ci, idxStore, sserialize::CellQueryResult::FF_CELL_GLOBAL_ITEM_IDS);
 }
 
+KVStatsCache::StatsPtr
+OsmCompleter::kvStats(const sserialize::CellQueryResult & cqr, uint32_t threadCount) const {
+	return m_kvStatsCache->stats(cqr, threadCount);
+}
+
 sserialize::CellQueryResult
 OsmCompleter::cqrComplete(
 	const std::string& query,
 	bool treedCQR,
-	uint32_t threadCount)
+	uint32_t threadCount) const
 {
 	return this->cqrComplete(query, m_ghsg, treedCQR, threadCount);
 }
@@ -398,10 +865,10 @@ OsmCompleter::clusteredComplete(
 	const sserialize::spatial::GeoHierarchySubGraph & ghsg,
 	uint32_t minCq4SparseSubSet,
 	bool treedCQR,
-	uint32_t threadCount)
+	uint32_t threadCount) const
 {
 	sserialize::CellQueryResult r = cqrComplete(query, ghsg, treedCQR, threadCount);
-	return ghsg.subSet(r, r.cellCount() > minCq4SparseSubSet, threadCount);
+	return subSet(r, ghsg, r.cellCount() > minCq4SparseSubSet, threadCount);
 }
 
 sserialize::Static::spatial::GeoHierarchy::SubSet
@@ -409,19 +876,20 @@ OsmCompleter::clusteredComplete(
 	const std::string& query,
 	uint32_t minCq4SparseSubSet,
 	bool treedCQR,
-	uint32_t threadCount)
+	uint32_t threadCount) const
 {
 	return this->clusteredComplete(query, m_ghsg, minCq4SparseSubSet, treedCQR, threadCount);
 }
 
 sserialize::Static::spatial::GeoHierarchy::SubSet
 OsmCompleter::clusteredComplete(
-	const std::string& query)
+	const std::string& query) const
 {
 	return this->clusteredComplete(query, m_ghsg, std::numeric_limits<uint32_t>::max(), false, 1);
 }
 
 TagStore OsmCompleter::tagStore() const {
+	waitFor(CAP_TAGS);
 	if (m_tagCompleter.priv()) {
 		return m_tagCompleter->tagStore();
 	}
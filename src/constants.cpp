@@ -17,6 +17,33 @@ FileConfig fileConfigFromString(const std::string & str) {
 	else if (str == "kvstore") {
 		return FC_KV_STORE;
 	}
+	else if (str == "kvstore.columns") {
+		return FC_KV_STORE_COLUMNS;
+	}
+	else if (str == "kvstore.osmids") {
+		return FC_KV_STORE_OSM_ID_INDEX;
+	}
+	else if (str == "kvstore.rtree") {
+		return FC_KV_STORE_RTREE;
+	}
+	else if (str == "kvstore.geometry") {
+		return FC_KV_STORE_GEOMETRY;
+	}
+	else if (str == "kvstore.simplified") {
+		return FC_KV_STORE_SIMPLIFIED_GEOMETRY;
+	}
+	else if (str == "kvstore.warmup") {
+		return FC_KV_STORE_WARMUP;
+	}
+	else if (str == "kvstore.payloads") {
+		return FC_KV_STORE_SPATIAL_PAYLOADS;
+	}
+	else if (str == "access.profile") {
+		return FC_ACCESS_PROFILE;
+	}
+	else if (str == "cellgraph") {
+		return FC_CELL_GRAPH;
+	}
 	else if (str == "textsearch") {
 		return FC_TEXT_SEARCH;
 	}
@@ -38,6 +65,24 @@ std::string toString(FileConfig fc) {
 		return std::string("tagstore.phrases");
 	case (FC_KV_STORE):
 		return std::string("kvstore");
+	case (FC_KV_STORE_COLUMNS):
+		return std::string("kvstore.columns");
+	case (FC_KV_STORE_OSM_ID_INDEX):
+		return std::string("kvstore.osmids");
+	case (FC_KV_STORE_RTREE):
+		return std::string("kvstore.rtree");
+	case (FC_KV_STORE_GEOMETRY):
+		return std::string("kvstore.geometry");
+	case (FC_KV_STORE_SIMPLIFIED_GEOMETRY):
+		return std::string("kvstore.simplified");
+	case (FC_KV_STORE_WARMUP):
+		return std::string("kvstore.warmup");
+	case (FC_KV_STORE_SPATIAL_PAYLOADS):
+		return std::string("kvstore.payloads");
+	case (FC_ACCESS_PROFILE):
+		return std::string("access.profile");
+	case (FC_CELL_GRAPH):
+		return std::string("cellgraph");
 	case (FC_GEO_SEARCH):
 		return std::string("geosearch");
 	case (FC_TEXT_SEARCH):
@@ -0,0 +1,113 @@
+//Writes the sidecars of the kvstore and the cell graph next to the other files of a data set.
+//OsmCompleter::setAllFilesFromPrefix() picks them up on the next start.
+#include <liboscar/StaticOsmCompleter.h>
+#include <liboscar/OsmKeyValueObjectStore.h>
+#include <liboscar/OsmKeyValueObjectStoreColumns.h>
+#include <liboscar/OsmIdIndex.h>
+#include <liboscar/ItemRTree.h>
+#include <liboscar/CompressedGeometry.h>
+#include <liboscar/SimplifiedGeometryStore.h>
+#include <liboscar/SpatialPayloadStore.h>
+#include <liboscar/GeoHierarchyCellGraph.h>
+#include <liboscar/constants.h>
+#include <sserialize/storage/UByteArrayAdapter.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+void help() {
+	std::cout << "prg -f <files directory> [-s <sidecar>]... [-t <thread count>] [--tolerance <degrees>]..." << std::endl;
+	std::cout << "Creates the given sidecars, all if none is given." << std::endl;
+	std::cout << "sidecars: columns, osmids, rtree, geometry, simplified, payloads, cellgraph" << std::endl;
+	std::cout << "--tolerance sets the simplification levels, default: 0.0001 0.001 0.01" << std::endl;
+}
+
+struct Sidecar {
+	std::string name;
+	liboscar::FileConfig fc;
+	std::function<void(sserialize::UByteArrayAdapter & dest)> create;
+};
+
+} //end namespace
+
+int main(int argc, char ** argv) {
+	std::string filesDir;
+	std::set<std::string> selected;
+	std::vector<double> tolerances;
+	uint32_t threadCount = std::max<uint32_t>(1, std::thread::hardware_concurrency());
+	for(int i(1); i < argc; ++i) {
+		std::string arg(argv[i]);
+		if (arg == "-f" && i+1 < argc) {
+			filesDir = argv[++i];
+		}
+		else if (arg == "-s" && i+1 < argc) {
+			selected.insert(argv[++i]);
+		}
+		else if (arg == "-t" && i+1 < argc) {
+			threadCount = std::atoi(argv[++i]);
+		}
+		else if (arg == "--tolerance" && i+1 < argc) {
+			tolerances.push_back(std::atof(argv[++i]));
+		}
+		else {
+			help();
+			return -1;
+		}
+	}
+	if (filesDir.empty() || !threadCount) {
+		help();
+		return -1;
+	}
+	if (tolerances.empty()) {
+		tolerances = {0.0001, 0.001, 0.01};
+	}
+
+	liboscar::Static::OsmCompleter cmp;
+	cmp.setAllFilesFromPrefix(filesDir);
+	cmp.energize();
+	const liboscar::Static::OsmKeyValueObjectStore & store = cmp.store();
+
+	using namespace liboscar::Static;
+	const Sidecar sidecars[] = {
+		{"columns", liboscar::FC_KV_STORE_COLUMNS, [&](sserialize::UByteArrayAdapter & d) { OsmKeyValueObjectStoreColumns::create(store, d, threadCount); }},
+		{"osmids", liboscar::FC_KV_STORE_OSM_ID_INDEX, [&](sserialize::UByteArrayAdapter & d) { OsmIdIndex::create(store, d, threadCount); }},
+		{"rtree", liboscar::FC_KV_STORE_RTREE, [&](sserialize::UByteArrayAdapter & d) { ItemRTree::create(store, d, threadCount); }},
+		{"geometry", liboscar::FC_KV_STORE_GEOMETRY, [&](sserialize::UByteArrayAdapter & d) { CompressedGeometryStore::create(store, d, threadCount); }},
+		{"simplified", liboscar::FC_KV_STORE_SIMPLIFIED_GEOMETRY, [&](sserialize::UByteArrayAdapter & d) { SimplifiedGeometryStore::create(store, tolerances, d, threadCount); }},
+		{"payloads", liboscar::FC_KV_STORE_SPATIAL_PAYLOADS, [&](sserialize::UByteArrayAdapter & d) { SpatialPayloadStore::create(store, d, threadCount); }},
+		{"cellgraph", liboscar::FC_CELL_GRAPH, [&](sserialize::UByteArrayAdapter & d) { GeoHierarchyCellGraph::create(store.geoHierarchy(), cmp.indexStore(), d, threadCount); }}
+	};
+	for(const Sidecar & sidecar : sidecars) {
+		if (!selected.empty() && !selected.count(sidecar.name)) {
+			continue;
+		}
+		std::string fn = liboscar::fileNameFromFileConfig(filesDir, sidecar.fc, false);
+		std::cout << "Creating " << fn << std::flush;
+		//the old sidecar may be in use by store, replace it once the new one is complete
+		std::string tmpFn = fn + ".tmp";
+		try {
+			sserialize::UByteArrayAdapter dest(sserialize::UByteArrayAdapter::createFile(0, tmpFn));
+			sidecar.create(dest);
+			std::cout << ": " << dest.tellPutPtr() << " bytes" << std::endl;
+		}
+		catch (const std::exception & e) {
+			std::cout << std::endl;
+			std::cerr << "Failed to create " << sidecar.name << ": " << e.what() << std::endl;
+			std::remove(tmpFn.c_str());
+			return -1;
+		}
+		if (std::rename(tmpFn.c_str(), fn.c_str())) {
+			std::cerr << "Failed to move " << tmpFn << " to " << fn << std::endl;
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,104 @@
+//Times the hash and the sort engine of KVStats on the same cqrs.
+//Every query is run once per engine before the measurement to warm the page cache.
+#include <liboscar/StaticOsmCompleter.h>
+#include <liboscar/KVStats.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+void help() {
+	std::cout << "prg -f <files directory> [-q <query>]... [-qf <file with one query per line>] [-t <thread count>] [-r <rounds>]" << std::endl;
+	std::cout << "Computes the key-value statistics of the cqr of every query r times with each engine and prints the mean times." << std::endl;
+}
+
+struct Result {
+	uint64_t keyCount{0};
+	double ms{0};
+};
+
+Result run(liboscar::KVStats & kvs, const sserialize::CellQueryResult & cqr, uint32_t threadCount, liboscar::KVStats::Engine engine, uint32_t rounds) {
+	Result r;
+	auto start = std::chrono::steady_clock::now();
+	for(uint32_t i(0); i < rounds; ++i) {
+		liboscar::KVStats::Stats stats = kvs.stats(cqr, threadCount, engine);
+		r.keyCount = stats.keys().size();
+	}
+	auto stop = std::chrono::steady_clock::now();
+	r.ms = std::chrono::duration<double, std::milli>(stop-start).count() / rounds;
+	return r;
+}
+
+} //end namespace
+
+int main(int argc, char ** argv) {
+	std::string filesDir;
+	std::vector<std::string> queries;
+	uint32_t threadCount = std::max<uint32_t>(1, std::thread::hardware_concurrency());
+	uint32_t rounds = 5;
+	for(int i(1); i < argc; ++i) {
+		std::string arg(argv[i]);
+		if (arg == "-f" && i+1 < argc) {
+			filesDir = argv[++i];
+		}
+		else if (arg == "-q" && i+1 < argc) {
+			queries.emplace_back(argv[++i]);
+		}
+		else if (arg == "-qf" && i+1 < argc) {
+			std::ifstream file(argv[++i]);
+			if (!file.is_open()) {
+				std::cerr << "Could not open query file " << argv[i] << std::endl;
+				return -1;
+			}
+			std::string line;
+			while (std::getline(file, line)) {
+				if (!line.empty()) {
+					queries.push_back(line);
+				}
+			}
+		}
+		else if (arg == "-t" && i+1 < argc) {
+			threadCount = std::atoi(argv[++i]);
+		}
+		else if (arg == "-r" && i+1 < argc) {
+			rounds = std::atoi(argv[++i]);
+		}
+		else {
+			help();
+			return -1;
+		}
+	}
+	if (filesDir.empty() || queries.empty() || !threadCount || !rounds) {
+		help();
+		return -1;
+	}
+
+	liboscar::Static::OsmCompleter cmp;
+	cmp.setAllFilesFromPrefix(filesDir);
+	cmp.energize();
+	const liboscar::Static::OsmCompleter & ccmp = cmp;
+	liboscar::KVStats kvs(ccmp.store());
+
+	std::cout << "query;cells;auto;hash [ms];sort [ms];keys" << std::endl;
+	for(const std::string & query : queries) {
+		sserialize::CellQueryResult cqr = ccmp.cqrComplete(query, false, threadCount);
+		run(kvs, cqr, threadCount, liboscar::KVStats::E_HASH, 1);
+		run(kvs, cqr, threadCount, liboscar::KVStats::E_SORT, 1);
+		Result hash = run(kvs, cqr, threadCount, liboscar::KVStats::E_HASH, rounds);
+		Result sort = run(kvs, cqr, threadCount, liboscar::KVStats::E_SORT, rounds);
+		if (hash.keyCount != sort.keyCount) {
+			std::cerr << "The engines disagree on the number of keys of " << query << std::endl;
+			return 1;
+		}
+		std::cout << query << ';' << cqr.cellCount() << ';'
+			<< (kvs.engine(cqr) == liboscar::KVStats::E_SORT ? "sort" : "hash") << ';'
+			<< hash.ms << ';' << sort.ms << ';' << hash.keyCount << std::endl;
+	}
+	return 0;
+}
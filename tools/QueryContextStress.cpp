@@ -0,0 +1,137 @@
+//Runs the same queries from many threads, each with its own OsmQueryContext on a shared OsmCompleter,
+//and compares the results with those of a single threaded run.
+#include <liboscar/StaticOsmCompleter.h>
+#include <liboscar/OsmQueryContext.h>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+void help() {
+	std::cout << "prg -f <files directory> [-q <query>]... [-qf <file with one query per line>] [-t <thread count>] [-r <rounds>]" << std::endl;
+	std::cout << "Every thread runs every query r times with its own OsmQueryContext and checks the results against a single threaded run." << std::endl;
+}
+
+struct Result {
+	std::vector<uint32_t> items;
+	std::vector<uint32_t> cqrItems;
+	bool operator==(const Result & other) const {
+		return items == other.items && cqrItems == other.cqrItems;
+	}
+	bool operator!=(const Result & other) const {
+		return !(*this == other);
+	}
+};
+
+Result run(liboscar::Static::OsmQueryContext & ctx, const std::string & query, bool withCqr) {
+	Result r;
+	liboscar::Static::OsmItemSet itemSet(ctx.complete(query));
+	r.items.reserve(itemSet.size());
+	for(uint32_t i(0), s(itemSet.size()); i < s; ++i) {
+		r.items.push_back(itemSet.at(i).id());
+	}
+	if (withCqr) {
+		sserialize::ItemIndex idx(ctx.cqrComplete(query).flaten());
+		r.cqrItems.reserve(idx.size());
+		for(uint32_t i(0), s(idx.size()); i < s; ++i) {
+			r.cqrItems.push_back(idx.at(i));
+		}
+	}
+	return r;
+}
+
+} //end namespace
+
+int main(int argc, char ** argv) {
+	std::string filesDir;
+	std::vector<std::string> queries;
+	uint32_t threadCount = 64;
+	uint32_t rounds = 10;
+	for(int i(1); i < argc; ++i) {
+		std::string arg(argv[i]);
+		if (arg == "-f" && i+1 < argc) {
+			filesDir = argv[++i];
+		}
+		else if (arg == "-q" && i+1 < argc) {
+			queries.emplace_back(argv[++i]);
+		}
+		else if (arg == "-qf" && i+1 < argc) {
+			std::ifstream file(argv[++i]);
+			if (!file.is_open()) {
+				std::cerr << "Could not open query file " << argv[i] << std::endl;
+				return -1;
+			}
+			std::string line;
+			while (std::getline(file, line)) {
+				if (!line.empty()) {
+					queries.push_back(line);
+				}
+			}
+		}
+		else if (arg == "-t" && i+1 < argc) {
+			threadCount = std::atoi(argv[++i]);
+		}
+		else if (arg == "-r" && i+1 < argc) {
+			rounds = std::atoi(argv[++i]);
+		}
+		else {
+			help();
+			return -1;
+		}
+	}
+	if (filesDir.empty() || queries.empty() || !threadCount) {
+		help();
+		return -1;
+	}
+
+	liboscar::Static::OsmCompleter cmp;
+	cmp.setAllFilesFromPrefix(filesDir);
+	cmp.energize();
+	const liboscar::Static::OsmCompleter & ccmp = cmp;
+	bool withCqr = ccmp.textSearch().hasSearch(liboscar::TextSearch::Type::GEOCELL);
+
+	std::vector<Result> expected;
+	{
+		liboscar::Static::OsmQueryContext ctx(ccmp);
+		for(const std::string & query : queries) {
+			expected.push_back(run(ctx, query, withCqr));
+		}
+	}
+
+	std::atomic<uint64_t> mismatches{0};
+	std::atomic<uint64_t> errors{0};
+	std::vector<std::thread> threads;
+	for(uint32_t t(0); t < threadCount; ++t) {
+		threads.emplace_back([&, t]() {
+			liboscar::Static::OsmQueryContext ctx(ccmp);
+			for(uint32_t r(0); r < rounds; ++r) {
+				//every thread starts at a different query to mix them
+				for(std::size_t i(0), s(queries.size()); i < s; ++i) {
+					std::size_t qi = (i + t) % s;
+					try {
+						if (run(ctx, queries[qi], withCqr) != expected[qi]) {
+							mismatches.fetch_add(1, std::memory_order_relaxed);
+						}
+					}
+					catch (const std::exception &) {
+						errors.fetch_add(1, std::memory_order_relaxed);
+					}
+				}
+			}
+		});
+	}
+	for(std::thread & t : threads) {
+		t.join();
+	}
+
+	std::cout << "threads: " << threadCount << std::endl;
+	std::cout << "queries: " << uint64_t(threadCount)*rounds*queries.size() << std::endl;
+	std::cout << "mismatches: " << mismatches << std::endl;
+	std::cout << "errors: " << errors << std::endl;
+	return (mismatches || errors) ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+//Counts the major page faults of a rect query workload on the kvstore with and without the spatial payloads.
+//Drop the page cache before every run, e.g. with "sync; echo 3 > /proc/sys/vm/drop_caches" as root,
+//and run the modes in separate processes, otherwise pages of the previous run are still cached.
+#include <liboscar/StaticOsmCompleter.h>
+#include <liboscar/OsmKeyValueObjectStore.h>
+#include <liboscar/SpatialPayloadStore.h>
+#include <sserialize/spatial/GeoRect.h>
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+
+namespace {
+
+void help() {
+	std::cout << "prg -f <files directory> -m <kv|spatial> [-n <query count>] [-s <rect size in degrees>] [--seed <seed>]" << std::endl;
+	std::cout << "Runs n random rect queries, fetches the boundaries and cells of the results and prints the number of major page faults." << std::endl;
+	std::cout << "-m kv reads the payloads from the kvstore, -m spatial from the spatial payloads sidecar." << std::endl;
+}
+
+long majorFaults() {
+	struct rusage usage;
+	::getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_majflt;
+}
+
+} //end namespace
+
+int main(int argc, char ** argv) {
+	std::string filesDir;
+	std::string mode;
+	uint32_t queryCount = 1000;
+	double rectSize = 0.1;
+	uint32_t seed = 0;
+	for(int i(1); i < argc; ++i) {
+		std::string arg(argv[i]);
+		if (arg == "-f" && i+1 < argc) {
+			filesDir = argv[++i];
+		}
+		else if (arg == "-m" && i+1 < argc) {
+			mode = argv[++i];
+		}
+		else if (arg == "-n" && i+1 < argc) {
+			queryCount = std::atoi(argv[++i]);
+		}
+		else if (arg == "-s" && i+1 < argc) {
+			rectSize = std::atof(argv[++i]);
+		}
+		else if (arg == "--seed" && i+1 < argc) {
+			seed = std::atoi(argv[++i]);
+		}
+		else {
+			help();
+			return -1;
+		}
+	}
+	if (filesDir.empty() || (mode != "kv" && mode != "spatial")) {
+		help();
+		return -1;
+	}
+	
+	liboscar::Static::OsmCompleter cmp;
+	cmp.setAllFilesFromPrefix(filesDir);
+	cmp.energize();
+	//shares the data with the store of cmp, which is not used afterwards
+	liboscar::Static::OsmKeyValueObjectStore store(cmp.store());
+	uint64_t spatialPayloadsSize = store.spatialPayloads().getSizeInBytes();
+	if (mode == "kv") {
+		store.setSpatialPayloads(liboscar::Static::SpatialPayloadStore());
+	}
+	else if (!store.spatialPayloads().valid()) {
+		std::cerr << "No spatial payloads available" << std::endl;
+		return -1;
+	}
+	
+	//the same queries in both modes
+	sserialize::spatial::GeoRect bounds(store.boundary());
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> latDist(bounds.minLat(), bounds.maxLat());
+	std::uniform_real_distribution<double> lonDist(bounds.minLon(), bounds.maxLon());
+	
+	uint64_t resultSize = 0;
+	liboscar::Static::OsmKeyValueObjectStoreItemBatch batch;
+	uint32_t fields = liboscar::Static::OsmKeyValueObjectStoreItemBatch::F_BOUNDARY | liboscar::Static::OsmKeyValueObjectStoreItemBatch::F_CELLS;
+	long faultsBegin = majorFaults();
+	auto timeBegin = std::chrono::steady_clock::now();
+	for(uint32_t i(0); i < queryCount; ++i) {
+		double lat = latDist(rng);
+		double lon = lonDist(rng);
+		sserialize::spatial::GeoRect rect(lat, lat+rectSize, lon, lon+rectSize);
+		sserialize::ItemIndex result(store.complete(rect, false));
+		store.items(result, fields, batch);
+		resultSize += result.size();
+	}
+	auto timeEnd = std::chrono::steady_clock::now();
+	long faults = majorFaults() - faultsBegin;
+	
+	std::cout << "mode: " << mode << std::endl;
+	std::cout << "queries: " << queryCount << std::endl;
+	std::cout << "results: " << resultSize << std::endl;
+	std::cout << "major page faults: " << faults << std::endl;
+	std::cout << "time [ms]: " << std::chrono::duration_cast<std::chrono::milliseconds>(timeEnd-timeBegin).count() << std::endl;
+	std::cout << "kvstore [bytes]: " << store.getSizeInBytes() << std::endl;
+	std::cout << "spatial payloads [bytes]: " << spatialPayloadsSize << std::endl;
+	return 0;
+}